@@ -36,6 +36,23 @@ pub fn build(b: *std.Build) void {
         buildDefault(b, "server", t, &.{
             "src/server.c",
             "src/kvstore.c",
+            "src/kvalloc.c",
+            "src/kvstrdecoder.c",
+            "src/executor.c",
+            "src/iothreads.c",
+            "src/logger.c",
+            "src/histogram.c",
+            "src/stats.c",
+            "src/slowlog.c",
+            "src/replication.c",
+            "src/cluster.c",
+            "src/tracking.c",
+            "src/watch.c",
+            "src/capture.c",
+            "src/hotkeys.c",
+            "src/lazyfree.c",
+            "src/kvclient.c",
+            "src/kvcompress.c",
             "src/utilfuns.c"
             }, &.{
                 "-Wall", 
@@ -44,16 +61,109 @@ pub fn build(b: *std.Build) void {
         );
 
         buildDefault(b, "client", t, &.{
-            "src/client.c"
+            "src/client.c",
+            "src/kvclient.c",
+            "src/kvcompress.c"
             }, &.{
                 "-Wall", 
                 "-std=c23"
             }
         );
 
+        buildDefault(b, "client_test", t, &.{
+            "src/client_unit_tests.c",
+            "src/kvcache.c",
+            "src/kvpool.c",
+            "src/kvshard.c",
+            "src/kvclient.c",
+            "src/kvcompress.c",
+            "src/utilfuns.c"
+            }, &.{
+                "-Wall", 
+                "-std=c23"
+            }
+        );
+
+        buildDefault(b, "transport_bench", t, &.{
+            "src/transport_bench.c",
+            "src/kvclient.c",
+            "src/kvcompress.c",
+            "src/histogram.c",
+            "src/stats.c"
+            }, &.{
+                "-Wall", 
+                "-std=c23"
+            }
+        );
+
+        buildDefault(b, "simplekv-benchmark", t, &.{
+            "src/benchmark.c",
+            "src/kvclient.c",
+            "src/kvcompress.c",
+            "src/histogram.c",
+            "src/stats.c",
+            "src/utilfuns.c"
+            }, &.{
+                "-Wall", 
+                "-std=c23"
+            }
+        );
+
+        buildDefault(b, "simplekv-replay", t, &.{
+            "src/replay.c",
+            "src/capture.c",
+            "src/kvstrdecoder.c",
+            "src/kvclient.c",
+            "src/kvcompress.c",
+            "src/histogram.c",
+            "src/stats.c",
+            "src/utilfuns.c"
+            }, &.{
+                "-Wall", 
+                "-std=c23"
+            }
+        );
+
+        // every file counts its allocations through kv_bench_alloc.h
+        buildDefault(b, "kv_bench", t, &.{
+            "src/kv_bench.c",
+            "src/kvstore.c",
+            "src/kvalloc.c",
+            "src/kvcompress.c",
+            "src/hotkeys.c",
+            "src/kvstrdecoder.c",
+            "src/utilfuns.c",
+            "src/stats.c",
+            "src/histogram.c"
+            }, &.{
+                "-Wall", 
+                "-std=c23",
+                "-O2",
+                "-include",
+                "src/kv_bench_alloc.h"
+            }
+        );
+
         buildDefault(b, "server_test", t, &.{
             "src/utilfuns.c",
             "src/kvstore.c",
+            "src/kvalloc.c",
+            "src/kvstrdecoder.c",
+            "src/executor.c",
+            "src/iothreads.c",
+            "src/logger.c",
+            "src/histogram.c",
+            "src/stats.c",
+            "src/slowlog.c",
+            "src/replication.c",
+            "src/cluster.c",
+            "src/tracking.c",
+            "src/watch.c",
+            "src/capture.c",
+            "src/hotkeys.c",
+            "src/lazyfree.c",
+            "src/kvclient.c",
+            "src/kvcompress.c",
             "src/server.c",
             "src/server_unit_tests.c"
             }, &.{
@@ -83,5 +83,6 @@ download_drmemory
 build
 run_tests "zig-out/bin/server_test.exe"
 memory_analysis "zig-out/bin/server_test.exe"
+run_tests "zig-out/bin/client_test.exe"
 
 echo "✅ All builds successful!"
@@ -0,0 +1,499 @@
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "histogram.h"
+#include "kvclient.h"
+#include "kvstrprotocol.h"
+#include "stats.h"
+#include "utilfuns.h"
+
+#ifdef _WIN64
+#include <windows.h>
+#endif
+
+/*
+ * Generates load against a running server and reports the throughput and the latency of every
+ * operation. Each thread drives its share of the sessions: it sends a batch of requests (the
+ * pipeline depth) on every one of them, then collects the responses, so connections x depth
+ * requests are in flight at any time. The latency of a request is measured from the send of its
+ * batch to its response. Responses are already read while a batch is still being sent, the server
+ * stops reading a session that leaves too many of them unread. Sessions require the server to run
+ * in worker mode.
+ */
+
+#define BENCH_DEFAULT_CONNECTIONS 50
+#define BENCH_DEFAULT_THREADS 4
+#define BENCH_DEFAULT_PIPELINE 1
+#define BENCH_DEFAULT_REQUESTS 100000
+#define BENCH_DEFAULT_KEYSPACE 100000
+#define BENCH_DEFAULT_ZIPF_THETA 0.99
+#define BENCH_DEFAULT_VALUE_SIZE 64
+#define BENCH_MAX_PIPELINE 256
+#define BENCH_MAX_KEY_SIZE 32
+
+enum bench_op { BENCH_GET, BENCH_PUT, BENCH_DEL, BENCH_OP_COUNT };
+static const char *opNames[BENCH_OP_COUNT] = {"get", "put", "del"};
+static const char *opRequests[BENCH_OP_COUNT] = {"GET", "PUT", "DEL"};
+
+typedef struct bench_config {
+  const char *server;
+  int port;
+  int connections;
+  int threads;
+  int pipeline;
+  long long requests;
+  int mix[BENCH_OP_COUNT];      // weights of GET, PUT and DEL
+  unsigned long long keyspace;
+  bool zipf;
+  double theta;
+  size_t valueMin;
+  size_t valueMax;
+  bool json;
+} bench_config;
+
+// keys by rank: rank 0 is the most popular one (Gray et al., "Quickly generating billion-record synthetic databases")
+typedef struct zipf_generator {
+  unsigned long long n;
+  double theta;
+  double alpha;
+  double zetan;
+  double eta;
+} zipf_generator;
+
+typedef struct bench_thread {
+  const bench_config *config;
+  const zipf_generator *zipf;
+  const char *value;            // valueMax bytes
+  int connections;
+  long long requests;
+  unsigned long long random;
+  HANDLE handle;
+  histogram latency[BENCH_OP_COUNT];
+  unsigned long long errors;    // failed requests and responses other than 2xx and 404
+  unsigned long long misses;    // GETs answered with 404
+  bool failed;                  // a session could not be started
+} bench_thread;
+
+typedef struct bench_session {
+  bench_thread *owner;
+  kvclient_conn *conn;
+  byte_buffer batch;
+  enum bench_op ops[BENCH_MAX_PIPELINE];
+  int count;
+  int received;                 // responses of the batch read so far
+  unsigned long long sent;      // stats_now() when the batch was sent
+} bench_session;
+
+static void initZipf(zipf_generator *z, unsigned long long n, double theta) {
+  z->n = n;
+  z->theta = theta;
+  z->zetan = 0;
+  for (unsigned long long i = 1; i <= n; i++) {
+    z->zetan += 1.0 / pow((double)i, theta);
+  }
+  double zeta2 = 1.0 + 1.0 / pow(2.0, theta);
+  z->alpha = 1.0 / (1.0 - theta);
+  z->eta = (1.0 - pow(2.0 / (double)n, 1.0 - theta)) / (1.0 - zeta2 / z->zetan);
+}
+
+// xorshift64*, one state per thread
+static unsigned long long nextRandom(unsigned long long *state) {
+  *state ^= *state >> 12;
+  *state ^= *state << 25;
+  *state ^= *state >> 27;
+  return *state * 2685821657736338717ULL;
+}
+
+static double nextUniform(unsigned long long *state) {
+  return (double)(nextRandom(state) >> 11) / 9007199254740992.0; // [0, 1)
+}
+
+static unsigned long long nextKey(bench_thread *t) {
+  if (!t->config->zipf) {
+    return nextRandom(&t->random) % t->config->keyspace;
+  }
+  const zipf_generator *z = t->zipf;
+  double u = nextUniform(&t->random);
+  double uz = u * z->zetan;
+  if (uz < 1.0) {
+    return 0;
+  }
+  if (uz < 1.0 + pow(0.5, z->theta)) {
+    return 1;
+  }
+  unsigned long long rank = (unsigned long long)((double)z->n * pow(z->eta * u - z->eta + 1.0, z->alpha));
+  return rank < z->n ? rank : z->n - 1;
+}
+
+static enum bench_op nextOp(bench_thread *t) {
+  const int *mix = t->config->mix;
+  int r = (int)(nextRandom(&t->random) % (unsigned long long)(mix[BENCH_GET] + mix[BENCH_PUT] + mix[BENCH_DEL]));
+  if (r < mix[BENCH_GET]) {
+    return BENCH_GET;
+  }
+  return r < mix[BENCH_GET] + mix[BENCH_PUT] ? BENCH_PUT : BENCH_DEL;
+}
+
+static int appendRequest(bench_thread *t, bench_session *s, enum bench_op op) {
+  char key[BENCH_MAX_KEY_SIZE];
+  int keyLen = snprintf(key, sizeof(key), "key:%llu", nextKey(t));
+  size_t valueLen = 0;
+  if (op == BENCH_PUT) {
+    size_t range = t->config->valueMax - t->config->valueMin + 1;
+    valueLen = t->config->valueMin + (size_t)(nextRandom(&t->random) % range);
+  }
+
+  char header[KVSTR_MAX_HEADER_SIZE];
+  kvstr_iovec iov[KVSTR_MAX_IOVEC];
+  int count = kvstr_encode_request(opRequests[op], key, (size_t)keyLen, op == BENCH_PUT ? t->value : NULL, valueLen,
+                                   header, sizeof(header), iov);
+  if (count < 0) {
+    return -1;
+  }
+  for (int i = 0; i < count; i++) {
+    if (byte_buffer_append(&s->batch, iov[i].base, iov[i].len) != 0) {
+      return -1;
+    }
+  }
+  s->ops[s->count++] = op;
+  return 0;
+}
+
+static void closeSession(bench_session *s) {
+  kvclient_close(&s->conn);
+  byte_buffer_free(&s->batch);
+}
+
+// reads the response of the next request of the batch, -1 if the session broke
+static int readResponse(bench_session *s) {
+  bench_thread *t = s->owner;
+  char *response = kvclient_recv_frame(s->conn, NULL);
+  if (response == NULL) {
+    return -1;
+  }
+  enum bench_op op = s->ops[s->received++];
+  histogram_record(&t->latency[op], stats_now() - s->sent);
+  if (strncmp(response, "404", 3) == 0 && op == BENCH_GET) {
+    t->misses++;
+  } else if (response[0] != '2' && strncmp(response, "404", 3) != 0) {
+    t->errors++;
+  }
+  free(response);
+  return 0;
+}
+
+// reads a response while the batch is sent, the server stops reading a session with too many unread
+// responses (4MB), so sending cannot wait for them
+static int drainResponse(void *ctx) {
+  bench_session *s = ctx;
+  if (s->received == s->count) {
+    return 1;
+  }
+  return readResponse(s);
+}
+
+static DWORD WINAPI benchThreadMain(LPVOID arg) {
+  bench_thread *t = (bench_thread *)arg;
+  const bench_config *config = t->config;
+  bench_session *sessions = calloc((size_t)t->connections, sizeof(bench_session));
+  if (sessions == NULL) {
+    t->failed = true;
+    return 0;
+  }
+  for (int i = 0; i < t->connections; i++) {
+    sessions[i].owner = t;
+    sessions[i].conn = kvclient_connect(config->server, config->port);
+    if (sessions[i].conn == NULL || kvclient_hello(sessions[i].conn) != 0) {
+      t->failed = true;
+    }
+  }
+
+  long long remaining = t->failed ? 0 : t->requests;
+  int open = t->connections;
+  while (remaining > 0 && open > 0) {
+    for (int i = 0; i < t->connections && remaining > 0; i++) {
+      bench_session *s = &sessions[i];
+      if (s->conn == NULL) {
+        continue;
+      }
+      s->batch.len = 0;
+      s->count = 0;
+      s->received = 0;
+      while (s->count < config->pipeline && remaining > 0) {
+        if (appendRequest(t, s, nextOp(t)) != 0) {
+          t->errors++;
+        }
+        remaining--;
+      }
+      s->sent = stats_now();
+      kvstr_iovec iov = {s->batch.data, s->batch.len};
+      if (s->count > 0 && kvclient_sendv_draining(s->conn, &iov, 1, drainResponse, s) != 0) {
+        t->errors += (unsigned long long)(s->count - s->received);
+        s->count = 0;
+        closeSession(s);
+        open--;
+      }
+    }
+
+    for (int i = 0; i < t->connections; i++) {
+      bench_session *s = &sessions[i];
+      while (s->received < s->count) {
+        if (readResponse(s) != 0) {
+          t->errors += (unsigned long long)(s->count - s->received);
+          closeSession(s);
+          open--;
+          break;
+        }
+      }
+      s->count = 0;
+    }
+  }
+
+  for (int i = 0; i < t->connections; i++) {
+    closeSession(&sessions[i]);
+  }
+  free(sessions);
+  return 0;
+}
+
+static void printLatencyText(const char *name, const histogram *h, double seconds) {
+  unsigned long long count = histogram_count(h);
+  if (count == 0) {
+    return;
+  }
+  printf("%-5s %10llu requests %12.0f ops/s  p50 %9llu ns  p90 %9llu ns  p99 %9llu ns  p999 %9llu ns  max %9llu ns\n",
+         name, count, (double)count / seconds, histogram_percentile(h, 50), histogram_percentile(h, 90),
+         histogram_percentile(h, 99), histogram_percentile(h, 99.9), histogram_percentile(h, 100));
+}
+
+static void printLatencyJson(const char *name, const histogram *h, double seconds, bool last) {
+  unsigned long long count = histogram_count(h);
+  printf("    \"%s\": {\"requests\": %llu, \"ops_per_sec\": %.0f, \"latency_ns\": {\"p50\": %llu, \"p90\": %llu, "
+         "\"p99\": %llu, \"p999\": %llu, \"max\": %llu}}%s\n",
+         name, count, (double)count / seconds, histogram_percentile(h, 50), histogram_percentile(h, 90),
+         histogram_percentile(h, 99), histogram_percentile(h, 99.9), histogram_percentile(h, 100), last ? "" : ",");
+}
+
+static void printReport(const bench_config *config, histogram *latency, unsigned long long errors,
+                        unsigned long long misses, unsigned long long elapsed) {
+  double seconds = elapsed > 0 ? (double)elapsed / 1e9 : 1e-9;
+  histogram *all = calloc(1, sizeof(histogram));
+  if (all == NULL) {
+    return;
+  }
+  for (int i = 0; i < BENCH_OP_COUNT; i++) {
+    histogram_merge(all, &latency[i]);
+  }
+
+  if (!config->json) {
+    printf("%d connections, %d threads, pipeline %d, GET:PUT:DEL %d:%d:%d, %llu keys (%s), values %zu-%zu bytes\n",
+           config->connections, config->threads, config->pipeline, config->mix[BENCH_GET], config->mix[BENCH_PUT],
+           config->mix[BENCH_DEL], config->keyspace, config->zipf ? "zipf" : "uniform", config->valueMin,
+           config->valueMax);
+    for (int i = 0; i < BENCH_OP_COUNT; i++) {
+      printLatencyText(opNames[i], &latency[i], seconds);
+    }
+    printLatencyText("all", all, seconds);
+    printf("%.3f s, %llu errors, %llu GET misses\n", seconds, errors, misses);
+    free(all);
+    return;
+  }
+
+  printf("{\n");
+  printf("  \"config\": {\"connections\": %d, \"threads\": %d, \"pipeline\": %d, \"requests\": %lld, "
+         "\"mix\": {\"get\": %d, \"put\": %d, \"del\": %d}, \"keyspace\": %llu, \"distribution\": \"%s\", "
+         "\"zipf_theta\": %.3f, \"value_min\": %zu, \"value_max\": %zu},\n",
+         config->connections, config->threads, config->pipeline, config->requests, config->mix[BENCH_GET],
+         config->mix[BENCH_PUT], config->mix[BENCH_DEL], config->keyspace, config->zipf ? "zipf" : "uniform",
+         config->theta, config->valueMin, config->valueMax);
+  printf("  \"elapsed_ms\": %.3f,\n  \"errors\": %llu,\n  \"get_misses\": %llu,\n", seconds * 1000.0, errors, misses);
+  printf("  \"results\": {\n");
+  for (int i = 0; i < BENCH_OP_COUNT; i++) {
+    printLatencyJson(opNames[i], &latency[i], seconds, false);
+  }
+  printLatencyJson("all", all, seconds, true);
+  printf("  }\n}\n");
+  free(all);
+}
+
+static int parseMix(const char *arg, int *mix) {
+  if (sscanf(arg, "%d:%d:%d", &mix[BENCH_GET], &mix[BENCH_PUT], &mix[BENCH_DEL]) != 3 || mix[BENCH_GET] < 0 ||
+      mix[BENCH_PUT] < 0 || mix[BENCH_DEL] < 0 || mix[BENCH_GET] + mix[BENCH_PUT] + mix[BENCH_DEL] == 0) {
+    return -1;
+  }
+  return 0;
+}
+
+// "<size>" or "<min>-<max>" for sizes spread evenly over the range
+static int parseValueSize(const char *arg, size_t *min, size_t *max) {
+  unsigned long long from, to;
+  int n = sscanf(arg, "%llu-%llu", &from, &to);
+  if (n == 1) {
+    to = from;
+  } else if (n != 2 || to < from) {
+    return -1;
+  }
+  *min = (size_t)from;
+  *max = (size_t)to;
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  bench_config config = {
+      .server = "127.0.0.1",
+      .port = 8080,
+      .connections = BENCH_DEFAULT_CONNECTIONS,
+      .threads = BENCH_DEFAULT_THREADS,
+      .pipeline = BENCH_DEFAULT_PIPELINE,
+      .requests = BENCH_DEFAULT_REQUESTS,
+      .mix = {90, 10, 0},
+      .keyspace = BENCH_DEFAULT_KEYSPACE,
+      .theta = BENCH_DEFAULT_ZIPF_THETA,
+      .valueMin = BENCH_DEFAULT_VALUE_SIZE,
+      .valueMax = BENCH_DEFAULT_VALUE_SIZE,
+  };
+  const char *unixPath = NULL;
+  char unixServer[256];
+
+  // every option takes exactly one value
+  for (int i = 1; i < argc; i += 2) {
+    if (i + 1 >= argc) {
+      printf("Usage: %s [-h host] [-p port] [-u unix socket path] [-c connections] [-t threads] [-P pipeline depth] "
+             "[-n requests] [-r GET:PUT:DEL] [-k keyspace] [-d uniform | zipf] [-z zipf theta] [-v size | min-max] "
+             "[-o text | json]\n",
+             argv[0]);
+      return 1;
+    }
+
+    const char *value = argv[i + 1];
+    if (strcmp(argv[i], "-h") == 0) {
+      config.server = value;
+    } else if (strcmp(argv[i], "-p") == 0) {
+      config.port = atoi(value);
+    } else if (strcmp(argv[i], "-u") == 0) {
+      unixPath = value;
+    } else if (strcmp(argv[i], "-c") == 0) {
+      config.connections = atoi(value);
+    } else if (strcmp(argv[i], "-t") == 0) {
+      config.threads = atoi(value);
+    } else if (strcmp(argv[i], "-P") == 0) {
+      config.pipeline = atoi(value);
+    } else if (strcmp(argv[i], "-n") == 0) {
+      config.requests = atoll(value);
+    } else if (strcmp(argv[i], "-r") == 0) {
+      if (parseMix(value, config.mix) != 0) {
+        printf("Invalid mix '%s', expected GET:PUT:DEL weights like 80:15:5.\n", value);
+        return 1;
+      }
+    } else if (strcmp(argv[i], "-k") == 0) {
+      config.keyspace = strtoull(value, NULL, 10);
+    } else if (strcmp(argv[i], "-d") == 0) {
+      config.zipf = strcmp(value, "zipf") == 0;
+    } else if (strcmp(argv[i], "-z") == 0) {
+      config.theta = atof(value);
+    } else if (strcmp(argv[i], "-v") == 0) {
+      if (parseValueSize(value, &config.valueMin, &config.valueMax) != 0) {
+        printf("Invalid value size '%s', expected a size or min-max.\n", value);
+        return 1;
+      }
+    } else if (strcmp(argv[i], "-o") == 0) {
+      config.json = strcmp(value, "json") == 0;
+    } else {
+      printf("Unknown option '%s' ignored.\n", argv[i]);
+    }
+  }
+
+  if (unixPath != NULL) {
+    snprintf(unixServer, sizeof(unixServer), "%s%s", KVCLIENT_UNIX_PREFIX, unixPath);
+    config.server = unixServer;
+  }
+  if (config.connections <= 0) {
+    config.connections = BENCH_DEFAULT_CONNECTIONS;
+  }
+  if (config.threads <= 0) {
+    config.threads = BENCH_DEFAULT_THREADS;
+  }
+  if (config.threads > config.connections) {
+    config.threads = config.connections;
+  }
+  if (config.pipeline <= 0 || config.pipeline > BENCH_MAX_PIPELINE) {
+    config.pipeline = config.pipeline <= 0 ? BENCH_DEFAULT_PIPELINE : BENCH_MAX_PIPELINE;
+  }
+  if (config.requests <= 0) {
+    config.requests = BENCH_DEFAULT_REQUESTS;
+  }
+  if (config.keyspace == 0) {
+    config.keyspace = BENCH_DEFAULT_KEYSPACE;
+  }
+  if (config.theta <= 0 || config.theta == 1.0) {
+    config.theta = BENCH_DEFAULT_ZIPF_THETA;
+  }
+
+  int r = kvclient_init();
+  if (r != 0) {
+    printf("WSAStartup failed. Error code: %d\n", r);
+    return 1;
+  }
+
+  zipf_generator zipf = {0};
+  if (config.zipf) {
+    initZipf(&zipf, config.keyspace, config.theta);
+  }
+  char *value = malloc(config.valueMax + 1);
+  // the histograms are too large for the stack
+  bench_thread *threads = calloc((size_t)config.threads, sizeof(bench_thread));
+  if (value == NULL || threads == NULL) {
+    printf("Out of memory\n");
+    return 1;
+  }
+  memset(value, 'v', config.valueMax);
+
+  for (int i = 0; i < config.threads; i++) {
+    bench_thread *t = &threads[i];
+    t->config = &config;
+    t->zipf = &zipf;
+    t->value = value;
+    t->connections = config.connections / config.threads + (i < config.connections % config.threads ? 1 : 0);
+    t->requests = config.requests / config.threads + (i < config.requests % config.threads ? 1 : 0);
+    t->random = 0x9E3779B97F4A7C15ULL * (unsigned long long)(i + 1);
+  }
+
+  unsigned long long start = stats_now();
+  for (int i = 0; i < config.threads; i++) {
+    threads[i].handle = CreateThread(NULL, 0, benchThreadMain, &threads[i], 0, NULL);
+    if (threads[i].handle == NULL) {
+      threads[i].failed = true;
+    }
+  }
+  histogram *latency = calloc(BENCH_OP_COUNT, sizeof(histogram));
+  unsigned long long errors = 0;
+  unsigned long long misses = 0;
+  bool failed = latency == NULL;
+  for (int i = 0; i < config.threads; i++) {
+    if (threads[i].handle != NULL) {
+      WaitForSingleObject(threads[i].handle, INFINITE);
+      CloseHandle(threads[i].handle);
+    }
+    failed |= threads[i].failed;
+    errors += threads[i].errors;
+    misses += threads[i].misses;
+    for (int j = 0; latency != NULL && j < BENCH_OP_COUNT; j++) {
+      histogram_merge(&latency[j], &threads[i].latency[j]);
+    }
+  }
+  unsigned long long elapsed = stats_now() - start;
+
+  if (failed) {
+    printf("Failed to start the sessions, the server needs to run in worker mode (-w).\n");
+  } else {
+    printReport(&config, latency, errors, misses, elapsed);
+  }
+
+  free(latency);
+  free(threads);
+  free(value);
+  kvclient_cleanup();
+  return failed ? 1 : 0;
+}
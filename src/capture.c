@@ -0,0 +1,349 @@
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "capture.h"
+#include "kvstrprotocol.h"
+#include "stats.h"
+
+#ifdef _WIN64
+#include <windows.h>
+#endif
+
+/*
+ * Requests are recorded as the client sent them, re-encoded from the parsed request. Every
+ * thread appends its records to its own ring of bytes (single producer), a background thread
+ * writes the rings to the file (single consumer), so capturing never waits for the disk. A
+ * request that does not fit into the ring of its thread is dropped and counted.
+ *
+ * File format: CAPTURE_MAGIC followed by the records, each of them
+ *   varint time (ns since the start) | varint connection id | varint length | request bytes
+ * with varints of 7 bits per byte, least significant group first. Records of different threads
+ * are written ring by ring, readers have to order them by time.
+ */
+
+typedef struct capture_ring {
+  unsigned char *data;
+  size_t mask;              // size - 1 (the size is a power of two)
+  atomic_size_t head;       // next byte to write out, only advanced by the consumer
+  atomic_size_t tail;       // end of the last complete record, only advanced by the owning thread
+  atomic_ullong records;    // written by the owning thread only
+  struct capture_ring *next;
+} capture_ring;
+
+static _Thread_local capture_ring *tl_ring = NULL;
+static _Thread_local unsigned int tl_ringGeneration = 0;
+
+static _Atomic(capture_ring *) gl_rings = NULL;  // all rings, only grows while capturing
+static atomic_uint gl_ringGeneration;            // invalidates the thread local rings of a previous capture
+static atomic_bool gl_captureRunning;
+static atomic_ullong gl_nextConnection;
+static atomic_ullong gl_droppedRecords;
+static unsigned long long gl_stoppedRecords = 0; // records of the last capture once it stopped
+static unsigned long long gl_captureStart = 0;
+static bool gl_writeFailed = false;
+static FILE *gl_captureOut = NULL;
+static size_t gl_ringSize = CAPTURE_RING_SIZE;
+static unsigned int gl_flushInterval = CAPTURE_FLUSH_INTERVAL;
+static HANDLE gl_writerThread = NULL;
+static SRWLOCK gl_wakeLock = SRWLOCK_INIT;
+static CONDITION_VARIABLE gl_wakeCond = CONDITION_VARIABLE_INIT;
+
+static size_t writeVarint(unsigned char *out, unsigned long long value) {
+  size_t pos = 0;
+  while (value >= 0x80) {
+    out[pos++] = (unsigned char)(value | 0x80);
+    value >>= 7;
+  }
+  out[pos++] = (unsigned char)value;
+  return pos;
+}
+
+// returns the ring of the calling thread, creating it on first use
+static capture_ring *getRing() {
+  unsigned int generation = atomic_load(&gl_ringGeneration);
+  if (tl_ring != NULL && tl_ringGeneration == generation) {
+    return tl_ring;
+  }
+
+  capture_ring *ring = calloc(1, sizeof(capture_ring));
+  if (ring == NULL) {
+    return NULL;
+  }
+  ring->data = malloc(gl_ringSize);
+  if (ring->data == NULL) {
+    free(ring);
+    return NULL;
+  }
+  ring->mask = gl_ringSize - 1;
+  atomic_init(&ring->head, 0);
+  atomic_init(&ring->tail, 0);
+  atomic_init(&ring->records, 0);
+
+  capture_ring *first = atomic_load(&gl_rings);
+  do {
+    ring->next = first;
+  } while (!atomic_compare_exchange_weak(&gl_rings, &first, ring));
+
+  tl_ring = ring;
+  tl_ringGeneration = generation;
+  return ring;
+}
+
+// copies data to the position pos of the ring, wrapping around at its end
+static size_t ringWrite(capture_ring *ring, size_t pos, const void *data, size_t len) {
+  size_t offset = pos & ring->mask;
+  size_t first = ring->mask + 1 - offset;
+  if (len <= first) {
+    memcpy(ring->data + offset, data, len);
+  } else {
+    memcpy(ring->data + offset, data, first);
+    memcpy(ring->data, (const char *)data + first, len - first);
+  }
+  return pos + len;
+}
+
+// writes out everything buffered so far, only called by one thread at a time
+static void drainRings() {
+  for (capture_ring *ring = atomic_load(&gl_rings); ring != NULL; ring = ring->next) {
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    while (head != tail) {
+      size_t offset = head & ring->mask;
+      size_t len = tail - head < ring->mask + 1 - offset ? tail - head : ring->mask + 1 - offset;
+      if (fwrite(ring->data + offset, 1, len, gl_captureOut) != len) {
+        gl_writeFailed = true;
+      }
+      head += len;
+    }
+    atomic_store_explicit(&ring->head, head, memory_order_release);
+  }
+  fflush(gl_captureOut);
+}
+
+static DWORD WINAPI writerMain(LPVOID arg) {
+  AcquireSRWLockExclusive(&gl_wakeLock);
+  while (atomic_load(&gl_captureRunning)) {
+    SleepConditionVariableSRW(&gl_wakeCond, &gl_wakeLock, gl_flushInterval, 0);
+    ReleaseSRWLockExclusive(&gl_wakeLock);
+    drainRings();
+    AcquireSRWLockExclusive(&gl_wakeLock);
+  }
+  ReleaseSRWLockExclusive(&gl_wakeLock);
+  return 0;
+}
+
+int capture_start(const char *path, size_t ringSize, unsigned int flushIntervalMs) {
+  if (path == NULL || ringSize == 0 || atomic_load(&gl_captureRunning)) {
+    return -1;
+  }
+
+  FILE *out = fopen(path, "wb");
+  if (out == NULL) {
+    return -1;
+  }
+  if (fwrite(CAPTURE_MAGIC, 1, strlen(CAPTURE_MAGIC), out) != strlen(CAPTURE_MAGIC)) {
+    fclose(out);
+    return -1;
+  }
+
+  // round up to a power of two, so positions can be mapped into the ring with a mask
+  size_t size = 1;
+  while (size < ringSize) {
+    size <<= 1;
+  }
+
+  gl_captureOut = out;
+  gl_ringSize = size;
+  gl_flushInterval = flushIntervalMs;
+  gl_writeFailed = false;
+  gl_stoppedRecords = 0;
+  gl_captureStart = stats_now();
+  atomic_store(&gl_droppedRecords, 0);
+  atomic_fetch_add(&gl_ringGeneration, 1);
+  atomic_store(&gl_captureRunning, true);
+
+  gl_writerThread = CreateThread(NULL, 0, writerMain, NULL, 0, NULL);
+  if (gl_writerThread == NULL) {
+    atomic_store(&gl_captureRunning, false);
+    fclose(out);
+    gl_captureOut = NULL;
+    return -1;
+  }
+  return 0;
+}
+
+int capture_stop() {
+  if (!atomic_load(&gl_captureRunning)) {
+    return 0;
+  }
+
+  AcquireSRWLockExclusive(&gl_wakeLock);
+  atomic_store(&gl_captureRunning, false);
+  WakeAllConditionVariable(&gl_wakeCond);
+  ReleaseSRWLockExclusive(&gl_wakeLock);
+
+  WaitForSingleObject(gl_writerThread, INFINITE);
+  CloseHandle(gl_writerThread);
+  gl_writerThread = NULL;
+
+  drainRings();
+  if (fclose(gl_captureOut) != 0) {
+    gl_writeFailed = true;
+  }
+  gl_captureOut = NULL;
+
+  capture_ring *ring = atomic_exchange(&gl_rings, NULL);
+  while (ring != NULL) {
+    capture_ring *next = ring->next;
+    gl_stoppedRecords += atomic_load(&ring->records);
+    free(ring->data);
+    free(ring);
+    ring = next;
+  }
+  return gl_writeFailed ? -1 : 0;
+}
+
+bool capture_running() {
+  return atomic_load_explicit(&gl_captureRunning, memory_order_relaxed);
+}
+
+unsigned long long capture_next_connection() {
+  return atomic_fetch_add_explicit(&gl_nextConnection, 1, memory_order_relaxed) + 1;
+}
+
+// the bytes of an argument with the given role
+static const char *argumentOf(const struct kvstr_request *req, char role, size_t *argIndex, size_t *len) {
+  if (role == 'k') {
+    *len = req->key != NULL ? strlen(req->key) : 0;
+    return req->key;
+  }
+  if (role == 'v') {
+    *len = req->value_len;
+    return req->value;
+  }
+  size_t i = (*argIndex)++;
+  *len = i < req->arg_count ? req->arg_lens[i] : 0;
+  return i < req->arg_count ? req->args[i] : NULL;
+}
+
+void capture_request(unsigned long long connection, const struct kvstr_request *req) {
+  if (!capture_running() || req == NULL || req->operation == NULL) {
+    return;
+  }
+  // the internal traffic of replication links and slot migrations cannot be replayed
+  const char *op = req->operation;
+  if (strcmp(op, "SYNC") == 0 || strcmp(op, "REPLPING") == 0 || strcmp(op, "REPLACK") == 0 ||
+      strcmp(op, "RESTORE") == 0) {
+    return;
+  }
+  const char *roles = kvstr_operation_args(op);
+  if (roles == NULL) {
+    return;
+  }
+
+  size_t opLen = strlen(op);
+  size_t length = roles[0] == '\0' ? opLen + 2 : opLen; // operations without arguments end with a line break
+  size_t argIndex = 0;
+  for (const char *role = roles; *role != '\0'; role++) {
+    size_t len;
+    argumentOf(req, *role, &argIndex, &len);
+    length += 1 + kvstr_digits(len) + 1 + len;
+  }
+
+  if (connection == CAPTURE_NO_CONNECTION) {
+    connection = capture_next_connection();
+  }
+  unsigned char prefix[30];
+  size_t prefixLen = writeVarint(prefix, stats_now() - gl_captureStart);
+  prefixLen += writeVarint(prefix + prefixLen, connection);
+  prefixLen += writeVarint(prefix + prefixLen, length);
+
+  capture_ring *ring = getRing();
+  if (ring == NULL) {
+    atomic_fetch_add_explicit(&gl_droppedRecords, 1, memory_order_relaxed);
+    return;
+  }
+  size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+  size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+  if (prefixLen + length > ring->mask + 1 - (tail - head)) {
+    atomic_fetch_add_explicit(&gl_droppedRecords, 1, memory_order_relaxed); // ring is full
+    return;
+  }
+
+  size_t pos = ringWrite(ring, tail, prefix, prefixLen);
+  pos = ringWrite(ring, pos, op, opLen);
+  argIndex = 0;
+  for (const char *role = roles; *role != '\0'; role++) {
+    size_t len;
+    const char *arg = argumentOf(req, *role, &argIndex, &len);
+    char header[KVSTR_MAX_HEADER_SIZE];
+    pos = ringWrite(ring, pos, header, kvstr_write_header(header, " ", len));
+    if (len > 0) {
+      pos = ringWrite(ring, pos, arg, len);
+    }
+  }
+  if (roles[0] == '\0') {
+    pos = ringWrite(ring, pos, "\r\n", 2);
+  }
+  atomic_store_explicit(&ring->records, atomic_load_explicit(&ring->records, memory_order_relaxed) + 1,
+                        memory_order_relaxed);
+  atomic_store_explicit(&ring->tail, pos, memory_order_release);
+}
+
+void capture_get_counts(unsigned long long *records, unsigned long long *dropped) {
+  if (!capture_running()) {
+    *records = gl_stoppedRecords;
+  } else {
+    *records = 0;
+    for (capture_ring *ring = atomic_load(&gl_rings); ring != NULL; ring = ring->next) {
+      *records += atomic_load_explicit(&ring->records, memory_order_relaxed);
+    }
+  }
+  *dropped = atomic_load(&gl_droppedRecords);
+}
+
+// 1 if a value was read, 0 if the file ended before it, -1 if it ended in the middle
+static int readVarint(FILE *in, unsigned long long *value) {
+  *value = 0;
+  for (int shift = 0; shift < 64; shift += 7) {
+    int c = fgetc(in);
+    if (c == EOF) {
+      return shift == 0 ? 0 : -1;
+    }
+    *value |= (unsigned long long)(c & 0x7f) << shift;
+    if ((c & 0x80) == 0) {
+      return 1;
+    }
+  }
+  return -1;
+}
+
+int capture_read_header(FILE *in) {
+  char magic[sizeof(CAPTURE_MAGIC)];
+  size_t len = strlen(CAPTURE_MAGIC);
+  return fread(magic, 1, len, in) == len && memcmp(magic, CAPTURE_MAGIC, len) == 0 ? 0 : -1;
+}
+
+int capture_read_record(FILE *in, capture_record *record) {
+  memset(record, 0, sizeof(capture_record));
+  int r = readVarint(in, &record->time);
+  if (r <= 0) {
+    return r;
+  }
+  unsigned long long length;
+  if (readVarint(in, &record->connection) != 1 || readVarint(in, &length) != 1 ||
+      length > KVSTR_MAX_VALUE_SIZE + KVSTR_MAX_KEY_SIZE + KVSTR_MAX_HEADER_SIZE) {
+    return -1;
+  }
+
+  record->data = malloc(length + 1);
+  if (record->data == NULL || fread(record->data, 1, length, in) != length) {
+    free(record->data);
+    record->data = NULL;
+    return -1;
+  }
+  record->data[length] = '\0';
+  record->length = length;
+  return 1;
+}
@@ -0,0 +1,33 @@
+#ifndef _KVSTR_CAPTURE_H
+#define _KVSTR_CAPTURE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#include "kvstrdecoder.h"
+
+#define CAPTURE_MAGIC "SKVCAP1\n"           // first bytes of a capture file
+#define CAPTURE_RING_SIZE (4 * 1024 * 1024) // default bytes buffered per thread before requests are dropped
+#define CAPTURE_FLUSH_INTERVAL 10           // default time in ms between two writes to the file
+#define CAPTURE_NO_CONNECTION 0ULL
+
+// a request read back from a capture file
+typedef struct capture_record {
+  unsigned long long time;        // ns since the capture started
+  unsigned long long connection;  // requests of the same connection share the id
+  char *data;                     // the request as the client sent it
+  size_t length;
+} capture_record;
+
+/* Prototypes */
+int capture_start(const char *path, size_t ringSize, unsigned int flushIntervalMs); // opens the file and starts the writer thread
+int capture_stop(); // writes everything buffered and closes the file, -1 if writing failed. Other threads must not capture anymore
+bool capture_running();
+unsigned long long capture_next_connection(); // a new connection id
+void capture_request(unsigned long long connection, const struct kvstr_request *req); // records the request without blocking, a new connection id is used for CAPTURE_NO_CONNECTION
+void capture_get_counts(unsigned long long *records, unsigned long long *dropped);
+int capture_read_header(FILE *in); // 0 if the file is a capture
+int capture_read_record(FILE *in, capture_record *record); // 1 if a record was read, 0 at the end, -1 if it is truncated or out of memory
+
+#endif
@@ -1,125 +1,82 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include "kvclient.h"
 #include "kvstrprotocol.h"
 
 #ifdef _WIN64
 #include <WinSock2.h>
 #endif
 
-void getFromServer(char *server, int port, char *key) {
-  WSADATA wsaData = {0};
-  int r = WSAStartup(MAKEWORD(2, 2), &wsaData);
-  if (r != 0) {
-    char logBuffer[1024];
-    printf(logBuffer, "WSAStartup failed. Error code: %d", r);
-  }
-
-  SOCKET sock = socket(AF_INET, SOCK_STREAM, 0);
-  if (sock == INVALID_SOCKET) {
-    printf("Failed to create socket: %d\n", WSAGetLastError());
-    exit(1);
-  }
-
-  struct sockaddr_in addr = {};
-  addr.sin_family = AF_INET;
-  addr.sin_port = ntohs(8080);
-  addr.sin_addr.s_addr = ntohl(INADDR_LOOPBACK); // 127.0.0.1
-  int rv = connect(sock, (const struct sockaddr *)&addr, sizeof(addr));
-  if (rv) {
-    printf("Failed to connect: %d\n", WSAGetLastError());
-    exit(1);
-  }
-
-  char* msg = kvstr_build_get_request(key);
-  send(sock, msg, strlen(msg), 0);
-  free(msg);
-
-  char rbuf[64] = {};
-  size_t n = recv(sock, rbuf, sizeof(rbuf) - 1, 0);
-  if (n < 0) {
-    printf("Failed to receive: %d\n", WSAGetLastError());
+// sends a single request to the server and prints its response
+void sendToServer(char *server, int port, char *request) {
+  if (request == NULL) {
+    printf("Failed to build request\n");
     exit(1);
   }
-  printf("server says: %s\n", rbuf);
-  closesocket(sock);
-}
 
-void delFromServer(char *server, int port, char *key) {
-  WSADATA wsaData = {0};
-  int r = WSAStartup(MAKEWORD(2, 2), &wsaData);
+  int r = kvclient_init();
   if (r != 0) {
-    char logBuffer[1024];
-    printf(logBuffer, "WSAStartup failed. Error code: %d", r);
-  }
-
-  SOCKET sock = socket(AF_INET, SOCK_STREAM, 0);
-  if (sock == INVALID_SOCKET) {
-    printf("Failed to create socket: %d\n", WSAGetLastError());
+    printf("WSAStartup failed. Error code: %d\n", r);
     exit(1);
   }
 
-  struct sockaddr_in addr = {};
-  addr.sin_family = AF_INET;
-  addr.sin_port = ntohs(8080);
-  addr.sin_addr.s_addr = ntohl(INADDR_LOOPBACK); // 127.0.0.1
-  int rv = connect(sock, (const struct sockaddr *)&addr, sizeof(addr));
-  if (rv) {
+  kvclient_conn *conn = kvclient_connect(server, port);
+  if (conn == NULL) {
     printf("Failed to connect: %d\n", WSAGetLastError());
     exit(1);
   }
 
-  char* msg = kvstr_build_del_request(key);
-  send(sock, msg, strlen(msg), 0);
-  free(msg);
-
-  char rbuf[64] = {};
-  size_t n = recv(sock, rbuf, sizeof(rbuf) - 1, 0);
-  if (n < 0) {
+  char *response = kvclient_request(conn, request, NULL);
+  free(request);
+  if (response == NULL) {
     printf("Failed to receive: %d\n", WSAGetLastError());
     exit(1);
   }
-  printf("%s\n", rbuf);
-  closesocket(sock);
+  printf("server says: %s\n", response);
+  free(response);
+
+  kvclient_close(&conn);
+  kvclient_cleanup();
 }
 
+static void printPush(void *ctx, const char *message, size_t length) {
+  (void)ctx;
+  printf("%.*s\n", (int)length, message);
+  fflush(stdout);
+}
 
-void setValueOnServer(char *server, int port, char *key, char *value) {
-    WSADATA wsaData = {0};
-  int r = WSAStartup(MAKEWORD(2, 2), &wsaData);
+// watches the given keys or prefixes ("user:*") and prints every change until the connection closes
+void watchKeys(char *server, int port, int count, char **patterns) {
+  int r = kvclient_init();
   if (r != 0) {
-    char logBuffer[1024];
-    printf(logBuffer, "WSAStartup failed. Error code: %d", r);
-  }
-
-  SOCKET sock = socket(AF_INET, SOCK_STREAM, 0);
-  if (sock == INVALID_SOCKET) {
-    printf("Failed to create socket: %d\n", WSAGetLastError());
+    printf("WSAStartup failed. Error code: %d\n", r);
     exit(1);
   }
 
-  struct sockaddr_in addr = {};
-  addr.sin_family = AF_INET;
-  addr.sin_port = ntohs(8080);
-  addr.sin_addr.s_addr = ntohl(INADDR_LOOPBACK); // 127.0.0.1
-  int rv = connect(sock, (const struct sockaddr *)&addr, sizeof(addr));
-  if (rv) {
-    printf("Failed to connect: %d\n", WSAGetLastError());
+  kvclient_conn *conn = kvclient_connect(server, port);
+  if (conn == NULL || kvclient_hello(conn) != 0) {
+    printf("Failed to start a session, the server has to run in worker mode (-w)\n");
     exit(1);
   }
+  conn->on_push = printPush;
+
+  for (int i = 0; i < count; i++) {
+    char *request = kvstr_build_request("WATCH", 1, &patterns[i]);
+    char *response = request != NULL ? kvclient_request(conn, request, NULL) : NULL;
+    free(request);
+    if (response == NULL || strncmp(response, "200", 3) != 0) {
+      printf("Failed to watch %s: %s\n", patterns[i], response != NULL ? response : "no response");
+      exit(1);
+    }
+    free(response);
+  }
 
-  char* msg = kvstr_build_put_request(key, value);
-  send(sock, msg, strlen(msg), 0);
-  free(msg);
-
-  char rbuf[64] = {};
-  size_t n = recv(sock, rbuf, sizeof(rbuf) - 1, 0);
-  if (n < 0) {
-    printf("Failed to receive: %d\n", WSAGetLastError());
-    exit(1);
+  while (kvclient_wait_pushes(conn, -1) == 0) {
   }
-  printf("server says: %s\n", rbuf);
-  closesocket(sock);
+  printf("Connection closed\n");
+  kvclient_close(&conn);
+  kvclient_cleanup();
 }
 
 int main(int argc, char **argv) {
@@ -129,31 +86,44 @@ int main(int argc, char **argv) {
   return 1;
 #endif
 
-  if (argc < 5) {
-    printf("Usage: %s <server> <port> <GET key | SET key value>\n", argv[0]);
+  if (argc < 4) {
+    printf("Usage: %s <server | unix:path> <port> <GET key | PUT key value | DEL key | WATCH pattern... | OPERATION [args...]>\n", argv[0]);
     return 1;
   }
 
   char *server = argv[1];
   int port = atoi(argv[2]);
   char *command = argv[3];
+  if (argc < 5 && (strcmp(command, "GET") == 0 || strcmp(command, "PUT") == 0 || strcmp(command, "DEL") == 0 ||
+                   strcmp(command, "get") == 0 || strcmp(command, "put") == 0 || strcmp(command, "del") == 0)) {
+    printf("usage: %s <key>\n", command);
+    return 1;
+  }
+
   if (strcmp(command, "GET") == 0 || strcmp(command, "get") == 0) {
     char *key = argv[4];
-    getFromServer(server, port, key);
+    sendToServer(server, port, kvstr_build_get_request(key));
   } else if (strcmp(command, "PUT") == 0 || strcmp(command, "put") == 0) {
     char *key = argv[4];
     if (argc < 6) {
-      printf("usage: SET <key> <value>\n");
+      printf("usage: PUT <key> <value>\n");
       return 1;
     }
     char *value = argv[5];
-    setValueOnServer(server, port, key, value);
+    sendToServer(server, port, kvstr_build_put_request(key, value));
   } else if(strcmp(command, "DEL") == 0 || strcmp(command, "del") == 0) {
     char *key = argv[4];
-    delFromServer(server, port, key);
+    sendToServer(server, port, kvstr_build_del_request(key));
+  } else if (strcmp(command, "WATCH") == 0 || strcmp(command, "watch") == 0) {
+    if (argc < 5) {
+      printf("usage: WATCH <key | prefix*>...\n");
+      return 1;
+    }
+    watchKeys(server, port, argc - 4, argv + 4);
   } else {
-    printf("Invalid command\n");
+    // any other operation is sent as is, e.g. STATS or SETSLOT 0-16383 NODE 127.0.0.1:7000
+    sendToServer(server, port, kvstr_build_request(command, argc - 4, argv + 4));
   }
 
   return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,563 @@
+#include "cmunit.h"
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "kvcache.h"
+#include "kvcompress.h"
+#include "kvpool.h"
+#include "kvshard.h"
+#include "kvstrprotocol.h"
+#include "utilfuns.h"
+
+#ifdef _WIN64
+#include <windows.h>
+#endif
+
+#define TEST_KEYS 100000
+
+static void keyName(char *buffer, size_t size, int i) {
+    snprintf(buffer, size, "user:%d", i);
+}
+
+static void addServers(kvshard_ring* ring, int count) {
+    char address[32];
+    for (int s = 0; s < count; s++) {
+        snprintf(address, sizeof(address), "10.0.0.%d:8080", s + 1);
+        kvshard_add_server(ring, address);
+    }
+}
+
+typedef char server_name[32];
+
+// server address of every test key, copied since the ring changes
+static server_name* assignKeys(const kvshard_ring* ring) {
+    server_name* owners = malloc(TEST_KEYS * sizeof(server_name));
+    char key[32];
+    for (int i = 0; i < TEST_KEYS; i++) {
+        keyName(key, sizeof(key), i);
+        strcpy(owners[i], ring->servers[kvshard_server_for_key(ring, key)]);
+    }
+    return owners;
+}
+
+char* test_build_request_with_arguments() {
+    char* args[] = {"0-8191", "NODE", "127.0.0.1:7000"};
+    char* request = kvstr_build_request("SETSLOT", 3, args);
+    cmunit_assert("wrong request", strcmp(request, "SETSLOT 6:0-8191 4:NODE 14:127.0.0.1:7000") == 0);
+    free(request);
+
+    request = kvstr_build_request("STATS", 0, NULL);
+    cmunit_assert("request without arguments not terminated", strcmp(request, "STATS\r\n") == 0);
+    free(request);
+    return NULL;
+}
+
+static size_t joinPieces(const kvstr_iovec* iov, int count, char* out) {
+    size_t len = 0;
+    for (int i = 0; i < count; i++) {
+        memcpy(out + len, iov[i].base, iov[i].len);
+        len += iov[i].len;
+    }
+    out[len] = '\0';
+    return len;
+}
+
+char* test_encode_request_into_caller_buffer() {
+    char header[KVSTR_MAX_HEADER_SIZE];
+    kvstr_iovec iov[KVSTR_MAX_IOVEC];
+    char joined[256];
+    const char* key = "user:1";
+    const char* value = "a value with spaces";
+
+    int count = kvstr_encode_put_request(key, strlen(key), value, strlen(value), header, sizeof(header), iov);
+    cmunit_assert("wrong number of pieces", count == 4);
+    cmunit_assert("key copied", iov[1].base == key && iov[1].len == strlen(key));
+    cmunit_assert("value copied", iov[3].base == value && iov[3].len == strlen(value));
+    char* built = kvstr_build_put_request(key, value);
+    size_t len = joinPieces(iov, count, joined);
+    cmunit_assert("encoded request differs", strcmp(joined, built) == 0);
+    cmunit_assert("wrong header size", len - strlen(key) - strlen(value) == kvstr_put_header_size(strlen(key), strlen(value)));
+    free(built);
+
+    count = kvstr_encode_get_request(key, strlen(key), header, sizeof(header), iov);
+    joinPieces(iov, count, joined);
+    cmunit_assert("wrong get request", count == 2 && strcmp(joined, "GET 6:user:1") == 0);
+    cmunit_assert("wrong get header size", kvstr_get_header_size(strlen(key)) == iov[0].len);
+    count = kvstr_encode_del_request(key, strlen(key), header, sizeof(header), iov);
+    joinPieces(iov, count, joined);
+    cmunit_assert("wrong del request", count == 2 && strcmp(joined, "DEL 6:user:1") == 0);
+
+    // the size query is exact, one byte less is rejected
+    size_t size = kvstr_put_header_size(strlen(key), 1234567);
+    cmunit_assert("exact buffer rejected", kvstr_encode_put_request(key, strlen(key), value, 1234567, header, size, iov) == 4);
+    cmunit_assert("small buffer accepted", kvstr_encode_put_request(key, strlen(key), value, 1234567, header, size - 1, iov) == -1);
+    cmunit_assert("empty value not encoded", kvstr_encode_put_request(key, strlen(key), "", 0, header, sizeof(header), iov) == 4 &&
+                                             iov[2].len == 3);
+    return NULL;
+}
+
+char* test_shard_ring_without_servers() {
+    kvshard_ring ring;
+    kvshard_init(&ring);
+    cmunit_assert("key assigned without servers", kvshard_server_for_key(&ring, "akey") == -1);
+
+    kvshard_add_server(&ring, "127.0.0.1:8080");
+    cmunit_assert("duplicate server added", kvshard_add_server(&ring, "127.0.0.1:8080") != 0);
+    cmunit_assert("unknown server removed", kvshard_remove_server(&ring, "127.0.0.1:8081") != 0);
+    cmunit_assert("key not assigned", kvshard_server_for_key(&ring, "akey") == 0);
+    kvshard_free(&ring);
+    return NULL;
+}
+
+char* test_shard_keys_spread_evenly() {
+    kvshard_ring ring;
+    kvshard_init(&ring);
+    addServers(&ring, 4);
+
+    int counts[4] = {0};
+    char key[32];
+    for (int i = 0; i < TEST_KEYS; i++) {
+        keyName(key, sizeof(key), i);
+        counts[kvshard_server_for_key(&ring, key)]++;
+    }
+    kvshard_free(&ring);
+
+    printf("  keys per server: %d %d %d %d\n", counts[0], counts[1], counts[2], counts[3]);
+    for (int s = 0; s < 4; s++) {
+        // ideal is 25%, virtual nodes keep every server within a few percent of it
+        cmunit_assert("keys not spread evenly", counts[s] > TEST_KEYS / 4 * 0.8 && counts[s] < TEST_KEYS / 4 * 1.2);
+    }
+    return NULL;
+}
+
+char* test_shard_membership_change_moves_few_keys() {
+    kvshard_ring ring;
+    kvshard_init(&ring);
+    addServers(&ring, 4);
+    server_name* before = assignKeys(&ring);
+
+    // a fifth server should take over about 1/5 of the keys, all of them from the others
+    kvshard_add_server(&ring, "10.0.0.5:8080");
+    server_name* added = assignKeys(&ring);
+    int moved = 0;
+    int movedElsewhere = 0;
+    for (int i = 0; i < TEST_KEYS; i++) {
+        if (strcmp(before[i], added[i]) != 0) {
+            moved++;
+            movedElsewhere += strcmp(added[i], "10.0.0.5:8080") != 0;
+        }
+    }
+
+    // removing a server only moves its own keys
+    kvshard_remove_server(&ring, "10.0.0.2:8080");
+    server_name* removed = assignKeys(&ring);
+    int movedOnRemove = 0;
+    int ownedByRemoved = 0;
+    int movedWrongly = 0;
+    for (int i = 0; i < TEST_KEYS; i++) {
+        ownedByRemoved += strcmp(added[i], "10.0.0.2:8080") == 0;
+        if (strcmp(added[i], removed[i]) != 0) {
+            movedOnRemove++;
+            movedWrongly += strcmp(added[i], "10.0.0.2:8080") != 0;
+        }
+    }
+    int unknownRemoved = kvshard_remove_server(&ring, "10.0.0.9:8080");
+    int serverCount = ring.server_count;
+    size_t pointCount = ring.point_count;
+    free(removed);
+    free(added);
+    free(before);
+    kvshard_free(&ring);
+
+    printf("  adding a 5th server moved %.1f%% of the keys (ideal 20%%)\n", 100.0 * moved / TEST_KEYS);
+    printf("  removing a server moved %.1f%% of the keys (it owned %.1f%%)\n", 100.0 * movedOnRemove / TEST_KEYS,
+           100.0 * ownedByRemoved / TEST_KEYS);
+    cmunit_assert("too many keys moved to the new server", moved > TEST_KEYS * 0.15 && moved < TEST_KEYS * 0.25);
+    cmunit_assert("keys moved between old servers", movedElsewhere == 0);
+    cmunit_assert("keys of other servers moved on removal", movedWrongly == 0);
+    cmunit_assert("ring changed by removing an unknown server", unknownRemoved == -1 && serverCount == 4 &&
+                  pointCount == 4 * KVSHARD_VNODES);
+    return NULL;
+}
+
+char* test_shard_execute_without_reachable_servers() {
+    kvshard_ring ring;
+    kvshard_init(&ring);
+    kvshard_op ops[2] = {{.key = "a"}, {.key = NULL}};
+    int failed = kvshard_execute(&ring, "GET", ops, 2);
+    kvshard_free(&ring);
+
+    cmunit_assert("keys without server not reported", failed == 2);
+    cmunit_assert("response set", ops[0].response == NULL && ops[1].response == NULL);
+    return NULL;
+}
+
+// accepts one connection, answers HELLO and then sends canned responses, whatever was asked
+typedef struct fake_server {
+    SOCKET listener;
+    char address[32];
+    byte_buffer responses;
+    size_t responseEnd[8];
+    int responseCount;
+    bool answerEachRead;      // one response per read instead of all of them at once
+    bool closeAfterResponses; // end the connection after the responses instead of waiting for more requests
+    int connections;
+    HANDLE thread;
+} fake_server;
+
+static DWORD WINAPI fakeServerMain(LPVOID arg) {
+    fake_server* server = arg;
+    char buffer[4096];
+    SOCKET client = accept(server->listener, NULL, NULL);
+    if (client != INVALID_SOCKET) {
+        server->connections++;
+        recv(client, buffer, sizeof(buffer), 0);
+        send(client, "6:200 OK", 8, 0);
+        if (server->answerEachRead) {
+            for (int i = 0; i < server->responseCount && recv(client, buffer, sizeof(buffer), 0) > 0; i++) {
+                size_t start = i > 0 ? server->responseEnd[i - 1] : 0;
+                send(client, server->responses.data + start, (int)(server->responseEnd[i] - start), 0);
+            }
+        } else {
+            send(client, server->responses.data, (int)server->responses.len, 0);
+        }
+        if (server->closeAfterResponses) {
+            shutdown(client, SD_SEND);
+        }
+        while (recv(client, buffer, sizeof(buffer), 0) > 0) {
+        }
+        closesocket(client);
+    }
+    return 0;
+}
+
+static void addResponse(fake_server* server, const char* response, size_t len) {
+    char prefix[32];
+    byte_buffer_append(&server->responses, prefix, snprintf(prefix, sizeof(prefix), "%zu:", len));
+    byte_buffer_append(&server->responses, response, len);
+    server->responseEnd[server->responseCount++] = server->responses.len;
+}
+
+// a frame sent together with the last response, as if the server pushed it right after
+static void addPush(fake_server* server, const char* message) {
+    char prefix[32];
+    byte_buffer_append(&server->responses, prefix, snprintf(prefix, sizeof(prefix), "%zu:", strlen(message)));
+    byte_buffer_append(&server->responses, message, strlen(message));
+    server->responseEnd[server->responseCount - 1] = server->responses.len;
+}
+
+static int startFakeServer(fake_server* server) {
+    struct sockaddr_in addr = {0};
+    int addrLen = sizeof(addr);
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    server->listener = socket(AF_INET, SOCK_STREAM, 0);
+    if (server->listener == INVALID_SOCKET || bind(server->listener, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+        listen(server->listener, 1) != 0 || getsockname(server->listener, (struct sockaddr*)&addr, &addrLen) != 0) {
+        return -1;
+    }
+    snprintf(server->address, sizeof(server->address), "127.0.0.1:%d", ntohs(addr.sin_port));
+    server->thread = CreateThread(NULL, 0, fakeServerMain, server, 0, NULL);
+    return server->thread != NULL ? 0 : -1;
+}
+
+static void stopFakeServer(fake_server* server) {
+    WaitForSingleObject(server->thread, INFINITE);
+    CloseHandle(server->thread);
+    closesocket(server->listener);
+    byte_buffer_free(&server->responses);
+}
+
+char* test_pool_reuses_sessions() {
+    fake_server server = {.answerEachRead = true};
+    addResponse(&server, "200 OK", 6);
+    addResponse(&server, "200 value", 9);
+    cmunit_assert("fake server not started", startFakeServer(&server) == 0);
+
+    kvpool* pool = kvpool_create(server.address, 2);
+    size_t len = 0;
+    char* first = kvpool_request(pool, "PUT 1:a 1:b", 11, &len);
+    char* second = kvpool_request(pool, "GET 1:a", 7, &len);
+    kvpool_destroy(pool);
+    stopFakeServer(&server);
+
+    cmunit_assert("wrong first response", first != NULL && strcmp(first, "200 OK") == 0);
+    cmunit_assert("wrong second response", second != NULL && strcmp(second, "200 value") == 0 && len == 9);
+    cmunit_assert("session not reused", server.connections == 1);
+    free(first);
+    free(second);
+    return NULL;
+}
+
+typedef struct callback_result {
+    int calls;
+    size_t length;
+} callback_result;
+
+static void countResponse(void* ctx, const char* response, size_t length) {
+    callback_result* result = ctx;
+    result->calls++;
+    result->length = response != NULL ? length : 0;
+}
+
+char* test_pipeline_collects_responses_in_order() {
+    fake_server server = {0};
+    size_t largeLen = 100000;
+    char* large = malloc(largeLen);
+    memset(large, 'x', largeLen);
+    memcpy(large, "200 ", 4);
+    addResponse(&server, "200 OK", 6);
+    addResponse(&server, large, largeLen);
+    addResponse(&server, "404 Not Found", 13);
+    addResponse(&server, "200 OK", 6);
+    cmunit_assert("fake server not started", startFakeServer(&server) == 0);
+
+    kvpool* pool = kvpool_create(server.address, 0);
+    kvpipeline* p = kvpipeline_begin(pool);
+    cmunit_assert("pipeline not started", p != NULL);
+    // the fake server only reads once its responses are sent, a small value keeps both sides from blocking
+    kvfuture* put = kvpipeline_put(p, "big", large, 1000);
+    kvfuture* get = kvpipeline_get(p, "big");
+    kvfuture* missing = kvpipeline_get(p, "other");
+    callback_result result = {0};
+    kvpipeline_send_cb(p, "DEL 3:big", 9, countResponse, &result);
+
+    // waiting for a later response reads the earlier ones as well
+    size_t len = 0;
+    const char* missingResponse = kvfuture_wait(missing, &len);
+    cmunit_assert("wrong third response", missingResponse != NULL && strcmp(missingResponse, "404 Not Found") == 0);
+    cmunit_assert("callback ran too early", result.calls == 0);
+    const char* getResponse = kvfuture_wait(get, &len);
+    cmunit_assert("large response cut", getResponse != NULL && len == largeLen && memcmp(getResponse, large, len) == 0);
+    cmunit_assert("wrong first response", strcmp(kvfuture_wait(put, NULL), "200 OK") == 0);
+    cmunit_assert("requests failed", kvpipeline_flush(p) == 0);
+    cmunit_assert("callback not run once", result.calls == 1 && result.length == 6);
+
+    kvpipeline_end(p);
+    kvpool_destroy(pool);
+    stopFakeServer(&server);
+    free(large);
+    return NULL;
+}
+
+char* test_pipeline_reads_responses_while_sending() {
+    // both sides send more than the sockets hold, the fake server only reads again once its response is read
+    fake_server server = {0};
+    size_t largeLen = 16 * 1024 * 1024;
+    char* large = malloc(largeLen);
+    memset(large, 'x', largeLen);
+    memcpy(large, "200 ", 4);
+    addResponse(&server, large, largeLen);
+    addResponse(&server, "200 OK", 6);
+    cmunit_assert("fake server not started", startFakeServer(&server) == 0);
+
+    kvpool* pool = kvpool_create(server.address, 0);
+    kvpipeline* p = kvpipeline_begin(pool);
+    cmunit_assert("pipeline not started", p != NULL);
+    kvfuture* get = kvpipeline_get(p, "big");
+    kvfuture* put = kvpipeline_put(p, "big", large, largeLen);
+
+    size_t len = 0;
+    const char* getResponse = kvfuture_wait(get, &len);
+    cmunit_assert("large response not read", getResponse != NULL && len == largeLen);
+    cmunit_assert("large request not sent", put != NULL && strcmp(kvfuture_wait(put, NULL), "200 OK") == 0);
+
+    kvpipeline_end(p);
+    kvpool_destroy(pool);
+    stopFakeServer(&server);
+    free(large);
+    return NULL;
+}
+
+char* test_pipeline_fails_requests_of_broken_session() {
+    fake_server server = {.closeAfterResponses = true};
+    addResponse(&server, "200 OK", 6);
+    cmunit_assert("fake server not started", startFakeServer(&server) == 0);
+
+    kvpool* pool = kvpool_create(server.address, 0);
+    kvpipeline* p = kvpipeline_begin(pool);
+    cmunit_assert("pipeline not started", p != NULL);
+    kvfuture* first = kvpipeline_get(p, "a");
+    kvpipeline_get(p, "b");
+    kvpipeline_get(p, "c");
+    cmunit_assert("first response lost", kvfuture_wait(first, NULL) != NULL);
+    cmunit_assert("unanswered requests not failed", kvpipeline_flush(p) == 2);
+    kvpipeline_end(p);
+    kvpool_destroy(pool);
+    stopFakeServer(&server);
+    return NULL;
+}
+
+char* test_cache_serves_reads_until_invalidated() {
+    fake_server server = {.answerEachRead = true};
+    addResponse(&server, "200 OK", 6);      // TRACKING ON
+    addResponse(&server, "200 v1", 6);
+    addResponse(&server, "201 Created", 11);
+    addPush(&server, "INVALIDATE 4:akey");  // written by another client meanwhile
+    addResponse(&server, "200 v2", 6);
+    addResponse(&server, "200 b", 5);
+    cmunit_assert("fake server not started", startFakeServer(&server) == 0);
+
+    kvcache* cache = kvcache_create(server.address, 1);
+    char* first = kvcache_get(cache, "akey", NULL);
+    char* cached = kvcache_get(cache, "akey", NULL);
+    free(kvcache_put(cache, "ckey", "c", 1));
+    // the invalidation is read before the next GET may be answered from the cache
+    char* changed = kvcache_get(cache, "akey", NULL);
+    char* other = kvcache_get(cache, "bkey", NULL);
+    kvcache_stats stats;
+    kvcache_get_stats(cache, &stats);
+    kvcache_destroy(cache);
+    stopFakeServer(&server);
+
+    cmunit_assert("wrong first value", first != NULL && strcmp(first, "200 v1") == 0);
+    cmunit_assert("value not cached", cached != NULL && strcmp(cached, "200 v1") == 0);
+    cmunit_assert("stale value served", changed != NULL && strcmp(changed, "200 v2") == 0);
+    cmunit_assert("wrong other value", other != NULL && strcmp(other, "200 b") == 0);
+    cmunit_assert("wrong statistics", stats.hits == 1 && stats.misses == 3 && stats.invalidations == 1);
+    cmunit_assert("oldest value not evicted", stats.evictions == 1 && stats.entries == 1);
+    free(first);
+    free(cached);
+    free(changed);
+    free(other);
+    return NULL;
+}
+
+static void collectPush(void* ctx, const char* message, size_t length) {
+    byte_buffer* pushes = ctx;
+    byte_buffer_append(pushes, message, length);
+    byte_buffer_append(pushes, "|", 1);
+}
+
+char* test_wait_pushes_hands_notifications_to_callback() {
+    fake_server server = {.answerEachRead = true};
+    addResponse(&server, "200 OK", 6);      // WATCH
+    addPush(&server, "NOTIFY PUT 4:akey");
+    addPush(&server, "NOTIFY DEL 4:akey");
+    cmunit_assert("fake server not started", startFakeServer(&server) == 0);
+
+    byte_buffer pushes = {0};
+    kvclient_conn* conn = kvclient_connect_address(server.address);
+    cmunit_assert("no session", conn != NULL && kvclient_hello(conn) == 0);
+    conn->on_push = collectPush;
+    conn->push_ctx = &pushes;
+    char* response = kvclient_request(conn, "WATCH 4:akey", NULL);
+    int waited = kvclient_wait_pushes(conn, 1000);
+    kvclient_close(&conn);
+    stopFakeServer(&server);
+
+    cmunit_assert("wrong response", response != NULL && strcmp(response, "200 OK") == 0);
+    cmunit_assert("pushes not handed out", waited == 0 && pushes.len == 36 &&
+                  memcmp(pushes.data, "NOTIFY PUT 4:akey|NOTIFY DEL 4:akey|", 36) == 0);
+    free(response);
+    byte_buffer_free(&pushes);
+    return NULL;
+}
+
+char* test_session_rejects_oversized_frames() {
+    // SIZE_MAX, its allocation of len + 1 bytes would wrap around to 0
+    const char* lengths[] = {"18446744073709551615:x", "1073741825:x", "99999999999999999999999:x"};
+    for (size_t i = 0; i < sizeof(lengths) / sizeof(lengths[0]); i++) {
+        fake_server server = {.answerEachRead = true, .closeAfterResponses = true};
+        byte_buffer_append(&server.responses, lengths[i], strlen(lengths[i]));
+        server.responseEnd[server.responseCount++] = server.responses.len;
+        cmunit_assert("fake server not started", startFakeServer(&server) == 0);
+
+        kvclient_conn* conn = kvclient_connect_address(server.address);
+        cmunit_assert("no session", conn != NULL && kvclient_hello(conn) == 0);
+        char* response = kvclient_request(conn, "GET 1:a", NULL);
+        kvclient_close(&conn);
+        stopFakeServer(&server);
+
+        cmunit_assert("oversized frame accepted", response == NULL);
+    }
+    return NULL;
+}
+
+char* test_getz_value_decompresses_response() {
+    char text[1000];
+    for (size_t i = 0; i < sizeof(text); i++) {
+        text[i] = "compressed "[i % 11];
+    }
+    char response[1100];
+    int headerLen = snprintf(response, sizeof(response), "200 lz %zu ", sizeof(text));
+    size_t blockLen = kvcompress_encode(text, sizeof(text), response + headerLen, sizeof(response) - headerLen);
+    cmunit_assert("not compressed", blockLen > 0);
+
+    size_t valueLen = 0;
+    char* value = kvclient_getz_value(response, headerLen + blockLen, &valueLen);
+    cmunit_assert("wrong value", value != NULL && valueLen == sizeof(text) && memcmp(value, text, sizeof(text)) == 0);
+    free(value);
+    value = kvclient_getz_value(response, headerLen + blockLen - 1, &valueLen);
+    cmunit_assert("truncated block accepted", value == NULL);
+
+    value = kvclient_getz_value("200 raw plain", 13, &valueLen);
+    cmunit_assert("wrong raw value", value != NULL && valueLen == 5 && strcmp(value, "plain") == 0);
+    free(value);
+    cmunit_assert("error taken for value", kvclient_getz_value("404 Not Found", 13, &valueLen) == NULL);
+    return NULL;
+}
+
+char* test_getz_value_rejects_oversized_length() {
+    // SIZE_MAX, its allocation of len + 1 bytes would wrap around to 0 and the block would be decoded past it
+    const char* lengths[] = {"18446744073709551615", "1073741825", "99999999999999999999999"};
+    for (size_t i = 0; i < sizeof(lengths) / sizeof(lengths[0]); i++) {
+        char body[64];
+        int bodyLen = snprintf(body, sizeof(body), "200 lz %s \x10" "abc", lengths[i]);
+        char frame[96];
+        int frameLen = snprintf(frame, sizeof(frame), "%d:%s", bodyLen, body);
+        fake_server server = {.answerEachRead = true, .closeAfterResponses = true};
+        byte_buffer_append(&server.responses, frame, frameLen);
+        server.responseEnd[server.responseCount++] = server.responses.len;
+        cmunit_assert("fake server not started", startFakeServer(&server) == 0);
+
+        kvclient_conn* conn = kvclient_connect_address(server.address);
+        cmunit_assert("no session", conn != NULL && kvclient_hello(conn) == 0);
+        size_t length = 0;
+        char* response = kvclient_request(conn, "GETZ 1:a", &length);
+        kvclient_close(&conn);
+        stopFakeServer(&server);
+
+        cmunit_assert("response not received", response != NULL && length == (size_t)bodyLen);
+        size_t valueLen = 0;
+        char* value = kvclient_getz_value(response, length, &valueLen);
+        free(response);
+        cmunit_assert("oversized length accepted", value == NULL);
+    }
+    return NULL;
+}
+
+int main(void) {
+    cmunit_init();
+    kvclient_init();
+
+    cmunit_run_test(test_build_request_with_arguments);
+    cmunit_run_test(test_encode_request_into_caller_buffer);
+    cmunit_run_test(test_getz_value_decompresses_response);
+    cmunit_run_test(test_getz_value_rejects_oversized_length);
+
+    // client side sharding
+    cmunit_run_test(test_shard_ring_without_servers);
+    cmunit_run_test(test_shard_keys_spread_evenly);
+    cmunit_run_test(test_shard_membership_change_moves_few_keys);
+    cmunit_run_test(test_shard_execute_without_reachable_servers);
+
+    // connection pool and pipelining
+    cmunit_run_test(test_pool_reuses_sessions);
+    cmunit_run_test(test_pipeline_collects_responses_in_order);
+    cmunit_run_test(test_pipeline_reads_responses_while_sending);
+    cmunit_run_test(test_pipeline_fails_requests_of_broken_session);
+
+    // near cache
+    cmunit_run_test(test_cache_serves_reads_until_invalidated);
+
+    // key change notifications
+    cmunit_run_test(test_wait_pushes_hands_notifications_to_callback);
+    cmunit_run_test(test_session_rejects_oversized_frames);
+
+    cmunit_summary();
+    kvclient_cleanup();
+
+    return _cmunit_test_errors;
+}
@@ -0,0 +1,237 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cluster.h"
+#include "logger.h"
+
+#ifdef _WIN64
+#include <windows.h>
+#endif
+
+/*
+ * The keyspace is split into CLUSTER_SLOTS hash slots, every slot is owned by one node. Nodes do
+ * not talk to each other about the slot map, it is set on every node with SETSLOT (see
+ * PROTOCOL.md). Moving a slot to another node:
+ *
+ *   target: SETSLOT <slot> IMPORTING <source>
+ *   source: SETSLOT <slot> MIGRATING <target>
+ *   source: MIGRATE <slot> <count> until no keys remain
+ *   all:    SETSLOT <slot> NODE <target>
+ *
+ * While the slot migrates the source serves the keys it still has and sends clients asking for
+ * other keys to the target (ASK), which accepts them if the client sent ASKING first.
+ */
+
+static SRWLOCK gl_clusterLock = SRWLOCK_INIT;
+static bool gl_clusterEnabled = false;
+static char gl_nodes[CLUSTER_MAX_NODES][CLUSTER_ADDRESS_SIZE];
+static int gl_nodeCount = 0;
+static int gl_myself = CLUSTER_NO_NODE;
+static short gl_slotOwner[CLUSTER_SLOTS];
+static short gl_slotMigrating[CLUSTER_SLOTS];   // target of a slot leaving this node
+static short gl_slotImporting[CLUSTER_SLOTS];   // source of a slot coming to this node
+static char *gl_migratingKey = NULL;            // key currently copied to the target
+
+// CRC16-CCITT (XMODEM)
+static unsigned short crc16(const char *data, size_t len) {
+  unsigned short crc = 0;
+  for (size_t i = 0; i < len; i++) {
+    crc ^= (unsigned short)((unsigned char)data[i] << 8);
+    for (int bit = 0; bit < 8; bit++) {
+      crc = (crc & 0x8000) ? (unsigned short)((crc << 1) ^ 0x1021) : (unsigned short)(crc << 1);
+    }
+  }
+  return crc;
+}
+
+// index of the node with that address, added if unknown, call with the lock held exclusively
+static int findNode(const char *node) {
+  for (int i = 0; i < gl_nodeCount; i++) {
+    if (strcmp(gl_nodes[i], node) == 0) {
+      return i;
+    }
+  }
+  if (gl_nodeCount == CLUSTER_MAX_NODES || strlen(node) >= CLUSTER_ADDRESS_SIZE) {
+    return CLUSTER_NO_NODE;
+  }
+  strcpy_s(gl_nodes[gl_nodeCount], CLUSTER_ADDRESS_SIZE, node);
+  return gl_nodeCount++;
+}
+
+static void setRedirect(cluster_redirect *redirect, int slot, int node) {
+  redirect->slot = slot;
+  strcpy_s(redirect->address, sizeof(redirect->address), gl_nodes[node]);
+}
+
+int cluster_enable(const char *myself) {
+  AcquireSRWLockExclusive(&gl_clusterLock);
+  for (int i = 0; i < CLUSTER_SLOTS; i++) {
+    gl_slotOwner[i] = gl_slotMigrating[i] = gl_slotImporting[i] = CLUSTER_NO_NODE;
+  }
+  gl_nodeCount = 0;
+  gl_myself = myself != NULL ? findNode(myself) : CLUSTER_NO_NODE;
+  gl_clusterEnabled = gl_myself != CLUSTER_NO_NODE;
+  ReleaseSRWLockExclusive(&gl_clusterLock);
+  return gl_clusterEnabled ? 0 : -1;
+}
+
+bool cluster_enabled() {
+  return gl_clusterEnabled;
+}
+
+int cluster_key_slot(const char *key) {
+  size_t len = strlen(key);
+
+  // only the part between the first { and the next } is hashed, so related keys can be kept together
+  const char *open = memchr(key, '{', len);
+  if (open != NULL) {
+    const char *close = memchr(open + 1, '}', len - (size_t)(open + 1 - key));
+    if (close != NULL && close > open + 1) {
+      return crc16(open + 1, (size_t)(close - open - 1)) % CLUSTER_SLOTS;
+    }
+  }
+  return crc16(key, len) % CLUSTER_SLOTS;
+}
+
+int cluster_parse_slots(const char *text, int *first, int *last) {
+  char *end;
+  long from = strtol(text, &end, 10);
+  long to = from;
+  if (end == text) {
+    return -1;
+  }
+  if (*end == '-') {
+    const char *rest = end + 1;
+    to = strtol(rest, &end, 10);
+    if (end == rest) {
+      return -1;
+    }
+  }
+  if (*end != '\0' || from < 0 || to < from || to >= CLUSTER_SLOTS) {
+    return -1;
+  }
+  *first = (int)from;
+  *last = (int)to;
+  return 0;
+}
+
+cluster_route cluster_route_key(kv_store *store, const char *key, bool asking, bool write,
+                                cluster_redirect *redirect) {
+  if (!gl_clusterEnabled) {
+    return CLUSTER_ROUTE_LOCAL;
+  }
+
+  int slot = cluster_key_slot(key);
+  cluster_route route = CLUSTER_ROUTE_LOCAL;
+  AcquireSRWLockShared(&gl_clusterLock);
+  int owner = gl_slotOwner[slot];
+  if (owner == gl_myself) {
+    int target = gl_slotMigrating[slot];
+    if (target != CLUSTER_NO_NODE) {
+      if (write && gl_migratingKey != NULL && strcmp(gl_migratingKey, key) == 0) {
+        route = CLUSTER_ROUTE_TRYAGAIN;
+      } else if (kv_store_lookup(store, key) == NULL) {
+        // already migrated or a new key, both belong to the target
+        route = CLUSTER_ROUTE_ASK;
+        setRedirect(redirect, slot, target);
+      }
+    }
+  } else if (asking && gl_slotImporting[slot] != CLUSTER_NO_NODE) {
+    route = CLUSTER_ROUTE_LOCAL;
+  } else if (owner == CLUSTER_NO_NODE) {
+    route = CLUSTER_ROUTE_DOWN;
+    redirect->slot = slot;
+    redirect->address[0] = '\0';
+  } else {
+    route = CLUSTER_ROUTE_MOVED;
+    setRedirect(redirect, slot, owner);
+  }
+  ReleaseSRWLockShared(&gl_clusterLock);
+  return route;
+}
+
+int cluster_assign(int first, int last, const char *node) {
+  AcquireSRWLockExclusive(&gl_clusterLock);
+  int index = findNode(node);
+  if (index != CLUSTER_NO_NODE) {
+    for (int slot = first; slot <= last; slot++) {
+      gl_slotOwner[slot] = (short)index;
+      gl_slotMigrating[slot] = gl_slotImporting[slot] = CLUSTER_NO_NODE;
+    }
+  }
+  ReleaseSRWLockExclusive(&gl_clusterLock);
+  return index != CLUSTER_NO_NODE ? 0 : -1;
+}
+
+int cluster_set_migrating(int slot, const char *node) {
+  AcquireSRWLockExclusive(&gl_clusterLock);
+  int index = findNode(node);
+  int result = -1;
+  if (index != CLUSTER_NO_NODE && index != gl_myself && gl_slotOwner[slot] == gl_myself) {
+    gl_slotMigrating[slot] = (short)index;
+    result = 0;
+  }
+  ReleaseSRWLockExclusive(&gl_clusterLock);
+  return result;
+}
+
+int cluster_set_importing(int slot, const char *node) {
+  AcquireSRWLockExclusive(&gl_clusterLock);
+  int index = findNode(node);
+  int result = -1;
+  if (index != CLUSTER_NO_NODE && index != gl_myself && gl_slotOwner[slot] != gl_myself) {
+    gl_slotImporting[slot] = (short)index;
+    result = 0;
+  }
+  ReleaseSRWLockExclusive(&gl_clusterLock);
+  return result;
+}
+
+int cluster_migration_target(int slot, char *node, size_t size) {
+  AcquireSRWLockShared(&gl_clusterLock);
+  int target = gl_slotOwner[slot] == gl_myself ? gl_slotMigrating[slot] : CLUSTER_NO_NODE;
+  if (target != CLUSTER_NO_NODE) {
+    strcpy_s(node, size, gl_nodes[target]);
+  }
+  ReleaseSRWLockShared(&gl_clusterLock);
+  return target != CLUSTER_NO_NODE ? 0 : -1;
+}
+
+void cluster_set_migrating_key(const char *key) {
+  char *copy = key != NULL ? duplicate_string(key) : NULL;
+  AcquireSRWLockExclusive(&gl_clusterLock);
+  char *old = gl_migratingKey;
+  gl_migratingKey = copy;
+  ReleaseSRWLockExclusive(&gl_clusterLock);
+  free(old);
+}
+
+int cluster_describe(byte_buffer *out) {
+  char line[2 * CLUSTER_ADDRESS_SIZE];
+  int r = 0;
+
+  AcquireSRWLockShared(&gl_clusterLock);
+  for (int slot = 0; slot < CLUSTER_SLOTS;) {
+    int first = slot;
+    int owner = gl_slotOwner[slot];
+    while (slot < CLUSTER_SLOTS && gl_slotOwner[slot] == owner) {
+      slot++;
+    }
+    if (owner != CLUSTER_NO_NODE) {
+      int len = snprintf(line, sizeof(line), "%d-%d %s\r\n", first, slot - 1, gl_nodes[owner]);
+      r |= byte_buffer_append(out, line, len);
+    }
+  }
+  for (int slot = 0; slot < CLUSTER_SLOTS; slot++) {
+    if (gl_slotMigrating[slot] != CLUSTER_NO_NODE) {
+      int len = snprintf(line, sizeof(line), "%d migrating %s\r\n", slot, gl_nodes[gl_slotMigrating[slot]]);
+      r |= byte_buffer_append(out, line, len);
+    }
+    if (gl_slotImporting[slot] != CLUSTER_NO_NODE) {
+      int len = snprintf(line, sizeof(line), "%d importing %s\r\n", slot, gl_nodes[gl_slotImporting[slot]]);
+      r |= byte_buffer_append(out, line, len);
+    }
+  }
+  ReleaseSRWLockShared(&gl_clusterLock);
+  return r != 0 ? -1 : 0;
+}
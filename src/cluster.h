@@ -0,0 +1,42 @@
+#ifndef _KVSTR_CLUSTER_H
+#define _KVSTR_CLUSTER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "kvstore.h"
+#include "utilfuns.h"
+
+#define CLUSTER_SLOTS 16384
+#define CLUSTER_MAX_NODES 64
+#define CLUSTER_ADDRESS_SIZE 128          // "host:port" or "unix:<path>" of a node
+#define CLUSTER_NO_NODE -1
+
+typedef enum cluster_route {
+  CLUSTER_ROUTE_LOCAL,      // served by this node
+  CLUSTER_ROUTE_MOVED,      // the slot belongs to another node
+  CLUSTER_ROUTE_ASK,        // the slot is being migrated and the key is not here (anymore), ask the target
+  CLUSTER_ROUTE_TRYAGAIN,   // the key is being migrated right now
+  CLUSTER_ROUTE_DOWN,       // no node serves the slot
+} cluster_route;
+
+typedef struct cluster_redirect {
+  int slot;
+  char address[CLUSTER_ADDRESS_SIZE]; // node to send the request to
+} cluster_redirect;
+
+/* Prototypes */
+int cluster_enable(const char *myself); // cluster mode with the address other nodes and clients reach this node at (NULL turns it off)
+bool cluster_enabled();
+int cluster_key_slot(const char *key); // CRC16 of the key (or of its {hash tag}) modulo CLUSTER_SLOTS
+int cluster_parse_slots(const char *text, int *first, int *last); // "<slot>" or "<first>-<last>"
+cluster_route cluster_route_key(kv_store *store, const char *key, bool asking, bool write,
+                                cluster_redirect *redirect); // call with the store locked
+int cluster_assign(int first, int last, const char *node); // owner of the slots, ends their migration
+int cluster_set_migrating(int slot, const char *node); // the slot moves from this node to node
+int cluster_set_importing(int slot, const char *node); // the slot moves from node to this node
+int cluster_migration_target(int slot, char *node, size_t size); // 0 if the slot is migrating from this node
+void cluster_set_migrating_key(const char *key); // writes to this key are refused until it is reset with NULL
+int cluster_describe(byte_buffer *out); // a line per slot range and open migration for SLOTS
+
+#endif
@@ -0,0 +1,204 @@
+#include <stdlib.h>
+#include <string.h>
+#include "executor.h"
+
+#define EXECUTOR_INITIAL_QUEUE_CAPACITY 64
+
+// worker the current thread belongs to (NULL for threads outside of any pool)
+static _Thread_local executor_worker* tl_worker = NULL;
+
+static int deque_init(executor_deque* deque) {
+    InitializeSRWLock(&deque->lock);
+    deque->tasks = calloc(EXECUTOR_INITIAL_QUEUE_CAPACITY, sizeof(executor_task));
+    if (deque->tasks == NULL) {
+        return -1;
+    }
+    deque->capacity = EXECUTOR_INITIAL_QUEUE_CAPACITY;
+    deque->head = 0;
+    deque->count = 0;
+    return 0;
+}
+
+static int deque_push(executor_deque* deque, executor_task task) {
+    AcquireSRWLockExclusive(&deque->lock);
+    if (deque->count == deque->capacity) {
+        // grow and unwrap the ring buffer
+        size_t new_capacity = deque->capacity * 2;
+        executor_task* tasks = malloc(new_capacity * sizeof(executor_task));
+        if (tasks == NULL) {
+            ReleaseSRWLockExclusive(&deque->lock);
+            return -1;
+        }
+        for (size_t i = 0; i < deque->count; i++) {
+            tasks[i] = deque->tasks[(deque->head + i) % deque->capacity];
+        }
+        free(deque->tasks);
+        deque->tasks = tasks;
+        deque->capacity = new_capacity;
+        deque->head = 0;
+    }
+
+    deque->tasks[(deque->head + deque->count) % deque->capacity] = task;
+    deque->count++;
+    ReleaseSRWLockExclusive(&deque->lock);
+    return 0;
+}
+
+// owner and thieves both take the oldest task, serving requests in arrival order keeps the
+// tail latency low
+static bool deque_take(executor_deque* deque, executor_task* task) {
+    AcquireSRWLockExclusive(&deque->lock);
+    if (deque->count == 0) {
+        ReleaseSRWLockExclusive(&deque->lock);
+        return false;
+    }
+
+    *task = deque->tasks[deque->head];
+    deque->head = (deque->head + 1) % deque->capacity;
+    deque->count--;
+    ReleaseSRWLockExclusive(&deque->lock);
+    return true;
+}
+
+static bool find_task(executor_worker* worker, executor_task* task) {
+    executor* pool = worker->pool;
+    if (deque_take(&worker->deque, task)) {
+        return true;
+    }
+
+    // own queue is empty, try to steal from the others starting with the next neighbour
+    for (int i = 1; i < pool->worker_count; i++) {
+        executor_worker* victim = &pool->workers[(worker->index + i) % pool->worker_count];
+        if (deque_take(&victim->deque, task)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static DWORD WINAPI worker_main(LPVOID arg) {
+    executor_worker* worker = (executor_worker*) arg;
+    executor* pool = worker->pool;
+    tl_worker = worker;
+
+    while (true) {
+        executor_task task;
+        if (find_task(worker, &task)) {
+            atomic_fetch_sub(&pool->pending, 1);
+            task.fn(task.arg);
+            continue;
+        }
+
+        AcquireSRWLockExclusive(&pool->idle_lock);
+        atomic_fetch_add(&pool->sleeping, 1);
+        while (atomic_load(&pool->pending) == 0 && atomic_load(&pool->running)) {
+            SleepConditionVariableSRW(&pool->idle_cond, &pool->idle_lock, INFINITE, 0);
+        }
+        atomic_fetch_sub(&pool->sleeping, 1);
+        bool stop = atomic_load(&pool->pending) == 0 && !atomic_load(&pool->running);
+        ReleaseSRWLockExclusive(&pool->idle_lock);
+
+        if (stop) {
+            break;
+        }
+    }
+
+    tl_worker = NULL;
+    return 0;
+}
+
+executor* executor_create(int workers) {
+    if (workers < 1) {
+        return NULL;
+    }
+
+    executor* pool = calloc(1, sizeof(executor));
+    if (pool == NULL) {
+        return NULL;
+    }
+
+    pool->workers = calloc(workers, sizeof(executor_worker));
+    if (pool->workers == NULL) {
+        free(pool);
+        return NULL;
+    }
+
+    atomic_init(&pool->pending, 0);
+    atomic_init(&pool->sleeping, 0);
+    atomic_init(&pool->next_queue, 0);
+    atomic_init(&pool->running, true);
+    InitializeSRWLock(&pool->idle_lock);
+    InitializeConditionVariable(&pool->idle_cond);
+
+    for (int i = 0; i < workers; i++) {
+        pool->workers[i].pool = pool;
+        pool->workers[i].index = i;
+        if (deque_init(&pool->workers[i].deque) != 0) {
+            pool->worker_count = i;
+            executor_destroy(pool);
+            return NULL;
+        }
+    }
+    pool->worker_count = workers;
+
+    for (int i = 0; i < workers; i++) {
+        pool->workers[i].thread = CreateThread(NULL, 0, worker_main, &pool->workers[i], 0, NULL);
+        if (pool->workers[i].thread == NULL) {
+            for (int j = i; j < workers; j++) {
+                free(pool->workers[j].deque.tasks);
+            }
+            pool->worker_count = i;
+            executor_destroy(pool);
+            return NULL;
+        }
+    }
+
+    return pool;
+}
+
+int executor_submit(executor* pool, executor_task_fn fn, void* arg) {
+    executor_task task = { fn, arg };
+
+    // tasks spawned by a worker stay on its own queue, everything else is spread round robin
+    executor_worker* worker = tl_worker;
+    if (worker == NULL || worker->pool != pool) {
+        unsigned int next = atomic_fetch_add(&pool->next_queue, 1);
+        worker = &pool->workers[next % pool->worker_count];
+    }
+
+    if (deque_push(&worker->deque, task) != 0) {
+        return -1;
+    }
+
+    atomic_fetch_add(&pool->pending, 1);
+    if (atomic_load(&pool->sleeping) > 0) {
+        AcquireSRWLockExclusive(&pool->idle_lock);
+        WakeConditionVariable(&pool->idle_cond);
+        ReleaseSRWLockExclusive(&pool->idle_lock);
+    }
+    return 0;
+}
+
+void executor_destroy(executor* pool) {
+    if (pool == NULL) {
+        return;
+    }
+
+    AcquireSRWLockExclusive(&pool->idle_lock);
+    atomic_store(&pool->running, false);
+    WakeAllConditionVariable(&pool->idle_cond);
+    ReleaseSRWLockExclusive(&pool->idle_lock);
+
+    for (int i = 0; i < pool->worker_count; i++) {
+        if (pool->workers[i].thread != NULL) {
+            WaitForSingleObject(pool->workers[i].thread, INFINITE);
+            CloseHandle(pool->workers[i].thread);
+        }
+    }
+
+    for (int i = 0; i < pool->worker_count; i++) {
+        free(pool->workers[i].deque.tasks);
+    }
+    free(pool->workers);
+    free(pool);
+}
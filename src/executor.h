@@ -0,0 +1,54 @@
+#ifndef _KVSTR_EXECUTOR_H
+#define _KVSTR_EXECUTOR_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef _WIN64
+#include <windows.h>
+#endif
+
+typedef void (*executor_task_fn)(void* arg);
+
+typedef struct executor_task {
+    executor_task_fn fn;
+    void* arg;
+} executor_task;
+
+// task queue of a single worker, other workers steal from it when they run dry
+typedef struct executor_deque {
+    SRWLOCK lock;
+    executor_task* tasks;   // ring buffer
+    size_t capacity;
+    size_t head;
+    size_t count;
+} executor_deque;
+
+struct executor;
+
+typedef struct executor_worker {
+    struct executor* pool;
+    int index;
+    HANDLE thread;
+    executor_deque deque;
+} executor_worker;
+
+// pool of worker threads with one task queue per worker (work-stealing)
+typedef struct executor {
+    executor_worker* workers;
+    int worker_count;
+    atomic_long pending;        // tasks queued but not yet taken by a worker
+    atomic_int sleeping;        // workers waiting for new tasks
+    atomic_uint next_queue;     // round robin target for tasks submitted from outside the pool
+    atomic_bool running;
+    SRWLOCK idle_lock;
+    CONDITION_VARIABLE idle_cond;
+} executor;
+
+// prototypes
+executor* executor_create(int workers); // start a pool with the given number of worker threads
+int executor_submit(executor* pool, executor_task_fn fn, void* arg); // queue a task, returns 0 on success
+void executor_destroy(executor* pool); // run all queued tasks, stop the workers and free the pool
+
+#endif
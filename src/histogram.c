@@ -0,0 +1,76 @@
+#include "histogram.h"
+
+// values below 2 * HISTOGRAM_SUB_BUCKETS get a bucket each, above that the top
+// HISTOGRAM_SUB_BUCKET_BITS + 1 bits of the value select the bucket
+static int bucketIndex(unsigned long long value) {
+    if (value < 2 * HISTOGRAM_SUB_BUCKETS) {
+        return (int) value;
+    }
+
+    int magnitude = 63 - __builtin_clzll(value);
+    int shift = magnitude - HISTOGRAM_SUB_BUCKET_BITS;
+    return shift * HISTOGRAM_SUB_BUCKETS + (int) (value >> shift);
+}
+
+// highest value that falls into the bucket
+static unsigned long long bucketValue(int index) {
+    if (index < 2 * HISTOGRAM_SUB_BUCKETS) {
+        return (unsigned long long) index;
+    }
+
+    int shift = index / HISTOGRAM_SUB_BUCKETS - 1;
+    unsigned long long sub = (unsigned long long) (index % HISTOGRAM_SUB_BUCKETS + HISTOGRAM_SUB_BUCKETS);
+    return ((sub + 1) << shift) - 1;
+}
+
+// the owning thread is the only writer, so a relaxed load and store is enough (no locked add)
+static void increment(atomic_ullong* counter, unsigned long long n) {
+    atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + n, memory_order_relaxed);
+}
+
+void histogram_record(histogram* h, unsigned long long value) {
+    increment(&h->counts[bucketIndex(value)], 1);
+    increment(&h->total, 1);
+}
+
+void histogram_merge(histogram* into, const histogram* from) {
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        unsigned long long n = atomic_load_explicit(&from->counts[i], memory_order_relaxed);
+        if (n > 0) {
+            increment(&into->counts[i], n);
+        }
+    }
+    increment(&into->total, atomic_load_explicit(&from->total, memory_order_relaxed));
+}
+
+unsigned long long histogram_count(const histogram* h) {
+    return atomic_load_explicit(&h->total, memory_order_relaxed);
+}
+
+unsigned long long histogram_percentile(const histogram* h, double percentile) {
+    unsigned long long total = histogram_count(h);
+    if (total == 0) {
+        return 0;
+    }
+
+    // rank of the value we are looking for, at least the first one
+    unsigned long long rank = (unsigned long long) (percentile / 100.0 * (double) total + 0.5);
+    if (rank < 1) {
+        rank = 1;
+    }
+
+    unsigned long long seen = 0;
+    int last = 0;
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        unsigned long long n = atomic_load_explicit(&h->counts[i], memory_order_relaxed);
+        if (n == 0) {
+            continue;
+        }
+        seen += n;
+        last = i;
+        if (seen >= rank) {
+            return bucketValue(i);
+        }
+    }
+    return bucketValue(last); // counts were recorded while we were reading
+}
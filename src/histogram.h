@@ -0,0 +1,23 @@
+#ifndef _KVSTR_HISTOGRAM_H
+#define _KVSTR_HISTOGRAM_H
+
+#include <stdatomic.h>
+
+// HDR style histogram: values are grouped into powers of two, each of them split into
+// HISTOGRAM_SUB_BUCKETS linear buckets. Every recorded value is accurate to 1/16 (~6%).
+#define HISTOGRAM_SUB_BUCKET_BITS 4
+#define HISTOGRAM_SUB_BUCKETS (1 << HISTOGRAM_SUB_BUCKET_BITS)
+#define HISTOGRAM_BUCKETS ((64 - HISTOGRAM_SUB_BUCKET_BITS + 1) * HISTOGRAM_SUB_BUCKETS)
+
+// Counts may only be recorded by a single thread, any thread may read them at the same time.
+typedef struct histogram {
+    atomic_ullong counts[HISTOGRAM_BUCKETS];
+    atomic_ullong total;
+} histogram;
+
+void histogram_record(histogram* h, unsigned long long value); // add a value (single writer)
+void histogram_merge(histogram* into, const histogram* from); // add all counts of from
+unsigned long long histogram_count(const histogram* h); // number of recorded values
+unsigned long long histogram_percentile(const histogram* h, double percentile); // highest value equivalent to the given percentile (0-100), 0 if empty
+
+#endif
@@ -0,0 +1,328 @@
+#include <limits.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "hotkeys.h"
+#include "stats.h"
+
+#ifdef _WIN64
+#include <windows.h>
+#endif
+
+/*
+ * Every thread counts the keys it accesses in its own count-min sketch, so recording an access
+ * is a hash and a few plain adds without any locked instruction or shared cache line. Next to
+ * the sketch every thread keeps the keys with the highest estimates it has seen as candidates.
+ * HOTKEYS sums up the estimates of all candidates over the sketches of all threads.
+ *
+ * Each thread has a sketch for the current and one for the previous window. The sliding window
+ * is approximated by adding the part of the previous window that is still inside of it,
+ * assuming its accesses were spread evenly.
+ */
+
+#define HOTKEYS_CHECK_INTERVAL 256  // accesses between two looks at the clock
+
+typedef struct hotkeys_block {
+  atomic_uint sketch[2][HOTKEYS_KIND_COUNT][HOTKEYS_DEPTH][HOTKEYS_WIDTH]; // current and previous window
+  atomic_uint current;                  // index of the sketch of the current window
+  atomic_ullong window;                 // number of the current window
+  atomic_uint generation;               // the block is outdated if it differs from gl_generation
+  unsigned int untilCheck;
+  SRWLOCK lock;                         // candidates only change with it held, other threads read them with it
+  hotkeys_entry candidates[HOTKEYS_KIND_COUNT][HOTKEYS_TOP];
+  size_t candidateCount[HOTKEYS_KIND_COUNT];
+  unsigned long long estimates[HOTKEYS_KIND_COUNT][HOTKEYS_TOP]; // of the candidates, only used by the owner
+  unsigned long long previous[HOTKEYS_KIND_COUNT][HOTKEYS_TOP];  // their part of it from the previous window
+  unsigned long long minEstimate[HOTKEYS_KIND_COUNT];            // at most the smallest of them
+  struct hotkeys_block *next;
+} hotkeys_block;
+
+static _Thread_local hotkeys_block *tl_block = NULL;
+
+static _Atomic(hotkeys_block *) gl_blocks = NULL;  // blocks live as long as the process
+static atomic_ullong gl_windowNs = HOTKEYS_DEFAULT_WINDOW * 1000000ULL;
+static atomic_uint gl_generation;
+
+static unsigned long long hashKey(const char *key, size_t len) {
+  unsigned long long h = 0x9E3779B97F4A7C15ULL ^ len;
+  size_t i = 0;
+  for (; i + 8 <= len; i += 8) {
+    unsigned long long word;
+    memcpy(&word, key + i, 8);
+    h = (h ^ word) * 0xff51afd7ed558ccdULL;
+    h ^= h >> 32;
+  }
+  unsigned long long rest = 0;
+  for (size_t j = 0; i + j < len; j++) {
+    rest |= (unsigned long long)(unsigned char)key[i + j] << (8 * j); // cheaper than a memcpy of variable length
+  }
+  // every bit of the input has to reach the low bits the rows are indexed with
+  h ^= rest;
+  h = (h ^ (h >> 33)) * 0xff51afd7ed558ccdULL;
+  h = (h ^ (h >> 33)) * 0xc4ceb9fe1a85ec53ULL;
+  return h ^ (h >> 33);
+}
+
+// counter of the key in a row, rows use independent positions derived from one hash
+static size_t slotOf(unsigned long long hash, int row) {
+  unsigned int h1 = (unsigned int)hash;
+  unsigned int h2 = (unsigned int)(hash >> 32) | 1;
+  return (h1 + (unsigned int)row * h2) & (HOTKEYS_WIDTH - 1);
+}
+
+static unsigned long long estimateOf(hotkeys_block *b, unsigned int sketch, enum hotkeys_kind kind,
+                                     unsigned long long hash) {
+  unsigned int estimate = UINT_MAX;
+  for (int row = 0; row < HOTKEYS_DEPTH; row++) {
+    unsigned int count = atomic_load_explicit(&b->sketch[sketch][kind][row][slotOf(hash, row)], memory_order_relaxed);
+    estimate = count < estimate ? count : estimate;
+  }
+  return estimate;
+}
+
+static void clearSketch(hotkeys_block *b, unsigned int sketch) {
+  for (int kind = 0; kind < HOTKEYS_KIND_COUNT; kind++) {
+    for (int row = 0; row < HOTKEYS_DEPTH; row++) {
+      for (int i = 0; i < HOTKEYS_WIDTH; i++) {
+        atomic_store_explicit(&b->sketch[sketch][kind][row][i], 0, memory_order_relaxed);
+      }
+    }
+  }
+}
+
+static void updateMinEstimate(hotkeys_block *b, enum hotkeys_kind kind) {
+  unsigned long long min = ULLONG_MAX;
+  for (size_t i = 0; i < b->candidateCount[kind]; i++) {
+    min = b->estimates[kind][i] < min ? b->estimates[kind][i] : min;
+  }
+  b->minEstimate[kind] = b->candidateCount[kind] < HOTKEYS_TOP ? 0 : min;
+}
+
+// starts a new window if the current one is over, only called by the owner
+static void rotate(hotkeys_block *b, unsigned long long now) {
+  unsigned long long window = now / atomic_load_explicit(&gl_windowNs, memory_order_relaxed);
+  unsigned long long last = atomic_load_explicit(&b->window, memory_order_relaxed);
+  if (window == last) {
+    return;
+  }
+
+  unsigned int current = atomic_load_explicit(&b->current, memory_order_relaxed);
+  clearSketch(b, current ^ 1);
+  if (window != last + 1) {
+    clearSketch(b, current); // not even the previous window
+  }
+  atomic_store_explicit(&b->current, current ^ 1, memory_order_relaxed);
+  atomic_store_explicit(&b->window, window, memory_order_relaxed);
+
+  // the accesses of the candidates now all belong to the previous window
+  for (int kind = 0; kind < HOTKEYS_KIND_COUNT; kind++) {
+    for (size_t i = 0; i < b->candidateCount[kind]; i++) {
+      b->previous[kind][i] = estimateOf(b, current, kind, b->candidates[kind][i].hash);
+      b->estimates[kind][i] = b->previous[kind][i];
+    }
+    updateMinEstimate(b, kind);
+  }
+}
+
+// forgets everything counted before a reset, only called by the owner
+static void clearBlock(hotkeys_block *b, unsigned int generation) {
+  clearSketch(b, 0);
+  clearSketch(b, 1);
+  AcquireSRWLockExclusive(&b->lock);
+  memset(b->candidateCount, 0, sizeof(b->candidateCount));
+  ReleaseSRWLockExclusive(&b->lock);
+  memset(b->minEstimate, 0, sizeof(b->minEstimate));
+  atomic_store_explicit(&b->window, stats_now() / atomic_load(&gl_windowNs), memory_order_relaxed);
+  atomic_store_explicit(&b->generation, generation, memory_order_relaxed);
+}
+
+static hotkeys_block *threadBlock() {
+  if (tl_block != NULL) {
+    return tl_block;
+  }
+
+  hotkeys_block *b = calloc(1, sizeof(hotkeys_block));
+  if (b == NULL) {
+    return NULL; // accesses of this thread are not counted
+  }
+  InitializeSRWLock(&b->lock);
+  b->untilCheck = HOTKEYS_CHECK_INTERVAL;
+  clearBlock(b, atomic_load(&gl_generation));
+
+  hotkeys_block *first = atomic_load(&gl_blocks);
+  do {
+    b->next = first;
+  } while (!atomic_compare_exchange_weak(&gl_blocks, &first, b));
+
+  tl_block = b;
+  return b;
+}
+
+static void setCandidate(hotkeys_entry *e, unsigned long long hash, const char *key, size_t len) {
+  e->hash = hash;
+  e->key_len = len;
+  size_t shown = len < HOTKEYS_MAX_KEY_LEN ? len : HOTKEYS_MAX_KEY_LEN;
+  for (size_t i = 0; i < shown; i++) {
+    // keep the key on one line and separated by spaces
+    e->key[i] = key[i] > ' ' && key[i] < 127 ? key[i] : '.';
+  }
+  e->key[shown] = '\0';
+}
+
+// current is the estimate of the key in the current window, the previous one is only looked up
+// when the key becomes a candidate
+static void updateCandidates(hotkeys_block *b, enum hotkeys_kind kind, unsigned long long hash, const char *key,
+                             size_t len, unsigned long long current) {
+  size_t count = b->candidateCount[kind];
+  unsigned long long *estimates = b->estimates[kind];
+  for (size_t i = 0; i < count; i++) {
+    if (b->candidates[kind][i].hash == hash) {
+      estimates[i] = current + b->previous[kind][i];
+      return;
+    }
+  }
+  if (count == HOTKEYS_TOP && current <= b->minEstimate[kind]) {
+    return; // the previous window is ignored here, the candidates of it were already carried over
+  }
+  unsigned long long previous = estimateOf(b, atomic_load_explicit(&b->current, memory_order_relaxed) ^ 1, kind, hash);
+  unsigned long long estimate = current + previous;
+
+  // a new candidate takes the place of the one with the lowest estimate
+  size_t slot = count;
+  if (count == HOTKEYS_TOP) {
+    if (estimate <= b->minEstimate[kind]) {
+      return;
+    }
+    slot = 0;
+    for (size_t i = 1; i < count; i++) {
+      slot = estimates[i] < estimates[slot] ? i : slot;
+    }
+    if (estimate <= estimates[slot]) {
+      b->minEstimate[kind] = estimates[slot];
+      return;
+    }
+  }
+
+  AcquireSRWLockExclusive(&b->lock);
+  setCandidate(&b->candidates[kind][slot], hash, key, len);
+  if (slot == count) {
+    b->candidateCount[kind]++;
+  }
+  ReleaseSRWLockExclusive(&b->lock);
+  estimates[slot] = estimate;
+  b->previous[kind][slot] = previous;
+  updateMinEstimate(b, kind);
+}
+
+void hotkeys_set_window(unsigned long long windowMs) {
+  if (windowMs > 0) {
+    atomic_store(&gl_windowNs, windowMs * 1000000ULL); // the counts start over with the next access
+  }
+}
+
+unsigned long long hotkeys_window() {
+  return atomic_load(&gl_windowNs) / 1000000ULL;
+}
+
+void hotkeys_record(enum hotkeys_kind kind, const char *key) {
+  hotkeys_block *b = key != NULL ? threadBlock() : NULL;
+  if (b == NULL) {
+    return;
+  }
+  unsigned int generation = atomic_load_explicit(&gl_generation, memory_order_relaxed);
+  if (atomic_load_explicit(&b->generation, memory_order_relaxed) != generation) {
+    clearBlock(b, generation);
+  }
+  if (--b->untilCheck == 0) {
+    b->untilCheck = HOTKEYS_CHECK_INTERVAL;
+    rotate(b, stats_now());
+  }
+
+  size_t len = strlen(key);
+  unsigned long long hash = hashKey(key, len);
+  unsigned int current = atomic_load_explicit(&b->current, memory_order_relaxed);
+  unsigned int estimate = UINT_MAX;
+  for (int row = 0; row < HOTKEYS_DEPTH; row++) {
+    atomic_uint *counter = &b->sketch[current][kind][row][slotOf(hash, row)];
+    unsigned int count = atomic_load_explicit(counter, memory_order_relaxed) + 1;
+    atomic_store_explicit(counter, count, memory_order_relaxed);
+    estimate = count < estimate ? count : estimate;
+  }
+  updateCandidates(b, kind, hash, key, len, estimate);
+}
+
+static int compareCounts(const void *a, const void *b) {
+  unsigned long long x = ((const hotkeys_entry *)a)->count;
+  unsigned long long y = ((const hotkeys_entry *)b)->count;
+  return x > y ? -1 : x < y;
+}
+
+size_t hotkeys_top(enum hotkeys_kind kind, hotkeys_entry *entries, size_t max) {
+  unsigned long long windowNs = atomic_load(&gl_windowNs);
+  unsigned long long now = stats_now();
+  unsigned long long window = now / windowNs;
+  double previousShare = 1.0 - (double)(now % windowNs) / (double)windowNs; // of the previous window still in the sliding one
+  unsigned int generation = atomic_load(&gl_generation);
+
+  size_t blockCount = 0;
+  for (hotkeys_block *b = atomic_load(&gl_blocks); b != NULL; b = b->next) {
+    blockCount++;
+  }
+  hotkeys_entry *candidates = malloc((blockCount > 0 ? blockCount : 1) * HOTKEYS_TOP * sizeof(hotkeys_entry));
+  if (candidates == NULL) {
+    return 0;
+  }
+
+  // the candidates of all threads, every key once
+  size_t count = 0;
+  for (hotkeys_block *b = atomic_load(&gl_blocks); b != NULL; b = b->next) {
+    if (atomic_load(&b->generation) != generation) {
+      continue;
+    }
+    AcquireSRWLockShared(&b->lock);
+    for (size_t i = 0; i < b->candidateCount[kind]; i++) {
+      bool known = false;
+      for (size_t j = 0; j < count && !known; j++) {
+        known = candidates[j].hash == b->candidates[kind][i].hash;
+      }
+      if (!known) {
+        candidates[count++] = b->candidates[kind][i];
+      }
+    }
+    ReleaseSRWLockShared(&b->lock);
+  }
+
+  for (size_t i = 0; i < count; i++) {
+    double total = 0;
+    for (hotkeys_block *b = atomic_load(&gl_blocks); b != NULL; b = b->next) {
+      unsigned long long blockWindow = atomic_load(&b->window);
+      unsigned int current = atomic_load(&b->current);
+      if (atomic_load(&b->generation) != generation) {
+        continue;
+      }
+      if (blockWindow == window) {
+        total += (double)estimateOf(b, current, kind, candidates[i].hash) +
+                 (double)estimateOf(b, current ^ 1, kind, candidates[i].hash) * previousShare;
+      } else if (blockWindow + 1 == window) {
+        // the thread did not access anything since the window changed
+        total += (double)estimateOf(b, current, kind, candidates[i].hash) * previousShare;
+      }
+    }
+    candidates[i].count = (unsigned long long)(total + 0.5);
+  }
+
+  qsort(candidates, count, sizeof(hotkeys_entry), compareCounts);
+  size_t n = 0;
+  for (size_t i = 0; i < count && n < max; i++) {
+    if (candidates[i].count > 0) {
+      entries[n++] = candidates[i];
+    }
+  }
+  free(candidates);
+  return n;
+}
+
+void hotkeys_reset() {
+  atomic_fetch_add(&gl_generation, 1);
+}
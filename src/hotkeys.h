@@ -0,0 +1,32 @@
+#ifndef _KVSTR_HOTKEYS_H
+#define _KVSTR_HOTKEYS_H
+
+#include <stddef.h>
+
+#define HOTKEYS_DEPTH 4                   // rows of the count-min sketch
+#define HOTKEYS_WIDTH 1024                // counters per row, overestimates by ~0.3% of the accesses of a thread in a window
+#define HOTKEYS_TOP 16                    // keys reported, and candidates kept per thread
+#define HOTKEYS_MAX_KEY_LEN 32            // keys are reported truncated to this length
+#define HOTKEYS_DEFAULT_WINDOW 10000      // ms
+
+enum hotkeys_kind {
+  HOTKEYS_READ,
+  HOTKEYS_WRITE,
+  HOTKEYS_KIND_COUNT,
+};
+
+typedef struct hotkeys_entry {
+  unsigned long long hash;
+  char key[HOTKEYS_MAX_KEY_LEN + 1];      // truncated, non-printable characters replaced
+  size_t key_len;                         // length of the complete key
+  unsigned long long count;               // estimated accesses in the last window
+} hotkeys_entry;
+
+/* Prototypes */
+void hotkeys_set_window(unsigned long long windowMs); // length of the sliding window
+unsigned long long hotkeys_window(); // in ms
+void hotkeys_record(enum hotkeys_kind kind, const char *key); // count an access by the calling thread
+size_t hotkeys_top(enum hotkeys_kind kind, hotkeys_entry *entries, size_t max); // most accessed keys first, returns the count
+void hotkeys_reset(); // forget all accesses so far
+
+#endif
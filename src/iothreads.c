@@ -0,0 +1,690 @@
+// the default of 64 sockets per select() is too small for an I/O thread
+#define FD_SETSIZE 1024
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "executor.h"
+#include "iothreads.h"
+#include "kvstrdecoder.h"
+#include "server.h"
+#include "slowlog.h"
+#include "stats.h"
+#include "tracking.h"
+#include "watch.h"
+#include "utilfuns.h"
+
+#define IO_THREAD_MAX_CONNECTIONS 512
+#define IO_RECV_CHUNK_SIZE 16 * 1024
+#define IO_RECV_DIRECT_SIZE 1024 * 1024
+#define IO_SEND_CHUNK_SIZE 1024 * 1024          // bytes written to a connection at once, so a large response cannot starve the others
+#define IO_KEEP_OUTPUT_SIZE 1024 * 1024         // output buffers up to this capacity are kept for the next responses
+#define IO_MAX_PENDING_REQUESTS 128             // stop reading from a connection with that many queued requests
+#define IO_MAX_PENDING_OUTPUT 4 * 1024 * 1024   // ... or with that much unsent output
+#define IO_MAX_PUSH_BACKLOG 16 * 1024 * 1024    // pushed bytes a session may leave unread before it is dropped
+#define IO_REQUESTS_PER_TASK 16                 // requests of one connection handled before yielding the worker
+#define IO_SELECT_TIMEOUT_MS 100
+
+struct pending_request {
+  struct kvstr_request *req;
+  int parseError;   // respond with this parse error instead of executing a request
+  bool framed;      // response belongs to a session and gets a length prefix
+  request_timing timing;
+  unsigned long long outputEnd;   // position behind the response in the output stream
+  unsigned long long readyAt;     // when the response was appended to the output
+  response_value value;           // large value the response ends with, sent from the store
+  size_t valueAt;                 // ... behind this many bytes of the output buffer
+  size_t valueSent;
+  struct pending_request *next;
+};
+
+struct io_thread;
+
+// a client connection, owned by one I/O thread
+struct connection {
+  SOCKET socket;
+  struct io_thread *owner;
+
+  // only touched by the owning I/O thread
+  struct kvstr_decoder decoder;
+  struct kvstr_request *request;  // request currently being decoded
+  request_timing timing;          // ... and its timing
+  bool session;                   // HELLO received, keep the connection open
+  client_state state;             // ... and the state of the session (touched by the worker running it)
+  bool readClosed;                // no further requests are read from this connection
+
+  // shared with the workers
+  SRWLOCK lock;
+  struct pending_request *head;   // requests in arrival order, executed one after another
+  struct pending_request *tail;
+  int pendingCount;
+  bool busy;                      // a task of this connection is queued or running
+  bool failed;                    // the socket is broken, output is discarded
+  bool detached;                  // the socket was taken over by a request handler (SYNC), not closed here
+  bool executing;                 // a worker runs a request, pushes wait for its response
+  byte_buffer pushes;             // framed invalidations and notifications held back until the running request responded
+  size_t pushBacklog;             // bytes pushed since the output was last written completely
+  byte_buffer output;             // responses in request order, waiting to be written
+  size_t outputPos;
+  unsigned long long outputBase;  // position of the output buffer in the output stream
+  size_t valueBytes;              // bytes of the values queued along with the output buffer (see pending_request)
+  size_t valueSent;               // ... and written of them
+  struct pending_request *unsentHead; // executed requests whose responses are not written yet
+  struct pending_request *unsentTail;
+};
+
+struct io_thread {
+  HANDLE thread;
+  SOCKET wakeSocket;              // loopback datagram socket to interrupt select()
+  struct sockaddr_in wakeAddr;
+  atomic_bool wakePending;
+  atomic_int load;
+
+  SRWLOCK lock;                   // guards the accepted connections waiting to be adopted
+  SOCKET incoming[IO_THREAD_MAX_CONNECTIONS];
+  int incomingCount;
+
+  struct connection *connections[IO_THREAD_MAX_CONNECTIONS];
+  int connectionCount;
+};
+
+static executor *gl_executor = NULL;
+static struct io_thread *gl_ioThreadList = NULL;
+static int gl_ioThreadCount = 0;
+static atomic_bool gl_ioRunning;
+static size_t gl_ioMaxValueSize;
+
+static void wakeIoThread(struct io_thread *t) {
+  if (!atomic_exchange(&t->wakePending, true)) {
+    sendto(t->wakeSocket, "w", 1, 0, (struct sockaddr *)&t->wakeAddr, sizeof(t->wakeAddr));
+  }
+}
+
+static int createWakeSocket(struct io_thread *t) {
+  t->wakeSocket = socket(AF_INET, SOCK_DGRAM, 0);
+  if (t->wakeSocket == INVALID_SOCKET) {
+    return -1;
+  }
+
+  struct sockaddr_in addr = {0};
+  addr.sin_family = AF_INET;
+  addr.sin_port = 0;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  int addrLen = sizeof(addr);
+  unsigned long nonBlocking = 1;
+  if (bind(t->wakeSocket, (struct sockaddr *)&addr, sizeof(addr)) == SOCKET_ERROR ||
+      getsockname(t->wakeSocket, (struct sockaddr *)&t->wakeAddr, &addrLen) == SOCKET_ERROR ||
+      ioctlsocket(t->wakeSocket, FIONBIO, &nonBlocking) != 0) {
+    closesocket(t->wakeSocket);
+    t->wakeSocket = INVALID_SOCKET;
+    return -1;
+  }
+  return 0;
+}
+
+static void resetDecoder(struct connection *conn) {
+  conn->request = create_kvstr_request();
+  kvstr_decoder_init(&conn->decoder, conn->request, KVSTR_MAX_KEY_SIZE, gl_ioMaxValueSize);
+}
+
+// executes the queued requests of a connection in order and appends the responses to its output
+static void runConnection(void *arg) {
+  struct connection *conn = (struct connection *)arg;
+  struct io_thread *owner = conn->owner;
+
+  for (int handled = 0;; handled++) {
+    AcquireSRWLockExclusive(&conn->lock);
+    struct pending_request *p = conn->head;
+    if (p == NULL || handled == IO_REQUESTS_PER_TASK) {
+      if (p == NULL) {
+        conn->busy = false; // the I/O thread may close the connection from here on
+      }
+      ReleaseSRWLockExclusive(&conn->lock);
+
+      if (p != NULL && executor_submit(gl_executor, runConnection, conn) != 0) {
+        AcquireSRWLockExclusive(&conn->lock);
+        conn->busy = false;
+        conn->failed = true;
+        ReleaseSRWLockExclusive(&conn->lock);
+      }
+      wakeIoThread(owner);
+      return;
+    }
+    conn->head = p->next;
+    if (conn->head == NULL) {
+      conn->tail = NULL;
+    }
+    conn->pendingCount--;
+    conn->executing = true;
+    ReleaseSRWLockExclusive(&conn->lock);
+
+    byte_buffer response = {0};
+    response_value value = {0};
+    captureResponses(&response, &value);
+    setClientState(p->framed ? &conn->state : NULL);
+    stats_set_request(&p->timing);
+    bool detached = false;
+    if (p->parseError != 0) {
+      sendParseError(conn->socket, p->parseError);
+    } else if (p->framed && strcmp(p->req->operation, "SYNC") == 0) {
+      const char *errMsg = "400 Bad Request: SYNC is not allowed in a session";
+      sendResponse(conn->socket, errMsg, strlen(errMsg));
+    } else {
+      processClientRequest(conn->socket, p->req);
+      detached = clientSocketDetached();
+    }
+    stats_set_request(NULL);
+    setClientState(NULL);
+    captureResponses(NULL, NULL);
+
+    AcquireSRWLockExclusive(&conn->lock);
+    conn->detached |= detached;
+    size_t capacity = conn->output.capacity;
+    if (p->framed) {
+      char prefix[32];
+      int prefixLen = snprintf(prefix, sizeof(prefix), "%llu:", (unsigned long long)(response.len + value.len));
+      byte_buffer_append(&conn->output, prefix, prefixLen);
+    }
+    if (response.len > 0) {
+      byte_buffer_append(&conn->output, response.data, response.len);
+    }
+    if (value.pin != NULL) {
+      // written from the store once the output before it is, instead of copying it
+      p->value = value;
+      p->valueAt = conn->output.len;
+      conn->valueBytes += value.len;
+    }
+    if (conn->pushes.len > 0) {
+      byte_buffer_append(&conn->output, conn->pushes.data, conn->pushes.len);
+      conn->pushes.len = 0;
+    }
+    conn->executing = false;
+    stats_add(STATS_BUFFER_BYTES, (long long)conn->output.capacity - (long long)capacity);
+
+    // the I/O thread completes the request once the response is written
+    p->outputEnd = conn->outputBase + conn->output.len + conn->valueBytes;
+    p->readyAt = stats_now();
+    p->next = NULL;
+    if (conn->unsentTail == NULL) {
+      conn->unsentHead = p;
+    } else {
+      conn->unsentTail->next = p;
+    }
+    conn->unsentTail = p;
+    ReleaseSRWLockExclusive(&conn->lock);
+    wakeIoThread(owner);
+
+    byte_buffer_free(&response);
+  }
+}
+
+// sends an invalidation or a notification to a session (see tracking.h and watch.h)
+static void pushToConnection(void *ctx, const char *message, size_t length) {
+  struct connection *conn = (struct connection *)ctx;
+  char prefix[32];
+  int prefixLen = snprintf(prefix, sizeof(prefix), "%llu:", (unsigned long long)length);
+
+  AcquireSRWLockExclusive(&conn->lock);
+  // a response that is still being produced may hold the value that is invalidated, it has to
+  // reach the client first
+  byte_buffer *out = conn->executing ? &conn->pushes : &conn->output;
+  bool wake = !conn->executing && !conn->failed;
+  if (!conn->failed) {
+    size_t capacity = out->capacity;
+    // a push that is lost or cut would leave the client with stale data, so the session goes instead,
+    // and with it whatever the client cached
+    if (conn->pushBacklog + prefixLen + length > IO_MAX_PUSH_BACKLOG ||
+        byte_buffer_reserve(out, prefixLen + length) != 0) {
+      LOGF(WARN, "Dropping a session, %zu pushed bytes are unread.", conn->pushBacklog);
+      conn->failed = true;
+      shutdown(conn->socket, SD_BOTH);
+      wake = true;
+    } else {
+      byte_buffer_append(out, prefix, prefixLen);
+      byte_buffer_append(out, message, length);
+      conn->pushBacklog += prefixLen + length;
+    }
+    stats_add(STATS_BUFFER_BYTES, (long long)out->capacity - (long long)capacity);
+  }
+  ReleaseSRWLockExclusive(&conn->lock);
+  if (wake) {
+    wakeIoThread(conn->owner);
+  }
+}
+
+// queues a decoded request (or a parse error) for execution
+static void queueRequest(struct connection *conn, int parseError) {
+  struct pending_request *p = calloc(1, sizeof(struct pending_request));
+  if (p == NULL) {
+    logMessage(ERR, "Failed to allocate pending request.");
+    conn->readClosed = true;
+    return;
+  }
+
+  if (parseError == 0) {
+    p->req = conn->request;
+    if (strcmp(p->req->operation, "HELLO") == 0) {
+      conn->session = true;
+    }
+  } else {
+    p->parseError = parseError;
+    free_kvstr_request(&conn->request);
+  }
+  p->framed = conn->session;
+
+  // everything between the first byte and the complete request that was not parsing is receiving
+  p->timing = conn->timing;
+  p->timing.phase[STATS_PHASE_RECV] = stats_now() - p->timing.start - p->timing.phase[STATS_PHASE_PARSE];
+  p->timing.measured |= 1u << STATS_PHASE_RECV;
+  memset(&conn->timing, 0, sizeof(conn->timing));
+
+  // a broken stream cannot be resynchronized, and connections without a session serve one request
+  if (parseError != 0 || !conn->session) {
+    conn->readClosed = true;
+  }
+  resetDecoder(conn);
+
+  AcquireSRWLockExclusive(&conn->lock);
+  if (conn->tail == NULL) {
+    conn->head = p;
+  } else {
+    conn->tail->next = p;
+  }
+  conn->tail = p;
+  conn->pendingCount++;
+  bool submit = !conn->busy;
+  conn->busy = true;
+  ReleaseSRWLockExclusive(&conn->lock);
+
+  if (submit && executor_submit(gl_executor, runConnection, conn) != 0) {
+    logMessage(ERR, "Failed to submit request to the executor.");
+    AcquireSRWLockExclusive(&conn->lock);
+    conn->busy = false;
+    conn->failed = true;
+    ReleaseSRWLockExclusive(&conn->lock);
+    conn->readClosed = true;
+  }
+}
+
+static void feedConnection(struct connection *conn, const char *data, size_t len) {
+  size_t pos = 0;
+  while (pos < len && !conn->readClosed) {
+    if (conn->request == NULL) {
+      conn->readClosed = true; // out of memory
+      return;
+    }
+
+    unsigned long long parseStart = stats_now();
+    if (conn->timing.start == 0) {
+      conn->timing.start = parseStart; // next pipelined request in the same chunk
+    }
+    pos += kvstr_decoder_feed(&conn->decoder, data + pos, len - pos);
+    stats_timing_add(&conn->timing, STATS_PHASE_PARSE, parseStart);
+    if (kvstr_decoder_done(&conn->decoder)) {
+      // like the single-threaded server, reject junk following the request of a one-shot connection
+      bool junk = !conn->session && strcmp(conn->request->operation, "HELLO") != 0 &&
+                  pos + strspn(data + pos, "\r\n") < len;
+      queueRequest(conn, junk ? -5 : 0);
+    } else if (conn->decoder.state == KVSTR_DEC_ERROR) {
+      queueRequest(conn, conn->decoder.error);
+    }
+  }
+}
+
+static void readConnection(struct connection *conn) {
+  char chunk[IO_RECV_CHUNK_SIZE + 1];
+
+  // a few reads per round so one busy connection cannot starve the others
+  for (int round = 0; round < 4 && !conn->readClosed; round++) {
+    size_t remaining;
+    char *direct = kvstr_decoder_direct_buffer(&conn->decoder, &remaining);
+
+    int receivedBytes;
+    unsigned long long recvStart = stats_now();
+    if (direct != NULL && remaining >= IO_RECV_CHUNK_SIZE) {
+      // large values are received straight into their final allocation
+      int len = remaining > IO_RECV_DIRECT_SIZE ? IO_RECV_DIRECT_SIZE : (int)remaining;
+      receivedBytes = recv(conn->socket, direct, len, 0);
+      if (receivedBytes > 0) {
+        stats_add(STATS_BYTES_IN, receivedBytes);
+        kvstr_decoder_commit(&conn->decoder, receivedBytes);
+        if (kvstr_decoder_done(&conn->decoder)) {
+          queueRequest(conn, 0);
+        }
+        continue;
+      }
+    } else {
+      receivedBytes = recv(conn->socket, chunk, IO_RECV_CHUNK_SIZE, 0);
+      if (receivedBytes > 0) {
+        stats_add(STATS_BYTES_IN, receivedBytes);
+        if (conn->timing.start == 0) {
+          conn->timing.start = recvStart;
+        }
+        chunk[receivedBytes] = '\0';
+        feedConnection(conn, chunk, receivedBytes);
+        continue;
+      }
+    }
+
+    if (receivedBytes == 0) {
+      // peer closed its side, a request terminated by the end of the input is still served
+      if (conn->request != NULL && (conn->decoder.token_len > 0 || conn->decoder.args != NULL)) {
+        int parseError = kvstr_decoder_finish(&conn->decoder);
+        queueRequest(conn, parseError);
+      }
+      conn->readClosed = true;
+    } else if (WSAGetLastError() != WSAEWOULDBLOCK) {
+      conn->readClosed = true;
+      AcquireSRWLockExclusive(&conn->lock);
+      conn->failed = true;
+      ReleaseSRWLockExclusive(&conn->lock);
+    }
+    return;
+  }
+}
+
+static void freePendingRequest(struct pending_request *p) {
+  if (p->value.pin != NULL) {
+    lazyfree_unpin(p->value.pin);
+  }
+  free_kvstr_request(&p->req);
+  free(p);
+}
+
+// bytes of the output and of its values that are not written yet, the caller holds the lock
+static size_t unsentBytes(const struct connection *conn) {
+  return conn->output.len - conn->outputPos + conn->valueBytes - conn->valueSent;
+}
+
+// the request with the first value that is not written completely, NULL if there is none, the caller holds the lock
+static struct pending_request *unsentValue(const struct connection *conn) {
+  for (struct pending_request *p = conn->unsentHead; p != NULL; p = p->next) {
+    if (p->value.pin != NULL && p->valueSent < p->value.len) {
+      return p;
+    }
+  }
+  return NULL;
+}
+
+// records the requests whose responses were written completely, the caller holds the lock
+static void completeResponses(struct connection *conn) {
+  unsigned long long written = conn->outputBase + conn->outputPos + conn->valueSent;
+  while (conn->unsentHead != NULL && conn->unsentHead->outputEnd <= written) {
+    struct pending_request *p = conn->unsentHead;
+    conn->unsentHead = p->next;
+    if (conn->unsentHead == NULL) {
+      conn->unsentTail = NULL;
+    }
+    stats_timing_add(&p->timing, STATS_PHASE_SEND, p->readyAt);
+    unsigned long long total = stats_record_request(&p->timing);
+    if (total > gl_slowlogThreshold) {
+      slowlog_record(conn->socket, p->req != NULL ? p->req->operation : NULL, p->req != NULL ? p->req->key : NULL,
+                     p->req != NULL ? p->req->value_len : 0, &p->timing, total);
+    }
+    freePendingRequest(p);
+  }
+}
+
+static void writeConnection(struct connection *conn) {
+  AcquireSRWLockExclusive(&conn->lock);
+  // the output up to the next value, then the value
+  struct pending_request *v = unsentValue(conn);
+  size_t end = v != NULL ? v->valueAt : conn->output.len;
+  const char *data = conn->output.data + conn->outputPos;
+  size_t pending = end - conn->outputPos;
+  if (pending == 0 && v != NULL) {
+    data = v->value.data + v->valueSent;
+    pending = v->value.len - v->valueSent;
+  }
+  if (pending > 0 && !conn->failed) {
+    int len = pending > IO_SEND_CHUNK_SIZE ? IO_SEND_CHUNK_SIZE : (int)pending;
+    int sentBytes = send(conn->socket, data, len, 0);
+    if (sentBytes > 0) {
+      if (conn->outputPos < end) {
+        conn->outputPos += sentBytes;
+      } else {
+        v->valueSent += sentBytes;
+        conn->valueSent += sentBytes;
+      }
+      stats_add(STATS_BYTES_OUT, sentBytes);
+    } else if (sentBytes == SOCKET_ERROR && WSAGetLastError() != WSAEWOULDBLOCK) {
+      conn->failed = true;
+    }
+  }
+  completeResponses(conn);
+
+  if (unsentBytes(conn) == 0) {
+    conn->outputBase += conn->output.len + conn->valueBytes;
+    conn->valueBytes = 0;
+    conn->valueSent = 0;
+    conn->pushBacklog = conn->pushes.len;
+    // keep small buffers around for the next responses, release large ones
+    if (conn->output.capacity > IO_KEEP_OUTPUT_SIZE) {
+      stats_add(STATS_BUFFER_BYTES, -(long long)conn->output.capacity);
+      byte_buffer_free(&conn->output);
+    }
+    conn->output.len = 0;
+    conn->outputPos = 0;
+  }
+  ReleaseSRWLockExclusive(&conn->lock);
+}
+
+static void freePendingRequests(struct pending_request *p) {
+  while (p != NULL) {
+    struct pending_request *next = p->next;
+    freePendingRequest(p);
+    p = next;
+  }
+}
+
+static void freeConnection(struct connection *conn) {
+  // no invalidations or notifications are pushed to the connection after this
+  tracking_unregister(conn->state.tracking);
+  watch_unregister(conn->state.watching);
+  if (!conn->detached) {
+    closesocket(conn->socket);
+  }
+  freePendingRequests(conn->head);
+  freePendingRequests(conn->unsentHead);
+  free_kvstr_request(&conn->request);
+  stats_add(STATS_BUFFER_BYTES, -(long long)(conn->output.capacity + conn->pushes.capacity));
+  byte_buffer_free(&conn->output);
+  byte_buffer_free(&conn->pushes);
+  atomic_fetch_sub(&conn->owner->load, 1);
+  stats_add(STATS_CONNECTIONS, -1);
+  free(conn);
+}
+
+static void adoptIncoming(struct io_thread *t) {
+  AcquireSRWLockExclusive(&t->lock);
+  for (int i = 0; i < t->incomingCount; i++) {
+    struct connection *conn = calloc(1, sizeof(struct connection));
+    if (conn == NULL) {
+      closesocket(t->incoming[i]);
+      atomic_fetch_sub(&t->load, 1);
+      continue;
+    }
+    conn->socket = t->incoming[i];
+    conn->owner = t;
+    conn->state.connectionId = capture_next_connection();
+    conn->state.push = pushToConnection;
+    conn->state.pushCtx = conn;
+    InitializeSRWLock(&conn->lock);
+    resetDecoder(conn);
+    t->connections[t->connectionCount++] = conn;
+    stats_add(STATS_CONNECTIONS, 1);
+  }
+  t->incomingCount = 0;
+  ReleaseSRWLockExclusive(&t->lock);
+}
+
+static DWORD WINAPI ioThreadMain(LPVOID arg) {
+  struct io_thread *t = (struct io_thread *)arg;
+
+  while (atomic_load(&gl_ioRunning)) {
+    adoptIncoming(t);
+
+    fd_set readSet, writeSet;
+    FD_ZERO(&readSet);
+    FD_ZERO(&writeSet);
+    FD_SET(t->wakeSocket, &readSet);
+    SOCKET maxSocket = t->wakeSocket;
+
+    for (int i = 0; i < t->connectionCount; i++) {
+      struct connection *conn = t->connections[i];
+      AcquireSRWLockExclusive(&conn->lock);
+      size_t unsent = unsentBytes(conn);
+      bool wantRead = !conn->readClosed && conn->pendingCount < IO_MAX_PENDING_REQUESTS &&
+                      unsent < IO_MAX_PENDING_OUTPUT;
+      bool wantWrite = unsent > 0 && !conn->failed;
+      ReleaseSRWLockExclusive(&conn->lock);
+
+      if (wantRead) {
+        FD_SET(conn->socket, &readSet);
+      }
+      if (wantWrite) {
+        FD_SET(conn->socket, &writeSet);
+      }
+      if ((wantRead || wantWrite) && conn->socket > maxSocket) {
+        maxSocket = conn->socket;
+      }
+    }
+
+    struct timeval timeout = {0, IO_SELECT_TIMEOUT_MS * 1000};
+    int r = select((int)maxSocket + 1, &readSet, &writeSet, NULL, &timeout);
+    if (r == SOCKET_ERROR) {
+      LOGF(ERR, "select() failed. Error code: %d", WSAGetLastError());
+      Sleep(IO_SELECT_TIMEOUT_MS);
+      continue;
+    }
+
+    if (FD_ISSET(t->wakeSocket, &readSet)) {
+      // drain before clearing the flag, otherwise a wake-up sent in between is swallowed and the
+      // flag stays set, so that no further wake-up is ever sent
+      char drain[64];
+      while (recv(t->wakeSocket, drain, sizeof(drain), 0) > 0) {
+      }
+      atomic_store(&t->wakePending, false);
+    }
+
+    for (int i = 0; i < t->connectionCount; i++) {
+      struct connection *conn = t->connections[i];
+      if (FD_ISSET(conn->socket, &readSet)) {
+        readConnection(conn);
+      }
+      if (FD_ISSET(conn->socket, &writeSet)) {
+        writeConnection(conn);
+      }
+    }
+
+    // close connections that are done: nothing more to read, nothing running, everything sent
+    for (int i = 0; i < t->connectionCount;) {
+      struct connection *conn = t->connections[i];
+      AcquireSRWLockExclusive(&conn->lock);
+      completeResponses(conn);
+      bool done = conn->readClosed && !conn->busy &&
+                  (conn->failed || unsentBytes(conn) == 0);
+      ReleaseSRWLockExclusive(&conn->lock);
+
+      if (done) {
+        freeConnection(conn);
+        t->connections[i] = t->connections[--t->connectionCount];
+      } else {
+        i++;
+      }
+    }
+  }
+
+  return 0;
+}
+
+int startIoThreads(int ioThreads, int workers, size_t maxValueSize) {
+  gl_ioMaxValueSize = maxValueSize;
+  atomic_store(&gl_ioRunning, true);
+
+  gl_executor = executor_create(workers);
+  if (gl_executor == NULL) {
+    return -1;
+  }
+
+  gl_ioThreadList = calloc(ioThreads, sizeof(struct io_thread));
+  if (gl_ioThreadList == NULL) {
+    executor_destroy(gl_executor);
+    gl_executor = NULL;
+    return -1;
+  }
+
+  for (int i = 0; i < ioThreads; i++) {
+    struct io_thread *t = &gl_ioThreadList[i];
+    InitializeSRWLock(&t->lock);
+    atomic_init(&t->wakePending, false);
+    atomic_init(&t->load, 0);
+    if (createWakeSocket(t) != 0) {
+      stopIoThreads();
+      return -1;
+    }
+
+    t->thread = CreateThread(NULL, 0, ioThreadMain, t, 0, NULL);
+    if (t->thread == NULL) {
+      closesocket(t->wakeSocket);
+      stopIoThreads();
+      return -1;
+    }
+    gl_ioThreadCount++;
+  }
+
+  return 0;
+}
+
+int dispatchConnection(SOCKET clientSocket) {
+  struct io_thread *target = NULL;
+  for (int i = 0; i < gl_ioThreadCount; i++) {
+    if (target == NULL || atomic_load(&gl_ioThreadList[i].load) < atomic_load(&target->load)) {
+      target = &gl_ioThreadList[i];
+    }
+  }
+  if (target == NULL || atomic_load(&target->load) >= IO_THREAD_MAX_CONNECTIONS) {
+    return -1;
+  }
+
+  unsigned long nonBlocking = 1;
+  int noDelay = 1;
+  ioctlsocket(clientSocket, FIONBIO, &nonBlocking);
+  setsockopt(clientSocket, IPPROTO_TCP, TCP_NODELAY, (const char *)&noDelay, sizeof(noDelay));
+
+  AcquireSRWLockExclusive(&target->lock);
+  target->incoming[target->incomingCount++] = clientSocket;
+  atomic_fetch_add(&target->load, 1);
+  ReleaseSRWLockExclusive(&target->lock);
+
+  wakeIoThread(target);
+  return 0;
+}
+
+void stopIoThreads() {
+  atomic_store(&gl_ioRunning, false);
+
+  for (int i = 0; i < gl_ioThreadCount; i++) {
+    WaitForSingleObject(gl_ioThreadList[i].thread, INFINITE);
+    CloseHandle(gl_ioThreadList[i].thread);
+  }
+
+  // runs the remaining tasks, they still append to the connections and wake the I/O threads
+  executor_destroy(gl_executor);
+  gl_executor = NULL;
+
+  for (int i = 0; i < gl_ioThreadCount; i++) {
+    struct io_thread *t = &gl_ioThreadList[i];
+    adoptIncoming(t);
+    for (int j = 0; j < t->connectionCount; j++) {
+      freeConnection(t->connections[j]);
+    }
+    closesocket(t->wakeSocket);
+  }
+
+  free(gl_ioThreadList);
+  gl_ioThreadList = NULL;
+  gl_ioThreadCount = 0;
+}
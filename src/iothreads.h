@@ -0,0 +1,15 @@
+#ifndef _KVSTR_IOTHREADS_H
+#define _KVSTR_IOTHREADS_H
+
+#include <stddef.h>
+
+#ifdef _WIN64
+#include <WinSock2.h>
+#endif
+
+/* Prototypes */
+int startIoThreads(int ioThreads, int workers, size_t maxValueSize); // start I/O threads and the executor pool (worker mode)
+int dispatchConnection(SOCKET clientSocket); // hand an accepted connection to the least loaded I/O thread
+void stopIoThreads(); // finish outstanding requests and close all connections
+
+#endif
@@ -0,0 +1,738 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "hotkeys.h"
+#include "kvcompress.h"
+#include "kvstore.h"
+#include "kvstrdecoder.h"
+#include "kvstrprotocol.h"
+#include "stats.h"
+
+#ifdef _WIN64
+#include <windows.h>
+#include <psapi.h>
+#endif
+
+/*
+ * Microbenchmarks of the key value store and its allocators, the request parser, the request
+ * builders, the hot key tracking and the value compression. Every benchmark runs with more iterations until it took at
+ * least the minimum time, only the measured operations are timed (not building the keys or
+ * restoring the store afterwards). The allocations of the measured code are counted through
+ * kv_bench_alloc.h.
+ *
+ * The results can be saved (-save) and later compared against (-compare): a benchmark that got
+ * slower by more than the threshold or allocates more often is reported as a regression.
+ */
+
+#define BENCH_DEFAULT_MAX_KEYS 10000000
+#define BENCH_DEFAULT_MIN_TIME 200          // ms per benchmark
+#define BENCH_DEFAULT_THRESHOLD 10.0        // % slower than the baseline that counts as a regression
+#define BENCH_MAX_ITERATIONS 100000000LL
+#define BENCH_BATCH 256                     // operations prepared and timed at once
+#define BENCH_MAX_KEY_SIZE 256
+#define BENCH_MAX_RESULTS 256
+#define BENCH_NAME_SIZE 64
+#define BENCH_HOTKEYS_KEYS 65536
+#define BENCH_COMPRESS_SIZE 4096            // bytes of the values compressed
+
+typedef struct bench_timer {
+  unsigned long long start;
+  unsigned long long elapsed;       // ns
+  unsigned long long allocStart;
+  unsigned long long allocs;
+} bench_timer;
+
+typedef void (*bench_fn)(void *ctx, long long iterations, bench_timer *timer);
+
+typedef struct bench_result {
+  char name[BENCH_NAME_SIZE];
+  double nsPerOp;
+  double allocsPerOp;
+} bench_result;
+
+// a store filled with keys of the same length, key i is "key:<i>" padded with zeros
+typedef struct store_fixture {
+  kv_store *store;
+  size_t keys;
+  size_t keyLen;
+  size_t valueLen;
+  int hitPercent;                   // GETs of keys that exist
+  const char *allocator;            // of the store, NULL for the system allocator
+  bool intKeys;                     // keys are the decimal numbers 0 to keys - 1, stored as integers
+  char *value;                      // valueLen bytes
+  unsigned long long random;
+} store_fixture;
+
+// keys accessed one after the other, with a share of them going to a single hot key
+typedef struct hotkeys_fixture {
+  char *keys;                       // BENCH_HOTKEYS_KEYS keys of 16 bytes
+  unsigned int order[BENCH_BATCH];  // key indexes, 0 is the hot key
+} hotkeys_fixture;
+
+// a value to compress and the block of the compressible one
+typedef struct compress_fixture {
+  char text[BENCH_COMPRESS_SIZE];
+  char block[BENCH_COMPRESS_SIZE];
+  size_t blockLen;
+  char decoded[BENCH_COMPRESS_SIZE];
+} compress_fixture;
+
+typedef struct request_fixture {
+  const char *request;              // parsed or built
+  size_t keyLen;
+  size_t valueLen;
+  char *key;
+  char *value;
+} request_fixture;
+
+static unsigned long long gl_allocs = 0;
+static unsigned long long gl_minTime = BENCH_DEFAULT_MIN_TIME * 1000000ULL;
+static const char *gl_filter = NULL;
+static bench_result gl_baseline[BENCH_MAX_RESULTS];
+static int gl_baselineCount = 0;
+static bench_result gl_results[BENCH_MAX_RESULTS];
+static int gl_resultCount = 0;
+static double gl_threshold = BENCH_DEFAULT_THRESHOLD;
+static int gl_regressions = 0;
+
+// the parentheses keep the macros of kv_bench_alloc.h from expanding
+void *kv_bench_malloc(size_t size) {
+  gl_allocs++;
+  return (malloc)(size);
+}
+
+void *kv_bench_calloc(size_t count, size_t size) {
+  gl_allocs++;
+  return (calloc)(count, size);
+}
+
+void *kv_bench_realloc(void *ptr, size_t size) {
+  gl_allocs++;
+  return (realloc)(ptr, size);
+}
+
+void kv_bench_free(void *ptr) {
+  (free)(ptr);
+}
+
+static void timerStart(bench_timer *t) {
+  t->allocStart = gl_allocs;
+  t->start = stats_now();
+}
+
+static void timerStop(bench_timer *t) {
+  t->elapsed += stats_now() - t->start;
+  t->allocs += gl_allocs - t->allocStart;
+}
+
+static size_t residentBytes() {
+  PROCESS_MEMORY_COUNTERS counters;
+  if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+    return 0;
+  }
+  return counters.WorkingSetSize;
+}
+
+// xorshift64*
+static unsigned long long nextRandom(unsigned long long *state) {
+  *state ^= *state >> 12;
+  *state ^= *state << 25;
+  *state ^= *state >> 27;
+  return *state * 2685821657736338717ULL;
+}
+
+static void makeKey(char *buffer, const char *prefix, size_t index, size_t keyLen) {
+  int len = snprintf(buffer, BENCH_MAX_KEY_SIZE, "%s%0*zu", prefix, (int)(keyLen - strlen(prefix)), index);
+  buffer[len < (int)keyLen ? len : (int)keyLen] = '\0';
+}
+
+static const bench_result *findBaseline(const char *name) {
+  for (int i = 0; i < gl_baselineCount; i++) {
+    if (strcmp(gl_baseline[i].name, name) == 0) {
+      return &gl_baseline[i];
+    }
+  }
+  return NULL;
+}
+
+static void report(const char *name, long long iterations, const bench_timer *t) {
+  bench_result *r = gl_resultCount < BENCH_MAX_RESULTS ? &gl_results[gl_resultCount++] : NULL;
+  double nsPerOp = (double)t->elapsed / (double)iterations;
+  double allocsPerOp = (double)t->allocs / (double)iterations;
+  if (r != NULL) {
+    snprintf(r->name, sizeof(r->name), "%s", name);
+    r->nsPerOp = nsPerOp;
+    r->allocsPerOp = allocsPerOp;
+  }
+
+  printf("%-40s %12lld %14.1f ns/op %8.2f allocs/op %8zu MB RSS", name, iterations, nsPerOp, allocsPerOp,
+         residentBytes() / (1024 * 1024));
+  const bench_result *base = findBaseline(name);
+  if (base != NULL) {
+    double change = base->nsPerOp > 0 ? (nsPerOp - base->nsPerOp) * 100.0 / base->nsPerOp : 0;
+    bool regression = change > gl_threshold || allocsPerOp > base->allocsPerOp + 0.01;
+    printf("  %+7.1f%%%s", change, regression ? "  REGRESSION" : "");
+    gl_regressions += regression ? 1 : 0;
+  }
+  printf("\n");
+}
+
+static bool selected(const char *name) {
+  return gl_filter == NULL || strstr(name, gl_filter) != NULL;
+}
+
+// runs the benchmark with more iterations until it took at least the minimum time
+static void runBench(const char *name, bench_fn fn, void *ctx) {
+  if (!selected(name)) {
+    return;
+  }
+
+  long long iterations = 1;
+  while (true) {
+    bench_timer timer = {0};
+    fn(ctx, iterations, &timer);
+    if (timer.elapsed >= gl_minTime || iterations >= BENCH_MAX_ITERATIONS) {
+      report(name, iterations, &timer);
+      return;
+    }
+
+    // aim a bit beyond the minimum time, but do not grow too fast on a noisy first measurement
+    double scale = timer.elapsed > 0 ? (double)gl_minTime * 1.2 / (double)timer.elapsed : 100.0;
+    scale = scale < 2.0 ? 2.0 : (scale > 100.0 ? 100.0 : scale);
+    iterations = (long long)((double)iterations * scale);
+    if (iterations > BENCH_MAX_ITERATIONS) {
+      iterations = BENCH_MAX_ITERATIONS;
+    }
+  }
+}
+
+// key i of the fixture, or a key that is not stored
+static void fixtureKey(const store_fixture *f, char *buffer, bool hit, size_t index) {
+  if (f->intKeys) {
+    snprintf(buffer, BENCH_MAX_KEY_SIZE, "%zu", hit ? index : f->keys + index);
+  } else {
+    makeKey(buffer, hit ? "key:" : "miss:", index, f->keyLen);
+  }
+}
+
+// integer keys are inserted one by one, that is fast enough for the hash table
+static int fillIntStore(store_fixture *f) {
+  char key[BENCH_MAX_KEY_SIZE];
+  if (kv_store_use_int_keys(f->store) != 0) {
+    return -1;
+  }
+  for (size_t i = 0; i < f->keys; i++) {
+    fixtureKey(f, key, true, i);
+    if (kv_store_put(f->store, key, f->value) != 0) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+// fills the entries directly, inserting them one by one would take longer than the benchmarks
+static int fillStore(store_fixture *f) {
+  f->store = create_kv_store_with_allocator((int)f->keys, f->allocator ? kv_allocator_create(f->allocator) : NULL);
+  f->value = malloc(f->valueLen + 1);
+  if (f->store == NULL || f->value == NULL) {
+    return -1;
+  }
+  memset(f->value, 'v', f->valueLen);
+  f->value[f->valueLen] = '\0';
+  if (f->intKeys) {
+    return fillIntStore(f);
+  }
+
+  char key[BENCH_MAX_KEY_SIZE];
+  for (size_t i = 0; i < f->keys; i++) {
+    makeKey(key, "key:", i, f->keyLen);
+    kv_entry *e = &f->store->entries[i];
+    kv_allocator *allocator = f->store->allocator;
+    e->key = allocator->allocate(allocator, f->keyLen + 1);
+    e->value = allocator->allocate(allocator, f->valueLen + 1);
+    f->store->allocated_bytes += f->keyLen + 1 + f->valueLen + 1;
+    f->store->allocations += 2;
+    if (e->key == NULL || e->value == NULL) {
+      f->store->size = i + 1;
+      return -1;
+    }
+    memcpy(e->key, key, f->keyLen + 1);
+    memcpy(e->value, f->value, f->valueLen + 1);
+    e->value_len = f->valueLen;
+    f->store->data_size += f->keyLen + f->valueLen;
+  }
+  f->store->size = f->keys;
+  return 0;
+}
+
+static void freeStore(store_fixture *f) {
+  if (f->store != NULL) {
+    free_kv_store(f->store);
+    f->store = NULL;
+  }
+  free(f->value);
+  f->value = NULL;
+}
+
+static void benchStoreGet(void *ctx, long long iterations, bench_timer *timer) {
+  store_fixture *f = ctx;
+  static char keys[BENCH_BATCH][BENCH_MAX_KEY_SIZE];
+  for (long long done = 0; done < iterations; done += BENCH_BATCH) {
+    int batch = iterations - done < BENCH_BATCH ? (int)(iterations - done) : BENCH_BATCH;
+    for (int i = 0; i < batch; i++) {
+      bool hit = (int)(nextRandom(&f->random) % 100) < f->hitPercent;
+      fixtureKey(f, keys[i], hit, (size_t)(nextRandom(&f->random) % f->keys));
+    }
+    timerStart(timer);
+    for (int i = 0; i < batch; i++) {
+      kv_store_get(f->store, keys[i]);
+    }
+    timerStop(timer);
+  }
+}
+
+// overwrites existing keys
+static void benchStoreUpdate(void *ctx, long long iterations, bench_timer *timer) {
+  store_fixture *f = ctx;
+  static char keys[BENCH_BATCH][BENCH_MAX_KEY_SIZE];
+  for (long long done = 0; done < iterations; done += BENCH_BATCH) {
+    int batch = iterations - done < BENCH_BATCH ? (int)(iterations - done) : BENCH_BATCH;
+    for (int i = 0; i < batch; i++) {
+      fixtureKey(f, keys[i], true, (size_t)(nextRandom(&f->random) % f->keys));
+    }
+    timerStart(timer);
+    for (int i = 0; i < batch; i++) {
+      kv_store_put(f->store, keys[i], f->value);
+    }
+    timerStop(timer);
+  }
+}
+
+// adds new keys, they are deleted again afterwards
+static void benchStoreInsert(void *ctx, long long iterations, bench_timer *timer) {
+  store_fixture *f = ctx;
+  static char keys[BENCH_BATCH][BENCH_MAX_KEY_SIZE];
+  for (long long done = 0; done < iterations; done += BENCH_BATCH) {
+    int batch = iterations - done < BENCH_BATCH ? (int)(iterations - done) : BENCH_BATCH;
+    for (int i = 0; i < batch; i++) {
+      makeKey(keys[i], "new:", (size_t)(done + i), f->keyLen);
+    }
+    timerStart(timer);
+    for (int i = 0; i < batch; i++) {
+      kv_store_put(f->store, keys[i], f->value);
+    }
+    timerStop(timer);
+    for (int i = 0; i < batch; i++) {
+      kv_store_delete(f->store, keys[i]);
+    }
+  }
+}
+
+// deletes existing keys, they are stored again afterwards
+static void benchStoreDelete(void *ctx, long long iterations, bench_timer *timer) {
+  store_fixture *f = ctx;
+  static char keys[BENCH_BATCH][BENCH_MAX_KEY_SIZE];
+  for (long long done = 0; done < iterations; done += BENCH_BATCH) {
+    int batch = iterations - done < BENCH_BATCH ? (int)(iterations - done) : BENCH_BATCH;
+    for (int i = 0; i < batch; i++) {
+      makeKey(keys[i], "key:", (size_t)(nextRandom(&f->random) % f->keys), f->keyLen);
+    }
+    timerStart(timer);
+    for (int i = 0; i < batch; i++) {
+      kv_store_delete(f->store, keys[i]);
+    }
+    timerStop(timer);
+    for (int i = 0; i < batch; i++) {
+      kv_store_put(f->store, keys[i], f->value);
+    }
+  }
+}
+
+typedef struct store_bench {
+  char name[BENCH_NAME_SIZE];
+  bench_fn fn;
+  int hitPercent;
+} store_bench;
+
+static void benchStore(size_t keys, size_t keyLen, size_t valueLen, bool sizesOnly) {
+  store_bench benches[6] = {0};
+  int count = 0;
+  if (!sizesOnly) {
+    int hitPercents[] = {100, 50, 0};
+    for (int i = 0; i < 3; i++, count++) {
+      snprintf(benches[count].name, BENCH_NAME_SIZE, "store/get/hit%d/n=%zu", hitPercents[i], keys);
+      benches[count].fn = benchStoreGet;
+      benches[count].hitPercent = hitPercents[i];
+    }
+    snprintf(benches[count].name, BENCH_NAME_SIZE, "store/put-insert/n=%zu", keys);
+    benches[count++].fn = benchStoreInsert;
+    snprintf(benches[count].name, BENCH_NAME_SIZE, "store/delete/n=%zu", keys);
+    benches[count++].fn = benchStoreDelete;
+  }
+  snprintf(benches[count].name, BENCH_NAME_SIZE, "store/put-update/n=%zu/k%zu/v%zu", keys, keyLen, valueLen);
+  benches[count++].fn = benchStoreUpdate;
+
+  // filling a large store takes a while, skip it if nothing is measured on it
+  bool any = false;
+  for (int i = 0; i < count; i++) {
+    any |= selected(benches[i].name);
+  }
+  if (!any) {
+    return;
+  }
+
+  store_fixture f = {.keys = keys, .keyLen = keyLen, .valueLen = valueLen, .random = 0x9E3779B97F4A7C15ULL};
+  if (fillStore(&f) != 0) {
+    printf("Out of memory filling the store with %zu keys\n", keys);
+    freeStore(&f);
+    return;
+  }
+  for (int i = 0; i < count; i++) {
+    f.hitPercent = benches[i].hitPercent;
+    runBench(benches[i].name, benches[i].fn, &f);
+  }
+  freeStore(&f);
+}
+
+// the same store with integer keys, lookups hash instead of comparing strings
+static void benchIntKeys(size_t keys) {
+  store_bench benches[3] = {0};
+  int hitPercents[] = {100, 0};
+  for (int i = 0; i < 2; i++) {
+    snprintf(benches[i].name, BENCH_NAME_SIZE, "store/intkeys/get/hit%d/n=%zu", hitPercents[i], keys);
+    benches[i].fn = benchStoreGet;
+    benches[i].hitPercent = hitPercents[i];
+  }
+  snprintf(benches[2].name, BENCH_NAME_SIZE, "store/intkeys/put-update/n=%zu", keys);
+  benches[2].fn = benchStoreUpdate;
+  if (!selected(benches[0].name) && !selected(benches[1].name) && !selected(benches[2].name)) {
+    return;
+  }
+
+  store_fixture f = {.keys = keys, .valueLen = 32, .intKeys = true, .random = 0x9E3779B97F4A7C15ULL};
+  if (fillStore(&f) != 0) {
+    printf("Out of memory filling the store with %zu integer keys\n", keys);
+    freeStore(&f);
+    return;
+  }
+  for (int i = 0; i < 3; i++) {
+    f.hitPercent = benches[i].hitPercent;
+    runBench(benches[i].name, benches[i].fn, &f);
+  }
+  freeStore(&f);
+}
+
+// updates and inserts of small values through each allocator of the store
+static void benchAllocators() {
+  static const char *allocators[] = {"system", "arena", "slab"};
+  for (size_t a = 0; a < sizeof(allocators) / sizeof(allocators[0]); a++) {
+    store_bench benches[2] = {0};
+    snprintf(benches[0].name, BENCH_NAME_SIZE, "store/put-update/%s/n=1000", allocators[a]);
+    benches[0].fn = benchStoreUpdate;
+    snprintf(benches[1].name, BENCH_NAME_SIZE, "store/put-insert/%s/n=1000", allocators[a]);
+    benches[1].fn = benchStoreInsert;
+    if (!selected(benches[0].name) && !selected(benches[1].name)) {
+      continue;
+    }
+
+    store_fixture f = {.keys = 1000, .keyLen = 16, .valueLen = 32, .allocator = allocators[a],
+                       .random = 0x9E3779B97F4A7C15ULL};
+    if (fillStore(&f) != 0) {
+      printf("Out of memory filling the store with the %s allocator\n", allocators[a]);
+      freeStore(&f);
+      continue;
+    }
+    for (int i = 0; i < 2; i++) {
+      runBench(benches[i].name, benches[i].fn, &f);
+    }
+    freeStore(&f);
+  }
+}
+
+static void benchParse(void *ctx, long long iterations, bench_timer *timer) {
+  request_fixture *f = ctx;
+  static struct kvstr_request *requests[BENCH_BATCH];
+  for (long long done = 0; done < iterations; done += BENCH_BATCH) {
+    int batch = iterations - done < BENCH_BATCH ? (int)(iterations - done) : BENCH_BATCH;
+    for (int i = 0; i < batch; i++) {
+      requests[i] = create_kvstr_request();
+    }
+    timerStart(timer);
+    for (int i = 0; i < batch; i++) {
+      kvstr_parse_request(f->request, requests[i]);
+    }
+    timerStop(timer);
+    for (int i = 0; i < batch; i++) {
+      free_kvstr_request(&requests[i]);
+    }
+  }
+}
+
+static void benchBuildGet(void *ctx, long long iterations, bench_timer *timer) {
+  request_fixture *f = ctx;
+  timerStart(timer);
+  for (long long i = 0; i < iterations; i++) {
+    free(kvstr_build_get_request(f->key));
+  }
+  timerStop(timer);
+}
+
+static void benchBuildPut(void *ctx, long long iterations, bench_timer *timer) {
+  request_fixture *f = ctx;
+  timerStart(timer);
+  for (long long i = 0; i < iterations; i++) {
+    free(kvstr_build_put_request(f->key, f->value));
+  }
+  timerStop(timer);
+}
+
+static void benchBuildDel(void *ctx, long long iterations, bench_timer *timer) {
+  request_fixture *f = ctx;
+  timerStart(timer);
+  for (long long i = 0; i < iterations; i++) {
+    free(kvstr_build_del_request(f->key));
+  }
+  timerStop(timer);
+}
+
+static void benchEncodePut(void *ctx, long long iterations, bench_timer *timer) {
+  request_fixture *f = ctx;
+  char header[KVSTR_MAX_HEADER_SIZE];
+  kvstr_iovec iov[KVSTR_MAX_IOVEC];
+  volatile size_t sink = 0; // keeps the loop from being optimized away
+  timerStart(timer);
+  for (long long i = 0; i < iterations; i++) {
+    int count = kvstr_encode_put_request(f->key, f->keyLen, f->value, f->valueLen, header, sizeof(header), iov);
+    sink += count > 0 ? iov[0].len : 0;
+  }
+  timerStop(timer);
+  (void)sink;
+}
+
+static void benchProtocol(size_t keyLen, size_t valueLen, bool withKeyOnly) {
+  request_fixture f = {.keyLen = keyLen, .valueLen = valueLen};
+  f.key = malloc(keyLen + 1);
+  f.value = malloc(valueLen + 1);
+  if (f.key == NULL || f.value == NULL) {
+    free(f.key);
+    free(f.value);
+    return;
+  }
+  makeKey(f.key, "key:", 42, keyLen);
+  memset(f.value, 'v', valueLen);
+  f.value[valueLen] = '\0';
+
+  char name[BENCH_NAME_SIZE];
+  char *get = kvstr_build_get_request(f.key);
+  char *put = kvstr_build_put_request(f.key, f.value);
+  if (get != NULL && put != NULL) {
+    if (withKeyOnly) {
+      f.request = get;
+      snprintf(name, sizeof(name), "parse/get/k%zu", keyLen);
+      runBench(name, benchParse, &f);
+    }
+    f.request = put;
+    snprintf(name, sizeof(name), "parse/put/k%zu/v%zu", keyLen, valueLen);
+    runBench(name, benchParse, &f);
+  }
+  free(get);
+  free(put);
+
+  if (withKeyOnly) {
+    snprintf(name, sizeof(name), "build/get/k%zu", keyLen);
+    runBench(name, benchBuildGet, &f);
+    snprintf(name, sizeof(name), "build/del/k%zu", keyLen);
+    runBench(name, benchBuildDel, &f);
+  }
+  snprintf(name, sizeof(name), "build/put/k%zu/v%zu", keyLen, valueLen);
+  runBench(name, benchBuildPut, &f);
+  snprintf(name, sizeof(name), "encode/put/k%zu/v%zu", keyLen, valueLen);
+  runBench(name, benchEncodePut, &f);
+
+  free(f.key);
+  free(f.value);
+}
+
+static void benchHotkeysRecord(void *ctx, long long iterations, bench_timer *timer) {
+  hotkeys_fixture *f = ctx;
+  timerStart(timer);
+  for (long long i = 0; i < iterations; i++) {
+    hotkeys_record(HOTKEYS_READ, f->keys + f->order[i & (BENCH_BATCH - 1)] * 16);
+  }
+  timerStop(timer);
+}
+
+static void benchHotkeys() {
+  hotkeys_fixture f;
+  f.keys = malloc(BENCH_HOTKEYS_KEYS * 16);
+  if (f.keys == NULL) {
+    return;
+  }
+  for (size_t i = 0; i < BENCH_HOTKEYS_KEYS; i++) {
+    makeKey(f.keys + i * 16, "key:", i, 15);
+  }
+
+  static const struct {
+    const char *name;
+    int hotPercent;
+  } benches[] = {{"hotkeys/record/uniform", 0}, {"hotkeys/record/hot50", 50}};
+  unsigned long long random = 42;
+  for (size_t b = 0; b < sizeof(benches) / sizeof(benches[0]); b++) {
+    for (int i = 0; i < BENCH_BATCH; i++) {
+      bool hot = (int)(nextRandom(&random) % 100) < benches[b].hotPercent;
+      f.order[i] = hot ? 0 : (unsigned int)(nextRandom(&random) % BENCH_HOTKEYS_KEYS);
+    }
+    hotkeys_reset();
+    runBench(benches[b].name, benchHotkeysRecord, &f);
+  }
+  free(f.keys);
+}
+
+static void benchEncode(void *ctx, long long iterations, bench_timer *timer) {
+  compress_fixture *f = ctx;
+  timerStart(timer);
+  for (long long i = 0; i < iterations; i++) {
+    f->blockLen = kvcompress_encode(f->text, BENCH_COMPRESS_SIZE, f->block, BENCH_COMPRESS_SIZE - BENCH_COMPRESS_SIZE / 8);
+  }
+  timerStop(timer);
+}
+
+static void benchDecode(void *ctx, long long iterations, bench_timer *timer) {
+  compress_fixture *f = ctx;
+  timerStart(timer);
+  for (long long i = 0; i < iterations; i++) {
+    kvcompress_decode(f->block, f->blockLen, f->decoded, BENCH_COMPRESS_SIZE);
+  }
+  timerStop(timer);
+}
+
+// JSON like text compresses, random bytes are given up on like the store does
+static void benchCompression() {
+  compress_fixture *f = calloc(1, sizeof(compress_fixture));
+  if (f == NULL) {
+    return;
+  }
+  unsigned long long random = 42;
+  size_t len = 0;
+  while (len < BENCH_COMPRESS_SIZE) {
+    char record[64];
+    int n = snprintf(record, sizeof(record), "{\"id\":%llu,\"name\":\"user\",\"active\":true},",
+                     nextRandom(&random) % 100000);
+    size_t copy = BENCH_COMPRESS_SIZE - len < (size_t)n ? BENCH_COMPRESS_SIZE - len : (size_t)n;
+    memcpy(f->text + len, record, copy);
+    len += copy;
+  }
+  f->blockLen = kvcompress_encode(f->text, BENCH_COMPRESS_SIZE, f->block, BENCH_COMPRESS_SIZE - BENCH_COMPRESS_SIZE / 8);
+  if (selected("compress/encode/json-4k")) {
+    printf("json-4k compresses to %zu bytes\n", f->blockLen);
+  }
+  runBench("compress/encode/json-4k", benchEncode, f);
+  runBench("compress/decode/json-4k", benchDecode, f);
+
+  for (size_t i = 0; i < BENCH_COMPRESS_SIZE; i++) {
+    f->text[i] = (char)nextRandom(&random);
+  }
+  runBench("compress/encode/random-4k", benchEncode, f);
+  free(f);
+}
+
+// "<name> <ns/op> <allocs/op>" per line, lines starting with '#' are comments
+static int loadBaseline(const char *path) {
+  FILE *file = fopen(path, "r");
+  if (file == NULL) {
+    return -1;
+  }
+  char line[256];
+  while (fgets(line, sizeof(line), file) != NULL && gl_baselineCount < BENCH_MAX_RESULTS) {
+    bench_result *r = &gl_baseline[gl_baselineCount];
+    if (line[0] != '#' && sscanf(line, "%63s %lf %lf", r->name, &r->nsPerOp, &r->allocsPerOp) == 3) {
+      gl_baselineCount++;
+    }
+  }
+  fclose(file);
+  return 0;
+}
+
+static int saveResults(const char *path) {
+  FILE *file = fopen(path, "w");
+  if (file == NULL) {
+    return -1;
+  }
+  fprintf(file, "# kv_bench results: <name> <ns/op> <allocs/op>\n");
+  for (int i = 0; i < gl_resultCount; i++) {
+    fprintf(file, "%s %.1f %.2f\n", gl_results[i].name, gl_results[i].nsPerOp, gl_results[i].allocsPerOp);
+  }
+  fclose(file);
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  size_t maxKeys = BENCH_DEFAULT_MAX_KEYS;
+  const char *savePath = NULL;
+  const char *comparePath = NULL;
+
+  // every option takes exactly one value
+  for (int i = 1; i < argc; i += 2) {
+    if (i + 1 >= argc) {
+      printf("Usage: %s [-max keys] [-time ms per benchmark] [-filter name part] [-save file] [-compare baseline file] "
+             "[-threshold %% slower]\n",
+             argv[0]);
+      return 1;
+    }
+
+    if (strcmp(argv[i], "-max") == 0) {
+      maxKeys = strtoull(argv[i + 1], NULL, 10);
+    } else if (strcmp(argv[i], "-time") == 0) {
+      gl_minTime = strtoull(argv[i + 1], NULL, 10) * 1000000ULL;
+    } else if (strcmp(argv[i], "-filter") == 0) {
+      gl_filter = argv[i + 1];
+    } else if (strcmp(argv[i], "-save") == 0) {
+      savePath = argv[i + 1];
+    } else if (strcmp(argv[i], "-compare") == 0) {
+      comparePath = argv[i + 1];
+    } else if (strcmp(argv[i], "-threshold") == 0) {
+      gl_threshold = atof(argv[i + 1]);
+    } else {
+      printf("Unknown option '%s' ignored.\n", argv[i]);
+    }
+  }
+
+  if (comparePath != NULL && loadBaseline(comparePath) != 0) {
+    printf("Cannot read the baseline '%s'.\n", comparePath);
+    return 1;
+  }
+
+  // the store scales with the number of keys, the key and value sizes matter when values are copied
+  for (size_t keys = 1000; keys <= maxKeys; keys *= 10) {
+    benchStore(keys, 16, 32, false);
+    benchIntKeys(keys);
+  }
+  size_t keys = maxKeys < 10000 ? maxKeys : 10000;
+  size_t keyLens[] = {16, 256};
+  size_t valueLens[] = {32, 1024, 65536};
+  for (int k = 0; k < 2 && keys > 0; k++) {
+    for (int v = 0; v < 3; v++) {
+      if (keyLens[k] != 16 || valueLens[v] != 32) {
+        benchStore(keys, keyLens[k], valueLens[v], true);
+      }
+    }
+  }
+  benchAllocators();
+
+  for (int v = 0; v < 3; v++) {
+    benchProtocol(16, valueLens[v], v == 0);
+  }
+  benchHotkeys();
+  benchCompression();
+
+  if (savePath != NULL && saveResults(savePath) != 0) {
+    printf("Cannot write the results to '%s'.\n", savePath);
+    return 1;
+  }
+  if (comparePath != NULL) {
+    printf("%d regressions against %s (more than %.1f%% slower or more allocations)\n", gl_regressions, comparePath,
+           gl_threshold);
+  }
+  return gl_regressions > 0 ? 1 : 0;
+}
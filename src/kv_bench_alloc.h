@@ -0,0 +1,22 @@
+#ifndef _KVSTR_KV_BENCH_ALLOC_H
+#define _KVSTR_KV_BENCH_ALLOC_H
+
+// force included into every file of kv_bench (-include), so the allocations of the measured code
+// are counted without changing it. The system headers are included first, their declarations
+// are not touched by the macros.
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+void *kv_bench_malloc(size_t size);
+void *kv_bench_calloc(size_t count, size_t size);
+void *kv_bench_realloc(void *ptr, size_t size);
+void kv_bench_free(void *ptr);
+
+#define malloc(size) kv_bench_malloc(size)
+#define calloc(count, size) kv_bench_calloc(count, size)
+#define realloc(ptr, size) kv_bench_realloc(ptr, size)
+#define free(ptr) kv_bench_free(ptr)
+
+#endif
@@ -0,0 +1,317 @@
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "kvalloc.h"
+
+#define KV_ALIGNMENT 16
+#define SLAB_CLASS_COUNT 28 // 16 byte steps up to 128, then four classes per power of two up to KV_SLAB_MAX_SIZE
+
+static size_t alignSize(size_t size) {
+    return size == 0 ? KV_ALIGNMENT : (size + KV_ALIGNMENT - 1) & ~(size_t)(KV_ALIGNMENT - 1);
+}
+
+// system
+
+static void* systemAlloc(kv_allocator* allocator, size_t size) {
+    (void)allocator;
+    return malloc(size);
+}
+
+static void* systemRealloc(kv_allocator* allocator, void* ptr, size_t old_size, size_t new_size) {
+    (void)allocator;
+    (void)old_size;
+    return realloc(ptr, new_size);
+}
+
+static void systemFree(kv_allocator* allocator, void* ptr, size_t size) {
+    (void)allocator;
+    (void)size;
+    free(ptr);
+}
+
+static kv_allocator gl_systemAllocator = {
+    .name = "system",
+    .allocate = systemAlloc,
+    .reallocate = systemRealloc,
+    .release = systemFree,
+};
+
+kv_allocator* kv_allocator_system() {
+    return &gl_systemAllocator;
+}
+
+// arena
+
+typedef struct arena_chunk {
+    struct arena_chunk* next;
+    size_t size; // usable bytes behind the header
+    size_t used;
+} arena_chunk;
+
+#define ARENA_HEADER_SIZE ((sizeof(arena_chunk) + KV_ALIGNMENT - 1) & ~(size_t)(KV_ALIGNMENT - 1))
+
+typedef struct arena_allocator {
+    kv_allocator base;
+    size_t chunk_size;
+    arena_chunk* chunks; // the one allocations are taken from first
+    size_t reserved;
+} arena_allocator;
+
+static char* chunkData(arena_chunk* chunk) {
+    return (char*)chunk + ARENA_HEADER_SIZE;
+}
+
+static void* arenaAlloc(kv_allocator* allocator, size_t size) {
+    arena_allocator* arena = (arena_allocator*)allocator;
+    size = alignSize(size);
+    arena_chunk* current = arena->chunks;
+    if (current != NULL && current->size - current->used >= size) {
+        void* ptr = chunkData(current) + current->used;
+        current->used += size;
+        return ptr;
+    }
+
+    // allocations larger than a chunk get one of their own, the current chunk stays in use
+    size_t chunkSize = size > arena->chunk_size ? size : arena->chunk_size;
+    arena_chunk* chunk = malloc(ARENA_HEADER_SIZE + chunkSize);
+    if (chunk == NULL) {
+        return NULL;
+    }
+    chunk->size = chunkSize;
+    chunk->used = size;
+    if (chunkSize > arena->chunk_size && current != NULL) {
+        chunk->next = current->next;
+        current->next = chunk;
+    } else {
+        chunk->next = current;
+        arena->chunks = chunk;
+    }
+    arena->reserved += ARENA_HEADER_SIZE + chunkSize;
+    return chunkData(chunk);
+}
+
+static bool isLastAllocation(arena_chunk* chunk, void* ptr, size_t size) {
+    return chunk != NULL && (char*)ptr + size == chunkData(chunk) + chunk->used;
+}
+
+static void arenaFree(kv_allocator* allocator, void* ptr, size_t size) {
+    arena_allocator* arena = (arena_allocator*)allocator;
+    size = alignSize(size);
+    if (ptr != NULL && isLastAllocation(arena->chunks, ptr, size)) {
+        arena->chunks->used -= size;
+    }
+}
+
+static void* arenaRealloc(kv_allocator* allocator, void* ptr, size_t old_size, size_t new_size) {
+    arena_allocator* arena = (arena_allocator*)allocator;
+    if (ptr == NULL) {
+        return arenaAlloc(allocator, new_size);
+    }
+
+    // the last allocation can grow or shrink in place
+    arena_chunk* current = arena->chunks;
+    size_t oldAligned = alignSize(old_size);
+    size_t newAligned = alignSize(new_size);
+    if (isLastAllocation(current, ptr, oldAligned) && current->size - (current->used - oldAligned) >= newAligned) {
+        current->used = current->used - oldAligned + newAligned;
+        return ptr;
+    }
+
+    void* moved = arenaAlloc(allocator, new_size);
+    if (moved == NULL) {
+        return NULL;
+    }
+    memcpy(moved, ptr, old_size < new_size ? old_size : new_size);
+    arenaFree(allocator, ptr, old_size);
+    return moved;
+}
+
+static size_t arenaReserved(kv_allocator* allocator) {
+    return ((arena_allocator*)allocator)->reserved;
+}
+
+static void arenaDestroy(kv_allocator* allocator) {
+    arena_allocator* arena = (arena_allocator*)allocator;
+    arena_chunk* chunk = arena->chunks;
+    while (chunk != NULL) {
+        arena_chunk* next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    free(arena);
+}
+
+kv_allocator* kv_allocator_arena(size_t chunk_size) {
+    arena_allocator* arena = calloc(1, sizeof(arena_allocator));
+    if (arena == NULL) {
+        return NULL;
+    }
+    arena->base = (kv_allocator){
+        .name = "arena",
+        .allocate = arenaAlloc,
+        .reallocate = arenaRealloc,
+        .release = arenaFree,
+        .reserved = arenaReserved,
+        .destroy = arenaDestroy,
+    };
+    arena->chunk_size = alignSize(chunk_size);
+    return &arena->base;
+}
+
+// slab
+
+typedef struct slab_allocator {
+    kv_allocator base;
+    void* free_lists[SLAB_CLASS_COUNT]; // every free allocation starts with the pointer to the next one
+    char* carve[SLAB_CLASS_COUNT];      // not yet used part of the latest page of the class
+    char* carve_end[SLAB_CLASS_COUNT];
+    void* pages;                        // every page starts with the pointer to the next one
+    size_t page_count;
+    size_t large_bytes;                 // allocations passed to malloc
+} slab_allocator;
+
+#define SLAB_HEADER_SIZE KV_ALIGNMENT
+
+static int sizeClass(size_t size) {
+    if (size <= 128) {
+        return size == 0 ? 0 : (int)((size - 1) / 16);
+    }
+    int power = 63 - __builtin_clzll(size - 1); // 2^power < size <= 2^(power + 1)
+    size_t step = (size_t)1 << (power - 2);
+    size_t steps = (size - ((size_t)1 << power) + step - 1) / step;
+    return 8 + (power - 7) * 4 + (int)steps - 1;
+}
+
+static size_t classSize(int sizeClass) {
+    if (sizeClass < 8) {
+        return (size_t)(sizeClass + 1) * 16;
+    }
+    int power = 7 + (sizeClass - 8) / 4;
+    return ((size_t)1 << power) + (size_t)((sizeClass - 8) % 4 + 1) * ((size_t)1 << (power - 2));
+}
+
+static void* slabAlloc(kv_allocator* allocator, size_t size) {
+    slab_allocator* slab = (slab_allocator*)allocator;
+    if (size > KV_SLAB_MAX_SIZE) {
+        void* ptr = malloc(size);
+        if (ptr != NULL) {
+            slab->large_bytes += size;
+        }
+        return ptr;
+    }
+
+    int cls = sizeClass(size);
+    void* ptr = slab->free_lists[cls];
+    if (ptr != NULL) {
+        slab->free_lists[cls] = *(void**)ptr;
+        return ptr;
+    }
+
+    size_t objectSize = classSize(cls);
+    if (slab->carve[cls] == NULL || (size_t)(slab->carve_end[cls] - slab->carve[cls]) < objectSize) {
+        char* page = malloc(KV_SLAB_PAGE_SIZE);
+        if (page == NULL) {
+            return NULL;
+        }
+        *(void**)page = slab->pages;
+        slab->pages = page;
+        slab->page_count++;
+        slab->carve[cls] = page + SLAB_HEADER_SIZE;
+        slab->carve_end[cls] = page + KV_SLAB_PAGE_SIZE;
+    }
+    ptr = slab->carve[cls];
+    slab->carve[cls] += objectSize;
+    return ptr;
+}
+
+static void slabFree(kv_allocator* allocator, void* ptr, size_t size) {
+    slab_allocator* slab = (slab_allocator*)allocator;
+    if (ptr == NULL) {
+        return;
+    }
+    if (size > KV_SLAB_MAX_SIZE) {
+        slab->large_bytes -= size;
+        free(ptr);
+        return;
+    }
+    int cls = sizeClass(size);
+    *(void**)ptr = slab->free_lists[cls];
+    slab->free_lists[cls] = ptr;
+}
+
+static void* slabRealloc(kv_allocator* allocator, void* ptr, size_t old_size, size_t new_size) {
+    slab_allocator* slab = (slab_allocator*)allocator;
+    if (ptr == NULL) {
+        return slabAlloc(allocator, new_size);
+    }
+    if (old_size > KV_SLAB_MAX_SIZE && new_size > KV_SLAB_MAX_SIZE) {
+        void* moved = realloc(ptr, new_size);
+        if (moved != NULL) {
+            slab->large_bytes = slab->large_bytes - old_size + new_size;
+        }
+        return moved;
+    }
+    if (old_size <= KV_SLAB_MAX_SIZE && new_size <= KV_SLAB_MAX_SIZE && sizeClass(old_size) == sizeClass(new_size)) {
+        return ptr;
+    }
+
+    void* moved = slabAlloc(allocator, new_size);
+    if (moved == NULL) {
+        return NULL;
+    }
+    memcpy(moved, ptr, old_size < new_size ? old_size : new_size);
+    slabFree(allocator, ptr, old_size);
+    return moved;
+}
+
+static size_t slabReserved(kv_allocator* allocator) {
+    slab_allocator* slab = (slab_allocator*)allocator;
+    return slab->page_count * KV_SLAB_PAGE_SIZE + slab->large_bytes;
+}
+
+// allocations larger than KV_SLAB_MAX_SIZE have to be freed before
+static void slabDestroy(kv_allocator* allocator) {
+    slab_allocator* slab = (slab_allocator*)allocator;
+    void* page = slab->pages;
+    while (page != NULL) {
+        void* next = *(void**)page;
+        free(page);
+        page = next;
+    }
+    free(slab);
+}
+
+kv_allocator* kv_allocator_slab() {
+    slab_allocator* slab = calloc(1, sizeof(slab_allocator));
+    if (slab == NULL) {
+        return NULL;
+    }
+    slab->base = (kv_allocator){
+        .name = "slab",
+        .allocate = slabAlloc,
+        .reallocate = slabRealloc,
+        .release = slabFree,
+        .reserved = slabReserved,
+        .destroy = slabDestroy,
+    };
+    return &slab->base;
+}
+
+kv_allocator* kv_allocator_create(const char* name) {
+    if (strcmp(name, "system") == 0) {
+        return kv_allocator_system();
+    }
+    if (strcmp(name, "arena") == 0) {
+        return kv_allocator_arena(KV_ARENA_CHUNK_SIZE);
+    }
+    if (strcmp(name, "slab") == 0) {
+        return kv_allocator_slab();
+    }
+    return NULL;
+}
+
+void kv_allocator_destroy(kv_allocator* allocator) {
+    if (allocator != NULL && allocator->destroy != NULL) {
+        allocator->destroy(allocator);
+    }
+}
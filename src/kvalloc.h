@@ -0,0 +1,29 @@
+#ifndef _KVALLOC_H_
+#define _KVALLOC_H_
+
+#include <stddef.h>
+
+#define KV_ARENA_CHUNK_SIZE (1024 * 1024)    // bytes the arena allocator requests from the system at once
+#define KV_SLAB_PAGE_SIZE (64 * 1024)        // bytes the slab allocator carves into allocations of one size class
+#define KV_SLAB_MAX_SIZE 4096                // larger allocations are passed to malloc by the slab allocator
+
+// Allocation strategy of a key value store. The store calls it with its own lock held, so an allocator
+// does not need to be thread-safe. Sizes are passed back on reallocate and release, an allocator does not need
+// to remember them. A user-supplied allocator embeds this struct as its first member.
+typedef struct kv_allocator {
+    const char* name;
+    void* (*allocate)(struct kv_allocator* allocator, size_t size);
+    void* (*reallocate)(struct kv_allocator* allocator, void* ptr, size_t old_size, size_t new_size);
+    void (*release)(struct kv_allocator* allocator, void* ptr, size_t size);
+    size_t (*reserved)(struct kv_allocator* allocator); // bytes held from the system, NULL if unknown
+    void (*destroy)(struct kv_allocator* allocator);    // releases all memory of the allocator, NULL if there is none
+} kv_allocator;
+
+// prototypes
+kv_allocator* kv_allocator_system(); // malloc, realloc and free, shared by all stores
+kv_allocator* kv_allocator_arena(size_t chunk_size); // bump allocator, freed memory is only reused if it was the last allocation
+kv_allocator* kv_allocator_slab(); // free lists of size classes up to KV_SLAB_MAX_SIZE bytes
+kv_allocator* kv_allocator_create(const char* name); // "system", "arena" or "slab" with default settings, NULL if unknown
+void kv_allocator_destroy(kv_allocator* allocator); // does nothing for allocators without destroy
+
+#endif
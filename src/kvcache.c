@@ -0,0 +1,280 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "kvcache.h"
+#include "kvstrprotocol.h"
+#include "utilfuns.h"
+
+/*
+ * The cache talks to the server over a session with TRACKING ON. The server remembers every key
+ * the session reads and pushes "INVALIDATE <len>:<key>" once it changes. Pushes arrive in the
+ * same stream as the responses, always behind the response that carried the old value, and
+ * everything received is applied before a GET is answered from the cache.
+ */
+
+typedef struct cache_entry {
+  char *key;
+  char *response;               // "200 <value>"
+  size_t length;
+  struct cache_entry *next;     // in the bucket
+  struct cache_entry *newer;    // in the order of use
+  struct cache_entry *older;
+} cache_entry;
+
+struct kvcache {
+  char *address;
+  kvclient_conn *conn;          // NULL until the next request connects again
+  size_t maxEntries;
+  cache_entry **buckets;
+  size_t bucketCount;
+  cache_entry *newest;
+  cache_entry *oldest;
+  kvcache_stats stats;
+};
+
+static size_t hashKey(const char *key, size_t len) {
+  unsigned long long h = 14695981039346656037ULL;
+  for (size_t i = 0; i < len; i++) {
+    h ^= (unsigned char)key[i];
+    h *= 1099511628211ULL;
+  }
+  return (size_t)h;
+}
+
+static cache_entry **findEntry(kvcache *cache, const char *key, size_t len) {
+  cache_entry **link = &cache->buckets[hashKey(key, len) & (cache->bucketCount - 1)];
+  while (*link != NULL && (strlen((*link)->key) != len || memcmp((*link)->key, key, len) != 0)) {
+    link = &(*link)->next;
+  }
+  return link;
+}
+
+static void unlinkUse(kvcache *cache, cache_entry *e) {
+  if (e->newer != NULL) {
+    e->newer->older = e->older;
+  } else {
+    cache->newest = e->older;
+  }
+  if (e->older != NULL) {
+    e->older->newer = e->newer;
+  } else {
+    cache->oldest = e->newer;
+  }
+}
+
+static void linkNewest(kvcache *cache, cache_entry *e) {
+  e->newer = NULL;
+  e->older = cache->newest;
+  if (cache->newest != NULL) {
+    cache->newest->newer = e;
+  } else {
+    cache->oldest = e;
+  }
+  cache->newest = e;
+}
+
+static void removeEntry(kvcache *cache, cache_entry **link) {
+  cache_entry *e = *link;
+  *link = e->next;
+  unlinkUse(cache, e);
+  cache->stats.entries--;
+  free(e->key);
+  free(e->response);
+  free(e);
+}
+
+static void removeKey(kvcache *cache, const char *key, size_t len) {
+  cache_entry **link = findEntry(cache, key, len);
+  if (*link != NULL) {
+    removeEntry(cache, link);
+  }
+}
+
+static void clearEntries(kvcache *cache) {
+  while (cache->oldest != NULL) {
+    removeKey(cache, cache->oldest->key, strlen(cache->oldest->key));
+  }
+}
+
+static void storeEntry(kvcache *cache, const char *key, const char *response, size_t length) {
+  if (cache->stats.entries >= cache->maxEntries && cache->oldest != NULL) {
+    removeKey(cache, cache->oldest->key, strlen(cache->oldest->key));
+    cache->stats.evictions++;
+  }
+
+  cache_entry *e = calloc(1, sizeof(cache_entry));
+  char *copy = malloc(length + 1);
+  if (e == NULL || copy == NULL || (e->key = duplicate_string(key)) == NULL) {
+    free(e);
+    free(copy);
+    return;
+  }
+  memcpy(copy, response, length + 1);
+  e->response = copy;
+  e->length = length;
+  cache_entry **link = findEntry(cache, key, strlen(key));
+  e->next = *link;
+  *link = e;
+  linkNewest(cache, e);
+  cache->stats.entries++;
+}
+
+// "INVALIDATE <len>:<key>" for one key, "INVALIDATE" alone for all of them
+static void onPush(void *ctx, const char *message, size_t length) {
+  kvcache *cache = (kvcache *)ctx;
+  size_t prefixLen = strlen(KVCLIENT_INVALIDATE_PREFIX);
+  if (length < prefixLen || memcmp(message, KVCLIENT_INVALIDATE_PREFIX, prefixLen) != 0) {
+    return; // the cache does not watch keys
+  }
+  if (length == prefixLen) {
+    cache->stats.invalidations += cache->stats.entries;
+    clearEntries(cache);
+    return;
+  }
+
+  char *end;
+  size_t keyLen = strtoull(message + prefixLen + 1, &end, 10);
+  if (*end == ':' && (size_t)(end + 1 - message) + keyLen == length) {
+    size_t before = cache->stats.entries;
+    removeKey(cache, end + 1, keyLen);
+    cache->stats.invalidations += before - cache->stats.entries;
+  }
+}
+
+// the cached values cannot be trusted without the session that would invalidate them
+static void dropConnection(kvcache *cache) {
+  kvclient_close(&cache->conn);
+  clearEntries(cache);
+}
+
+static int connectCache(kvcache *cache) {
+  if (cache->conn != NULL) {
+    return 0;
+  }
+  cache->conn = kvclient_connect_address(cache->address);
+  if (cache->conn == NULL || kvclient_hello(cache->conn) != 0) {
+    kvclient_close(&cache->conn); // sessions require the server to run in worker mode
+    return -1;
+  }
+  cache->conn->on_push = onPush;
+  cache->conn->push_ctx = cache;
+
+  const char *tracking = "TRACKING 2:ON";
+  char *response = kvclient_send(cache->conn, tracking, strlen(tracking)) == 0
+                       ? kvclient_recv_frame(cache->conn, NULL)
+                       : NULL;
+  bool tracked = response != NULL && strncmp(response, "200", 3) == 0;
+  free(response);
+  if (!tracked) {
+    kvclient_close(&cache->conn);
+    return -1;
+  }
+  return 0;
+}
+
+static char *sendRequest(kvcache *cache, const char *operation, const char *key, const char *value,
+                         size_t valueLength, size_t *length) {
+  char header[KVSTR_MAX_HEADER_SIZE];
+  kvstr_iovec iov[KVSTR_MAX_IOVEC];
+  int count = kvstr_encode_request(operation, key, strlen(key), value, valueLength, header, sizeof(header), iov);
+  if (count < 0 || connectCache(cache) != 0) {
+    return NULL;
+  }
+
+  char *response = kvclient_sendv(cache->conn, iov, count) == 0 ? kvclient_recv_frame(cache->conn, length) : NULL;
+  if (response == NULL) {
+    dropConnection(cache);
+  }
+  return response;
+}
+
+kvcache *kvcache_create(const char *address, size_t maxEntries) {
+  kvcache *cache = calloc(1, sizeof(kvcache));
+  if (cache == NULL) {
+    return NULL;
+  }
+  cache->maxEntries = maxEntries > 0 ? maxEntries : KVCACHE_DEFAULT_ENTRIES;
+  cache->bucketCount = 16;
+  while (cache->bucketCount < cache->maxEntries) {
+    cache->bucketCount *= 2;
+  }
+  cache->address = duplicate_string(address);
+  cache->buckets = calloc(cache->bucketCount, sizeof(cache_entry *));
+  if (cache->address == NULL || cache->buckets == NULL) {
+    kvcache_destroy(cache);
+    return NULL;
+  }
+  return cache;
+}
+
+void kvcache_destroy(kvcache *cache) {
+  if (cache == NULL) {
+    return;
+  }
+  if (cache->buckets != NULL) {
+    dropConnection(cache);
+  }
+  free(cache->buckets);
+  free(cache->address);
+  free(cache);
+}
+
+char *kvcache_get(kvcache *cache, const char *key, size_t *length) {
+  if (key == NULL) {
+    return NULL;
+  }
+
+  // invalidations that arrived since the last request apply before anything is served locally
+  if (cache->conn != NULL && kvclient_poll_pushes(cache->conn) != 0) {
+    dropConnection(cache);
+  }
+
+  cache_entry **link = findEntry(cache, key, strlen(key));
+  if (*link != NULL) {
+    cache_entry *e = *link;
+    unlinkUse(cache, e);
+    linkNewest(cache, e);
+    cache->stats.hits++;
+
+    char *response = malloc(e->length + 1);
+    if (response != NULL) {
+      memcpy(response, e->response, e->length + 1);
+      if (length != NULL) {
+        *length = e->length;
+      }
+    }
+    return response;
+  }
+
+  cache->stats.misses++;
+  size_t len = 0;
+  char *response = sendRequest(cache, "GET", key, NULL, 0, &len);
+  if (response != NULL && strncmp(response, "200", 3) == 0) {
+    storeEntry(cache, key, response, len);
+  }
+  if (response != NULL && length != NULL) {
+    *length = len;
+  }
+  return response;
+}
+
+char *kvcache_put(kvcache *cache, const char *key, const char *value, size_t valueLength) {
+  if (key == NULL || value == NULL) {
+    return NULL;
+  }
+  removeKey(cache, key, strlen(key));
+  return sendRequest(cache, "PUT", key, value, valueLength, NULL);
+}
+
+char *kvcache_del(kvcache *cache, const char *key) {
+  if (key == NULL) {
+    return NULL;
+  }
+  removeKey(cache, key, strlen(key));
+  return sendRequest(cache, "DEL", key, NULL, 0, NULL);
+}
+
+void kvcache_get_stats(const kvcache *cache, kvcache_stats *stats) {
+  *stats = cache->stats;
+}
@@ -0,0 +1,30 @@
+#ifndef _KVSTR_KVCACHE_H
+#define _KVSTR_KVCACHE_H
+
+#include <stddef.h>
+
+#include "kvclient.h"
+
+#define KVCACHE_DEFAULT_ENTRIES 10000
+
+// values read from one server kept in the client, the server invalidates them when they change.
+// a cache uses a single session and must not be used by several threads at once
+typedef struct kvcache kvcache;
+
+typedef struct kvcache_stats {
+  unsigned long long hits;           // GETs answered from the cache
+  unsigned long long misses;         // ... and sent to the server
+  unsigned long long invalidations;  // values dropped because the server reported a change
+  unsigned long long evictions;      // ... or because the cache was full
+  size_t entries;
+} kvcache_stats;
+
+/* Prototypes */
+kvcache *kvcache_create(const char *address, size_t maxEntries); // "host:port" or "unix:<path>", the server has to run in worker mode
+void kvcache_destroy(kvcache *cache);
+char *kvcache_get(kvcache *cache, const char *key, size_t *length); // response like the server's ("200 <value>", "404 Not Found", ...), free() it, NULL if the server cannot be reached
+char *kvcache_put(kvcache *cache, const char *key, const char *value, size_t valueLength);
+char *kvcache_del(kvcache *cache, const char *key);
+void kvcache_get_stats(const kvcache *cache, kvcache_stats *stats);
+
+#endif
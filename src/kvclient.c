@@ -0,0 +1,452 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "kvclient.h"
+#include "kvcompress.h"
+
+#ifdef _WIN64
+#include <ws2tcpip.h>
+#include <afunix.h>
+#endif
+
+int kvclient_init() {
+  WSADATA wsaData = {0};
+  return WSAStartup(MAKEWORD(2, 2), &wsaData);
+}
+
+void kvclient_cleanup() {
+  WSACleanup();
+}
+
+static SOCKET connectUnix(const char *path) {
+  struct sockaddr_un addr = {0};
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    return INVALID_SOCKET;
+  }
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, path);
+
+  SOCKET sock = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (sock == INVALID_SOCKET) {
+    return INVALID_SOCKET;
+  }
+  if (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) == SOCKET_ERROR) {
+    closesocket(sock);
+    return INVALID_SOCKET;
+  }
+  return sock;
+}
+
+static SOCKET connectTcp(const char *server, int port) {
+  struct addrinfo hints = {0};
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_protocol = IPPROTO_TCP;
+
+  char portStr[16];
+  snprintf(portStr, sizeof(portStr), "%d", port);
+
+  struct addrinfo *result = NULL;
+  if (getaddrinfo(server, portStr, &hints, &result) != 0) {
+    return INVALID_SOCKET;
+  }
+
+  SOCKET sock = INVALID_SOCKET;
+  for (struct addrinfo *ai = result; ai != NULL; ai = ai->ai_next) {
+    sock = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+    if (sock == INVALID_SOCKET) {
+      continue;
+    }
+    if (connect(sock, ai->ai_addr, (int)ai->ai_addrlen) == 0) {
+      break;
+    }
+    closesocket(sock);
+    sock = INVALID_SOCKET;
+  }
+  freeaddrinfo(result);
+
+  if (sock != INVALID_SOCKET) {
+    // requests are small and sent at once, waiting for more data only adds latency
+    int noDelay = 1;
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, (const char *)&noDelay, sizeof(noDelay));
+  }
+  return sock;
+}
+
+kvclient_conn *kvclient_connect(const char *server, int port) {
+  if (server == NULL) {
+    return NULL;
+  }
+
+  size_t prefixLen = strlen(KVCLIENT_UNIX_PREFIX);
+  SOCKET sock = strncmp(server, KVCLIENT_UNIX_PREFIX, prefixLen) == 0 ? connectUnix(server + prefixLen)
+                                                                      : connectTcp(server, port);
+  if (sock == INVALID_SOCKET) {
+    return NULL;
+  }
+
+  kvclient_conn *conn = calloc(1, sizeof(kvclient_conn));
+  if (conn == NULL) {
+    closesocket(sock);
+    return NULL;
+  }
+  conn->sock = sock;
+  return conn;
+}
+
+kvclient_conn *kvclient_connect_address(const char *address) {
+  if (address == NULL) {
+    return NULL;
+  }
+  if (strncmp(address, KVCLIENT_UNIX_PREFIX, strlen(KVCLIENT_UNIX_PREFIX)) == 0) {
+    return kvclient_connect(address, 0);
+  }
+
+  // the port follows the last colon
+  const char *separator = strrchr(address, ':');
+  size_t hostLen = separator != NULL ? (size_t)(separator - address) : 0;
+  char host[256];
+  if (hostLen == 0 || hostLen >= sizeof(host)) {
+    return NULL;
+  }
+  memcpy(host, address, hostLen);
+  host[hostLen] = '\0';
+  return kvclient_connect(host, atoi(separator + 1));
+}
+
+void kvclient_close(kvclient_conn **conn) {
+  if (conn == NULL || *conn == NULL) {
+    return;
+  }
+  closesocket((*conn)->sock);
+  free(*conn);
+  *conn = NULL;
+}
+
+int kvclient_send(kvclient_conn *conn, const char *buffer, size_t length) {
+  size_t sent = 0;
+  while (sent < length) {
+    int n = send(conn->sock, buffer + sent, (int)(length - sent), 0);
+    if (n == SOCKET_ERROR) {
+      return SOCKET_ERROR;
+    }
+    sent += n;
+  }
+  return 0;
+}
+
+int kvclient_sendv(kvclient_conn *conn, const kvstr_iovec *iov, int count) {
+  if (count < 0 || count > KVCLIENT_MAX_IOVEC) {
+    return SOCKET_ERROR;
+  }
+  WSABUF buffers[KVCLIENT_MAX_IOVEC];
+  int first = 0;
+  for (int i = 0; i < count; i++) {
+    buffers[i].buf = (char *)iov[i].base;
+    buffers[i].len = (ULONG)iov[i].len;
+  }
+
+  while (first < count) {
+    DWORD sent = 0;
+    if (WSASend(conn->sock, buffers + first, (DWORD)(count - first), &sent, 0, NULL, NULL) == SOCKET_ERROR) {
+      return SOCKET_ERROR;
+    }
+
+    // a partial send continues behind the last byte that went out
+    while (first < count && sent >= buffers[first].len) {
+      sent -= buffers[first].len;
+      first++;
+    }
+    if (first < count) {
+      buffers[first].buf += sent;
+      buffers[first].len -= sent;
+    }
+  }
+  return 0;
+}
+
+int kvclient_sendv_draining(kvclient_conn *conn, const kvstr_iovec *iov, int count, kvclient_drain_fn drain, void *ctx) {
+  if (count < 0 || count > KVCLIENT_MAX_IOVEC) {
+    return SOCKET_ERROR;
+  }
+  WSABUF buffers[KVCLIENT_MAX_IOVEC];
+  int first = 0;
+  for (int i = 0; i < count; i++) {
+    buffers[i].buf = (char *)iov[i].base;
+    buffers[i].len = (ULONG)iov[i].len;
+  }
+
+  bool draining = true;
+  while (first < count) {
+    // only the send must not wait, drain reads whole responses from the blocking socket
+    u_long nonBlocking = 1;
+    ioctlsocket(conn->sock, FIONBIO, &nonBlocking);
+    DWORD sent = 0;
+    int result = WSASend(conn->sock, buffers + first, (DWORD)(count - first), &sent, 0, NULL, NULL);
+    bool wouldBlock = result == SOCKET_ERROR && WSAGetLastError() == WSAEWOULDBLOCK;
+    nonBlocking = 0;
+    ioctlsocket(conn->sock, FIONBIO, &nonBlocking);
+    if (result == SOCKET_ERROR && !wouldBlock) {
+      return SOCKET_ERROR;
+    }
+
+    while (first < count && sent >= buffers[first].len) {
+      sent -= buffers[first].len;
+      first++;
+    }
+    if (first == count) {
+      break;
+    }
+    buffers[first].buf += sent;
+    buffers[first].len -= sent;
+
+    // wait until the socket takes more, reading responses meanwhile lets the server go on reading
+    fd_set readSet, writeSet;
+    FD_ZERO(&readSet);
+    FD_ZERO(&writeSet);
+    if (draining) {
+      FD_SET(conn->sock, &readSet);
+    }
+    FD_SET(conn->sock, &writeSet);
+    if (select((int)conn->sock + 1, &readSet, &writeSet, NULL, NULL) == SOCKET_ERROR) {
+      return SOCKET_ERROR;
+    }
+    if (FD_ISSET(conn->sock, &readSet)) {
+      int drained = drain(ctx);
+      if (drained < 0) {
+        return SOCKET_ERROR;
+      }
+      draining = drained == 0;
+    }
+  }
+  return 0;
+}
+
+// receives more bytes into the buffer, returns the number of bytes or <= 0 if the connection is gone
+static int fillBuffer(kvclient_conn *conn) {
+  if (conn->start == conn->end) {
+    conn->start = 0;
+    conn->end = 0;
+  }
+  int n = recv(conn->sock, conn->buffer + conn->end, (int)(KVCLIENT_BUFFER_SIZE - conn->end), 0);
+  if (n > 0) {
+    conn->end += n;
+  }
+  return n;
+}
+
+char *kvclient_recv_response(kvclient_conn *conn, size_t *length) {
+  size_t capacity = KVCLIENT_BUFFER_SIZE;
+  size_t len = 0;
+  char *response = malloc(capacity + 1);
+  if (response == NULL) {
+    return NULL;
+  }
+
+  // bytes that were already received belong to this response
+  len = conn->end - conn->start;
+  memcpy(response, conn->buffer + conn->start, len);
+  conn->start = conn->end;
+
+  int n;
+  while (true) {
+    if (len == capacity) {
+      char *grown = realloc(response, capacity * 2 + 1);
+      if (grown == NULL) {
+        free(response);
+        return NULL;
+      }
+      response = grown;
+      capacity *= 2;
+    }
+    n = recv(conn->sock, response + len, (int)(capacity - len), 0);
+    if (n <= 0) {
+      break;
+    }
+    len += n;
+  }
+
+  if (n < 0) {
+    free(response);
+    return NULL;
+  }
+
+  response[len] = '\0';
+  if (length != NULL) {
+    *length = len;
+  }
+  return response;
+}
+
+static char *readFrame(kvclient_conn *conn, size_t *length) {
+  // length prefix up to the colon
+  size_t len = 0;
+  int digits = 0;
+  while (true) {
+    if (conn->start == conn->end && fillBuffer(conn) <= 0) {
+      return NULL;
+    }
+    char c = conn->buffer[conn->start++];
+    if (c == ':' && digits > 0) {
+      break;
+    }
+    // checked per digit, so the length can neither wrap around nor make len + 1 overflow
+    if (c < '0' || c > '9' || (len = len * 10 + (c - '0')) > KVCLIENT_MAX_FRAME_SIZE) {
+      return NULL;
+    }
+    digits++;
+  }
+
+  char *response = malloc(len + 1);
+  if (response == NULL) {
+    return NULL;
+  }
+
+  size_t received = conn->end - conn->start < len ? conn->end - conn->start : len;
+  memcpy(response, conn->buffer + conn->start, received);
+  conn->start += received;
+
+  // the rest of a large response goes straight into its buffer
+  while (received < len) {
+    int n = recv(conn->sock, response + received, (int)(len - received), 0);
+    if (n <= 0) {
+      free(response);
+      return NULL;
+    }
+    received += n;
+  }
+
+  response[len] = '\0';
+  if (length != NULL) {
+    *length = len;
+  }
+  return response;
+}
+
+static bool hasPrefix(const char *frame, size_t length, const char *prefix) {
+  size_t prefixLen = strlen(prefix);
+  return length >= prefixLen && memcmp(frame, prefix, prefixLen) == 0 &&
+         (length == prefixLen || frame[prefixLen] == ' ');
+}
+
+static bool isPush(const char *frame, size_t length) {
+  return hasPrefix(frame, length, KVCLIENT_INVALIDATE_PREFIX) || hasPrefix(frame, length, KVCLIENT_NOTIFY_PREFIX);
+}
+
+char *kvclient_recv_frame(kvclient_conn *conn, size_t *length) {
+  while (true) {
+    size_t len = 0;
+    char *frame = readFrame(conn, &len);
+    if (frame == NULL || conn->on_push == NULL || !isPush(frame, len)) {
+      if (frame != NULL && length != NULL) {
+        *length = len;
+      }
+      return frame;
+    }
+    conn->on_push(conn->push_ctx, frame, len);
+    free(frame);
+  }
+}
+
+int kvclient_poll_pushes(kvclient_conn *conn) {
+  return kvclient_wait_pushes(conn, 0);
+}
+
+int kvclient_wait_pushes(kvclient_conn *conn, int timeoutMs) {
+  while (true) {
+    if (conn->start == conn->end) {
+      fd_set readSet;
+      FD_ZERO(&readSet);
+      FD_SET(conn->sock, &readSet);
+      struct timeval timeout = {timeoutMs / 1000, (timeoutMs % 1000) * 1000};
+      int r = select((int)conn->sock + 1, &readSet, NULL, NULL, timeoutMs < 0 ? NULL : &timeout);
+      if (r == 0) {
+        return 0;
+      } else if (r == SOCKET_ERROR) {
+        return -1;
+      }
+    }
+
+    // nothing was requested, so anything that arrived has to be a push
+    size_t len = 0;
+    char *frame = readFrame(conn, &len);
+    bool push = frame != NULL && isPush(frame, len);
+    if (push && conn->on_push != NULL) {
+      conn->on_push(conn->push_ctx, frame, len);
+    }
+    free(frame);
+    if (!push) {
+      return -1;
+    }
+    timeoutMs = 0; // only the first push is waited for
+  }
+}
+
+int kvclient_hello(kvclient_conn *conn) {
+  const char *hello = "HELLO\r\n";
+  if (kvclient_send(conn, hello, strlen(hello)) != 0) {
+    return -1;
+  }
+
+  // a server that does not support sessions answers unframed and closes the connection
+  char *response = kvclient_recv_frame(conn, NULL);
+  if (response == NULL) {
+    return -1;
+  }
+  int r = strncmp(response, "200", 3) == 0 ? 0 : -1;
+  free(response);
+  if (r == 0) {
+    conn->session = true;
+  }
+  return r;
+}
+
+char *kvclient_request(kvclient_conn *conn, const char *request, size_t *length) {
+  if (kvclient_send(conn, request, strlen(request)) != 0) {
+    return NULL;
+  }
+  return conn->session ? kvclient_recv_frame(conn, length) : kvclient_recv_response(conn, length);
+}
+
+char *kvclient_getz_value(const char *response, size_t length, size_t *valueLength) {
+  const char *end = response + length;
+  if (length > 8 && memcmp(response, "200 raw ", 8) == 0) {
+    size_t len = length - 8;
+    char *value = malloc(len + 1);
+    if (value == NULL) {
+      return NULL;
+    }
+    memcpy(value, response + 8, len);
+    value[len] = '\0';
+    *valueLength = len;
+    return value;
+  }
+  if (length < 7 || memcmp(response, "200 lz ", 7) != 0) {
+    return NULL;
+  }
+
+  // "200 lz <length of the value> <block>"
+  size_t len = 0;
+  const char *p = response + 7;
+  for (; p < end && *p >= '0' && *p <= '9'; p++) {
+    // like the length of a frame, so malloc(len + 1) can neither wrap around nor be huge
+    if ((len = len * 10 + (size_t)(*p - '0')) > KVCLIENT_MAX_FRAME_SIZE) {
+      return NULL;
+    }
+  }
+  if (p == response + 7 || p == end || *p != ' ') {
+    return NULL;
+  }
+  p++;
+  char *value = malloc(len + 1);
+  if (value == NULL) {
+    return NULL;
+  }
+  if (kvcompress_decode(p, (size_t)(end - p), value, len) != 0) {
+    free(value);
+    return NULL;
+  }
+  value[len] = '\0';
+  *valueLength = len;
+  return value;
+}
@@ -0,0 +1,55 @@
+#ifndef _KVSTR_KVCLIENT_H
+#define _KVSTR_KVCLIENT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "kvstrprotocol.h"
+
+#ifdef _WIN64
+#include <WinSock2.h>
+#endif
+
+#define KVCLIENT_UNIX_PREFIX "unix:"   // server addresses starting with this are unix socket paths
+#define KVCLIENT_BUFFER_SIZE 16 * 1024 // bytes received from the socket at once
+#define KVCLIENT_MAX_IOVEC 64          // pieces sent with one kvclient_sendv
+#define KVCLIENT_MAX_FRAME_SIZE (1024 * 1024 * 1024) // longer frames of a session are taken for a broken stream
+
+// frames of a session sent by the server on its own
+#define KVCLIENT_INVALIDATE_PREFIX "INVALIDATE" // a cached value changed (TRACKING)
+#define KVCLIENT_NOTIFY_PREFIX "NOTIFY"         // a watched key changed (WATCH)
+
+// called with a message the server pushed to a session
+typedef void (*kvclient_push_fn)(void *ctx, const char *message, size_t length);
+
+// reads a response that arrived while a request is sent, 0 if there may be more, 1 if none is expected, -1 if the session broke
+typedef int (*kvclient_drain_fn)(void *ctx);
+
+// connection to a server, either over TCP or a unix socket
+typedef struct kvclient_conn {
+  SOCKET sock;
+  char buffer[KVCLIENT_BUFFER_SIZE];
+  size_t start;  // received bytes that were not handed out yet
+  size_t end;
+  bool session;  // responses are framed after HELLO
+  kvclient_push_fn on_push;  // pushed frames are handed to this instead of being taken for responses
+  void *push_ctx;
+} kvclient_conn;
+
+/* Prototypes */
+int kvclient_init(); // start up WinSock, returns 0 on success
+void kvclient_cleanup();
+kvclient_conn *kvclient_connect(const char *server, int port); // "unix:<path>" connects to a unix socket and ignores the port, NULL on failure
+kvclient_conn *kvclient_connect_address(const char *address); // "host:port" or "unix:<path>", NULL on failure
+void kvclient_close(kvclient_conn **conn);
+int kvclient_send(kvclient_conn *conn, const char *buffer, size_t length); // 0 or SOCKET_ERROR
+int kvclient_sendv(kvclient_conn *conn, const kvstr_iovec *iov, int count); // gathering send of all pieces without copying them, 0 or SOCKET_ERROR
+int kvclient_sendv_draining(kvclient_conn *conn, const kvstr_iovec *iov, int count, kvclient_drain_fn drain, void *ctx); // like kvclient_sendv, but calls drain whenever the socket takes no more and data arrived, so the responses of earlier requests do not stop the server from reading
+char *kvclient_recv_response(kvclient_conn *conn, size_t *length); // response of a single request, read until the server closes the connection
+int kvclient_hello(kvclient_conn *conn); // turn the connection into a session, 0 on success
+char *kvclient_recv_frame(kvclient_conn *conn, size_t *length); // next "<len>:<response>" of a session
+int kvclient_poll_pushes(kvclient_conn *conn); // hand already received pushes to on_push without waiting, -1 if the session broke
+int kvclient_wait_pushes(kvclient_conn *conn, int timeoutMs); // like kvclient_poll_pushes but waits up to timeoutMs (forever if negative) for the first one
+char *kvclient_request(kvclient_conn *conn, const char *request, size_t *length); // send a request and wait for its response, framed if it is a session
+char *kvclient_getz_value(const char *response, size_t length, size_t *valueLength); // the value of a GETZ response, decompressed if needed, NULL if it is no value or corrupt
+
+#endif
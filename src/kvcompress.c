@@ -0,0 +1,159 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include "kvcompress.h"
+
+#define LAST_LITERALS 8     // matches end before the last bytes, so a match is never checked beyond the input
+#define SKIP_TRIGGER 6      // the search speeds up after 2^SKIP_TRIGGER bytes without a match
+
+static uint32_t read32(const char* p) {
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static uint32_t hashOf(uint32_t sequence) {
+    return (sequence * 2654435761U) >> (32 - KVCOMPRESS_HASH_BITS);
+}
+
+// 15 or more is continued in bytes of 255 and a last byte below it
+static char* writeLength(char* op, const char* end, size_t length) {
+    for (; length >= 255; length -= 255) {
+        if (op == end) {
+            return NULL;
+        }
+        *op++ = (char)255;
+    }
+    if (op == end) {
+        return NULL;
+    }
+    *op++ = (char)length;
+    return op;
+}
+
+static char* writeSequence(char* op, const char* end, const char* literals, size_t literalLen, size_t offset,
+                                                      size_t matchLen) {
+    if (op == end) {
+        return NULL;
+    }
+    size_t matchCode = matchLen > 0 ? matchLen - KVCOMPRESS_MIN_MATCH : 0;
+    char* token = op++;
+    *token = (char)(((literalLen < 15 ? literalLen : 15) << 4) | (matchCode < 15 ? matchCode : 15));
+    if (literalLen >= 15 && (op = writeLength(op, end, literalLen - 15)) == NULL) {
+        return NULL;
+    }
+    if ((size_t)(end - op) < literalLen) {
+        return NULL;
+    }
+    memcpy(op, literals, literalLen);
+    op += literalLen;
+    if (matchLen == 0) {
+        return op; // the last sequence
+    }
+
+    if (end - op < 2) {
+        return NULL;
+    }
+    *op++ = (char)(offset & 0xff);
+    *op++ = (char)(offset >> 8);
+    if (matchCode >= 15) {
+        op = writeLength(op, end, matchCode - 15);
+    }
+    return op;
+}
+
+size_t kvcompress_encode(const char* src, size_t length, char* dst, size_t capacity) {
+    uint32_t table[1 << KVCOMPRESS_HASH_BITS];
+    memset(table, 0, sizeof(table));
+
+    char* op = dst;
+    const char* end = dst + capacity;
+    size_t anchor = 0;
+    size_t pos = 1; // position 0 is what the empty table points to
+    size_t limit = length > LAST_LITERALS + KVCOMPRESS_MIN_MATCH ? length - LAST_LITERALS - KVCOMPRESS_MIN_MATCH : 0;
+    while (pos < limit) {
+        uint32_t sequence = read32(src + pos);
+        uint32_t* slot = &table[hashOf(sequence)];
+        size_t candidate = *slot;
+        *slot = (uint32_t)pos;
+        if (pos - candidate > KVCOMPRESS_MAX_OFFSET || read32(src + candidate) != sequence) {
+            pos += 1 + ((pos - anchor) >> SKIP_TRIGGER); // incompressible data is skipped faster
+            continue;
+        }
+
+        size_t matchLen = KVCOMPRESS_MIN_MATCH;
+        size_t matchLimit = length - LAST_LITERALS;
+        while (pos + matchLen < matchLimit && src[candidate + matchLen] == src[pos + matchLen]) {
+            matchLen++;
+        }
+        op = writeSequence(op, end, src + anchor, pos - anchor, pos - candidate, matchLen);
+        if (op == NULL) {
+            return 0;
+        }
+        pos += matchLen;
+        anchor = pos;
+    }
+
+    op = writeSequence(op, end, src + anchor, length - anchor, 0, 0);
+    return op != NULL ? (size_t)(op - dst) : 0;
+}
+
+// adds the continuation bytes of a length, false if the block ends before
+static bool readLength(const unsigned char** ip, const unsigned char* end, size_t* length) {
+    unsigned char byte;
+    do {
+        if (*ip == end) {
+            return false;
+        }
+        byte = *(*ip)++;
+        *length += byte;
+    } while (byte == 255);
+    return true;
+}
+
+int kvcompress_decode(const char* src, size_t length, char* dst, size_t decodedLength) {
+    const unsigned char* ip = (const unsigned char*)src;
+    const unsigned char* end = ip + length;
+    size_t out = 0;
+    while (ip < end) {
+        unsigned char token = *ip++;
+        size_t literalLen = token >> 4;
+        if (literalLen == 15 && !readLength(&ip, end, &literalLen)) {
+            return -1;
+        }
+        if ((size_t)(end - ip) < literalLen || decodedLength - out < literalLen) {
+            return -1;
+        }
+        memcpy(dst + out, ip, literalLen);
+        ip += literalLen;
+        out += literalLen;
+        if (ip == end) {
+            break; // the last sequence has no match
+        }
+
+        if (end - ip < 2) {
+            return -1;
+        }
+        size_t offset = ip[0] | ((size_t)ip[1] << 8);
+        ip += 2;
+        size_t matchLen = token & 15;
+        if (matchLen == 15 && !readLength(&ip, end, &matchLen)) {
+            return -1;
+        }
+        matchLen += KVCOMPRESS_MIN_MATCH;
+        if (offset == 0 || offset > out || decodedLength - out < matchLen) {
+            return -1;
+        }
+
+        char* match = dst + out - offset;
+        if (offset >= matchLen) {
+            memcpy(dst + out, match, matchLen);
+        } else {
+            for (size_t i = 0; i < matchLen; i++) { // overlapping, repeats the last offset bytes
+                dst[out + i] = match[i];
+            }
+        }
+        out += matchLen;
+    }
+    return out == decodedLength ? 0 : -1;
+}
@@ -0,0 +1,19 @@
+#ifndef _KVCOMPRESS_H_
+#define _KVCOMPRESS_H_
+
+#include <stddef.h>
+
+#define KVCOMPRESS_HASH_BITS 12     // positions remembered while looking for matches, the table is on the stack
+#define KVCOMPRESS_MIN_MATCH 4
+#define KVCOMPRESS_MAX_OFFSET 65535
+
+// LZ77 block codec in the style of LZ4: a sequence is a token (4 bits literal length, 4 bits match
+// length - 4), more length bytes if a part is 15 or longer, the literals, a 2 byte little endian
+// offset and more match length bytes. The last sequence ends after its literals. Used by the store
+// to compress large values and by clients that receive them compressed (GETZ).
+
+// prototypes
+size_t kvcompress_encode(const char* src, size_t length, char* dst, size_t capacity); // length of the block, 0 if it does not fit into capacity
+int kvcompress_decode(const char* src, size_t length, char* dst, size_t decodedLength); // 0 if the block decodes to exactly decodedLength bytes, -1 if it is corrupt
+
+#endif
@@ -0,0 +1,271 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "kvpool.h"
+#include "utilfuns.h"
+
+#ifdef _WIN64
+#include <windows.h>
+#endif
+
+/*
+ * A pool keeps sessions (HELLO) to one server open so requests do not pay for a connect each.
+ * A pipeline borrows one session and sends requests without waiting for their responses. The
+ * server answers a session in request order, so the responses are read in the same order when
+ * a future is waited for or the pipeline is flushed. Callbacks run in request order from the
+ * thread that waits.
+ */
+
+struct kvpool {
+  char *address;
+  SRWLOCK lock;
+  kvclient_conn **idle;
+  int idleCount;
+  int maxIdle;
+};
+
+struct kvfuture {
+  kvpipeline *pipeline;
+  bool done;
+  bool failed;
+  char *response;          // NULL if the session broke before it was read
+  size_t length;
+  kvpipeline_callback callback;
+  void *ctx;
+};
+
+struct kvpipeline {
+  kvpool *pool;
+  kvclient_conn *conn;     // NULL once the session broke
+  kvfuture **futures;      // in request order
+  size_t count;
+  size_t capacity;
+  size_t received;         // futures[0..received) are done
+};
+
+kvpool *kvpool_create(const char *address, int maxIdle) {
+  kvpool *pool = calloc(1, sizeof(kvpool));
+  if (pool == NULL) {
+    return NULL;
+  }
+  pool->maxIdle = maxIdle > 0 ? maxIdle : KVPOOL_DEFAULT_IDLE;
+  pool->address = duplicate_string(address);
+  pool->idle = calloc((size_t)pool->maxIdle, sizeof(kvclient_conn *));
+  if (pool->address == NULL || pool->idle == NULL) {
+    free(pool->address);
+    free(pool->idle);
+    free(pool);
+    return NULL;
+  }
+  InitializeSRWLock(&pool->lock);
+  return pool;
+}
+
+void kvpool_destroy(kvpool *pool) {
+  if (pool == NULL) {
+    return;
+  }
+  for (int i = 0; i < pool->idleCount; i++) {
+    kvclient_close(&pool->idle[i]);
+  }
+  free(pool->idle);
+  free(pool->address);
+  free(pool);
+}
+
+kvclient_conn *kvpool_acquire(kvpool *pool) {
+  kvclient_conn *conn = NULL;
+  AcquireSRWLockExclusive(&pool->lock);
+  if (pool->idleCount > 0) {
+    conn = pool->idle[--pool->idleCount];
+  }
+  ReleaseSRWLockExclusive(&pool->lock);
+  if (conn != NULL) {
+    return conn;
+  }
+
+  // connecting happens outside of the lock, other threads keep taking idle sessions meanwhile
+  conn = kvclient_connect_address(pool->address);
+  if (conn != NULL && kvclient_hello(conn) != 0) {
+    kvclient_close(&conn); // sessions require the server to run in worker mode
+  }
+  return conn;
+}
+
+void kvpool_release(kvpool *pool, kvclient_conn *conn, bool broken) {
+  if (conn == NULL) {
+    return;
+  }
+
+  // unread responses would be handed to the next user of the session
+  broken |= conn->start != conn->end;
+  AcquireSRWLockExclusive(&pool->lock);
+  if (!broken && pool->idleCount < pool->maxIdle) {
+    pool->idle[pool->idleCount++] = conn;
+    conn = NULL;
+  }
+  ReleaseSRWLockExclusive(&pool->lock);
+  kvclient_close(&conn);
+}
+
+char *kvpool_request(kvpool *pool, const char *request, size_t length, size_t *responseLength) {
+  kvclient_conn *conn = kvpool_acquire(pool);
+  if (conn == NULL) {
+    return NULL;
+  }
+  char *response = NULL;
+  if (kvclient_send(conn, request, length) == 0) {
+    response = kvclient_recv_frame(conn, responseLength);
+  }
+  kvpool_release(pool, conn, response == NULL);
+  return response;
+}
+
+kvpipeline *kvpipeline_begin(kvpool *pool) {
+  kvpipeline *p = calloc(1, sizeof(kvpipeline));
+  if (p == NULL) {
+    return NULL;
+  }
+  p->pool = pool;
+  p->conn = kvpool_acquire(pool);
+  if (p->conn == NULL) {
+    free(p);
+    return NULL;
+  }
+  return p;
+}
+
+// reads the response of the oldest request still waiting for one
+static void receiveNext(kvpipeline *p) {
+  kvfuture *f = p->futures[p->received++];
+  f->response = p->conn != NULL ? kvclient_recv_frame(p->conn, &f->length) : NULL;
+  if (f->response == NULL) {
+    kvclient_close(&p->conn); // all later responses fail as well
+  }
+  f->done = true;
+  f->failed = f->response == NULL;
+
+  if (f->callback != NULL) {
+    f->callback(f->ctx, f->response, f->length);
+    free(f->response);
+    f->response = NULL;
+  }
+}
+
+// reads a response while a request is sent, the server stops reading a session with too many unread
+// responses (4MB), so sending cannot wait for them
+static int drainResponse(void *ctx) {
+  kvpipeline *p = ctx;
+  if (p->received == p->count) {
+    return 1;
+  }
+  receiveNext(p);
+  return p->conn != NULL ? 0 : -1;
+}
+
+static kvfuture *sendRequest(kvpipeline *p, const kvstr_iovec *iov, int count, kvpipeline_callback callback,
+                             void *ctx) {
+  if (p->conn == NULL) {
+    return NULL;
+  }
+
+  // bounds the requests in flight on the socket, not the memory of a long pipeline: the futures and
+  // their responses stay until kvpipeline_end
+  if (p->count - p->received >= KVPOOL_MAX_INFLIGHT) {
+    receiveNext(p);
+  }
+
+  if (p->count == p->capacity) {
+    size_t capacity = p->capacity > 0 ? p->capacity * 2 : 64;
+    kvfuture **futures = realloc(p->futures, capacity * sizeof(kvfuture *));
+    if (futures == NULL) {
+      return NULL;
+    }
+    p->futures = futures;
+    p->capacity = capacity;
+  }
+  kvfuture *f = calloc(1, sizeof(kvfuture));
+  if (f == NULL) {
+    return NULL;
+  }
+  f->pipeline = p;
+  f->callback = callback;
+  f->ctx = ctx;
+
+  if (p->conn == NULL || kvclient_sendv_draining(p->conn, iov, count, drainResponse, p) != 0) {
+    kvclient_close(&p->conn);
+    free(f);
+    return NULL;
+  }
+  p->futures[p->count++] = f;
+  return f;
+}
+
+kvfuture *kvpipeline_send(kvpipeline *p, const char *request, size_t length) {
+  kvstr_iovec iov = {request, length};
+  return sendRequest(p, &iov, 1, NULL, NULL);
+}
+
+int kvpipeline_send_cb(kvpipeline *p, const char *request, size_t length, kvpipeline_callback callback, void *ctx) {
+  kvstr_iovec iov = {request, length};
+  return sendRequest(p, &iov, 1, callback, ctx) != NULL ? 0 : -1;
+}
+
+// only the header is encoded, key and value are sent from the memory of the caller
+static kvfuture *sendKeyRequest(kvpipeline *p, const char *operation, const char *key, const char *value,
+                                size_t valueLength) {
+  char header[KVSTR_MAX_HEADER_SIZE];
+  kvstr_iovec iov[KVSTR_MAX_IOVEC];
+  int count = key != NULL ? kvstr_encode_request(operation, key, strlen(key), value, valueLength, header,
+                                                 sizeof(header), iov)
+                          : -1;
+  return count > 0 ? sendRequest(p, iov, count, NULL, NULL) : NULL;
+}
+
+kvfuture *kvpipeline_get(kvpipeline *p, const char *key) {
+  return sendKeyRequest(p, "GET", key, NULL, 0);
+}
+
+kvfuture *kvpipeline_put(kvpipeline *p, const char *key, const char *value, size_t valueLength) {
+  return value != NULL ? sendKeyRequest(p, "PUT", key, value, valueLength) : NULL;
+}
+
+kvfuture *kvpipeline_del(kvpipeline *p, const char *key) {
+  return sendKeyRequest(p, "DEL", key, NULL, 0);
+}
+
+const char *kvfuture_wait(kvfuture *f, size_t *length) {
+  kvpipeline *p = f->pipeline;
+  while (!f->done) {
+    receiveNext(p);
+  }
+  if (length != NULL) {
+    *length = f->length;
+  }
+  return f->response;
+}
+
+int kvpipeline_flush(kvpipeline *p) {
+  while (p->received < p->count) {
+    receiveNext(p);
+  }
+  int failed = 0;
+  for (size_t i = 0; i < p->count; i++) {
+    failed += p->futures[i]->failed;
+  }
+  return failed;
+}
+
+void kvpipeline_end(kvpipeline *p) {
+  if (p == NULL) {
+    return;
+  }
+  kvpipeline_flush(p);
+  kvpool_release(p->pool, p->conn, p->conn == NULL);
+  for (size_t i = 0; i < p->count; i++) {
+    free(p->futures[i]->response);
+    free(p->futures[i]);
+  }
+  free(p->futures);
+  free(p);
+}
@@ -0,0 +1,41 @@
+#ifndef _KVSTR_KVPOOL_H
+#define _KVSTR_KVPOOL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "kvclient.h"
+
+#define KVPOOL_DEFAULT_IDLE 8       // sessions kept open for reuse
+#define KVPOOL_MAX_INFLIGHT 1024    // requests a pipeline sends before it waits for the oldest response, responses that arrive are read while a request is sent anyway
+
+// pool of open sessions to one server, shared by any number of threads
+typedef struct kvpool kvpool;
+
+// requests sent on one session of a pool whose responses are collected later
+typedef struct kvpipeline kvpipeline;
+
+// response of a pipelined request, owned by its pipeline
+typedef struct kvfuture kvfuture;
+
+// called with the response of a pipelined request, or NULL if the session broke
+typedef void (*kvpipeline_callback)(void *ctx, const char *response, size_t length);
+
+/* Prototypes */
+kvpool *kvpool_create(const char *address, int maxIdle); // "host:port" or "unix:<path>", the server has to run in worker mode
+void kvpool_destroy(kvpool *pool);
+kvclient_conn *kvpool_acquire(kvpool *pool); // idle session or a new one, NULL if the server cannot be reached
+void kvpool_release(kvpool *pool, kvclient_conn *conn, bool broken); // hand back a session, broken ones are closed
+char *kvpool_request(kvpool *pool, const char *request, size_t length, size_t *responseLength); // send a request on a pooled session and wait for the response
+
+kvpipeline *kvpipeline_begin(kvpool *pool); // NULL if no session is available
+kvfuture *kvpipeline_send(kvpipeline *p, const char *request, size_t length); // send without waiting, NULL on failure
+kvfuture *kvpipeline_get(kvpipeline *p, const char *key);
+kvfuture *kvpipeline_put(kvpipeline *p, const char *key, const char *value, size_t valueLength);
+kvfuture *kvpipeline_del(kvpipeline *p, const char *key);
+int kvpipeline_send_cb(kvpipeline *p, const char *request, size_t length, kvpipeline_callback callback, void *ctx); // the callback runs once the response is read
+const char *kvfuture_wait(kvfuture *f, size_t *length); // read responses up to this one, NULL if the session broke
+int kvpipeline_flush(kvpipeline *p); // wait for all responses, returns the number of failed requests
+void kvpipeline_end(kvpipeline *p); // flush, hand the session back and free all futures
+
+#endif
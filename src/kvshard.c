@@ -0,0 +1,258 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "kvclient.h"
+#include "kvshard.h"
+#include "kvstrprotocol.h"
+#include "utilfuns.h"
+
+/*
+ * Every server is placed on a ring of 64 bit hashes KVSHARD_VNODES times. A key belongs to the
+ * first point at or behind its own hash. Adding a server only takes over the keys in front of
+ * its own points, about 1/N of all keys, and removing one only moves the keys it had.
+ */
+
+// FNV-1a with the MurmurHash3 finalizer, FNV alone does not mix similar strings well enough
+static unsigned long long hashBytes(const char *data, size_t len) {
+  unsigned long long h = 14695981039346656037ULL;
+  for (size_t i = 0; i < len; i++) {
+    h ^= (unsigned char)data[i];
+    h *= 1099511628211ULL;
+  }
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  return h;
+}
+
+static int comparePoints(const void *a, const void *b) {
+  const kvshard_point *pa = a;
+  const kvshard_point *pb = b;
+  if (pa->hash != pb->hash) {
+    return pa->hash < pb->hash ? -1 : 1;
+  }
+  return pa->server - pb->server;
+}
+
+// sorted points of the servers, the ring is only changed once they are built
+static int buildPoints(char *const *servers, int serverCount, kvshard_point **points, size_t *pointCount) {
+  size_t count = (size_t)serverCount * KVSHARD_VNODES;
+  *points = count > 0 ? malloc(count * sizeof(kvshard_point)) : NULL;
+  if (count > 0 && *points == NULL) {
+    return -1;
+  }
+
+  size_t n = 0;
+  for (int s = 0; s < serverCount; s++) {
+    char name[256];
+    for (int v = 0; v < KVSHARD_VNODES; v++) {
+      int len = snprintf(name, sizeof(name), "%s#%d", servers[s], v);
+      (*points)[n].hash = hashBytes(name, (size_t)len);
+      (*points)[n].server = s;
+      n++;
+    }
+  }
+  qsort(*points, n, sizeof(kvshard_point), comparePoints);
+  *pointCount = n;
+  return 0;
+}
+
+static void replacePoints(kvshard_ring *ring, kvshard_point *points, size_t pointCount) {
+  free(ring->points);
+  ring->points = points;
+  ring->point_count = pointCount;
+}
+
+void kvshard_init(kvshard_ring *ring) {
+  memset(ring, 0, sizeof(*ring));
+}
+
+void kvshard_free(kvshard_ring *ring) {
+  for (int s = 0; s < ring->server_count; s++) {
+    free(ring->servers[s]);
+  }
+  free(ring->points);
+  memset(ring, 0, sizeof(*ring));
+}
+
+int kvshard_add_server(kvshard_ring *ring, const char *address) {
+  if (address == NULL || ring->server_count == KVSHARD_MAX_SERVERS) {
+    return -1;
+  }
+  for (int s = 0; s < ring->server_count; s++) {
+    if (strcmp(ring->servers[s], address) == 0) {
+      return -1;
+    }
+  }
+
+  char *copy = duplicate_string(address);
+  if (copy == NULL) {
+    return -1;
+  }
+  ring->servers[ring->server_count] = copy;
+  kvshard_point *points;
+  size_t pointCount;
+  if (buildPoints(ring->servers, ring->server_count + 1, &points, &pointCount) != 0) {
+    ring->servers[ring->server_count] = NULL;
+    free(copy);
+    return -1;
+  }
+  ring->server_count++;
+  replacePoints(ring, points, pointCount);
+  return 0;
+}
+
+int kvshard_remove_server(kvshard_ring *ring, const char *address) {
+  for (int s = 0; s < ring->server_count; s++) {
+    if (strcmp(ring->servers[s], address) != 0) {
+      continue;
+    }
+    // the points refer to servers by index, so the server only goes once the points without it exist
+    char *remaining[KVSHARD_MAX_SERVERS];
+    memcpy(remaining, ring->servers, (size_t)s * sizeof(char *));
+    memcpy(&remaining[s], &ring->servers[s + 1], (size_t)(ring->server_count - s - 1) * sizeof(char *));
+    kvshard_point *points;
+    size_t pointCount;
+    if (buildPoints(remaining, ring->server_count - 1, &points, &pointCount) != 0) {
+      return -1;
+    }
+
+    free(ring->servers[s]);
+    memmove(&ring->servers[s], &ring->servers[s + 1], (size_t)(ring->server_count - s - 1) * sizeof(char *));
+    ring->servers[--ring->server_count] = NULL;
+    replacePoints(ring, points, pointCount);
+    return 0;
+  }
+  return -1;
+}
+
+int kvshard_server_for_key(const kvshard_ring *ring, const char *key) {
+  if (ring->point_count == 0 || key == NULL) {
+    return -1;
+  }
+
+  // first point at or behind the hash of the key, wrapping around to the start of the ring
+  unsigned long long h = hashBytes(key, strlen(key));
+  size_t low = 0;
+  size_t high = ring->point_count;
+  while (low < high) {
+    size_t mid = low + (high - low) / 2;
+    if (ring->points[mid].hash < h) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+  return ring->points[low == ring->point_count ? 0 : low].server;
+}
+
+// sends the next batch of requests to a server, returns -1 if the connection broke
+static int sendBatch(kvclient_conn *conn, const char *operation, kvshard_op *ops, const size_t *order, size_t from,
+                     size_t to) {
+  byte_buffer batch = {0};
+  char header[KVSTR_MAX_HEADER_SIZE];
+  kvstr_iovec iov[KVSTR_MAX_IOVEC];
+  int r = 0;
+  for (size_t i = from; i < to && r == 0; i++) {
+    const kvshard_op *op = &ops[order[i]];
+    const char *value = strcmp(operation, "PUT") == 0 ? op->value : NULL;
+    int count = kvstr_encode_request(operation, op->key, strlen(op->key), value, value != NULL ? strlen(value) : 0,
+                                     header, sizeof(header), iov);
+    r = count < 0 ? -1 : 0;
+    for (int j = 0; j < count && r == 0; j++) {
+      r = byte_buffer_append(&batch, iov[j].base, iov[j].len);
+    }
+  }
+  if (r == 0) {
+    r = kvclient_send(conn, batch.data, batch.len) != 0 ? -1 : 0;
+  }
+  byte_buffer_free(&batch);
+  return r;
+}
+
+int kvshard_execute(kvshard_ring *ring, const char *operation, kvshard_op *ops, size_t count) {
+  int servers = ring->server_count;
+  size_t *order = malloc((count > 0 ? count : 1) * sizeof(size_t));
+  int *serverOf = malloc((count > 0 ? count : 1) * sizeof(int));
+  if (order == NULL || serverOf == NULL) {
+    free(order);
+    free(serverOf);
+    return (int)count;
+  }
+
+  // group the keys by server, keeping their order within a server
+  size_t start[KVSHARD_MAX_SERVERS + 1] = {0};
+  for (size_t i = 0; i < count; i++) {
+    ops[i].response = NULL;
+    ops[i].response_len = 0;
+    bool valid = ops[i].key != NULL && (ops[i].value != NULL || strcmp(operation, "PUT") != 0);
+    serverOf[i] = valid ? kvshard_server_for_key(ring, ops[i].key) : -1;
+    if (serverOf[i] >= 0) {
+      start[serverOf[i] + 1]++;
+    }
+  }
+  for (int s = 0; s < servers; s++) {
+    start[s + 1] += start[s];
+  }
+  size_t next[KVSHARD_MAX_SERVERS];
+  memcpy(next, start, sizeof(next));
+  for (size_t i = 0; i < count; i++) {
+    if (serverOf[i] >= 0) {
+      order[next[serverOf[i]]++] = i;
+    }
+  }
+  memcpy(next, start, sizeof(next));
+
+  kvclient_conn *conns[KVSHARD_MAX_SERVERS] = {0};
+  bool more = true;
+  while (more) {
+    more = false;
+
+    // a batch to every server before any response is read, so all servers work at the same time
+    size_t batchEnd[KVSHARD_MAX_SERVERS];
+    for (int s = 0; s < servers; s++) {
+      batchEnd[s] = next[s] + KVSHARD_BATCH < start[s + 1] ? next[s] + KVSHARD_BATCH : start[s + 1];
+      if (next[s] == batchEnd[s]) {
+        continue;
+      }
+
+      if (conns[s] == NULL && next[s] == start[s]) {
+        conns[s] = kvclient_connect_address(ring->servers[s]);
+        if (conns[s] != NULL && kvclient_hello(conns[s]) != 0) {
+          kvclient_close(&conns[s]); // sessions require the server to run in worker mode
+        }
+      }
+      if (conns[s] == NULL || sendBatch(conns[s], operation, ops, order, next[s], batchEnd[s]) != 0) {
+        kvclient_close(&conns[s]);
+        next[s] = batchEnd[s] = start[s + 1]; // the remaining keys of the server stay without response
+      }
+    }
+
+    for (int s = 0; s < servers; s++) {
+      for (size_t i = next[s]; i < batchEnd[s] && conns[s] != NULL; i++) {
+        kvshard_op *op = &ops[order[i]];
+        op->response = kvclient_recv_frame(conns[s], &op->response_len);
+        if (op->response == NULL) {
+          kvclient_close(&conns[s]);
+          batchEnd[s] = start[s + 1];
+        }
+      }
+      next[s] = batchEnd[s];
+      more |= next[s] < start[s + 1];
+    }
+  }
+
+  int failed = 0;
+  for (int s = 0; s < servers; s++) {
+    kvclient_close(&conns[s]);
+  }
+  for (size_t i = 0; i < count; i++) {
+    failed += ops[i].response == NULL;
+  }
+  free(order);
+  free(serverOf);
+  return failed;
+}
@@ -0,0 +1,40 @@
+#ifndef _KVSTR_KVSHARD_H
+#define _KVSTR_KVSHARD_H
+
+#include <stddef.h>
+
+#define KVSHARD_MAX_SERVERS 64
+#define KVSHARD_VNODES 160      // points of every server on the ring, more points spread the keys more evenly
+#define KVSHARD_BATCH 256       // requests sent to a server before its responses are read
+
+// a virtual node: the server owns the keys hashing up to this point of the ring
+typedef struct kvshard_point {
+  unsigned long long hash;
+  int server;
+} kvshard_point;
+
+// consistent hash ring over the configured servers
+typedef struct kvshard_ring {
+  char *servers[KVSHARD_MAX_SERVERS];  // "host:port" or "unix:<path>"
+  int server_count;
+  kvshard_point *points;               // sorted by hash
+  size_t point_count;
+} kvshard_ring;
+
+// one key of a multi-key request
+typedef struct kvshard_op {
+  const char *key;
+  const char *value;      // PUT only
+  char *response;         // set by kvshard_execute (NULL if the server could not be reached), free() it
+  size_t response_len;
+} kvshard_op;
+
+/* Prototypes */
+void kvshard_init(kvshard_ring *ring);
+void kvshard_free(kvshard_ring *ring);
+int kvshard_add_server(kvshard_ring *ring, const char *address); // 0 on success, only about 1/N of the keys move to it
+int kvshard_remove_server(kvshard_ring *ring, const char *address); // its keys move to the remaining servers
+int kvshard_server_for_key(const kvshard_ring *ring, const char *key); // index into servers, -1 without servers
+int kvshard_execute(kvshard_ring *ring, const char *operation, kvshard_op *ops, size_t count); // GET, PUT or DEL of many keys, split per server and sent to all of them at once, returns the number of keys without response
+
+#endif
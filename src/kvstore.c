@@ -1,31 +1,861 @@
+#include <limits.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include "kvcompress.h"
 #include "kvstore.h"
-#include "utilfuns.h"
+
+typedef struct kv_hash kv_hash;
+
+static int putValue(kv_store* store, const char* key, kv_entry value);
+static void releaseHash(kv_store* store, kv_hash* hash);
+static bool lazyFree(kv_store* store, const kv_entry* entry);
+static bool handOverPinned(kv_store* store, const kv_entry* entry);
+
+static void* storeAlloc(kv_store* store, size_t size) {
+    void* ptr = store->allocator->allocate(store->allocator, size);
+    if (ptr != NULL) {
+        store->allocated_bytes += size;
+        store->allocations++;
+    }
+    return ptr;
+}
+
+static void storeFree(kv_store* store, void* ptr, size_t size) {
+    if (ptr == NULL) {
+        return;
+    }
+    store->allocator->release(store->allocator, ptr, size);
+    store->allocated_bytes -= size;
+    store->allocations--;
+}
+
+// numbers
+
+static bool parseNumber(const char* text, size_t len, long long* number) {
+    // only the canonical form, so the value is rendered back exactly like it was stored
+    size_t start = len > 0 && text[0] == '-' ? 1 : 0;
+    if (len == start || len - start > 19 || text[start] < '0' || text[start] > '9' ||
+        (text[start] == '0' && (len - start > 1 || start == 1))) {
+        return false;
+    }
+    unsigned long long value = 0;
+    for (size_t i = start; i < len; i++) {
+        if (text[i] < '0' || text[i] > '9') {
+            return false;
+        }
+        value = value * 10 + (unsigned int)(text[i] - '0');
+    }
+    if (value > (unsigned long long)LLONG_MAX + start) {
+        return false;
+    }
+    *number = start == 1 ? (long long)(0 - value) : (long long)value;
+    return true;
+}
+
+static size_t numberTextLen(long long number) {
+    size_t len = number < 0 ? 2 : 1;
+    unsigned long long value = number < 0 ? 0 - (unsigned long long)number : (unsigned long long)number;
+    while (value >= 10) {
+        value /= 10;
+        len++;
+    }
+    return len;
+}
+
+static kv_entry numberValue(long long number) {
+    kv_entry value = {.number = number, .value_len = KV_VALUE_NUMBER | numberTextLen(number)};
+    return value;
+}
+
+// frees the value unless it is a number, values in use by a reader go to pinned, large ones to lazy_free
+static void releaseValue(kv_store* store, kv_entry* entry) {
+    if (kv_entry_is_number(entry) || handOverPinned(store, entry) || lazyFree(store, entry)) {
+        return;
+    }
+    if (kv_entry_is_hash(entry)) {
+        releaseHash(store, (kv_hash*)entry->value);
+        return;
+    }
+    if (kv_entry_is_compressed(entry)) {
+        kv_compressed_value* compressed = (kv_compressed_value*)entry->value;
+        size_t stored = sizeof(kv_compressed_value) + compressed->block_len;
+        store->compressed_values--;
+        store->compressed_raw_bytes -= kv_entry_value_len(entry);
+        store->compressed_stored_bytes -= stored;
+        storeFree(store, compressed, stored);
+        return;
+    }
+    storeFree(store, entry->value, entry->value_len + 1);
+}
+
+const char* kv_entry_value(const kv_entry* entry, char* buffer) {
+    if (kv_entry_is_compressed(entry) || kv_entry_is_hash(entry)) {
+        return NULL;
+    }
+    if (!kv_entry_is_number(entry)) {
+        return entry->value;
+    }
+    snprintf(buffer, KV_NUMBER_TEXT_SIZE, "%lld", entry->number);
+    return buffer;
+}
+
+int kv_entry_read(const kv_entry* entry, char* dst) {
+    size_t len = kv_entry_value_len(entry);
+    if (kv_entry_is_hash(entry)) {
+        return -1;
+    }
+    if (kv_entry_is_compressed(entry)) {
+        const kv_compressed_value* compressed = (const kv_compressed_value*)entry->value;
+        if (kvcompress_decode(compressed->block, compressed->block_len, dst, len) != 0) {
+            return -1;
+        }
+    } else {
+        char numberText[KV_NUMBER_TEXT_SIZE];
+        memcpy(dst, kv_entry_value(entry, numberText), len);
+    }
+    dst[len] = '\0';
+    return 0;
+}
+
+// compression
+
+void kv_store_set_compression(kv_store* store, size_t min_size) {
+    store->compress_min = min_size;
+}
+
+// stores the text compressed if it is long enough and the block saves at least 1/8 of it, less is not worth
+// decompressing it on every read. Returns 1 if it was stored, 0 if it has to be stored as text and -1 on failure.
+static int putCompressed(kv_store* store, const char* key, const char* text, size_t len) {
+    if (store->compress_min == 0 || len < store->compress_min) {
+        return 0;
+    }
+
+    size_t capacity = len - len / 8;
+    size_t size = sizeof(kv_compressed_value) + capacity;
+    kv_compressed_value* compressed = storeAlloc(store, size);
+    if (compressed == NULL) {
+        return -1;
+    }
+    size_t block_len = kvcompress_encode(text, len, compressed->block, capacity);
+    if (block_len == 0) {
+        storeFree(store, compressed, size);
+        store->compress_skipped++;
+        return 0;
+    }
+
+    size_t stored = sizeof(kv_compressed_value) + block_len;
+    kv_compressed_value* shrunk = store->allocator->reallocate(store->allocator, compressed, size, stored);
+    if (shrunk == NULL) {
+        storeFree(store, compressed, size);
+        return -1;
+    }
+    store->allocated_bytes -= size - stored;
+    shrunk->block_len = block_len;
+    store->compressed_values++;
+    store->compressed_raw_bytes += len;
+    store->compressed_stored_bytes += stored;
+
+    kv_entry value = {.value = (char*)shrunk, .value_len = KV_VALUE_COMPRESSED | len};
+    if (putValue(store, key, value) != 0) {
+        releaseValue(store, &value);
+        return -1;
+    }
+    return 1;
+}
+
+// hashes
+
+#define PACKED_HEADER 2 // every field of the packed encoding starts with the length of the field and of the value
+
+typedef struct kv_hash_field {
+    struct kv_hash_field* next;
+    size_t field_len;
+    size_t value_len;
+    char data[];                // the field followed by the value
+} kv_hash_field;
+
+// fields of a small hash follow each other in one allocation, like a listpack. The hash is converted
+// to a table of chained fields once it gets too large for a linear search.
+struct kv_hash {
+    size_t count;
+    size_t bytes;               // of all fields and values
+    char* packed;               // NULL once the hash was converted
+    size_t packed_len;
+    size_t packed_capacity;
+    kv_hash_field** buckets;    // NULL as long as the hash is packed
+    size_t bucket_count;        // power of two
+};
+
+static uint64_t hashField(const char* field, size_t len) {
+    // FNV-1a
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < len; i++) {
+        hash = (hash ^ (unsigned char)field[i]) * 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+static size_t fieldSize(size_t field_len, size_t value_len) {
+    return sizeof(kv_hash_field) + field_len + value_len;
+}
+
+// offset of the field in the packed encoding, packed_len if it is not there
+static size_t packedFind(const kv_hash* hash, const char* field, size_t field_len) {
+    size_t pos = 0;
+    while (pos < hash->packed_len) {
+        const unsigned char* p = (const unsigned char*)hash->packed + pos;
+        if (p[0] == field_len && memcmp(p + PACKED_HEADER, field, field_len) == 0) {
+            return pos;
+        }
+        pos += PACKED_HEADER + p[0] + p[1];
+    }
+    return pos;
+}
+
+static int packedReserve(kv_store* store, kv_hash* hash, size_t needed) {
+    if (hash->packed_capacity - hash->packed_len >= needed) {
+        return 0;
+    }
+    size_t capacity = hash->packed_capacity * 2;
+    if (capacity < hash->packed_len + needed) {
+        capacity = hash->packed_len + needed;
+    }
+    char* grown = store->allocator->reallocate(store->allocator, hash->packed, hash->packed_capacity, capacity);
+    if (grown == NULL) {
+        return -1;
+    }
+    store->allocated_bytes += capacity - hash->packed_capacity;
+    hash->packed = grown;
+    hash->packed_capacity = capacity;
+    return 0;
+}
+
+// the link that points to the field, or the NULL at the end of its bucket
+static kv_hash_field** tableFind(kv_hash* hash, const char* field, size_t field_len) {
+    kv_hash_field** link = &hash->buckets[hashField(field, field_len) & (hash->bucket_count - 1)];
+    while (*link != NULL && ((*link)->field_len != field_len || memcmp((*link)->data, field, field_len) != 0)) {
+        link = &(*link)->next;
+    }
+    return link;
+}
+
+static kv_hash_field* newField(kv_store* store, const char* field, size_t field_len, const char* value, size_t value_len) {
+    kv_hash_field* node = storeAlloc(store, fieldSize(field_len, value_len));
+    if (node == NULL) {
+        return NULL;
+    }
+    node->next = NULL;
+    node->field_len = field_len;
+    node->value_len = value_len;
+    memcpy(node->data, field, field_len);
+    memcpy(node->data + field_len, value, value_len);
+    return node;
+}
+
+static void freeTable(kv_store* store, kv_hash* hash) {
+    for (size_t i = 0; i < hash->bucket_count; i++) {
+        kv_hash_field* node = hash->buckets[i];
+        while (node != NULL) {
+            kv_hash_field* next = node->next;
+            storeFree(store, node, fieldSize(node->field_len, node->value_len));
+            node = next;
+        }
+    }
+    storeFree(store, hash->buckets, hash->bucket_count * sizeof(kv_hash_field*));
+    hash->buckets = NULL;
+    hash->bucket_count = 0;
+}
+
+static int tableResize(kv_store* store, kv_hash* hash, size_t bucket_count) {
+    kv_hash_field** buckets = storeAlloc(store, bucket_count * sizeof(kv_hash_field*));
+    if (buckets == NULL) {
+        return -1;
+    }
+    memset(buckets, 0, bucket_count * sizeof(kv_hash_field*));
+    for (size_t i = 0; i < hash->bucket_count; i++) {
+        kv_hash_field* node = hash->buckets[i];
+        while (node != NULL) {
+            kv_hash_field* next = node->next;
+            size_t b = hashField(node->data, node->field_len) & (bucket_count - 1);
+            node->next = buckets[b];
+            buckets[b] = node;
+            node = next;
+        }
+    }
+    storeFree(store, hash->buckets, hash->bucket_count * sizeof(kv_hash_field*));
+    hash->buckets = buckets;
+    hash->bucket_count = bucket_count;
+    return 0;
+}
+
+static int convertToTable(kv_store* store, kv_hash* hash) {
+    size_t bucket_count = KV_HASH_MIN_BUCKETS;
+    while (bucket_count < hash->count) {
+        bucket_count *= 2;
+    }
+    if (tableResize(store, hash, bucket_count) != 0) {
+        return -1;
+    }
+
+    for (size_t pos = 0; pos < hash->packed_len;) {
+        const unsigned char* p = (const unsigned char*)hash->packed + pos;
+        const char* field = (const char*)p + PACKED_HEADER;
+        kv_hash_field* node = newField(store, field, p[0], field + p[0], p[1]);
+        if (node == NULL) {
+            freeTable(store, hash); // still packed
+            return -1;
+        }
+        kv_hash_field** link = &hash->buckets[hashField(field, p[0]) & (bucket_count - 1)];
+        node->next = *link;
+        *link = node;
+        pos += PACKED_HEADER + p[0] + p[1];
+    }
+    storeFree(store, hash->packed, hash->packed_capacity);
+    hash->packed = NULL;
+    hash->packed_len = 0;
+    hash->packed_capacity = 0;
+    return 0;
+}
+
+static int tableSet(kv_store* store, kv_hash* hash, const char* field, size_t field_len, const char* value,
+                    size_t value_len) {
+    kv_hash_field** link = tableFind(hash, field, field_len);
+    kv_hash_field* old = *link;
+    if (old != NULL && old->value_len == value_len) {
+        memcpy(old->data + field_len, value, value_len); // in place
+        return 0;
+    }
+
+    kv_hash_field* node = newField(store, field, field_len, value, value_len);
+    if (node == NULL) {
+        return -1;
+    }
+    *link = node;
+    if (old != NULL) {
+        node->next = old->next;
+        hash->bytes = hash->bytes - old->value_len + value_len;
+        storeFree(store, old, fieldSize(old->field_len, old->value_len));
+        return 0;
+    }
+
+    hash->count++;
+    hash->bytes += field_len + value_len;
+    if (hash->count > hash->bucket_count) {
+        tableResize(store, hash, hash->bucket_count * 2); // the chains only get longer if it fails
+    }
+    return 1;
+}
+
+static int packedSet(kv_store* store, kv_hash* hash, const char* field, size_t field_len, const char* value,
+                     size_t value_len) {
+    size_t pos = packedFind(hash, field, field_len);
+    bool found = pos < hash->packed_len;
+    if (field_len > KV_HASH_PACKED_MAX_LEN || value_len > KV_HASH_PACKED_MAX_LEN ||
+        (!found && hash->count >= KV_HASH_PACKED_MAX_FIELDS)) {
+        if (convertToTable(store, hash) != 0) {
+            return -1;
+        }
+        return tableSet(store, hash, field, field_len, value, value_len);
+    }
+
+    if (!found) {
+        if (packedReserve(store, hash, PACKED_HEADER + field_len + value_len) != 0) {
+            return -1;
+        }
+        unsigned char* p = (unsigned char*)hash->packed + pos;
+        p[0] = (unsigned char)field_len;
+        p[1] = (unsigned char)value_len;
+        memcpy(p + PACKED_HEADER, field, field_len);
+        memcpy(p + PACKED_HEADER + field_len, value, value_len);
+        hash->packed_len += PACKED_HEADER + field_len + value_len;
+        hash->count++;
+        hash->bytes += field_len + value_len;
+        return 1;
+    }
+
+    // the fields behind it move if the length of the value changes
+    size_t old_len = ((unsigned char*)hash->packed)[pos + 1];
+    if (value_len > old_len && packedReserve(store, hash, value_len - old_len) != 0) {
+        return -1;
+    }
+    size_t tail = pos + PACKED_HEADER + field_len + old_len;
+    if (value_len != old_len) {
+        memmove(hash->packed + tail - old_len + value_len, hash->packed + tail, hash->packed_len - tail);
+        hash->packed_len = hash->packed_len - old_len + value_len;
+        hash->bytes = hash->bytes - old_len + value_len;
+        ((unsigned char*)hash->packed)[pos + 1] = (unsigned char)value_len;
+    }
+    memcpy(hash->packed + pos + PACKED_HEADER + field_len, value, value_len);
+    return 0;
+}
+
+static kv_hash* newHash(kv_store* store) {
+    kv_hash* hash = storeAlloc(store, sizeof(kv_hash));
+    if (hash == NULL) {
+        return NULL;
+    }
+    memset(hash, 0, sizeof(kv_hash));
+    hash->packed = storeAlloc(store, KV_HASH_PACKED_INITIAL);
+    if (hash->packed == NULL) {
+        storeFree(store, hash, sizeof(kv_hash));
+        return NULL;
+    }
+    hash->packed_capacity = KV_HASH_PACKED_INITIAL;
+    return hash;
+}
+
+static void releaseHash(kv_store* store, kv_hash* hash) {
+    if (hash->buckets != NULL) {
+        freeTable(store, hash);
+    }
+    storeFree(store, hash->packed, hash->packed_capacity);
+    storeFree(store, hash, sizeof(kv_hash));
+}
+
+int kv_store_hset(kv_store* store, const char* key, const char* field, size_t field_len, const char* value,
+                  size_t value_len) {
+    if (key == NULL || field == NULL || value == NULL) {
+        return -1;
+    }
+
+    kv_entry* entry = (kv_entry*)kv_store_lookup(store, key);
+    if (entry != NULL && !kv_entry_is_hash(entry)) {
+        return KV_STORE_WRONG_TYPE;
+    }
+    if (entry == NULL) {
+        kv_hash* hash = newHash(store);
+        if (hash == NULL) {
+            return -1;
+        }
+        if (putValue(store, key, (kv_entry){.value = (char*)hash, .value_len = KV_VALUE_HASH}) != 0) {
+            releaseHash(store, hash);
+            return -1;
+        }
+        entry = (kv_entry*)kv_store_lookup(store, key);
+    }
+
+    kv_hash* hash = (kv_hash*)entry->value;
+    size_t old_bytes = hash->bytes;
+    int result = hash->buckets == NULL ? packedSet(store, hash, field, field_len, value, value_len)
+                                       : tableSet(store, hash, field, field_len, value, value_len);
+    store->data_size = store->data_size - old_bytes + hash->bytes;
+    entry->value_len = KV_VALUE_HASH | hash->bytes;
+    if (result >= 0) {
+        entry->version = ++store->version;
+    }
+    if (hash->count == 0) {
+        kv_store_delete(store, key); // the hash was created for a field that could not be stored
+    }
+    return result;
+}
+
+int kv_store_hget(kv_store* store, const char* key, const char* field, size_t field_len, const char** value,
+                  size_t* value_len) {
+    const kv_entry* entry = kv_store_lookup(store, key);
+    if (entry == NULL) {
+        return -1;
+    }
+    if (!kv_entry_is_hash(entry)) {
+        return KV_STORE_WRONG_TYPE;
+    }
+
+    kv_hash* hash = (kv_hash*)entry->value;
+    if (hash->buckets == NULL) {
+        size_t pos = packedFind(hash, field, field_len);
+        if (pos == hash->packed_len) {
+            return -1;
+        }
+        const unsigned char* p = (const unsigned char*)hash->packed + pos;
+        *value = (const char*)p + PACKED_HEADER + p[0];
+        *value_len = p[1];
+        return 0;
+    }
+    kv_hash_field* node = *tableFind(hash, field, field_len);
+    if (node == NULL) {
+        return -1;
+    }
+    *value = node->data + node->field_len;
+    *value_len = node->value_len;
+    return 0;
+}
+
+int kv_store_hdel(kv_store* store, const char* key, const char* field, size_t field_len) {
+    kv_entry* entry = (kv_entry*)kv_store_lookup(store, key);
+    if (entry == NULL) {
+        return -1;
+    }
+    if (!kv_entry_is_hash(entry)) {
+        return KV_STORE_WRONG_TYPE;
+    }
+
+    kv_hash* hash = (kv_hash*)entry->value;
+    size_t removed;
+    if (hash->buckets == NULL) {
+        size_t pos = packedFind(hash, field, field_len);
+        if (pos == hash->packed_len) {
+            return -1;
+        }
+        const unsigned char* p = (const unsigned char*)hash->packed + pos;
+        removed = p[0] + p[1];
+        size_t next = pos + PACKED_HEADER + removed;
+        memmove(hash->packed + pos, hash->packed + next, hash->packed_len - next);
+        hash->packed_len -= PACKED_HEADER + removed;
+    } else {
+        kv_hash_field** link = tableFind(hash, field, field_len);
+        kv_hash_field* node = *link;
+        if (node == NULL) {
+            return -1;
+        }
+        *link = node->next;
+        removed = node->field_len + node->value_len;
+        storeFree(store, node, fieldSize(node->field_len, node->value_len));
+    }
+
+    hash->count--;
+    hash->bytes -= removed;
+    store->data_size -= removed;
+    entry->value_len = KV_VALUE_HASH | hash->bytes;
+    entry->version = ++store->version;
+    if (hash->count == 0) {
+        kv_store_delete(store, key); // an empty hash is no value
+    }
+    return 0;
+}
+
+size_t kv_entry_hash_len(const kv_entry* entry) {
+    return ((const kv_hash*)entry->value)->count;
+}
+
+int kv_entry_hash_foreach(const kv_entry* entry, kv_hash_visitor visit, void* ctx) {
+    const kv_hash* hash = (const kv_hash*)entry->value;
+    for (size_t pos = 0; pos < hash->packed_len;) {
+        const unsigned char* p = (const unsigned char*)hash->packed + pos;
+        const char* field = (const char*)p + PACKED_HEADER;
+        int result = visit(field, p[0], field + p[0], p[1], ctx);
+        if (result != 0) {
+            return result;
+        }
+        pos += PACKED_HEADER + p[0] + p[1];
+    }
+    for (size_t i = 0; i < hash->bucket_count; i++) {
+        for (const kv_hash_field* node = hash->buckets[i]; node != NULL; node = node->next) {
+            int result = visit(node->data, node->field_len, node->data + node->field_len, node->value_len, ctx);
+            if (result != 0) {
+                return result;
+            }
+        }
+    }
+    return 0;
+}
+
+// lazy freeing
+
+// bytes and allocations of a value, so they can be taken off the counts of the store when it is unlinked
+static size_t valueAllocation(const kv_entry* entry, size_t* allocations) {
+    if (kv_entry_is_hash(entry)) {
+        const kv_hash* hash = (const kv_hash*)entry->value;
+        if (hash->buckets == NULL) {
+            *allocations = 2;
+            return sizeof(kv_hash) + hash->packed_capacity;
+        }
+        *allocations = 2 + hash->count;
+        return sizeof(kv_hash) + hash->bucket_count * sizeof(kv_hash_field*) + hash->count * sizeof(kv_hash_field) +
+               hash->bytes;
+    }
+    *allocations = 1;
+    if (kv_entry_is_compressed(entry)) {
+        return sizeof(kv_compressed_value) + ((const kv_compressed_value*)entry->value)->block_len;
+    }
+    return entry->value_len + 1;
+}
+
+// unlinks a value from the store before it is handed over, it is no longer counted
+static void detachValue(kv_store* store, const kv_entry* entry, size_t bytes, size_t allocations) {
+    if (kv_entry_is_compressed(entry)) {
+        store->compressed_values--;
+        store->compressed_raw_bytes -= kv_entry_value_len(entry);
+        store->compressed_stored_bytes -= bytes;
+    }
+    store->allocated_bytes -= bytes;
+    store->allocations -= allocations;
+}
+
+// hands a large value to lazy_free instead of freeing it, false if it has to be freed inline
+static bool lazyFree(kv_store* store, const kv_entry* entry) {
+    if (store->lazy_free == NULL) {
+        return false;
+    }
+    size_t allocations;
+    size_t bytes = valueAllocation(entry, &allocations);
+    if (bytes < store->lazy_free_min) {
+        return false;
+    }
+
+    detachValue(store, entry, bytes, allocations);
+    store->lazy_freed++;
+    store->lazy_free(*entry, bytes, store->lazy_free_ctx);
+    return true;
+}
+
+// hands a value a reader still uses to pinned instead of freeing it, false if it has to be freed here
+static bool handOverPinned(kv_store* store, const kv_entry* entry) {
+    if (store->pinned == NULL || kv_entry_is_hash(entry)) {
+        return false;
+    }
+    size_t allocations;
+    size_t bytes = valueAllocation(entry, &allocations);
+    if (!store->pinned(*entry, bytes, true, store->pinned_ctx)) {
+        return false;
+    }
+    detachValue(store, entry, bytes, allocations);
+    return true;
+}
+
+// whether a reader uses the value, it must not be changed in place then
+static bool valuePinned(kv_store* store, const kv_entry* entry) {
+    return store->pinned != NULL && store->pinned(*entry, 0, false, store->pinned_ctx);
+}
+
+int kv_store_set_pinned(kv_store* store, kv_pinned_fn pinned, void* ctx) {
+    if (store->allocator != kv_allocator_system()) {
+        return -1;
+    }
+    store->pinned = pinned;
+    store->pinned_ctx = ctx;
+    return 0;
+}
+
+int kv_store_set_lazy_free(kv_store* store, size_t min_size, kv_lazy_free_fn lazy_free, void* ctx) {
+    if (store->allocator != kv_allocator_system()) {
+        return -1;
+    }
+    store->lazy_free_min = min_size;
+    store->lazy_free = min_size > 0 ? lazy_free : NULL;
+    store->lazy_free_ctx = ctx;
+    return 0;
+}
+
+void kv_entry_free_detached(kv_entry value) {
+    if (kv_entry_is_number(&value)) {
+        return;
+    }
+    if (!kv_entry_is_hash(&value)) {
+        free(value.value); // text and compressed values are one allocation
+        return;
+    }
+
+    kv_hash* hash = (kv_hash*)value.value;
+    for (size_t i = 0; i < hash->bucket_count; i++) {
+        kv_hash_field* node = hash->buckets[i];
+        while (node != NULL) {
+            kv_hash_field* next = node->next;
+            free(node);
+            node = next;
+        }
+    }
+    free(hash->buckets);
+    free(hash->packed);
+    free(hash);
+}
+
+// integer keys
+
+bool kv_parse_int_key(const char* key, unsigned long long* id) {
+    // only the canonical form, so "007" and "7" stay different keys
+    if (key[0] < '0' || key[0] > '9' || (key[0] == '0' && key[1] != '\0')) {
+        return false;
+    }
+    unsigned long long value = 0;
+    for (const char* c = key; *c != '\0'; c++) {
+        if (*c < '0' || *c > '9') {
+            return false;
+        }
+        unsigned int digit = (unsigned int)(*c - '0');
+        if (value > (ULLONG_MAX - digit) / 10) {
+            return false;
+        }
+        value = value * 10 + digit;
+    }
+    *id = value;
+    return true;
+}
+
+static size_t intSlotOf(const kv_store* store, unsigned long long id) {
+    // murmur3 finalizer, sequential ids end up spread over the table
+    id ^= id >> 33;
+    id *= 0xff51afd7ed558ccdULL;
+    id ^= id >> 33;
+    id *= 0xc4ceb9fe1a85ec53ULL;
+    id ^= id >> 33;
+    return (size_t)id & (store->int_capacity - 1);
+}
+
+// the number 0 has no value pointer either, but its value_len is not 0
+static bool slotUsed(const kv_entry* slot) {
+    return slot->value != NULL || slot->value_len != 0;
+}
+
+static kv_entry* intFind(const kv_store* store, unsigned long long id) {
+    size_t mask = store->int_capacity - 1;
+    for (size_t i = intSlotOf(store, id);; i = (i + 1) & mask) {
+        kv_entry* slot = &store->int_slots[i];
+        if (!slotUsed(slot)) {
+            return NULL;
+        }
+        if (slot->id == id) {
+            return slot;
+        }
+    }
+}
+
+static int intResize(kv_store* store, size_t new_capacity) {
+    kv_entry* old_slots = store->int_slots;
+    size_t old_capacity = store->int_capacity;
+    kv_entry* slots = storeAlloc(store, new_capacity * sizeof(kv_entry));
+    if (slots == NULL) {
+        return -1;
+    }
+    memset(slots, 0, new_capacity * sizeof(kv_entry));
+
+    store->int_slots = slots;
+    store->int_capacity = new_capacity;
+    for (size_t i = 0; i < old_capacity; i++) {
+        if (slotUsed(&old_slots[i])) {
+            size_t j = intSlotOf(store, old_slots[i].id);
+            while (slotUsed(&slots[j])) {
+                j = (j + 1) & (new_capacity - 1);
+            }
+            slots[j] = old_slots[i];
+        }
+    }
+    storeFree(store, old_slots, old_capacity * sizeof(kv_entry));
+    return 0;
+}
+
+static int intPut(kv_store* store, unsigned long long id, kv_entry value) {
+    // at most 3/4 of the slots are used, so probe sequences stay short
+    if ((store->int_size + 1) * 4 > store->int_capacity * 3 && intResize(store, store->int_capacity * 2) != 0) {
+        return -1;
+    }
+
+    size_t mask = store->int_capacity - 1;
+    size_t i = intSlotOf(store, id);
+    while (slotUsed(&store->int_slots[i]) && store->int_slots[i].id != id) {
+        i = (i + 1) & mask;
+    }
+
+    kv_entry* slot = &store->int_slots[i];
+    if (slotUsed(slot)) {
+        releaseValue(store, slot);
+        store->data_size = store->data_size - kv_entry_value_len(slot) + kv_entry_value_len(&value);
+    } else {
+        slot->id = id;
+        store->int_size++;
+        store->data_size += sizeof(unsigned long long) + kv_entry_value_len(&value);
+    }
+    slot->value = value.value;
+    slot->value_len = value.value_len;
+    slot->version = ++store->version;
+    return 0;
+}
+
+static int intDelete(kv_store* store, unsigned long long id) {
+    kv_entry* slot = intFind(store, id);
+    if (slot == NULL) {
+        return -1;
+    }
+    store->data_size -= sizeof(unsigned long long) + kv_entry_value_len(slot);
+    releaseValue(store, slot);
+    store->int_size--;
+
+    // moves the following slots of the probe sequence back instead of leaving a tombstone
+    size_t mask = store->int_capacity - 1;
+    size_t hole = (size_t)(slot - store->int_slots);
+    for (size_t i = (hole + 1) & mask; slotUsed(&store->int_slots[i]); i = (i + 1) & mask) {
+        size_t home = intSlotOf(store, store->int_slots[i].id);
+        // the entry stays if its home lies cyclically in (hole, i]
+        bool stays = hole <= i ? (home > hole && home <= i) : (home > hole || home <= i);
+        if (!stays) {
+            store->int_slots[hole] = store->int_slots[i];
+            hole = i;
+        }
+    }
+    store->int_slots[hole].value = NULL;
+    store->int_slots[hole].value_len = 0;
+    return 0;
+}
+
+int kv_store_use_int_keys(kv_store* store) {
+    if (store->int_slots != NULL) {
+        return 0;
+    }
+    kv_entry* slots = storeAlloc(store, KV_INT_INITIAL_CAPACITY * sizeof(kv_entry));
+    if (slots == NULL) {
+        return -1;
+    }
+    memset(slots, 0, KV_INT_INITIAL_CAPACITY * sizeof(kv_entry));
+    store->int_slots = slots;
+    store->int_capacity = KV_INT_INITIAL_CAPACITY;
+    store->int_size = 0;
+    return 0;
+}
 
 kv_store* create_kv_store(int initialCapcity) {
+    return create_kv_store_with_allocator(initialCapcity, NULL);
+}
+
+// differs between stores, also of other runs, so versions of one are not taken for those of another
+static unsigned long long newEpoch(const kv_store* store) {
+    static atomic_ullong created;
+    struct timespec now;
+    timespec_get(&now, TIME_UTC);
+    unsigned long long x = (unsigned long long)now.tv_sec * 1000000000ULL + (unsigned long long)now.tv_nsec;
+    x ^= (unsigned long long)(uintptr_t)store ^ atomic_fetch_add(&created, 1) * 0x9E3779B97F4A7C15ULL;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+kv_store* create_kv_store_with_allocator(int initialCapcity, kv_allocator* allocator) {
+    if (allocator == NULL) {
+        allocator = kv_allocator_system();
+    }
+
     kv_store* store = calloc(1, sizeof(kv_store));
     if (store == NULL) {
+        kv_allocator_destroy(allocator);
         return NULL;
     }
+    store->allocator = allocator;
 
-    store->entries = calloc(initialCapcity, sizeof(kv_entry));
+    store->entries = storeAlloc(store, initialCapcity * sizeof(kv_entry));
     if (store->entries == NULL) {
+        kv_allocator_destroy(allocator);
         free(store);
         return NULL;
     }
+    memset(store->entries, 0, initialCapcity * sizeof(kv_entry));
 
     store->capacity = initialCapcity;
     store->size = 0;
+    store->epoch = newEpoch(store);
     return store;
 }
 
 int kv_store_resize( kv_store* store) {
     size_t new_capacity = store->capacity * 2;
-    struct kv_entry* new_entries = realloc(store->entries, new_capacity * sizeof(kv_entry));
+    struct kv_entry* new_entries = store->allocator->reallocate(store->allocator, store->entries,
+                                                             store->capacity * sizeof(kv_entry),
+                                                             new_capacity * sizeof(kv_entry));
     if (new_entries == NULL) {
         return -1;
     }
+    store->allocated_bytes += (new_capacity - store->capacity) * sizeof(kv_entry);
 
     size_t old_capacity = store->capacity;
     memset(new_entries + old_capacity, 0, (new_capacity - old_capacity) * sizeof(kv_entry));
@@ -40,55 +870,270 @@ int kv_store_put(kv_store* store, const char* key, const char* value) {
     if(key == NULL || value == NULL) {
         return -1;
     }
-    
+
+    size_t value_len = strlen(value);
+    long long number;
+    if (parseNumber(value, value_len, &number)) {
+        return putValue(store, key, numberValue(number));
+    }
+    int compressed = putCompressed(store, key, value, value_len);
+    if (compressed != 0) {
+        return compressed > 0 ? 0 : -1;
+    }
+
+    char* copy = storeAlloc(store, value_len + 1);
+    if (copy == NULL) {
+        return -1;
+    }
+    memcpy(copy, value, value_len + 1);
+
+    if (putValue(store, key, (kv_entry){.value = copy, .value_len = value_len}) != 0) {
+        storeFree(store, copy, value_len + 1);
+        return -1;
+    }
+    return 0;
+}
+
+int kv_store_put_owned(kv_store* store, const char* key, char* value, size_t value_len) {
+
+    if(key == NULL || value == NULL) {
+        return -1;
+    }
+
+    long long number;
+    if (parseNumber(value, value_len, &number)) {
+        return putValue(store, key, numberValue(number)) == 0 ? KV_STORE_COPIED : -1;
+    }
+    int compressed = putCompressed(store, key, value, value_len);
+    if (compressed != 0) {
+        return compressed > 0 ? KV_STORE_COPIED : -1;
+    }
+
+    // values allocated with malloc can only be kept if the store frees them with free
+    if (store->allocator == kv_allocator_system()) {
+        store->allocated_bytes += value_len + 1;
+        store->allocations++;
+        if (putValue(store, key, (kv_entry){.value = value, .value_len = value_len}) != 0) {
+            store->allocated_bytes -= value_len + 1;
+            store->allocations--;
+            return -1;
+        }
+        return 0;
+    }
+
+    char* copy = storeAlloc(store, value_len + 1);
+    if (copy == NULL) {
+        return -1;
+    }
+    memcpy(copy, value, value_len);
+    copy[value_len] = '\0';
+    if (putValue(store, key, (kv_entry){.value = copy, .value_len = value_len}) != 0) {
+        storeFree(store, copy, value_len + 1);
+        return -1;
+    }
+    return KV_STORE_COPIED;
+}
+
+// stores the value and value_len of the entry, a text value is allocated with the allocator of the store (incl. the terminating zero)
+static int putValue(kv_store* store, const char* key, kv_entry value) {
+    unsigned long long id;
+    if (store->int_slots != NULL && kv_parse_int_key(key, &id)) {
+        return intPut(store, id, value);
+    }
+    size_t value_len = kv_entry_value_len(&value);
+
     // Search for the key, if found, update the value
+    kv_entry* free_slot = NULL;
     for (size_t i = 0; i < store->size; i++) {
         if(store->entries[i].key == NULL) {
-            // there is a free slot we can use
-            store->entries[i].key = duplicate_string(key);
-            store->entries[i].value = duplicate_string(value);
-            return 0;
+            // remember the first free slot in case the key is not stored yet
+            if (free_slot == NULL) free_slot = &store->entries[i];
+            continue;
         }
-        
+
         if (strcmp(store->entries[i].key, key) == 0) {
-            free(store->entries[i].value);
-            store->entries[i].value = duplicate_string(value);
+            releaseValue(store, &store->entries[i]);
+            store->data_size = store->data_size - kv_entry_value_len(&store->entries[i]) + value_len;
+            store->entries[i].value = value.value;
+            store->entries[i].value_len = value.value_len;
+            store->entries[i].version = ++store->version;
             return 0;
         }
     }
 
+    size_t key_size = strlen(key) + 1;
+    char* key_copy = storeAlloc(store, key_size);
+    if (key_copy == NULL) {
+        return -1;
+    }
+    memcpy(key_copy, key, key_size);
+
     // If not found, insert new key-value pair
-    if (store->size == store->capacity) {
-        // Resize if necessary
-        if (kv_store_resize(store) != 0) {
-            return -1;
+    if (free_slot == NULL) {
+        if (store->size == store->capacity) {
+            // Resize if necessary
+            if (kv_store_resize(store) != 0) {
+                storeFree(store, key_copy, key_size);
+                return -1;
+            }
         }
+        free_slot = &store->entries[store->size];
+        store->size++;
     }
 
-    store->entries[store->size].key = duplicate_string(key);
-    store->entries[store->size].value = duplicate_string(value);
-    store->size++;
-    return 0; 
+    free_slot->key = key_copy;
+    free_slot->value = value.value;
+    free_slot->value_len = value.value_len;
+    free_slot->version = ++store->version;
+    store->data_size += key_size - 1 + value_len;
+    return 0;
 }
 
-const char* kv_store_get(kv_store* store, const char* key) {
+const kv_entry* kv_store_lookup(kv_store* store, const char* key) {
+    unsigned long long id;
+    if (store->int_slots != NULL && kv_parse_int_key(key, &id)) {
+        return intFind(store, id);
+    }
+
     for (size_t i = 0; i < store->size; i++) {
         if(store->entries[i].key == NULL) continue;
         if (strcmp(store->entries[i].key, key) == 0) {
-            return store->entries[i].value;  // Return the associated value
+            return &store->entries[i];
         }
     }
 
     return NULL;  // Key not found
 }
 
+const char* kv_store_get(kv_store* store, const char* key) {
+    static _Thread_local char numberText[KV_NUMBER_TEXT_SIZE];
+    static _Thread_local char* text;
+    static _Thread_local size_t textCapacity;
+    const kv_entry* entry = kv_store_lookup(store, key);
+    if (entry == NULL) {
+        return NULL;  // Key not found
+    }
+
+    if (kv_entry_is_compressed(entry)) {
+        size_t len = kv_entry_value_len(entry);
+        if (len + 1 > textCapacity) {
+            char* grown = realloc(text, len + 1);
+            if (grown == NULL) {
+                return NULL;
+            }
+            text = grown;
+            textCapacity = len + 1;
+        }
+        return kv_entry_read(entry, text) == 0 ? text : NULL;
+    }
+
+    return kv_entry_value(entry, numberText);  // Return the associated value
+}
+
+int kv_store_incrby(kv_store* store, const char* key, long long delta, long long* result) {
+    if (key == NULL) {
+        return -1;
+    }
+
+    // only the lookup is shared with GET, the entry is changed in place
+    kv_entry* entry = (kv_entry*)kv_store_lookup(store, key);
+    if (entry == NULL) {
+        if (putValue(store, key, numberValue(delta)) != 0) {
+            return -1;
+        }
+        *result = delta;
+        return 0;
+    }
+    if (!kv_entry_is_number(entry)) {
+        return KV_STORE_NOT_A_NUMBER;
+    }
+
+    long long number;
+    if (__builtin_add_overflow(entry->number, delta, &number)) {
+        return KV_STORE_OVERFLOW;
+    }
+    kv_entry value = numberValue(number);
+    store->data_size = store->data_size - kv_entry_value_len(entry) + kv_entry_value_len(&value);
+    entry->number = number;
+    entry->value_len = value.value_len;
+    entry->version = ++store->version;
+    *result = number;
+    return 0;
+}
+
+int kv_store_setrange(kv_store* store, const char* key, size_t offset, const char* value, size_t value_len,
+                      size_t* length) {
+    if (key == NULL || value == NULL) {
+        return -1;
+    }
+
+    kv_entry* entry = (kv_entry*)kv_store_lookup(store, key);
+    if (entry != NULL && kv_entry_is_hash(entry)) {
+        return KV_STORE_WRONG_TYPE;
+    }
+    size_t old_len = entry != NULL ? kv_entry_value_len(entry) : 0;
+    size_t new_len = offset + value_len > old_len ? offset + value_len : old_len;
+    if (value_len == 0) {
+        *length = old_len; // nothing to write, not even the gap
+        return 0;
+    }
+    *length = new_len;
+
+    // text is changed in place, short results are put again as they may have become a number, and text a
+    // reader still sends is replaced by a copy
+    if (entry != NULL && (entry->value_len & KV_VALUE_FLAGS) == 0 && new_len >= KV_NUMBER_TEXT_SIZE &&
+        !valuePinned(store, entry)) {
+        if (new_len > old_len) {
+            char* grown = store->allocator->reallocate(store->allocator, entry->value, old_len + 1, new_len + 1);
+            if (grown == NULL) {
+                return -1;
+            }
+            store->allocated_bytes += new_len - old_len;
+            store->data_size += new_len - old_len;
+            memset(grown + old_len, 0, new_len - old_len); // the gap before the offset is filled with zero bytes
+            grown[new_len] = '\0';
+            entry->value = grown;
+            entry->value_len = new_len;
+        }
+        memcpy(entry->value + offset, value, value_len);
+        entry->version = ++store->version;
+        return 0;
+    }
+
+    // numbers, compressed values and missing keys are rebuilt as text
+    char* text = malloc(new_len + 1);
+    if (text == NULL) {
+        return -1;
+    }
+    if (entry != NULL && kv_entry_read(entry, text) != 0) {
+        free(text);
+        return -1;
+    }
+    memset(text + old_len, 0, new_len - old_len + 1);
+    memcpy(text + offset, value, value_len);
+    int result = kv_store_put_owned(store, key, text, new_len);
+    if (result != 0) {
+        free(text);
+    }
+    return result < 0 ? -1 : 0;
+}
+
 int kv_store_delete(kv_store* store, const char* key) {
+    unsigned long long id;
+    if (store->int_slots != NULL && kv_parse_int_key(key, &id)) {
+        return intDelete(store, id);
+    }
+
     for (size_t i = 0; i < store->size; i++) {
+        if(store->entries[i].key == NULL) continue;
         if (strcmp(store->entries[i].key, key) == 0) {
-            free(store->entries[i].key);
-            free(store->entries[i].value);
+            size_t key_len = strlen(store->entries[i].key);
+            store->data_size -= key_len + kv_entry_value_len(&store->entries[i]);
+            storeFree(store, store->entries[i].key, key_len + 1);
+            releaseValue(store, &store->entries[i]);
             store->entries[i].key = NULL;
             store->entries[i].value = NULL;
+            store->entries[i].value_len = 0;
             return 0;
         }
     }
@@ -97,10 +1142,99 @@ int kv_store_delete(kv_store* store, const char* key) {
 }
 
 void free_kv_store(kv_store* store) {
+    store->lazy_free = NULL; // the whole store goes, there is nothing to keep responsive
     for (size_t i = 0; i < store->size; i++) {
-        if(store->entries[i].key != NULL) free(store->entries[i].key);
-        if(store->entries[i].value != NULL) free(store->entries[i].value);
+        if(store->entries[i].key != NULL) {
+            storeFree(store, store->entries[i].key, strlen(store->entries[i].key) + 1);
+            releaseValue(store, &store->entries[i]);
+        }
     }
-    free(store->entries);
+    storeFree(store, store->entries, store->capacity * sizeof(kv_entry));
+    for (size_t i = 0; i < store->int_capacity; i++) {
+        if (slotUsed(&store->int_slots[i])) releaseValue(store, &store->int_slots[i]);
+    }
+    storeFree(store, store->int_slots, store->int_capacity * sizeof(kv_entry));
+    kv_allocator_destroy(store->allocator);
     free(store);
 }
+
+int kv_store_scan(kv_store* store, size_t* cursor, size_t count, kv_store_visitor visit, void* ctx) {
+    // entries keep their slot until they are deleted, growing the array does not move them
+    if (*cursor >= store->size) {
+        *cursor = store->size;
+        return 0;
+    }
+    size_t end = count < store->size - *cursor ? *cursor + count : store->size;
+    for (size_t i = *cursor; i < end; i++) {
+        if (store->entries[i].key != NULL) {
+            int result = visit(store->entries[i].key, &store->entries[i], ctx);
+            if (result != 0) {
+                *cursor = i;
+                return result;
+            }
+        }
+    }
+    *cursor = end;
+    return 0;
+}
+
+int kv_store_int_keys(kv_store* store, unsigned long long** ids, size_t* count) {
+    *ids = NULL;
+    *count = 0;
+    if (store->int_size == 0) {
+        return 0;
+    }
+    *ids = malloc(store->int_size * sizeof(unsigned long long));
+    if (*ids == NULL) {
+        return -1;
+    }
+    for (size_t i = 0; i < store->int_capacity; i++) {
+        if (slotUsed(&store->int_slots[i])) {
+            (*ids)[(*count)++] = store->int_slots[i].id;
+        }
+    }
+    return 0;
+}
+
+void kv_store_memory_stats(const kv_store* store, kv_memory_stats* stats) {
+    kv_allocator* allocator = store->allocator;
+    stats->allocator = allocator->name;
+    stats->allocated_bytes = store->allocated_bytes;
+    stats->allocations = store->allocations;
+    stats->reserved_bytes = allocator->reserved != NULL ? allocator->reserved(allocator) : store->allocated_bytes;
+    stats->fragmentation = store->allocated_bytes > 0 ? (double)stats->reserved_bytes / (double)store->allocated_bytes : 1.0;
+    stats->compressed_values = store->compressed_values;
+    stats->compressed_raw_bytes = store->compressed_raw_bytes;
+    stats->compressed_stored_bytes = store->compressed_stored_bytes;
+    stats->compression_ratio = store->compressed_stored_bytes > 0 ?
+        (double)store->compressed_raw_bytes / (double)store->compressed_stored_bytes : 1.0;
+    stats->compress_skipped = store->compress_skipped;
+    stats->lazy_freed = store->lazy_freed;
+}
+
+size_t kv_store_count(const kv_store* store) {
+    size_t count = store->int_size;
+    for (size_t i = 0; i < store->size; i++) {
+        count += store->entries[i].key != NULL;
+    }
+    return count;
+}
+
+int kv_store_foreach(kv_store* store, kv_store_visitor visit, void* ctx) {
+    for (size_t i = 0; i < store->size; i++) {
+        if (store->entries[i].key != NULL) {
+            int result = visit(store->entries[i].key, &store->entries[i], ctx);
+            if (result != 0) return result;
+        }
+    }
+
+    char key[24]; // up to 20 digits
+    for (size_t i = 0; i < store->int_capacity; i++) {
+        if (slotUsed(&store->int_slots[i])) {
+            snprintf(key, sizeof(key), "%llu", store->int_slots[i].id);
+            int result = visit(key, &store->int_slots[i], ctx);
+            if (result != 0) return result;
+        }
+    }
+    return 0;
+}
@@ -1,25 +1,144 @@
 #ifndef _KVSTORE_H_
 #define _KVSTORE_H_
 
+#include <stdbool.h>
 #include <stddef.h>
+#include "kvalloc.h"
+
+#define KV_INT_INITIAL_CAPACITY 64
+#define KV_VALUE_NUMBER ((size_t)1 << (sizeof(size_t) * 8 - 1)) // flag in value_len: the value is kept as number
+#define KV_VALUE_COMPRESSED ((size_t)1 << (sizeof(size_t) * 8 - 2)) // flag in value_len: the value is a kv_compressed_value
+#define KV_VALUE_HASH ((size_t)1 << (sizeof(size_t) * 8 - 3)) // flag in value_len: the value is a hash of fields
+#define KV_VALUE_FLAGS (KV_VALUE_NUMBER | KV_VALUE_COMPRESSED | KV_VALUE_HASH)
+#define KV_HASH_PACKED_MAX_FIELDS 128 // hashes with more fields are converted from the packed encoding to a table
+#define KV_HASH_PACKED_MAX_LEN 64     // so are hashes with a longer field or value
+#define KV_HASH_PACKED_INITIAL 64     // bytes of the packed encoding of a new hash
+#define KV_HASH_MIN_BUCKETS 16
+#define KV_LAZY_FREE_MIN (64 * 1024)  // default bytes of a value from which on it is freed in the background
+#define KV_NUMBER_TEXT_SIZE 21  // "-9223372036854775808" incl. the terminating zero
+#define KV_STORE_NOT_A_NUMBER -2
+#define KV_STORE_OVERFLOW -3
+#define KV_STORE_WRONG_TYPE -4   // the key holds a hash where a value is expected or the other way round
+#define KV_STORE_COPIED 1     // kv_store_put_owned stored the value without keeping the allocation
 
 typedef struct kv_entry {
-    char* key;
-    char* value;
+    union {
+        char* key;
+        unsigned long long id;  // instead of the key in the table of integer keys
+    };
+    union {
+        char* value;            // NULL in free slots of the table of integer keys
+        long long number;       // instead of the value if value_len has KV_VALUE_NUMBER set
+    };
+    size_t value_len;           // of the text (of all fields and values of a hash), use kv_entry_value_len
+    unsigned long long version; // changes with every write of the value, never goes back for a key of the store
 } kv_entry;
 
+// value of an entry with KV_VALUE_COMPRESSED set, value_len stays the length of the text
+typedef struct kv_compressed_value {
+    size_t block_len;
+    char block[];               // kvcompress block of the text
+} kv_compressed_value;
+
+// called instead of freeing a large value that was deleted or overwritten. The value is unlinked from the
+// store and no longer counted, the callee frees it with kv_entry_free_detached on any thread.
+typedef void (*kv_lazy_free_fn)(kv_entry value, size_t bytes, void* ctx);
+
+// asked before a value is freed (release) or changed in place, true if a reader still uses it without holding the
+// store lock. A released value is then handed over like to a kv_lazy_free_fn, one that would be changed is copied.
+typedef bool (*kv_pinned_fn)(kv_entry value, size_t bytes, bool release, void* ctx);
+
 typedef struct kv_store {
     kv_entry* entries;   // Dynamic array of entries
     size_t capacity;            // Maximum number of entries before resizing
     size_t size;                // Current number of entries
+    size_t data_size;           // Bytes held by all keys and values
+    kv_allocator* allocator;    // Entries, keys and values are allocated with it
+    size_t allocated_bytes;     // Bytes requested from the allocator and not freed yet
+    size_t allocations;         // Allocations not freed yet
+    kv_entry* int_slots;        // Open addressing table of keys that are integers, NULL if they are kept as strings
+    size_t int_capacity;        // Power of two
+    size_t int_size;
+    size_t compress_min;        // values of at least this many bytes are compressed, 0 if none are
+    size_t compressed_values;
+    size_t compressed_raw_bytes;    // length of the compressed values as text
+    size_t compressed_stored_bytes; // bytes allocated for them
+    size_t compress_skipped;    // values that were large enough but did not compress well, counted since the start
+    unsigned long long version; // the last version given to an entry, versions start at 1
+    unsigned long long epoch;   // differs per store, versions of different stores (or runs) are not comparable
+    size_t lazy_free_min;       // values of at least this many bytes are handed to lazy_free, 0 if none are
+    kv_lazy_free_fn lazy_free;
+    void* lazy_free_ctx;
+    size_t lazy_freed;          // values handed to lazy_free, counted since the start
+    kv_pinned_fn pinned;        // NULL if no value is used outside of the store lock
+    void* pinned_ctx;
 } kv_store;
 
+// called for every key of the store, a result other than 0 stops the iteration
+typedef int (*kv_store_visitor)(const char* key, const kv_entry* entry, void* ctx);
+
+// called for every field of a hash, a result other than 0 stops the iteration
+typedef int (*kv_hash_visitor)(const char* field, size_t field_len, const char* value, size_t value_len, void* ctx);
+
+typedef struct kv_memory_stats {
+    const char* allocator;      // name of the allocator
+    size_t allocated_bytes;
+    size_t allocations;
+    size_t reserved_bytes;      // held by the allocator, allocated_bytes if it cannot tell
+    double fragmentation;       // reserved_bytes / allocated_bytes
+    size_t compressed_values;
+    size_t compressed_raw_bytes;
+    size_t compressed_stored_bytes;
+    double compression_ratio;   // compressed_raw_bytes / compressed_stored_bytes
+    size_t compress_skipped;
+    size_t lazy_freed;
+} kv_memory_stats;
+
+static inline bool kv_entry_is_number(const kv_entry* entry) {
+    return (entry->value_len & KV_VALUE_NUMBER) != 0;
+}
+
+static inline bool kv_entry_is_compressed(const kv_entry* entry) {
+    return (entry->value_len & KV_VALUE_COMPRESSED) != 0;
+}
+
+static inline bool kv_entry_is_hash(const kv_entry* entry) {
+    return (entry->value_len & KV_VALUE_HASH) != 0;
+}
+
+static inline size_t kv_entry_value_len(const kv_entry* entry) {
+    return entry->value_len & ~KV_VALUE_FLAGS;
+}
+
 // prototypes
-kv_store* create_kv_store(int initialCapacity); // initialize a new key value store
+kv_store* create_kv_store(int initialCapacity); // initialize a new key value store using the system allocator
+kv_store* create_kv_store_with_allocator(int initialCapacity, kv_allocator* allocator); // takes ownership of the allocator, NULL for the system allocator
 int kv_store_resize(kv_store* store);  // resize an existing key value store by doubling its capacity
 int kv_store_put(kv_store* store, const char* key, const char* value) ; // add or overwrite a key value pair in the store
-const char* kv_store_get(kv_store* store, const char* key); // retrieve the value associated with a key from the store
+int kv_store_put_owned(kv_store* store, const char* key, char* value, size_t value_len); // like kv_store_put but takes ownership of a value allocated with malloc if it returns 0, KV_STORE_COPIED if the value stays with the caller (numbers, compressed values and stores with another allocator)
+const char* kv_store_get(kv_store* store, const char* key); // retrieve the value associated with a key from the store (NULL for hashes), numbers and compressed values are rendered into a buffer of the thread that is reused by the next call
+const kv_entry* kv_store_lookup(kv_store* store, const char* key); // retrieve the entry of a key (incl. value length) from the store, it has an id instead of the key for integer keys
 void free_kv_store(kv_store* store); // free the memory allocated for the key value store (incl. all values)
 int kv_store_delete(kv_store* store, const char* key); // delete a key value pair from the store
+const char* kv_entry_value(const kv_entry* entry, char* buffer); // the value as text, numbers are rendered into the buffer of KV_NUMBER_TEXT_SIZE bytes, NULL if it is compressed or a hash
+int kv_entry_read(const kv_entry* entry, char* dst); // copies the value as text incl. the terminating zero into dst of kv_entry_value_len + 1 bytes, -1 if a compressed value is corrupt or it is a hash
+void kv_store_set_compression(kv_store* store, size_t min_size); // compress values of at least min_size bytes that are stored from now on, 0 turns it off
+int kv_store_set_lazy_free(kv_store* store, size_t min_size, kv_lazy_free_fn lazy_free, void* ctx); // hand values of at least min_size bytes to lazy_free (0 to free all inline), -1 unless the store uses the system allocator, the others are not thread-safe
+void kv_entry_free_detached(kv_entry value); // frees a value handed to a kv_lazy_free_fn, safe on any thread
+int kv_store_set_pinned(kv_store* store, kv_pinned_fn pinned, void* ctx); // ask pinned before a value is freed or changed in place (NULL to stop), -1 unless the store uses the system allocator
+int kv_store_incrby(kv_store* store, const char* key, long long delta, long long* result); // adds delta to the number stored (0 if the key is missing), KV_STORE_NOT_A_NUMBER or KV_STORE_OVERFLOW if it cannot
+int kv_store_setrange(kv_store* store, const char* key, size_t offset, const char* value, size_t value_len, size_t* length); // overwrite the value from offset on (a missing key is empty), a gap behind its end is filled with zero bytes, length is the new length of the value, KV_STORE_WRONG_TYPE for hashes
+int kv_store_use_int_keys(kv_store* store); // keep keys in canonical decimal form ("0" to "18446744073709551615") as integers in a hash table, call before the first put
+bool kv_parse_int_key(const char* key, unsigned long long* id); // whether the key is an integer in canonical decimal form
+size_t kv_store_count(const kv_store* store); // number of keys
+int kv_store_foreach(kv_store* store, kv_store_visitor visit, void* ctx); // visits all keys, returns the first result other than 0
+int kv_store_scan(kv_store* store, size_t* cursor, size_t count, kv_store_visitor visit, void* ctx); // visits the keys of up to count slots from *cursor on (start at 0, done once it reaches store->size) and advances it, a key that stays is visited once even if the store changes between calls, integer keys are left out (see kv_store_int_keys), returns the first result of visit other than 0
+int kv_store_int_keys(kv_store* store, unsigned long long** ids, size_t* count); // copies the integer keys into an array allocated with malloc (NULL if there are none), -1 if out of memory
+void kv_store_memory_stats(const kv_store* store, kv_memory_stats* stats); // allocation counters of the store and its allocator
+int kv_store_hset(kv_store* store, const char* key, const char* field, size_t field_len, const char* value, size_t value_len); // set a field of the hash stored under the key (created if missing), 1 if the field is new, 0 if it was updated, KV_STORE_WRONG_TYPE if the key holds no hash
+int kv_store_hget(kv_store* store, const char* key, const char* field, size_t field_len, const char** value, size_t* value_len); // the value of a field points into the store, -1 if key or field are missing, KV_STORE_WRONG_TYPE if the key holds no hash
+int kv_store_hdel(kv_store* store, const char* key, const char* field, size_t field_len); // delete a field, the key goes away with the last one, -1 if key or field are missing, KV_STORE_WRONG_TYPE if the key holds no hash
+size_t kv_entry_hash_len(const kv_entry* entry); // number of fields of a hash
+int kv_entry_hash_foreach(const kv_entry* entry, kv_hash_visitor visit, void* ctx); // visits all fields of a hash, returns the first result other than 0
 
 #endif
\ No newline at end of file
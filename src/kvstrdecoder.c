@@ -0,0 +1,344 @@
+#include <stdlib.h>
+#include <string.h>
+#include "kvstrdecoder.h"
+
+// supported operations and the roles of their arguments in order
+struct kvstr_operation {
+    const char* name;
+    const char* args;
+};
+
+static const struct kvstr_operation kvstr_operations[] = {
+    { "GET", "k" },
+    { "GETZ", "k" },
+    { "PUT", "kv" },
+    { "DEL", "k" },
+    { "INCRBY", "ka" },
+    { "GETV", "ka" },
+    { "PUTV", "kav" },
+    { "GETRANGE", "kaa" },
+    { "SETRANGE", "kav" },
+    { "HSET", "kav" },
+    { "HGET", "ka" },
+    { "HDEL", "ka" },
+    { "HGETALL", "k" },
+    { "HELLO", "" },
+    { "STATS", "" },
+    { "SLOWLOG", "a" },
+    { "SYNC", "" },
+    { "REPLPING", "aa" },   // only sent by a primary to its replicas
+    { "REPLACK", "a" },     // only sent by a replica to its primary
+    { "ASKING", "" },
+    { "SLOTS", "" },
+    { "KEYSLOT", "k" },
+    { "SETSLOT", "aaa" },
+    { "MIGRATE", "aa" },
+    { "RESTORE", "kv" },    // only sent by the source of a slot migration
+    { "HRESTORE", "kv" },   // only sent by the source of a slot migration
+    { "TRACKING", "a" },
+    { "WATCH", "a" },
+    { "UNWATCH", "a" },
+    { "HOTKEYS", "a" },
+    { "MEMORY", "a" },
+};
+
+const char* kvstr_operation_args(const char* operation) {
+  for (size_t i = 0; i < sizeof(kvstr_operations) / sizeof(kvstr_operations[0]); i++) {
+    if (strcmp(operation, kvstr_operations[i].name) == 0) {
+      return kvstr_operations[i].args;
+    }
+  }
+  return NULL;
+}
+
+// helper fucntion to free the memory allocated for the request
+void free_kvstr_request(struct kvstr_request** req_ptr) {
+  if (req_ptr == NULL) {
+      return;
+  }
+
+  struct kvstr_request* req = *req_ptr;
+  if (req == NULL) {
+      return;
+  }
+
+  if (req->operation != NULL) {
+      free(req->operation);
+      req->operation = NULL;
+  }
+  if (req->key != NULL) {
+      free(req->key);
+      req->key = NULL;
+  }
+  if (req->value != NULL) {
+      free(req->value);
+      req->value = NULL;
+  }
+  for (size_t i = 0; i < req->arg_count; i++) {
+      free(req->args[i]);
+      req->args[i] = NULL;
+  }
+  req->arg_count = 0;
+
+  free(req);
+  *req_ptr = NULL;
+}
+
+// helper function to initialize a clean request struct
+struct kvstr_request* create_kvstr_request() {
+    struct kvstr_request* req = (struct kvstr_request*) malloc(sizeof(struct kvstr_request));
+    if (req == NULL) {
+        return NULL;  // Memory allocation failure
+    }
+
+    req->operation = NULL;
+    req->key = NULL;
+    req->value = NULL;
+    req->value_len = 0;
+    req->arg_count = 0;
+
+    return req;
+}
+
+void kvstr_decoder_init(struct kvstr_decoder* dec, struct kvstr_request* request, size_t max_key_len, size_t max_value_len) {
+  memset(dec, 0, sizeof(*dec));
+  dec->state = KVSTR_DEC_OPERATION;
+  dec->max_key_len = max_key_len;
+  dec->max_value_len = max_value_len;
+  dec->request = request;
+}
+
+int kvstr_decoder_done(const struct kvstr_decoder* dec) {
+  return dec->state == KVSTR_DEC_DONE;
+}
+
+static void fail(struct kvstr_decoder* dec, int error) {
+  dec->state = KVSTR_DEC_ERROR;
+  dec->error = error;
+}
+
+// error code reported when the argument at the current position is broken
+static int argumentError(const struct kvstr_decoder* dec) {
+  if (dec->args == NULL) {
+    return -2; // still parsing the operation
+  }
+  switch (dec->args[dec->arg_index]) {
+  case 'v':
+    return -4;
+  case 'a':
+    return -8;
+  default:
+    return -3;
+  }
+}
+
+// looks up the operation read so far, args_follow tells whether it was terminated by a space
+// (arguments follow) or by a line break / the end of the input
+static void startOperation(struct kvstr_decoder* dec, int args_follow) {
+  dec->token[dec->token_len] = '\0';
+
+  const char* args = kvstr_operation_args(dec->token);
+  if (args == NULL) {
+    fail(dec, -2); // Invalid operation
+    return;
+  }
+
+  dec->request->operation = (char *)malloc(dec->token_len + 1);
+  if (dec->request->operation == NULL) {
+    fail(dec, -7);
+    return;
+  }
+  memcpy(dec->request->operation, dec->token, dec->token_len + 1);
+
+  dec->args = args;
+  dec->arg_index = 0;
+  dec->arg_len = 0;
+  dec->arg_digits = 0;
+  if (dec->args[0] == '\0') {
+    dec->state = KVSTR_DEC_DONE; // operation without arguments
+  } else if (!args_follow) {
+    fail(dec, argumentError(dec)); // arguments missing
+  } else {
+    dec->state = KVSTR_DEC_ARG_LENGTH;
+  }
+}
+
+// allocates the argument with its announced length and attaches it to the request right away,
+// so it is released together with the request even if decoding fails later on
+static void startArgument(struct kvstr_decoder* dec) {
+  if (dec->arg_digits == 0 || dec->arg_len == 0) {
+    fail(dec, argumentError(dec)); // Invalid argument length
+    return;
+  }
+
+  dec->arg_buf = (char *)malloc(dec->arg_len + 1);
+  if (dec->arg_buf == NULL) {
+    fail(dec, -7);
+    return;
+  }
+  dec->arg_buf[dec->arg_len] = '\0';
+  dec->arg_filled = 0;
+
+  if (dec->args[dec->arg_index] == 'v') {
+    dec->request->value = dec->arg_buf;
+    dec->request->value_len = dec->arg_len;
+  } else if (dec->args[dec->arg_index] == 'a') {
+    dec->request->args[dec->request->arg_count] = dec->arg_buf;
+    dec->request->arg_lens[dec->request->arg_count] = dec->arg_len;
+    dec->request->arg_count++;
+  } else {
+    dec->request->key = dec->arg_buf;
+  }
+  dec->state = KVSTR_DEC_ARG_DATA;
+}
+
+static void finishArgument(struct kvstr_decoder* dec) {
+  if (dec->args[dec->arg_index] == 'k' && memchr(dec->arg_buf, '\0', dec->arg_len) != NULL) {
+    fail(dec, -3); // keys are used as strings and must not contain '\0'
+    return;
+  }
+
+  dec->arg_buf = NULL;
+  dec->arg_index++;
+  if (dec->args[dec->arg_index] == '\0') {
+    dec->state = KVSTR_DEC_DONE;
+    return;
+  }
+
+  dec->arg_len = 0;
+  dec->arg_digits = 0;
+  dec->state = KVSTR_DEC_SEPARATOR;
+}
+
+size_t kvstr_decoder_feed(struct kvstr_decoder* dec, const char* data, size_t len) {
+  size_t pos = 0;
+
+  while (pos < len && dec->state != KVSTR_DEC_DONE && dec->state != KVSTR_DEC_ERROR) {
+    char c = data[pos];
+
+    switch (dec->state) {
+    case KVSTR_DEC_OPERATION:
+      if (c == ' ') {
+        startOperation(dec, 1);
+      } else if (c == '\r' || c == '\n') {
+        // line breaks in front of a request are tolerated (e.g. when typing into telnet)
+        if (dec->token_len > 0) {
+          startOperation(dec, 0);
+        }
+      } else if (dec->token_len < sizeof(dec->token) - 1) {
+        dec->token[dec->token_len++] = c;
+      } else {
+        fail(dec, -2); // no known operation is that long
+      }
+      pos++;
+      break;
+
+    case KVSTR_DEC_ARG_LENGTH: {
+      pos++;
+      if (c == ':') {
+        startArgument(dec);
+        break;
+      }
+
+      size_t limit = dec->args[dec->arg_index] == 'v' ? dec->max_value_len : dec->max_key_len;
+      if (c < '0' || c > '9') {
+        fail(dec, argumentError(dec)); // Malformed length prefix
+        break;
+      }
+      dec->arg_len = dec->arg_len * 10 + (size_t)(c - '0');
+      dec->arg_digits++;
+      if (dec->arg_len > limit) {
+        fail(dec, -6); // larger than we are willing to accept
+      }
+      break;
+    }
+
+    case KVSTR_DEC_ARG_DATA: {
+      size_t n = dec->arg_len - dec->arg_filled;
+      if (n > len - pos) {
+        n = len - pos;
+      }
+      memcpy(dec->arg_buf + dec->arg_filled, data + pos, n);
+      pos += n;
+      kvstr_decoder_commit(dec, n);
+      break;
+    }
+
+    case KVSTR_DEC_SEPARATOR:
+      pos++;
+      if (c != ' ') {
+        fail(dec, argumentError(dec)); // Malformed request (no space between arguments)
+        break;
+      }
+      dec->state = KVSTR_DEC_ARG_LENGTH;
+      break;
+
+    default:
+      break;
+    }
+  }
+
+  return pos;
+}
+
+char* kvstr_decoder_direct_buffer(struct kvstr_decoder* dec, size_t* remaining) {
+  if (dec->state != KVSTR_DEC_ARG_DATA) {
+    *remaining = 0;
+    return NULL;
+  }
+
+  *remaining = dec->arg_len - dec->arg_filled;
+  return dec->arg_buf + dec->arg_filled;
+}
+
+void kvstr_decoder_commit(struct kvstr_decoder* dec, size_t len) {
+  dec->arg_filled += len;
+  if (dec->arg_filled == dec->arg_len) {
+    finishArgument(dec);
+  }
+}
+
+int kvstr_decoder_finish(struct kvstr_decoder* dec) {
+  if (dec->state == KVSTR_DEC_DONE) {
+    return 0;
+  }
+
+  if (dec->state == KVSTR_DEC_OPERATION && dec->token_len > 0) {
+    startOperation(dec, 0); // the end of the input terminates operations without arguments
+    if (dec->state == KVSTR_DEC_DONE) {
+      return 0;
+    }
+  }
+
+  if (dec->state != KVSTR_DEC_ERROR) {
+    fail(dec, argumentError(dec)); // input ended in the middle of the request
+  }
+  return dec->error;
+}
+
+int kvstr_parse_request(const char *request_str, struct kvstr_request *result) {
+  if (request_str == NULL || result == NULL) {
+    return -1; // Invalid input
+  }
+
+  result->operation = result->key = result->value = NULL;
+  result->value_len = 0;
+  result->arg_count = 0;
+
+  struct kvstr_decoder dec;
+  kvstr_decoder_init(&dec, result, KVSTR_MAX_KEY_SIZE, KVSTR_MAX_VALUE_SIZE);
+
+  size_t len = strlen(request_str);
+  size_t consumed = kvstr_decoder_feed(&dec, request_str, len);
+  int error = kvstr_decoder_finish(&dec);
+  if (error != 0) {
+    return error;
+  }
+
+  // Ensure that the request string has been fully parsed (a trailing line break is fine)
+  if (request_str[consumed + strspn(request_str + consumed, "\r\n")] != '\0') {
+    return -5; // Junk data found after parsing
+  }
+
+  return 0; // Success
+}
@@ -0,0 +1,65 @@
+#ifndef _KVSTR_DECODER_H
+#define _KVSTR_DECODER_H
+
+#include <stddef.h>
+
+#define KVSTR_MAX_KEY_SIZE (64 * 1024)            // keys are small and always fully buffered
+#define KVSTR_MAX_VALUE_SIZE (512 * 1024 * 1024)  // default upper bound for a single value
+#define KVSTR_MAX_ARGS 4                          // further arguments besides key and value
+
+// represents a request from the client
+struct kvstr_request {
+    char* key;
+    char* value;
+    char* operation;
+    size_t value_len;   // values are length-prefixed and may contain any byte
+    char* args[KVSTR_MAX_ARGS];         // further arguments of the operation (e.g. a subcommand)
+    size_t arg_lens[KVSTR_MAX_ARGS];
+    size_t arg_count;
+};
+
+enum kvstr_decoder_state {
+    KVSTR_DEC_OPERATION,    // reading the operation name up to the first space
+    KVSTR_DEC_ARG_LENGTH,   // reading the decimal length prefix of an argument
+    KVSTR_DEC_ARG_DATA,     // copying argument bytes into their final allocation
+    KVSTR_DEC_SEPARATOR,    // expecting the space between two arguments
+    KVSTR_DEC_DONE,
+    KVSTR_DEC_ERROR,
+};
+
+// incremental request decoder
+//
+// Bytes can be fed in arbitrary chunks as they arrive from the socket. As soon as the length
+// prefix of an argument is known the argument is allocated with its final size, so large values
+// can be received straight into that allocation (see kvstr_decoder_direct_buffer) instead of
+// buffering the whole request first.
+struct kvstr_decoder {
+    enum kvstr_decoder_state state;
+    char token[16];             // operation name being accumulated
+    size_t token_len;
+    const char* args;           // argument roles of the current operation ('k' key, 'v' value, 'a' other)
+    size_t arg_index;
+    char* arg_buf;              // allocation the current argument is written to
+    size_t arg_len;
+    size_t arg_filled;
+    size_t arg_digits;
+    size_t max_key_len;
+    size_t max_value_len;
+    int error;                  // parse error code once state is KVSTR_DEC_ERROR
+    struct kvstr_request* request;
+};
+
+/* Prototypes */
+struct kvstr_request* create_kvstr_request();
+void free_kvstr_request(struct kvstr_request** req_ptr);
+int kvstr_parse_request(const char *request_str, struct kvstr_request *result);
+const char* kvstr_operation_args(const char* operation); // roles of the arguments ('k', 'v', 'a') in order, NULL for unknown operations
+
+void kvstr_decoder_init(struct kvstr_decoder* dec, struct kvstr_request* request, size_t max_key_len, size_t max_value_len);
+size_t kvstr_decoder_feed(struct kvstr_decoder* dec, const char* data, size_t len); // returns the number of consumed bytes
+char* kvstr_decoder_direct_buffer(struct kvstr_decoder* dec, size_t* remaining); // where the next argument bytes belong (or NULL)
+void kvstr_decoder_commit(struct kvstr_decoder* dec, size_t len); // mark bytes written to the direct buffer as received
+int kvstr_decoder_finish(struct kvstr_decoder* dec); // end of input, returns 0 or the parse error code
+int kvstr_decoder_done(const struct kvstr_decoder* dec);
+
+#endif
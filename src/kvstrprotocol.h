@@ -5,7 +5,7 @@
 #include <string.h>
 #include <stdio.h>
 
-char* kvstr_build_get_request(const char* key) {
+static inline char* kvstr_build_get_request(const char* key) {
     // Validate input
     if (key == NULL) {
         return NULL;
@@ -27,7 +27,7 @@ char* kvstr_build_get_request(const char* key) {
     return request;  // Caller is responsible for freeing the memory
 }
 
-char* kvstr_build_put_request(const char* key, const char* value) {
+static inline char* kvstr_build_put_request(const char* key, const char* value) {
     // Validate input
     if (key == NULL || value == NULL) {
         return NULL;
@@ -52,7 +52,7 @@ char* kvstr_build_put_request(const char* key, const char* value) {
     return request;  // Caller is responsible for freeing the memory
 }
 
-char* kvstr_build_del_request(const char* key) {
+static inline char* kvstr_build_del_request(const char* key) {
     if (key == NULL) {
         return NULL;
     }
@@ -73,4 +73,127 @@ char* kvstr_build_del_request(const char* key) {
     return request;  // Caller is responsible for freeing the memory
 }
 
-#endif
\ No newline at end of file
+static inline char* kvstr_build_request(const char* operation, int arg_count, char** args) {
+    if (operation == NULL || (arg_count > 0 && args == NULL)) {
+        return NULL;
+    }
+
+    // Every argument is sent as " <len>:<bytes>"
+    size_t buffer_size = strlen(operation) + 3;
+    for (int i = 0; i < arg_count; i++) {
+        buffer_size += 1 + 20 + 1 + strlen(args[i]); // space, max 20 digits, colon
+    }
+
+    char* request = (char*)malloc(buffer_size);
+    if (!request) {
+        return NULL;
+    }
+
+    size_t pos = snprintf(request, buffer_size, "%s", operation);
+    for (int i = 0; i < arg_count; i++) {
+        pos += snprintf(request + pos, buffer_size - pos, " %zu:%s", strlen(args[i]), args[i]);
+    }
+    if (arg_count == 0) {
+        snprintf(request + pos, buffer_size - pos, "\r\n"); // operations without arguments end with a line break
+    }
+
+    return request;  // Caller is responsible for freeing the memory
+}
+
+/*
+ * Allocation free variants: only the header of a request ("GET <len>:", " <len>:" in front of a
+ * value) is written into a buffer of the caller, the key and value are referenced by the returned
+ * kvstr_iovec entries and can be sent with a single gathering write without being copied.
+ */
+
+#define KVSTR_MAX_HEADER_SIZE 48  // enough for the headers of any GET, PUT or DEL request
+#define KVSTR_MAX_IOVEC 4         // entries filled in by the encoders at most
+
+// a piece of a request, the memory stays owned by the caller
+typedef struct kvstr_iovec {
+    const char* base;
+    size_t len;
+} kvstr_iovec;
+
+static inline size_t kvstr_digits(size_t value) {
+    size_t digits = 1;
+    while (value >= 10) {
+        value /= 10;
+        digits++;
+    }
+    return digits;
+}
+
+// header bytes of a request with one key, and a value if has_value is set
+static inline size_t kvstr_header_size(const char* operation, size_t key_len, int has_value, size_t value_len) {
+    size_t size = strlen(operation) + 1 + kvstr_digits(key_len) + 1;  // "<op> <len>:"
+    if (has_value) {
+        size += 1 + kvstr_digits(value_len) + 1;                         // " <len>:"
+    }
+    return size;
+}
+
+// writes "<prefix><len>:" without a terminating zero, returns the number of bytes written
+static inline size_t kvstr_write_header(char* buffer, const char* prefix, size_t len) {
+    size_t pos = strlen(prefix);
+    memcpy(buffer, prefix, pos);
+    size_t digits = kvstr_digits(len);
+    for (size_t i = digits; i > 0; i--) {
+        buffer[pos + i - 1] = (char)('0' + len % 10);
+        len /= 10;
+    }
+    buffer[pos + digits] = ':';
+    return pos + digits + 1;
+}
+
+static inline size_t kvstr_get_header_size(size_t key_len) {
+    return kvstr_header_size("GET", key_len, 0, 0);
+}
+
+static inline size_t kvstr_put_header_size(size_t key_len, size_t value_len) {
+    return kvstr_header_size("PUT", key_len, 1, value_len);
+}
+
+static inline size_t kvstr_del_header_size(size_t key_len) {
+    return kvstr_header_size("DEL", key_len, 0, 0);
+}
+
+// writes the header into buffer and fills iov, returns the number of entries or -1 if buffer is too small
+static inline int kvstr_encode_request(const char* operation, const char* key, size_t key_len, const char* value,
+                                       size_t value_len, char* buffer, size_t buffer_size, kvstr_iovec* iov) {
+    if (operation == NULL || key == NULL || buffer == NULL || iov == NULL ||
+        kvstr_header_size(operation, key_len, value != NULL, value_len) > buffer_size) {
+        return -1;
+    }
+
+    // both headers go into the buffer one after the other, each with its own entry
+    size_t op_len = strlen(operation);
+    memcpy(buffer, operation, op_len);
+    size_t key_header = op_len + kvstr_write_header(buffer + op_len, " ", key_len);
+    iov[0] = (kvstr_iovec){buffer, key_header};
+    iov[1] = (kvstr_iovec){key, key_len};
+    if (value == NULL) {
+        return 2;
+    }
+    size_t value_header = kvstr_write_header(buffer + key_header, " ", value_len);
+    iov[2] = (kvstr_iovec){buffer + key_header, value_header};
+    iov[3] = (kvstr_iovec){value, value_len};
+    return 4;
+}
+
+static inline int kvstr_encode_get_request(const char* key, size_t key_len, char* buffer, size_t buffer_size,
+                                           kvstr_iovec* iov) {
+    return kvstr_encode_request("GET", key, key_len, NULL, 0, buffer, buffer_size, iov);
+}
+
+static inline int kvstr_encode_put_request(const char* key, size_t key_len, const char* value, size_t value_len,
+                                           char* buffer, size_t buffer_size, kvstr_iovec* iov) {
+    return value != NULL ? kvstr_encode_request("PUT", key, key_len, value, value_len, buffer, buffer_size, iov) : -1;
+}
+
+static inline int kvstr_encode_del_request(const char* key, size_t key_len, char* buffer, size_t buffer_size,
+                                           kvstr_iovec* iov) {
+    return kvstr_encode_request("DEL", key, key_len, NULL, 0, buffer, buffer_size, iov);
+}
+
+#endif
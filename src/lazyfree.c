@@ -0,0 +1,201 @@
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include "lazyfree.h"
+
+#ifdef _WIN64
+#include <windows.h>
+#endif
+
+/*
+ * Large values that are deleted or overwritten are unlinked from the store under its lock and
+ * queued here, a background thread frees them. Freeing a hash of many fields or returning a
+ * large block to the system then no longer adds to the latency of the request. The queue is a
+ * lock-free stack (many producers), the thread takes all of it at once (single consumer).
+ */
+
+typedef struct lazyfree_item {
+  kv_entry value;
+  size_t bytes;
+  struct lazyfree_item *next;
+} lazyfree_item;
+
+static _Atomic(lazyfree_item *) gl_queue = NULL;
+static atomic_size_t gl_pendingBytes;
+static atomic_ullong gl_freedValues;
+static atomic_bool gl_running;
+static HANDLE gl_reclaimerThread = NULL;
+static SRWLOCK gl_wakeLock = SRWLOCK_INIT;
+static CONDITION_VARIABLE gl_wakeCond = CONDITION_VARIABLE_INIT;
+
+/*
+ * Values that are sent after the store lock was released are pinned. A write that frees or changes a
+ * pinned value leaves it to the last reader instead, so a slow client holds up no writer. Readers pin
+ * under the shared store lock, writes ask under the exclusive one.
+ */
+
+struct lazyfree_pin {
+  kv_entry value;
+  size_t bytes;
+  size_t readers;
+  bool released;      // the store let go of the value, the last reader frees it
+  struct lazyfree_pin *next;
+};
+
+static SRWLOCK gl_pinLock = SRWLOCK_INIT;
+static lazyfree_pin *gl_pins = NULL;
+static atomic_size_t gl_pinCount; // writes do not take the lock while nothing is pinned
+
+static void freeQueued() {
+  lazyfree_item *item = atomic_exchange(&gl_queue, NULL);
+  while (item != NULL) {
+    lazyfree_item *next = item->next;
+    kv_entry_free_detached(item->value);
+    atomic_fetch_sub(&gl_pendingBytes, item->bytes);
+    atomic_fetch_add(&gl_freedValues, 1);
+    free(item);
+    item = next;
+  }
+}
+
+static DWORD WINAPI reclaimerMain(LPVOID arg) {
+  AcquireSRWLockExclusive(&gl_wakeLock);
+  while (atomic_load(&gl_running)) {
+    if (atomic_load(&gl_queue) == NULL) {
+      SleepConditionVariableSRW(&gl_wakeCond, &gl_wakeLock, INFINITE, 0);
+    }
+    ReleaseSRWLockExclusive(&gl_wakeLock);
+    freeQueued();
+    AcquireSRWLockExclusive(&gl_wakeLock);
+  }
+  ReleaseSRWLockExclusive(&gl_wakeLock);
+  return 0;
+}
+
+int lazyfree_start() {
+  if (atomic_load(&gl_running)) {
+    return -1;
+  }
+
+  atomic_store(&gl_running, true);
+  gl_reclaimerThread = CreateThread(NULL, 0, reclaimerMain, NULL, 0, NULL);
+  if (gl_reclaimerThread == NULL) {
+    atomic_store(&gl_running, false);
+    return -1;
+  }
+  return 0;
+}
+
+void lazyfree_stop() {
+  if (!atomic_load(&gl_running)) {
+    return;
+  }
+
+  AcquireSRWLockExclusive(&gl_wakeLock);
+  atomic_store(&gl_running, false);
+  WakeAllConditionVariable(&gl_wakeCond);
+  ReleaseSRWLockExclusive(&gl_wakeLock);
+
+  WaitForSingleObject(gl_reclaimerThread, INFINITE);
+  CloseHandle(gl_reclaimerThread);
+  gl_reclaimerThread = NULL;
+  freeQueued();
+}
+
+bool lazyfree_running() {
+  return atomic_load_explicit(&gl_running, memory_order_relaxed);
+}
+
+void lazyfree_value(kv_entry value, size_t bytes, void *ctx) {
+  (void)ctx;
+  lazyfree_item *item = atomic_load(&gl_running) ? malloc(sizeof(lazyfree_item)) : NULL;
+  if (item == NULL) {
+    kv_entry_free_detached(value);
+    return;
+  }
+  item->value = value;
+  item->bytes = bytes;
+  atomic_fetch_add(&gl_pendingBytes, bytes);
+  item->next = atomic_load(&gl_queue);
+  while (!atomic_compare_exchange_weak(&gl_queue, &item->next, item)) {
+  }
+
+  // under the lock, so the thread cannot miss it between looking at the queue and going to sleep
+  AcquireSRWLockExclusive(&gl_wakeLock);
+  WakeConditionVariable(&gl_wakeCond);
+  ReleaseSRWLockExclusive(&gl_wakeLock);
+}
+
+// the caller holds gl_pinLock
+static lazyfree_pin *findPin(const char *value) {
+  for (lazyfree_pin *pin = gl_pins; pin != NULL; pin = pin->next) {
+    if (pin->value.value == value) {
+      return pin;
+    }
+  }
+  return NULL;
+}
+
+lazyfree_pin *lazyfree_pin_value(const kv_entry *value) {
+  AcquireSRWLockExclusive(&gl_pinLock);
+  lazyfree_pin *pin = findPin(value->value);
+  if (pin == NULL) {
+    pin = calloc(1, sizeof(lazyfree_pin));
+    if (pin != NULL) {
+      pin->value = *value;
+      pin->next = gl_pins;
+      gl_pins = pin;
+      atomic_fetch_add(&gl_pinCount, 1);
+    }
+  }
+  if (pin != NULL) {
+    pin->readers++;
+  }
+  ReleaseSRWLockExclusive(&gl_pinLock);
+  return pin;
+}
+
+void lazyfree_unpin(lazyfree_pin *pin) {
+  AcquireSRWLockExclusive(&gl_pinLock);
+  bool last = --pin->readers == 0;
+  if (last) {
+    lazyfree_pin **link = &gl_pins;
+    while (*link != pin) {
+      link = &(*link)->next;
+    }
+    *link = pin->next;
+    atomic_fetch_sub(&gl_pinCount, 1);
+  }
+  ReleaseSRWLockExclusive(&gl_pinLock);
+
+  if (last) {
+    if (pin->released) {
+      lazyfree_value(pin->value, pin->bytes, NULL);
+    }
+    free(pin);
+  }
+}
+
+bool lazyfree_pinned(kv_entry value, size_t bytes, bool release, void *ctx) {
+  (void)ctx;
+  if (atomic_load(&gl_pinCount) == 0) {
+    return false;
+  }
+  AcquireSRWLockExclusive(&gl_pinLock);
+  lazyfree_pin *pin = findPin(value.value);
+  if (pin != NULL && release) {
+    pin->value = value;
+    pin->bytes = bytes;
+    pin->released = true;
+  }
+  ReleaseSRWLockExclusive(&gl_pinLock);
+  return pin != NULL;
+}
+
+size_t lazyfree_pending_bytes() {
+  return atomic_load_explicit(&gl_pendingBytes, memory_order_relaxed);
+}
+
+unsigned long long lazyfree_freed_values() {
+  return atomic_load_explicit(&gl_freedValues, memory_order_relaxed);
+}
@@ -0,0 +1,21 @@
+#ifndef _KVSTR_LAZYFREE_H
+#define _KVSTR_LAZYFREE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "kvstore.h"
+
+/* Prototypes */
+int lazyfree_start(); // starts the thread that frees queued values
+void lazyfree_stop(); // frees everything still queued and stops the thread
+bool lazyfree_running();
+void lazyfree_value(kv_entry value, size_t bytes, void *ctx); // kv_lazy_free_fn, queues the value without waiting for the thread, freed inline if it is not running
+typedef struct lazyfree_pin lazyfree_pin;
+lazyfree_pin *lazyfree_pin_value(const kv_entry *value); // keeps the value of an entry until lazyfree_unpin, call under the lock of a store set up with lazyfree_pinned, NULL if out of memory
+void lazyfree_unpin(lazyfree_pin *pin); // frees the value if the store let go of it meanwhile, without the store lock
+bool lazyfree_pinned(kv_entry value, size_t bytes, bool release, void *ctx); // kv_pinned_fn, keeps released values that are pinned
+size_t lazyfree_pending_bytes(); // bytes queued and not freed yet
+unsigned long long lazyfree_freed_values(); // values freed by the thread since the start
+
+#endif
@@ -0,0 +1,286 @@
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "logger.h"
+
+#ifdef _WIN64
+#include <windows.h>
+#endif
+
+/*
+ * Every thread formats its log lines into its own ring buffer (single producer), a background
+ * thread writes them out in batches (single consumer). Logging on the request path therefore
+ * never blocks on stdout. Lines of different threads are written ring by ring, so their order
+ * across threads is only preserved between two flushes. The ring of a thread that ends is handed
+ * to the next thread that logs, so there are never more rings than threads running at once.
+ */
+
+enum LogLevel gl_logLevel = INFO;
+
+typedef struct {
+  time_t time;
+  enum LogLevel level;
+  char text[LOG_LINE_SIZE];
+} log_line;
+
+typedef struct log_ring {
+  log_line *lines;
+  size_t mask;          // number of slots - 1 (slots are a power of two)
+  atomic_size_t head;   // next line to write out, only advanced by the consumer
+  atomic_size_t tail;   // next free slot, only advanced by the owning thread
+  atomic_bool owned;    // false once the owning thread ended
+  struct log_ring *next;
+} log_ring;
+
+static _Thread_local log_ring *tl_ring = NULL;
+static _Thread_local unsigned int tl_ringGeneration = 0;
+
+static _Atomic(log_ring *) gl_rings = NULL;  // all rings, only grows while the logger is running
+static atomic_uint gl_ringGeneration;        // invalidates the thread local rings of a previous run
+static atomic_bool gl_loggerRunning;
+static DWORD gl_ringFls = FLS_OUT_OF_INDEXES; // gives the ring of a thread back when the thread ends
+static atomic_ullong gl_droppedLines;
+static unsigned long long gl_reportedDrops = 0;
+static FILE *gl_logOut = NULL;
+static size_t gl_ringSlots = LOG_RING_SLOTS;
+static unsigned int gl_flushInterval = LOG_FLUSH_INTERVAL;
+static HANDLE gl_flusherThread = NULL;
+static SRWLOCK gl_flushLock = SRWLOCK_INIT;  // there must only be one consumer at a time
+static SRWLOCK gl_wakeLock = SRWLOCK_INIT;
+static CONDITION_VARIABLE gl_wakeCond = CONDITION_VARIABLE_INIT;
+
+const char *getLogLevelAsStr(enum LogLevel l) {
+  switch (l) {
+  case INFO:
+    return "INFO";
+  case WARN:
+    return "WARN";
+  case ERR:
+    return "ERR";
+  case DEBUG:
+    return "DEBUG";
+  case FATAL:
+    return "FATAL";
+  default:
+    return "UNKNOWN";
+  }
+}
+
+static void writeLine(FILE *out, time_t t, enum LogLevel lvl, const char *text) {
+#ifdef _WIN64
+  struct tm buf;
+  char timeStamp[26];
+  localtime_s(&buf, &t);
+  asctime_s(timeStamp, sizeof timeStamp, &buf);
+  timeStamp[24] = '\0';
+  fprintf(out, "%s - %s - %s\n", timeStamp, getLogLevelAsStr(lvl), text);
+#else
+  fprintf(out, "%s - %s\n", getLogLevelAsStr(lvl), text);
+#endif
+}
+
+static void WINAPI releaseRing(void *data) {
+  log_ring *ring = data;
+  atomic_store(&ring->owned, false);
+}
+
+// a ring whose thread ended, its lines not written out yet stay in front of the new ones
+static log_ring *claimRing() {
+  for (log_ring *ring = atomic_load(&gl_rings); ring != NULL; ring = ring->next) {
+    bool owned = false;
+    if (atomic_compare_exchange_strong(&ring->owned, &owned, true)) {
+      return ring;
+    }
+  }
+  return NULL;
+}
+
+// returns the ring of the calling thread, taking one over or creating it on first use
+static log_ring *getRing() {
+  unsigned int generation = atomic_load(&gl_ringGeneration);
+  if (tl_ring != NULL && tl_ringGeneration == generation) {
+    return tl_ring;
+  }
+
+  log_ring *ring = claimRing();
+  if (ring == NULL) {
+    ring = calloc(1, sizeof(log_ring));
+    if (ring == NULL) {
+      return NULL;
+    }
+    ring->lines = malloc(gl_ringSlots * sizeof(log_line));
+    if (ring->lines == NULL) {
+      free(ring);
+      return NULL;
+    }
+    ring->mask = gl_ringSlots - 1;
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    atomic_init(&ring->owned, true);
+
+    log_ring *first = atomic_load(&gl_rings);
+    do {
+      ring->next = first;
+    } while (!atomic_compare_exchange_weak(&gl_rings, &first, ring));
+  }
+  FlsSetValue(gl_ringFls, ring);
+
+  tl_ring = ring;
+  tl_ringGeneration = generation;
+  return ring;
+}
+
+// writes out everything buffered so far, the caller has to hold gl_flushLock
+static void drainRings() {
+  for (log_ring *ring = atomic_load(&gl_rings); ring != NULL; ring = ring->next) {
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    for (; head != tail; head++) {
+      log_line *line = &ring->lines[head & ring->mask];
+      writeLine(gl_logOut, line->time, line->level, line->text);
+    }
+    atomic_store_explicit(&ring->head, head, memory_order_release);
+  }
+
+  unsigned long long dropped = atomic_load(&gl_droppedLines);
+  if (dropped != gl_reportedDrops) {
+    char text[64];
+    snprintf(text, sizeof(text), "%llu log lines dropped.", dropped - gl_reportedDrops);
+    writeLine(gl_logOut, time(NULL), WARN, text);
+    gl_reportedDrops = dropped;
+  }
+  fflush(gl_logOut);
+}
+
+static DWORD WINAPI flusherMain(LPVOID arg) {
+  AcquireSRWLockExclusive(&gl_wakeLock);
+  while (atomic_load(&gl_loggerRunning)) {
+    SleepConditionVariableSRW(&gl_wakeCond, &gl_wakeLock, gl_flushInterval, 0);
+    ReleaseSRWLockExclusive(&gl_wakeLock);
+    logger_flush();
+    AcquireSRWLockExclusive(&gl_wakeLock);
+  }
+  ReleaseSRWLockExclusive(&gl_wakeLock);
+  return 0;
+}
+
+int logger_start(FILE *out, size_t ringSlots, unsigned int flushIntervalMs) {
+  if (out == NULL || ringSlots == 0 || atomic_load(&gl_loggerRunning)) {
+    return -1;
+  }
+
+  // round up to a power of two, so slots can be addressed with a mask
+  size_t slots = 1;
+  while (slots < ringSlots) {
+    slots <<= 1;
+  }
+
+  gl_ringFls = FlsAlloc(releaseRing);
+  if (gl_ringFls == FLS_OUT_OF_INDEXES) {
+    return -1;
+  }
+
+  gl_logOut = out;
+  gl_ringSlots = slots;
+  gl_flushInterval = flushIntervalMs;
+  gl_reportedDrops = 0;
+  atomic_store(&gl_droppedLines, 0);
+  atomic_fetch_add(&gl_ringGeneration, 1);
+  atomic_store(&gl_loggerRunning, true);
+
+  gl_flusherThread = CreateThread(NULL, 0, flusherMain, NULL, 0, NULL);
+  if (gl_flusherThread == NULL) {
+    atomic_store(&gl_loggerRunning, false);
+    FlsFree(gl_ringFls);
+    return -1;
+  }
+  return 0;
+}
+
+// must not be called while other threads are still logging
+void logger_stop() {
+  if (!atomic_load(&gl_loggerRunning)) {
+    return;
+  }
+
+  AcquireSRWLockExclusive(&gl_wakeLock);
+  atomic_store(&gl_loggerRunning, false);
+  WakeAllConditionVariable(&gl_wakeCond);
+  ReleaseSRWLockExclusive(&gl_wakeLock);
+
+  WaitForSingleObject(gl_flusherThread, INFINITE);
+  CloseHandle(gl_flusherThread);
+  gl_flusherThread = NULL;
+
+  // threads ending from now on must not touch the rings any more
+  FlsFree(gl_ringFls);
+
+  AcquireSRWLockExclusive(&gl_flushLock);
+  drainRings();
+  log_ring *ring = atomic_exchange(&gl_rings, NULL);
+  ReleaseSRWLockExclusive(&gl_flushLock);
+
+  while (ring != NULL) {
+    log_ring *next = ring->next;
+    free(ring->lines);
+    free(ring);
+    ring = next;
+  }
+}
+
+void logger_flush() {
+  AcquireSRWLockExclusive(&gl_flushLock);
+  if (atomic_load(&gl_loggerRunning)) {
+    drainRings();
+  }
+  ReleaseSRWLockExclusive(&gl_flushLock);
+}
+
+void logger_write(enum LogLevel lvl, const char *format, ...) {
+  va_list args;
+  log_ring *ring = atomic_load(&gl_loggerRunning) ? getRing() : NULL;
+
+  if (ring == NULL) {
+    // logger not running (or out of memory), write the line synchronously
+    char text[LOG_LINE_SIZE];
+    va_start(args, format);
+    vsnprintf(text, sizeof(text), format, args);
+    va_end(args);
+    writeLine(stdout, time(NULL), lvl, text);
+  } else {
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    if (tail - head > ring->mask) {
+      atomic_fetch_add_explicit(&gl_droppedLines, 1, memory_order_relaxed); // ring is full
+    } else {
+      log_line *line = &ring->lines[tail & ring->mask];
+      line->time = time(NULL);
+      line->level = lvl;
+      va_start(args, format);
+      vsnprintf(line->text, sizeof(line->text), format, args);
+      va_end(args);
+      atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+    }
+  }
+
+  if (lvl == FATAL) {
+    logger_flush();
+    fflush(stdout);
+    exit(1);
+  }
+}
+
+unsigned long long logger_dropped() {
+  return atomic_load(&gl_droppedLines);
+}
+
+size_t logger_rings() {
+  size_t count = 0;
+  for (log_ring *ring = atomic_load(&gl_rings); ring != NULL; ring = ring->next) {
+    count++;
+  }
+  return count;
+}
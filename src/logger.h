@@ -0,0 +1,50 @@
+#ifndef _KVSTR_LOGGER_H
+#define _KVSTR_LOGGER_H
+
+#include <stdio.h>
+#include <stddef.h>
+
+/* Data Types */
+enum LogLevel {
+  FATAL = 0,
+  WARN = 1,
+  ERR = 2,
+  INFO = 3,
+  DEBUG = 4,
+};
+
+// lines longer than this are truncated
+#define LOG_LINE_SIZE 512
+
+// default number of lines buffered per thread before lines are dropped
+#define LOG_RING_SLOTS 1024
+
+// default time in ms between two flushes of the buffered lines
+#define LOG_FLUSH_INTERVAL 10
+
+// levels above this are compiled out completely (e.g. -DLOG_MAX_LEVEL=INFO for release builds)
+#ifndef LOG_MAX_LEVEL
+#define LOG_MAX_LEVEL DEBUG
+#endif
+
+extern enum LogLevel gl_logLevel;
+
+// Formats and logs a line if lvl is enabled. Disabled levels cost a single branch and the
+// arguments are not evaluated.
+#define LOGF(lvl, ...)                                          \
+  do {                                                          \
+    if ((lvl) <= LOG_MAX_LEVEL && (lvl) <= gl_logLevel) {       \
+      logger_write((lvl), __VA_ARGS__);                         \
+    }                                                           \
+  } while (0)
+
+/* Prototypes */
+int logger_start(FILE *out, size_t ringSlots, unsigned int flushIntervalMs); // start the background flusher writing to out
+void logger_stop(); // write all buffered lines and stop the flusher
+void logger_flush(); // write all buffered lines right away
+void logger_write(enum LogLevel lvl, const char *format, ...); // queue a line without checking the level
+unsigned long long logger_dropped(); // number of lines dropped because a ring buffer was full
+size_t logger_rings(); // ring buffers allocated, a thread that ends leaves its ring to the next one
+const char *getLogLevelAsStr(enum LogLevel l);
+
+#endif
@@ -0,0 +1,501 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "capture.h"
+#include "histogram.h"
+#include "kvclient.h"
+#include "stats.h"
+
+#ifdef _WIN64
+#include <windows.h>
+#endif
+
+/*
+ * Replays a capture recorded by the server (-capture) against a running server and reports the
+ * latency of every operation. The requests of a captured connection are sent in their order on
+ * a connection of their own: a session if the connection started with HELLO, otherwise a new
+ * one-shot connection for every request. Connections are spread over the threads, every thread
+ * sends its requests one after the other and waits for each response, so requests a client
+ * pipelined are replayed one at a time.
+ *
+ * With a speed of 0 requests are sent as fast as possible, otherwise at the captured times
+ * divided by the speed (1 is the original timing). In that case latencies are measured from the
+ * time a request was due, so a server falling behind shows up in the latencies instead of only
+ * slowing down the replay.
+ */
+
+#define REPLAY_MIN_THREADS 4
+#define REPLAY_MAX_THREADS 64       // by default a thread per captured session, but not more
+#define REPLAY_LATE_NS 1000000ULL   // requests sent later than this behind their time are counted as late
+#define REPLAY_ONE_SHOT -1
+
+enum replay_op { REPLAY_GET, REPLAY_PUT, REPLAY_DEL, REPLAY_OTHER, REPLAY_OP_COUNT };
+static const char *opNames[REPLAY_OP_COUNT] = {"get", "put", "del", "other"};
+
+typedef struct replay_config {
+  const char *server;
+  int port;
+  const char *path;
+  int threads;
+  double speed;
+  bool json;
+} replay_config;
+
+typedef struct replay_request {
+  capture_record record;
+  size_t order;                 // position in the file, keeps requests of the same time in order
+  long long session;            // index of the session sending it, REPLAY_ONE_SHOT for one-shot connections
+  bool hello;                   // starts its session
+  bool last;                    // last request of its session
+  enum replay_op op;
+} replay_request;
+
+typedef struct replay_session {
+  unsigned long long connection;
+  kvclient_conn *conn;
+  bool failed;                  // HELLO was refused, the requests of the session are errors
+} replay_session;
+
+typedef struct replay_thread {
+  const replay_config *config;
+  replay_request **requests;    // in the order they are sent
+  size_t count;
+  replay_session *sessions;     // shared, but every session is only used by one thread
+  unsigned long long start;
+  HANDLE handle;
+  histogram latency[REPLAY_OP_COUNT];
+  unsigned long long errors;    // failed requests and responses other than 2xx and 404
+  unsigned long long late;
+  unsigned long long pushes;    // invalidations and notifications received by the sessions
+} replay_thread;
+
+static enum replay_op opOf(const char *data) {
+  size_t len = strcspn(data, " \r\n");
+  if (len == 3 && memcmp(data, "GET", 3) == 0) {
+    return REPLAY_GET;
+  }
+  if (len == 3 && memcmp(data, "PUT", 3) == 0) {
+    return REPLAY_PUT;
+  }
+  if (len == 3 && memcmp(data, "DEL", 3) == 0) {
+    return REPLAY_DEL;
+  }
+  return REPLAY_OTHER;
+}
+
+static int compareRequests(const void *a, const void *b) {
+  const replay_request *x = (const replay_request *)a;
+  const replay_request *y = (const replay_request *)b;
+  if (x->record.time != y->record.time) {
+    return x->record.time < y->record.time ? -1 : 1;
+  }
+  return x->order < y->order ? -1 : x->order > y->order;
+}
+
+static void freeRequests(replay_request *requests, size_t count) {
+  for (size_t i = 0; i < count; i++) {
+    free(requests[i].record.data);
+  }
+  free(requests);
+}
+
+// reads all records ordered by their time, NULL if the file cannot be read
+static replay_request *loadCapture(const char *path, size_t *count) {
+  FILE *in = fopen(path, "rb");
+  if (in == NULL) {
+    printf("Cannot open '%s'.\n", path);
+    return NULL;
+  }
+  if (capture_read_header(in) != 0) {
+    printf("'%s' is not a capture file.\n", path);
+    fclose(in);
+    return NULL;
+  }
+
+  replay_request *requests = NULL;
+  size_t capacity = 0;
+  *count = 0;
+  capture_record record;
+  int r;
+  while ((r = capture_read_record(in, &record)) == 1) {
+    if (*count == capacity) {
+      capacity = capacity == 0 ? 1024 : capacity * 2;
+      replay_request *grown = realloc(requests, capacity * sizeof(replay_request));
+      if (grown == NULL) {
+        free(record.data);
+        r = -1;
+        break;
+      }
+      requests = grown;
+    }
+    requests[*count] = (replay_request){.record = record, .order = *count, .op = opOf(record.data)};
+    (*count)++;
+  }
+  fclose(in);
+  if (r != 0) {
+    printf("Failed to read '%s' after %zu requests.\n", path, *count);
+    freeRequests(requests, *count);
+    return NULL;
+  }
+
+  qsort(requests, *count, sizeof(replay_request), compareRequests);
+  return requests;
+}
+
+// index of the connection in the sorted ids
+static size_t findSession(const replay_session *sessions, size_t count, unsigned long long connection) {
+  size_t low = 0;
+  size_t high = count;
+  while (low < high) {
+    size_t mid = low + (high - low) / 2;
+    if (sessions[mid].connection < connection) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+  return low;
+}
+
+static int compareSessions(const void *a, const void *b) {
+  unsigned long long x = ((const replay_session *)a)->connection;
+  unsigned long long y = ((const replay_session *)b)->connection;
+  return x < y ? -1 : x > y;
+}
+
+// connections whose first request was HELLO become sessions, returns their number or -1
+static long long assignSessions(replay_request *requests, size_t count, replay_session **sessions) {
+  size_t sessionCount = 0;
+  for (size_t i = 0; i < count; i++) {
+    sessionCount += requests[i].op == REPLAY_OTHER && strncmp(requests[i].record.data, "HELLO", 5) == 0;
+  }
+  *sessions = calloc(sessionCount > 0 ? sessionCount : 1, sizeof(replay_session));
+  if (*sessions == NULL) {
+    return -1;
+  }
+  size_t n = 0;
+  for (size_t i = 0; i < count; i++) {
+    if (requests[i].op == REPLAY_OTHER && strncmp(requests[i].record.data, "HELLO", 5) == 0) {
+      (*sessions)[n++].connection = requests[i].record.connection;
+    }
+  }
+  qsort(*sessions, n, sizeof(replay_session), compareSessions);
+
+  // a connection sends HELLO once, duplicates would be a broken capture
+  size_t unique = 0;
+  for (size_t i = 0; i < n; i++) {
+    if (unique == 0 || (*sessions)[unique - 1].connection != (*sessions)[i].connection) {
+      (*sessions)[unique++] = (*sessions)[i];
+    }
+  }
+
+  long long *lastRequest = malloc((unique > 0 ? unique : 1) * sizeof(long long));
+  if (lastRequest == NULL) {
+    free(*sessions);
+    return -1;
+  }
+  for (size_t i = 0; i < unique; i++) {
+    lastRequest[i] = -1;
+  }
+  for (size_t i = 0; i < count; i++) {
+    replay_request *req = &requests[i];
+    size_t s = findSession(*sessions, unique, req->record.connection);
+    // requests captured before HELLO (dropped records aside, this does not happen) are sent one-shot
+    if (s == unique || (*sessions)[s].connection != req->record.connection ||
+        (lastRequest[s] < 0 && strncmp(req->record.data, "HELLO", 5) != 0)) {
+      req->session = REPLAY_ONE_SHOT;
+      continue;
+    }
+    req->session = (long long)s;
+    req->hello = lastRequest[s] < 0;
+    lastRequest[s] = (long long)i;
+  }
+  for (size_t i = 0; i < unique; i++) {
+    if (lastRequest[i] >= 0) {
+      requests[lastRequest[i]].last = true;
+    }
+  }
+  free(lastRequest);
+  return (long long)unique;
+}
+
+static void countPush(void *ctx, const char *message, size_t length) {
+  ((replay_thread *)ctx)->pushes++;
+}
+
+static void waitUntil(unsigned long long due) {
+  unsigned long long now = stats_now();
+  if (now + 2000000ULL < due) {
+    Sleep((DWORD)((due - now) / 1000000ULL - 1));
+  }
+  while (stats_now() < due) {
+    // the remaining time is shorter than the granularity of Sleep
+  }
+}
+
+// sends the request and returns its response, NULL if the connection broke
+static char *sendRequest(replay_thread *t, replay_request *req) {
+  if (req->session == REPLAY_ONE_SHOT) {
+    kvclient_conn *conn = kvclient_connect(t->config->server, t->config->port);
+    char *response = conn != NULL && kvclient_send(conn, req->record.data, req->record.length) == 0
+                         ? kvclient_recv_response(conn, NULL)
+                         : NULL;
+    kvclient_close(&conn);
+    return response;
+  }
+
+  replay_session *s = &t->sessions[req->session];
+  if (s->failed) {
+    return NULL;
+  }
+  if (s->conn == NULL) {
+    s->conn = kvclient_connect(t->config->server, t->config->port);
+    if (s->conn == NULL) {
+      s->failed = true;
+      return NULL;
+    }
+    s->conn->on_push = countPush;
+    s->conn->push_ctx = t;
+  }
+  char *response = kvclient_send(s->conn, req->record.data, req->record.length) == 0
+                       ? kvclient_recv_frame(s->conn, NULL)
+                       : NULL;
+  if (req->hello && response != NULL && strncmp(response, "200", 3) != 0) {
+    s->failed = true; // the server does not run in worker mode
+  }
+  if (response == NULL) {
+    s->failed = true;
+    kvclient_close(&s->conn);
+  }
+  return response;
+}
+
+static DWORD WINAPI replayThreadMain(LPVOID arg) {
+  replay_thread *t = (replay_thread *)arg;
+  for (size_t i = 0; i < t->count; i++) {
+    replay_request *req = t->requests[i];
+    unsigned long long sent;
+    if (t->config->speed > 0) {
+      unsigned long long due = t->start + (unsigned long long)((double)req->record.time / t->config->speed);
+      waitUntil(due);
+      sent = due;
+      if (stats_now() - due > REPLAY_LATE_NS) {
+        t->late++;
+      }
+    } else {
+      sent = stats_now();
+    }
+
+    char *response = sendRequest(t, req);
+    histogram_record(&t->latency[req->op], stats_now() - sent);
+    if (response == NULL || (response[0] != '2' && strncmp(response, "404", 3) != 0)) {
+      t->errors++;
+    }
+    free(response);
+    if (req->last) {
+      kvclient_close(&t->sessions[req->session].conn);
+    }
+  }
+  return 0;
+}
+
+static void printLatencyText(const char *name, const histogram *h, double seconds) {
+  unsigned long long count = histogram_count(h);
+  if (count == 0) {
+    return;
+  }
+  printf("%-5s %10llu requests %12.0f ops/s  p50 %9llu ns  p90 %9llu ns  p99 %9llu ns  p999 %9llu ns  max %9llu ns\n",
+         name, count, (double)count / seconds, histogram_percentile(h, 50), histogram_percentile(h, 90),
+         histogram_percentile(h, 99), histogram_percentile(h, 99.9), histogram_percentile(h, 100));
+}
+
+static void printLatencyJson(const char *name, const histogram *h, double seconds, bool last) {
+  unsigned long long count = histogram_count(h);
+  printf("    \"%s\": {\"requests\": %llu, \"ops_per_sec\": %.0f, \"latency_ns\": {\"p50\": %llu, \"p90\": %llu, "
+         "\"p99\": %llu, \"p999\": %llu, \"max\": %llu}}%s\n",
+         name, count, (double)count / seconds, histogram_percentile(h, 50), histogram_percentile(h, 90),
+         histogram_percentile(h, 99), histogram_percentile(h, 99.9), histogram_percentile(h, 100), last ? "" : ",");
+}
+
+static void printReport(const replay_config *config, histogram *latency, size_t sessions, unsigned long long errors,
+                        unsigned long long late, unsigned long long pushes, unsigned long long elapsed) {
+  double seconds = elapsed > 0 ? (double)elapsed / 1e9 : 1e-9;
+  histogram *all = calloc(1, sizeof(histogram));
+  if (all == NULL) {
+    return;
+  }
+  for (int i = 0; i < REPLAY_OP_COUNT; i++) {
+    histogram_merge(all, &latency[i]);
+  }
+
+  if (!config->json) {
+    char speed[32] = "as fast as possible";
+    if (config->speed > 0) {
+      snprintf(speed, sizeof(speed), "%gx", config->speed);
+    }
+    printf("%s, %zu sessions, %d threads, speed %s\n", config->path, sessions, config->threads, speed);
+    for (int i = 0; i < REPLAY_OP_COUNT; i++) {
+      printLatencyText(opNames[i], &latency[i], seconds);
+    }
+    printLatencyText("all", all, seconds);
+    printf("%.3f s, %llu errors, %llu late, %llu pushes\n", seconds, errors, late, pushes);
+    free(all);
+    return;
+  }
+
+  printf("{\n");
+  printf("  \"config\": {\"file\": \"%s\", \"sessions\": %zu, \"threads\": %d, \"speed\": %g},\n", config->path,
+         sessions, config->threads, config->speed);
+  printf("  \"elapsed_ms\": %.3f,\n  \"errors\": %llu,\n  \"late\": %llu,\n  \"pushes\": %llu,\n", seconds * 1000.0,
+         errors, late, pushes);
+  printf("  \"results\": {\n");
+  for (int i = 0; i < REPLAY_OP_COUNT; i++) {
+    printLatencyJson(opNames[i], &latency[i], seconds, false);
+  }
+  printLatencyJson("all", all, seconds, true);
+  printf("  }\n}\n");
+  free(all);
+}
+
+int main(int argc, char **argv) {
+  replay_config config = {
+      .server = "127.0.0.1",
+      .port = 8080,
+      .threads = 0,
+      .speed = 0,
+  };
+  const char *unixPath = NULL;
+  char unixServer[256];
+
+  // every option takes exactly one value
+  for (int i = 1; i < argc; i += 2) {
+    if (i + 1 >= argc) {
+      printf("Usage: %s -f capture file [-h host] [-p port] [-u unix socket path] [-t threads] "
+             "[-s speed factor, 0 = as fast as possible] [-o text | json]\n",
+             argv[0]);
+      return 1;
+    }
+
+    const char *value = argv[i + 1];
+    if (strcmp(argv[i], "-f") == 0) {
+      config.path = value;
+    } else if (strcmp(argv[i], "-h") == 0) {
+      config.server = value;
+    } else if (strcmp(argv[i], "-p") == 0) {
+      config.port = atoi(value);
+    } else if (strcmp(argv[i], "-u") == 0) {
+      unixPath = value;
+    } else if (strcmp(argv[i], "-t") == 0) {
+      config.threads = atoi(value);
+    } else if (strcmp(argv[i], "-s") == 0) {
+      config.speed = atof(value);
+    } else if (strcmp(argv[i], "-o") == 0) {
+      config.json = strcmp(value, "json") == 0;
+    } else {
+      printf("Unknown option '%s' ignored.\n", argv[i]);
+    }
+  }
+
+  if (config.path == NULL) {
+    printf("No capture file given (-f).\n");
+    return 1;
+  }
+  if (unixPath != NULL) {
+    snprintf(unixServer, sizeof(unixServer), "%s%s", KVCLIENT_UNIX_PREFIX, unixPath);
+    config.server = unixServer;
+  }
+  if (config.speed < 0) {
+    config.speed = 0;
+  }
+
+  size_t count;
+  replay_request *requests = loadCapture(config.path, &count);
+  if (requests == NULL) {
+    return 1;
+  }
+  replay_session *sessions = NULL;
+  long long sessionCount = assignSessions(requests, count, &sessions);
+  if (config.threads <= 0) {
+    config.threads = sessionCount < REPLAY_MIN_THREADS ? REPLAY_MIN_THREADS
+                     : sessionCount > REPLAY_MAX_THREADS ? REPLAY_MAX_THREADS
+                                                         : (int)sessionCount;
+  }
+  replay_request **order = malloc((count > 0 ? count : 1) * sizeof(replay_request *));
+  // the histograms are too large for the stack
+  replay_thread *threads = calloc((size_t)config.threads, sizeof(replay_thread));
+  if (sessionCount < 0 || order == NULL || threads == NULL) {
+    printf("Out of memory\n");
+    return 1;
+  }
+
+  // all requests of a connection go to the same thread, in their order
+  size_t *firsts = calloc((size_t)config.threads, sizeof(size_t));
+  if (firsts == NULL) {
+    printf("Out of memory\n");
+    return 1;
+  }
+  for (size_t i = 0; i < count; i++) {
+    threads[requests[i].record.connection % (unsigned long long)config.threads].count++;
+  }
+  for (int i = 1; i < config.threads; i++) {
+    firsts[i] = firsts[i - 1] + threads[i - 1].count;
+  }
+  for (int i = 0; i < config.threads; i++) {
+    threads[i].config = &config;
+    threads[i].requests = order + firsts[i];
+    threads[i].sessions = sessions;
+    threads[i].count = 0;
+  }
+  for (size_t i = 0; i < count; i++) {
+    replay_thread *t = &threads[requests[i].record.connection % (unsigned long long)config.threads];
+    t->requests[t->count++] = &requests[i];
+  }
+  free(firsts);
+
+  int r = kvclient_init();
+  if (r != 0) {
+    printf("WSAStartup failed. Error code: %d\n", r);
+    return 1;
+  }
+
+  unsigned long long start = stats_now();
+  for (int i = 0; i < config.threads; i++) {
+    threads[i].start = start;
+    threads[i].handle = CreateThread(NULL, 0, replayThreadMain, &threads[i], 0, NULL);
+  }
+  histogram *latency = calloc(REPLAY_OP_COUNT, sizeof(histogram));
+  unsigned long long errors = 0;
+  unsigned long long late = 0;
+  unsigned long long pushes = 0;
+  for (int i = 0; i < config.threads; i++) {
+    if (threads[i].handle != NULL) {
+      WaitForSingleObject(threads[i].handle, INFINITE);
+      CloseHandle(threads[i].handle);
+    } else {
+      threads[i].errors += threads[i].count; // nothing of its share was sent
+    }
+    errors += threads[i].errors;
+    late += threads[i].late;
+    pushes += threads[i].pushes;
+    for (int j = 0; latency != NULL && j < REPLAY_OP_COUNT; j++) {
+      histogram_merge(&latency[j], &threads[i].latency[j]);
+    }
+  }
+  unsigned long long elapsed = stats_now() - start;
+
+  if (latency != NULL) {
+    printReport(&config, latency, (size_t)sessionCount, errors, late, pushes, elapsed);
+  }
+
+  for (long long i = 0; i < sessionCount; i++) {
+    kvclient_close(&sessions[i].conn);
+  }
+  free(latency);
+  free(threads);
+  free(order);
+  free(sessions);
+  freeRequests(requests, count);
+  kvclient_cleanup();
+  return 0;
+}
@@ -0,0 +1,639 @@
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "kvclient.h"
+#include "logger.h"
+#include "replication.h"
+#include "stats.h"
+#include "utilfuns.h"
+
+#ifdef _WIN64
+#include <windows.h>
+#endif
+
+/*
+ * The replication stream uses the request format of the protocol, so both sides can reuse the
+ * request decoder:
+ *
+ *   primary -> replica: PUT/HSET for every key of the snapshot, then every write of the primary
+ *                       REPLPING <position> <end> once the snapshot is sent and then every second
+ *   replica -> primary: REPLACK <position> every second
+ *
+ * Positions are byte offsets in the write log of the primary. The log only holds the writes
+ * that not all replicas have received yet. A REPLPING tells the replica at which position of the
+ * log the stream currently is and how far the log of the primary reaches at that moment.
+ *
+ * The snapshot is read in batches while writes go on, so a key may already have a newer value
+ * than at the position the log continues from. Replaying the writes of the log over it ends with
+ * the same value, as every write sets the value or field it touches to what it was on the primary.
+ */
+
+// a replica connected to this server, served by its own sender thread
+typedef struct replica {
+  SOCKET sock;
+  unsigned long long offset;    // log position sent up to (guarded by gl_replLock)
+  replication_read_fn read;     // reads the store for the snapshot, which is sent before the log
+  size_t snapshotCursor;        // slot of the store the snapshot goes on from
+  unsigned long long *intKeys;  // integer keys of the store when the snapshot started
+  size_t intKeyCount;
+  size_t intKeysSent;
+  bool dropped;                 // fell behind too far or the server is stopping
+  atomic_ullong ackedOffset;
+  atomic_ullong ackTime;        // stats_now() of the last acknowledgement
+} replica;
+
+// incremental decoding of a stream of requests
+typedef struct stream_decoder {
+  struct kvstr_decoder dec;
+  struct kvstr_request *req;
+  size_t bytes;                 // consumed by the current request so far
+  size_t maxValueSize;          // longest value a request may carry
+} stream_decoder;
+
+typedef int (*stream_request_fn)(void *ctx, struct kvstr_request *req, size_t bytes);
+
+// primary side
+static SRWLOCK gl_replLock = SRWLOCK_INIT;
+static CONDITION_VARIABLE gl_replCond = CONDITION_VARIABLE_INIT;
+static byte_buffer gl_replLog;                  // writes not all replicas have received yet
+static unsigned long long gl_replLogStart = 0;  // log position of gl_replLog.data[0]
+static unsigned long long gl_replOffset = 0;    // end of the log
+static replica *gl_replicas[REPL_MAX_REPLICAS];
+static int gl_replicaCount = 0;
+static int gl_replSenders = 0;                  // sender threads still running
+static bool gl_replStopping = false;
+
+// replica side
+static HANDLE gl_followerThread = NULL;
+static const char *gl_primary = NULL;
+static int gl_primaryPort = 0;
+static size_t gl_maxValueSize = KVSTR_MAX_VALUE_SIZE; // the limit of the server (-m) for values from the primary
+static replication_apply_fn gl_apply = NULL;
+static replication_reset_fn gl_reset = NULL;
+static atomic_bool gl_followerRunning = false;
+static atomic_bool gl_linkUp = false;
+static atomic_ullong gl_appliedOffset = 0;
+static atomic_ullong gl_primaryOffset = 0;
+static atomic_ullong gl_lastIo = 0;
+
+// appends a PUT (with value) or DEL request, returns 0 or -1 if out of memory
+// the field is left out if it is NULL, so is the value
+static int appendRequest(byte_buffer *out, const char *operation, const char *key, const char *field,
+                         size_t fieldLen, const char *value, size_t valueLen) {
+  char prefix[64];
+  size_t keyLen = strlen(key);
+  int len = snprintf(prefix, sizeof(prefix), "%s %zu:", operation, keyLen);
+  int r = byte_buffer_append(out, prefix, len) | byte_buffer_append(out, key, keyLen);
+  if (field != NULL) {
+    len = snprintf(prefix, sizeof(prefix), " %zu:", fieldLen);
+    r |= byte_buffer_append(out, prefix, len) | byte_buffer_append(out, field, fieldLen);
+  }
+  if (value != NULL) {
+    len = snprintf(prefix, sizeof(prefix), " %zu:", valueLen);
+    r |= byte_buffer_append(out, prefix, len) | byte_buffer_append(out, value, valueLen);
+  }
+  return r != 0 ? -1 : 0;
+}
+
+static void appendOffsets(byte_buffer *out, const char *operation, unsigned long long first,
+                          unsigned long long second, bool withSecond) {
+  char numbers[2][32];
+  int firstLen = snprintf(numbers[0], sizeof(numbers[0]), "%llu", first);
+  int secondLen = snprintf(numbers[1], sizeof(numbers[1]), "%llu", second);
+  char line[128];
+  int len = withSecond ? snprintf(line, sizeof(line), "%s %d:%s %d:%s", operation, firstLen, numbers[0], secondLen, numbers[1])
+                       : snprintf(line, sizeof(line), "%s %d:%s", operation, firstLen, numbers[0]);
+  byte_buffer_append(out, line, len);
+}
+
+static int sendBytes(SOCKET sock, const char *data, size_t len) {
+  size_t sent = 0;
+  while (sent < len) {
+    size_t chunk = len - sent > REPL_SEND_CHUNK_SIZE ? REPL_SEND_CHUNK_SIZE : len - sent;
+    int n = send(sock, data + sent, (int)chunk, 0);
+    if (n == SOCKET_ERROR) {
+      return SOCKET_ERROR;
+    }
+    sent += n;
+  }
+  return 0;
+}
+
+static void streamDecoderReset(stream_decoder *s) {
+  s->req = create_kvstr_request();
+  s->bytes = 0;
+  if (s->req != NULL) {
+    kvstr_decoder_init(&s->dec, s->req, KVSTR_MAX_KEY_SIZE, s->maxValueSize);
+  }
+}
+
+// hands every complete request in data to fn, returns -1 on a broken stream or if fn fails
+static int streamDecoderFeed(stream_decoder *s, const char *data, size_t len, stream_request_fn fn, void *ctx) {
+  size_t pos = 0;
+  while (pos < len) {
+    if (s->req == NULL) {
+      return -1; // out of memory
+    }
+    size_t consumed = kvstr_decoder_feed(&s->dec, data + pos, len - pos);
+    pos += consumed;
+    s->bytes += consumed;
+    if (s->dec.state == KVSTR_DEC_ERROR) {
+      return -1;
+    }
+    if (kvstr_decoder_done(&s->dec)) {
+      int r = fn(ctx, s->req, s->bytes);
+      free_kvstr_request(&s->req);
+      streamDecoderReset(s);
+      if (r != 0) {
+        return -1;
+      }
+    }
+  }
+  return 0;
+}
+
+/*** primary ***/
+
+// releases log bytes all replicas have received, the caller holds gl_replLock
+static void trimLog() {
+  unsigned long long oldest = gl_replOffset;
+  for (int i = 0; i < gl_replicaCount; i++) {
+    if (!gl_replicas[i]->dropped && gl_replicas[i]->offset < oldest) {
+      oldest = gl_replicas[i]->offset;
+    }
+  }
+
+  size_t done = (size_t)(oldest - gl_replLogStart);
+  if (done == gl_replLog.len) {
+    gl_replLog.len = 0;
+  } else if (done > gl_replLog.len / 2) {
+    // move the rest to the front only once it is less than half of the buffer
+    memmove(gl_replLog.data, gl_replLog.data + done, gl_replLog.len - done);
+    gl_replLog.len -= done;
+  } else {
+    return;
+  }
+  gl_replLogStart = oldest;
+}
+
+// disconnects a replica, its sender thread cleans up
+static void dropReplica(replica *r) {
+  r->dropped = true;
+  shutdown(r->sock, SD_BOTH);
+}
+
+void replication_feed(const char *operation, const char *key, const char *value, size_t valueLen) {
+  replication_feed_field(operation, key, NULL, 0, value, valueLen);
+}
+
+void replication_feed_field(const char *operation, const char *key, const char *field, size_t fieldLen,
+                            const char *value, size_t valueLen) {
+  AcquireSRWLockExclusive(&gl_replLock);
+  if (gl_replicaCount == 0) {
+    // nobody to send the log to, only the position moves on
+    char prefix[64];
+    gl_replOffset += snprintf(prefix, sizeof(prefix), "%s %zu:", operation, strlen(key)) + strlen(key);
+    if (field != NULL) {
+      gl_replOffset += snprintf(prefix, sizeof(prefix), " %zu:", fieldLen) + fieldLen;
+    }
+    if (value != NULL) {
+      gl_replOffset += snprintf(prefix, sizeof(prefix), " %zu:", valueLen) + valueLen;
+    }
+    gl_replLogStart = gl_replOffset;
+    ReleaseSRWLockExclusive(&gl_replLock);
+    return;
+  }
+
+  size_t before = gl_replLog.len;
+  if (appendRequest(&gl_replLog, operation, key, field, fieldLen, value, valueLen) != 0) {
+    // the stream would miss a write, the replicas have to start over
+    LOGF(ERR, "Out of memory for the replication log, dropping all replicas.");
+    for (int i = 0; i < gl_replicaCount; i++) {
+      dropReplica(gl_replicas[i]);
+    }
+  }
+  gl_replOffset += gl_replLog.len - before;
+
+  if (gl_replLog.len > REPL_MAX_BACKLOG) {
+    for (int i = 0; i < gl_replicaCount; i++) {
+      if (!gl_replicas[i]->dropped && gl_replOffset - gl_replicas[i]->offset > REPL_MAX_BACKLOG) {
+        LOGF(WARN, "Replica fell more than %d bytes behind, dropping it.", REPL_MAX_BACKLOG);
+        dropReplica(gl_replicas[i]);
+      }
+    }
+    trimLog();
+  }
+
+  WakeAllConditionVariable(&gl_replCond);
+  ReleaseSRWLockExclusive(&gl_replLock);
+}
+
+static int handleAck(void *ctx, struct kvstr_request *req, size_t bytes) {
+  replica *r = (replica *)ctx;
+  if (strcmp(req->operation, "REPLACK") != 0) {
+    LOGF(WARN, "Unexpected %s request from a replica.", req->operation);
+    return -1;
+  }
+  atomic_store(&r->ackedOffset, strtoull(req->args[0], NULL, 10));
+  atomic_store(&r->ackTime, stats_now());
+  return 0;
+}
+
+// reads the acknowledgements that arrived so far, returns -1 if the replica is gone
+static int readAcks(replica *r, stream_decoder *acks) {
+  while (true) {
+    fd_set readSet;
+    FD_ZERO(&readSet);
+    FD_SET(r->sock, &readSet);
+    struct timeval noWait = {0, 0};
+    if (select((int)r->sock + 1, &readSet, NULL, NULL, &noWait) <= 0) {
+      return 0;
+    }
+
+    char chunk[256];
+    int n = recv(r->sock, chunk, sizeof(chunk), 0);
+    if (n <= 0 || streamDecoderFeed(acks, chunk, n, handleAck, r) != 0) {
+      return -1;
+    }
+  }
+}
+
+static void removeReplica(replica *r) {
+  AcquireSRWLockExclusive(&gl_replLock);
+  for (int i = 0; i < gl_replicaCount; i++) {
+    if (gl_replicas[i] == r) {
+      gl_replicas[i] = gl_replicas[--gl_replicaCount];
+      break;
+    }
+  }
+  trimLog();
+  gl_replSenders--;
+  WakeAllConditionVariable(&gl_replCond);
+  ReleaseSRWLockExclusive(&gl_replLock);
+}
+
+typedef struct snapshot_hash {
+  byte_buffer *out;
+  const char *key;
+} snapshot_hash;
+
+static int appendSnapshotField(const char *field, size_t fieldLen, const char *value, size_t valueLen, void *ctx) {
+  snapshot_hash *hash = ctx;
+  return appendRequest(hash->out, "HSET", hash->key, field, fieldLen, value, valueLen);
+}
+
+static int appendSnapshotEntry(const char *key, const kv_entry *entry, void *ctx) {
+  if (kv_entry_is_hash(entry)) {
+    // one HSET per field
+    snapshot_hash hash = {.out = ctx, .key = key};
+    return kv_entry_hash_foreach(entry, appendSnapshotField, &hash);
+  }
+
+  char numberText[KV_NUMBER_TEXT_SIZE];
+  const char *value = kv_entry_value(entry, numberText);
+  if (value != NULL) {
+    return appendRequest(ctx, "PUT", key, NULL, 0, value, kv_entry_value_len(entry));
+  }
+
+  // compressed values are sent as text, the replica compresses them by its own settings
+  char *text = malloc(kv_entry_value_len(entry) + 1);
+  int r = text != NULL && kv_entry_read(entry, text) == 0
+              ? appendRequest(ctx, "PUT", key, NULL, 0, text, kv_entry_value_len(entry))
+              : -1;
+  free(text);
+  return r;
+}
+
+typedef struct snapshot_batch {
+  replica *r;
+  byte_buffer out;
+  int result;
+  bool done;
+} snapshot_batch;
+
+// appends the next keys of the snapshot, called with the store locked
+static void appendSnapshotBatch(kv_store *store, void *ctx) {
+  snapshot_batch *batch = ctx;
+  replica *r = batch->r;
+  if (r->snapshotCursor < store->size) {
+    batch->result = kv_store_scan(store, &r->snapshotCursor, REPL_SNAPSHOT_BATCH_KEYS, appendSnapshotEntry, &batch->out);
+    return;
+  }
+
+  // integer keys move within their table with every write, so they are looked up one by one
+  char key[24];
+  size_t end = r->intKeyCount - r->intKeysSent > REPL_SNAPSHOT_BATCH_KEYS ? r->intKeysSent + REPL_SNAPSHOT_BATCH_KEYS
+                                                                          : r->intKeyCount;
+  for (; r->intKeysSent < end && batch->result == 0; r->intKeysSent++) {
+    snprintf(key, sizeof(key), "%llu", r->intKeys[r->intKeysSent]);
+    const kv_entry *entry = kv_store_lookup(store, key);
+    if (entry != NULL) {
+      batch->result = appendSnapshotEntry(key, entry, &batch->out);
+    }
+  }
+  batch->done = r->intKeysSent == r->intKeyCount;
+}
+
+// sends the snapshot batch by batch, writers only wait for one batch to be read
+static int sendSnapshot(replica *r) {
+  snapshot_batch batch = {.r = r};
+  while (!batch.done && batch.result == 0) {
+    r->read(appendSnapshotBatch, &batch);
+    if (batch.result == 0 && sendBytes(r->sock, batch.out.data, batch.out.len) != 0) {
+      batch.result = -1;
+    }
+    batch.out.len = 0;
+  }
+  byte_buffer_free(&batch.out);
+  return batch.result;
+}
+
+static DWORD WINAPI replicaSenderMain(LPVOID arg) {
+  replica *r = (replica *)arg;
+  char *chunk = malloc(REPL_SEND_CHUNK_SIZE);
+  stream_decoder acks = {.maxValueSize = KVSTR_MAX_VALUE_SIZE};
+  streamDecoderReset(&acks);
+
+  // snapshot, then the position the log goes on from
+  byte_buffer ping = {0};
+  appendOffsets(&ping, "REPLPING", r->offset, r->offset, true);
+  bool failed = chunk == NULL || sendSnapshot(r) != 0 || sendBytes(r->sock, ping.data, ping.len) != 0;
+  byte_buffer_free(&ping);
+  free(r->intKeys);
+  if (!failed) {
+    LOGF(INFO, "Snapshot sent to replica, streaming from offset %llu.", r->offset);
+  }
+
+  unsigned long long lastPing = stats_now();
+  while (!failed) {
+    AcquireSRWLockExclusive(&gl_replLock);
+    if (r->offset == gl_replOffset && !r->dropped) {
+      SleepConditionVariableSRW(&gl_replCond, &gl_replLock, REPL_HEARTBEAT_INTERVAL, 0);
+    }
+    if (r->dropped) {
+      ReleaseSRWLockExclusive(&gl_replLock);
+      break;
+    }
+
+    // copy a part of the log, other writers may grow it while it is sent
+    unsigned long long from = r->offset;
+    size_t n = (size_t)(gl_replOffset - from);
+    bool toEnd = n <= REPL_SEND_CHUNK_SIZE;
+    if (!toEnd) {
+      n = REPL_SEND_CHUNK_SIZE;
+    }
+    if (n > 0) {
+      memcpy(chunk, gl_replLog.data + (from - gl_replLogStart), n);
+    }
+    ReleaseSRWLockExclusive(&gl_replLock);
+
+    if (n > 0 && sendBytes(r->sock, chunk, n) != 0) {
+      break;
+    }
+
+    AcquireSRWLockExclusive(&gl_replLock);
+    r->offset = from + n;
+    trimLog();
+    unsigned long long end = gl_replOffset;
+    ReleaseSRWLockExclusive(&gl_replLock);
+
+    // heartbeats may only be sent between two requests of the stream
+    if (toEnd && stats_now() - lastPing >= REPL_HEARTBEAT_INTERVAL * 1000000ULL) {
+      appendOffsets(&ping, "REPLPING", from + n, end, true);
+      failed = sendBytes(r->sock, ping.data, ping.len) != 0;
+      ping.len = 0;
+      lastPing = stats_now();
+    }
+    if (!failed && readAcks(r, &acks) != 0) {
+      break;
+    }
+  }
+
+  LOGF(INFO, "Replica disconnected.");
+  byte_buffer_free(&ping);
+  free_kvstr_request(&acks.req);
+  free(chunk);
+  closesocket(r->sock);
+  removeReplica(r);
+  free(r);
+  return 0;
+}
+
+int replication_add_replica(SOCKET sock, kv_store *store, replication_read_fn read) {
+  replica *r = calloc(1, sizeof(replica));
+  if (r == NULL) {
+    return -1;
+  }
+  r->sock = sock;
+  r->read = read;
+  atomic_init(&r->ackTime, stats_now());
+
+  // connections of the I/O threads are non-blocking, the sender thread blocks on its socket
+  u_long blocking = 0;
+  ioctlsocket(sock, FIONBIO, &blocking);
+
+  // the caller holds the store lock, so no write can slip in between the keys and the log position,
+  // the values are read later by the sender thread
+  if (kv_store_int_keys(store, &r->intKeys, &r->intKeyCount) != 0) {
+    free(r);
+    return -1;
+  }
+
+  size_t keyCount = kv_store_count(store);
+
+  AcquireSRWLockExclusive(&gl_replLock);
+  if (gl_replicaCount == REPL_MAX_REPLICAS || gl_replStopping) {
+    ReleaseSRWLockExclusive(&gl_replLock);
+    free(r->intKeys);
+    free(r);
+    return -1;
+  }
+  r->offset = gl_replOffset;
+  atomic_init(&r->ackedOffset, gl_replOffset);
+  gl_replicas[gl_replicaCount++] = r;
+  gl_replSenders++;
+
+  HANDLE thread = CreateThread(NULL, 0, replicaSenderMain, r, 0, NULL);
+  if (thread == NULL) {
+    gl_replicas[--gl_replicaCount] = NULL;
+    gl_replSenders--;
+    ReleaseSRWLockExclusive(&gl_replLock);
+    free(r->intKeys);
+    free(r);
+    return -1;
+  }
+  CloseHandle(thread);
+  ReleaseSRWLockExclusive(&gl_replLock);
+
+  LOGF(INFO, "Replica connected, sending a snapshot of %zu keys.", keyCount);
+  return 0;
+}
+
+/*** replica ***/
+
+static int applyFromPrimary(void *ctx, struct kvstr_request *req, size_t bytes) {
+  if (strcmp(req->operation, "PUT") == 0 || strcmp(req->operation, "DEL") == 0 ||
+      strcmp(req->operation, "HSET") == 0 || strcmp(req->operation, "HDEL") == 0 ||
+      strcmp(req->operation, "SETRANGE") == 0) {
+    gl_apply(req);
+    atomic_fetch_add(&gl_appliedOffset, bytes);
+    return 0;
+  }
+  if (strcmp(req->operation, "REPLPING") == 0) {
+    atomic_store(&gl_appliedOffset, strtoull(req->args[0], NULL, 10));
+    atomic_store(&gl_primaryOffset, strtoull(req->args[1], NULL, 10));
+    return 0;
+  }
+
+  LOGF(WARN, "Unexpected %s request from the primary.", req->operation);
+  return -1;
+}
+
+// follows the primary until the connection breaks
+static void followPrimary(kvclient_conn *conn) {
+  const char *sync = "SYNC\r\n";
+  if (kvclient_send(conn, sync, strlen(sync)) != 0) {
+    return;
+  }
+
+  // the snapshot replaces everything, replicas of this server need a new one as well
+  gl_reset();
+  AcquireSRWLockExclusive(&gl_replLock);
+  for (int i = 0; i < gl_replicaCount; i++) {
+    dropReplica(gl_replicas[i]);
+  }
+  WakeAllConditionVariable(&gl_replCond);
+  ReleaseSRWLockExclusive(&gl_replLock);
+
+  atomic_store(&gl_linkUp, true);
+  atomic_store(&gl_lastIo, stats_now());
+  LOGF(INFO, "Connected to primary %s, waiting for the snapshot.", gl_primary);
+
+  stream_decoder stream = {.maxValueSize = gl_maxValueSize};
+  streamDecoderReset(&stream);
+  char *chunk = malloc(REPL_RECV_CHUNK_SIZE);
+  unsigned long long lastAck = stats_now();
+  while (chunk != NULL && atomic_load(&gl_followerRunning)) {
+    fd_set readSet;
+    FD_ZERO(&readSet);
+    FD_SET(conn->sock, &readSet);
+    struct timeval timeout = {0, REPL_HEARTBEAT_INTERVAL * 1000};
+    int r = select((int)conn->sock + 1, &readSet, NULL, NULL, &timeout);
+    if (r == SOCKET_ERROR) {
+      break;
+    }
+    if (r > 0) {
+      int n = recv(conn->sock, chunk, REPL_RECV_CHUNK_SIZE, 0);
+      if (n <= 0) {
+        break;
+      }
+      atomic_store(&gl_lastIo, stats_now());
+      if (streamDecoderFeed(&stream, chunk, n, applyFromPrimary, NULL) != 0) {
+        LOGF(ERR, "Broken replication stream from the primary.");
+        break;
+      }
+    }
+
+    if (stats_now() - lastAck >= REPL_HEARTBEAT_INTERVAL * 1000000ULL) {
+      byte_buffer ack = {0};
+      appendOffsets(&ack, "REPLACK", atomic_load(&gl_appliedOffset), 0, false);
+      int failed = ack.data == NULL || kvclient_send(conn, ack.data, ack.len) != 0;
+      byte_buffer_free(&ack);
+      if (failed) {
+        break;
+      }
+      lastAck = stats_now();
+    }
+  }
+
+  free(chunk);
+  free_kvstr_request(&stream.req);
+  atomic_store(&gl_linkUp, false);
+}
+
+static DWORD WINAPI followerMain(LPVOID arg) {
+  while (atomic_load(&gl_followerRunning)) {
+    kvclient_conn *conn = kvclient_connect(gl_primary, gl_primaryPort);
+    if (conn == NULL) {
+      LOGF(WARN, "Failed to connect to primary %s. Error code: %d", gl_primary, WSAGetLastError());
+    } else {
+      followPrimary(conn);
+      kvclient_close(&conn);
+      LOGF(WARN, "Lost connection to primary %s.", gl_primary);
+    }
+
+    if (atomic_load(&gl_followerRunning)) {
+      Sleep(REPL_RECONNECT_INTERVAL);
+    }
+  }
+  return 0;
+}
+
+int replication_start_replica(const char *primary, int port, size_t maxValueSize, replication_apply_fn apply,
+                              replication_reset_fn reset) {
+  gl_primary = primary;
+  gl_primaryPort = port;
+  gl_maxValueSize = maxValueSize;
+  gl_apply = apply;
+  gl_reset = reset;
+  atomic_store(&gl_followerRunning, true);
+
+  gl_followerThread = CreateThread(NULL, 0, followerMain, NULL, 0, NULL);
+  if (gl_followerThread == NULL) {
+    atomic_store(&gl_followerRunning, false);
+    return -1;
+  }
+  return 0;
+}
+
+bool replication_is_replica() {
+  return gl_followerThread != NULL;
+}
+
+void replication_get_info(replication_info *info) {
+  memset(info, 0, sizeof(*info));
+  unsigned long long now = stats_now();
+
+  info->replica = replication_is_replica();
+  if (info->replica) {
+    info->link_up = atomic_load(&gl_linkUp);
+    info->offset = atomic_load(&gl_appliedOffset);
+    unsigned long long primaryOffset = atomic_load(&gl_primaryOffset);
+    info->lag_bytes = primaryOffset > info->offset ? primaryOffset - info->offset : 0;
+    info->last_io_ms = (now - atomic_load(&gl_lastIo)) / 1000000ULL;
+  }
+
+  AcquireSRWLockShared(&gl_replLock);
+  if (!info->replica) {
+    info->offset = gl_replOffset;
+  }
+  info->replica_count = gl_replicaCount;
+  for (int i = 0; i < gl_replicaCount; i++) {
+    unsigned long long acked = atomic_load(&gl_replicas[i]->ackedOffset);
+    info->replicas[i].acked_offset = acked;
+    info->replicas[i].lag_bytes = gl_replOffset > acked ? gl_replOffset - acked : 0;
+    info->replicas[i].ack_age_ms = (now - atomic_load(&gl_replicas[i]->ackTime)) / 1000000ULL;
+  }
+  ReleaseSRWLockShared(&gl_replLock);
+}
+
+void replication_stop() {
+  if (gl_followerThread != NULL) {
+    atomic_store(&gl_followerRunning, false);
+    WaitForSingleObject(gl_followerThread, INFINITE);
+    CloseHandle(gl_followerThread);
+  }
+
+  AcquireSRWLockExclusive(&gl_replLock);
+  gl_replStopping = true;
+  for (int i = 0; i < gl_replicaCount; i++) {
+    dropReplica(gl_replicas[i]);
+  }
+  WakeAllConditionVariable(&gl_replCond);
+  while (gl_replSenders > 0) {
+    SleepConditionVariableSRW(&gl_replCond, &gl_replLock, INFINITE, 0);
+  }
+  byte_buffer_free(&gl_replLog);
+  ReleaseSRWLockExclusive(&gl_replLock);
+}
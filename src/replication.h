@@ -0,0 +1,52 @@
+#ifndef _KVSTR_REPLICATION_H
+#define _KVSTR_REPLICATION_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef _WIN64
+#include <WinSock2.h>
+#endif
+
+#include "kvstore.h"
+#include "kvstrdecoder.h"
+
+#define REPL_MAX_REPLICAS 16
+#define REPL_HEARTBEAT_INTERVAL 1000          // ms between offset heartbeats and acknowledgements
+#define REPL_RECONNECT_INTERVAL 1000          // ms a replica waits before connecting again
+#define REPL_MAX_BACKLOG 64 * 1024 * 1024     // replicas falling further behind are dropped and resync
+#define REPL_SEND_CHUNK_SIZE 64 * 1024
+#define REPL_RECV_CHUNK_SIZE 16 * 1024
+#define REPL_SNAPSHOT_BATCH_KEYS 1024         // keys of the snapshot read per lock of the store
+
+typedef void (*replication_apply_fn)(struct kvstr_request *req); // apply a PUT, DEL, HSET, HDEL or SETRANGE of the primary (may take over the value)
+typedef void (*replication_reset_fn)(); // discard all data before a new snapshot is applied
+typedef void (*replication_snapshot_fn)(kv_store *store, void *ctx);
+typedef void (*replication_read_fn)(replication_snapshot_fn read, void *ctx); // call read with the store locked (shared)
+
+typedef struct replication_replica_info {
+  unsigned long long acked_offset;  // position in the write log the replica has applied
+  unsigned long long lag_bytes;     // written by the primary but not acknowledged yet
+  unsigned long long ack_age_ms;    // since the last acknowledgement
+} replication_replica_info;
+
+typedef struct replication_info {
+  bool replica;                     // this server follows a primary
+  bool link_up;                     // replica: connected to the primary
+  unsigned long long offset;        // primary: end of the write log, replica: position applied
+  unsigned long long lag_bytes;     // replica: behind the position the primary reported last
+  unsigned long long last_io_ms;    // replica: since data was received from the primary
+  int replica_count;                // replicas following this server
+  replication_replica_info replicas[REPL_MAX_REPLICAS];
+} replication_info;
+
+/* Prototypes */
+void replication_feed(const char *operation, const char *key, const char *value, size_t valueLen); // append a write to the log, call with the store locked exclusively
+void replication_feed_field(const char *operation, const char *key, const char *field, size_t fieldLen, const char *value, size_t valueLen); // like replication_feed for writes with an argument (HSET, HDEL, SETRANGE), value is NULL if there is none
+int replication_add_replica(SOCKET sock, kv_store *store, replication_read_fn read); // stream a snapshot of the store, read in batches with read, plus all further writes, call with the store locked (shared), takes over the socket
+int replication_start_replica(const char *primary, int port, size_t maxValueSize, replication_apply_fn apply, replication_reset_fn reset); // follow a primary ("unix:<path>" for a unix socket), values up to maxValueSize bytes
+bool replication_is_replica();
+void replication_get_info(replication_info *info);
+void replication_stop(); // disconnect all replicas and the primary
+
+#endif
@@ -1,127 +1,100 @@
+#include <ctype.h>
+#include <errno.h>
 #include <signal.h>
 #include <stdbool.h>
 #include <stdio.h>
-#include <time.h>
+#include "cluster.h"
+#include "kvclient.h"
 #include "kvstore.h"
 #include "server.h"
+#include "utilfuns.h"
+#include "iothreads.h"
+#include "logger.h"
+#include "replication.h"
+#include "slowlog.h"
+#include "stats.h"
+#include "tracking.h"
+#include "watch.h"
 
 #define SKVS_SERVER
 
 #ifdef UNIT_TEST
-#include "utilfuns.h"
 
 /* very bad c mocking :) */
 const char* _mock_lastMessage = NULL;
+size_t _mock_sentBytes = 0;         // total number of bytes "sent" since the last reset
+
+const char* _mock_recvData = NULL;  // bytes handed out by the mocked recv
+size_t _mock_recvLength = 0;
+size_t _mock_recvPos = 0;
+size_t _mock_recvChunk = 0;         // max. bytes per recv call to simulate fragmentation (0 = unlimited)
 
 int mock_send(SOCKET socket, const char *buffer, size_t length, int flags) {
     // Simulate sending a message; you can log it or store it for assertions later
     if(_mock_lastMessage != NULL) {
         free((void*) _mock_lastMessage);
     }
-    _mock_lastMessage = duplicate_string(buffer);
+    char* copy = malloc(length + 1);
+    memcpy(copy, buffer, length);
+    copy[length] = '\0';
+    _mock_lastMessage = copy;
+    _mock_sentBytes += length;
     return length; // Simulate successful send
 }
 
+int mock_recv(SOCKET socket, char *buffer, int length, int flags) {
+    size_t n = _mock_recvLength - _mock_recvPos;
+    if (n > (size_t) length) n = length;
+    if (_mock_recvChunk > 0 && n > _mock_recvChunk) n = _mock_recvChunk;
+    memcpy(buffer, _mock_recvData + _mock_recvPos, n);
+    _mock_recvPos += n;
+    return (int) n; // 0 once all data was consumed, like a closed connection
+}
+
 #define send mock_send
+#define recv mock_recv
+
+// no logging during tests, the arguments are still type checked
+#undef LOGF
+#define LOGF(lvl, ...)                    \
+  do {                                    \
+    if (0) {                              \
+      logger_write((lvl), __VA_ARGS__);   \
+    }                                     \
+  } while (0)
 #endif
 
+#define LISTENER_COUNT 2
+#define LISTENER_TCP 0
+#define LISTENER_UNIX 1
+#define ACCEPT_TIMEOUT_MS 500 // how long accepting waits before checking for an interrupt
+
 /*** global variables start ***/
-static enum LogLevel gl_logLevel = INFO;
 static volatile bool gl_keepRunning = true;
 static volatile bool gl_cleanedUp = false;
-static SOCKET gl_serverSocket;
+static SOCKET gl_listeners[LISTENER_COUNT] = {INVALID_SOCKET, INVALID_SOCKET}; // TCP and unix socket
+static int gl_port = 8080; // 0 = no TCP listener
+static const char *gl_unixSocketPath = NULL; // NULL = no unix socket listener
 kv_store* gl_kvStore;
+static SRWLOCK gl_storeLock = SRWLOCK_INIT; // GET shares the store, PUT and DEL need it exclusively
+static size_t gl_maxValueSize = KVSTR_MAX_VALUE_SIZE;
+static int gl_workerThreads = 0; // 0 = single-threaded mode, otherwise number of executor threads
+static int gl_ioThreads = 2;
+static char *gl_primary = NULL; // primary this server replicates ("host:port" or "unix:<path>")
+static const char *gl_allocator = "system"; // allocator of the key value store (see kv_allocator_create)
+static bool gl_intKeys = false; // keys in canonical decimal form are stored as integers
+static size_t gl_compressMin = 0; // values of at least this many bytes are stored compressed, 0 if none are
+static size_t gl_lazyFreeMin = KV_LAZY_FREE_MIN; // deleted or overwritten values of at least this many bytes are freed in the background, 0 if none are
 /*** global variables end ***/
 
-#define MAX_REQUEST_SIZE 5 * 1024 * 1024 // 5 MB buffer for requests
-
-// helper fucntion to free the memory allocated for the request
-void free_kvstr_request(struct kvstr_request** req_ptr) {
-  if (req_ptr == NULL) {
-      return;
-  }
-
-  struct kvstr_request* req = *req_ptr;
-  if (req == NULL) {
-      return;
-  }
-  
-  if (req->operation != NULL) {
-      free(req->operation);
-      req->operation = NULL;
-  }
-  if (req->key != NULL) {
-      free(req->key);
-      req->key = NULL;
-  }
-  if (req->value != NULL) {
-      free(req->value);
-      req->value = NULL;
-  }
-
-  free(req);
-  *req_ptr = NULL;
-}
-
-// helper function to initialize a clean request struct
-struct kvstr_request* create_kvstr_request() {
-    struct kvstr_request* req = (struct kvstr_request*) malloc(sizeof(struct kvstr_request));
-    if (req == NULL) {
-        return NULL;  // Memory allocation failure
-    }
-
-    req->operation = NULL;
-    req->key = NULL;
-    req->value = NULL;
-
-    return req;
-}
-
-void getCurrentTimeString(char *buffer) {
-  time_t t = time(NULL);
-  struct tm buf;
-  char timeStamp[26];
-  errno_t err = localtime_s(&buf, &t);
-  asctime_s(timeStamp, sizeof timeStamp, &buf);
-  timeStamp[24] = '\0';
-  strcpy_s(buffer, 25, timeStamp);
-  return;
-}
-
-const char *getLogLevelAsStr(enum LogLevel l) {
-  switch (l) {
-  case INFO:
-    return "INFO";
-  case WARN:
-    return "WARN";
-  case ERR:
-    return "ERR";
-  case DEBUG:
-    return "DEBUG";
-  case FATAL:
-    return "FATAL";
-  default:
-    return "UNKNOWN";
-  }
-}
+#define RECV_CHUNK_SIZE 16 * 1024 // bytes read from the socket at once while parsing a request header
+#define SEND_CHUNK_SIZE 64 * 1024 // large responses are sent in chunks of this size
+#define RECV_DIRECT_SIZE 1024 * 1024 // max. bytes received at once straight into a value
+#define MIGRATE_MAX_KEYS 1024 // keys moved by one MIGRATE at most, larger counts are clamped
 
 #ifndef UNIT_TEST
 void logMessage(enum LogLevel lvl, const char *message) {
-  if (gl_logLevel < lvl) {
-    return;
-  }
-
-#ifdef _WIN64
-  char timeStampStr[26];
-  getCurrentTimeString(timeStampStr);
-  printf("%s - %s - %s\n", timeStampStr, getLogLevelAsStr(lvl), message);
-#else
-  printf("%s - %s\n", getLogLevelAsStr(lvl), message);
-#endif
-
-  if (lvl == FATAL) {
-    exit(1);
-  }
+  LOGF(lvl, "%s", message);
 }
 #else
 void logMessage(enum LogLevel lvl, const char *message) { 
@@ -145,277 +118,367 @@ void setLoglevel(const char *lvl) {
     gl_logLevel = INFO;
   }
 
-  char logBuffer[1024];
-  sprintf(logBuffer, "Log level set to %s.", getLogLevelAsStr(gl_logLevel));
-  logMessage(INFO, logBuffer);
+  LOGF(INFO, "Log level set to %s.", getLogLevelAsStr(gl_logLevel));
 
   return;
 }
 
-void createSocket() {
+void setMaxValueSize(const char *megabytes) {
+  long long mb = atoll(megabytes);
+  if (mb <= 0) {
+    logMessage(WARN, "Invalid max value size. Keeping the default.");
+    return;
+  }
+
+  gl_maxValueSize = (size_t) mb * 1024 * 1024;
+
+  LOGF(INFO, "Max value size set to %lld MB.", mb);
+}
+
+void startWinsock() {
   WSADATA wsaData = {0};
   int r = WSAStartup(MAKEWORD(2, 2), &wsaData);
   if (r != 0) {
-    char logBuffer[1024];
-    sprintf(logBuffer, "WSAStartup failed. Error code: %d", r);
-    logMessage(FATAL, logBuffer);
+    LOGF(FATAL, "WSAStartup failed. Error code: %d", r);
   }
+}
 
-  SOCKET sock = socket(AF_INET, SOCK_STREAM, 0);
+SOCKET createSocket(int family) {
+  SOCKET sock = socket(family, SOCK_STREAM, 0);
   if (sock == INVALID_SOCKET) {
-    char logBuffer[1024];
-    sprintf(logBuffer, "Failed to create socket. Error code: %d",
-            WSAGetLastError());
-    logMessage(FATAL, logBuffer);
+    LOGF(FATAL, "Failed to create socket. Error code: %d", WSAGetLastError());
   }
 
-  int enable = 1;
-  r = setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, (const char *)&enable,
-                 sizeof(enable));
-  if (r != 0) {
-    char logBuffer[1024];
-    sprintf(logBuffer, "Failed to set socket options. Error code: %d",
-            WSAGetLastError());
-    logMessage(FATAL, logBuffer);
+  if (family == AF_INET) {
+    int enable = 1;
+    int r = setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, (const char *)&enable,
+                       sizeof(enable));
+    if (r != 0) {
+      LOGF(FATAL, "Failed to set socket options. Error code: %d", WSAGetLastError());
+    }
   }
 
   logMessage(DEBUG, "Socket created.");
-  gl_serverSocket = sock;
+  return sock;
 }
 
-void bindSocket(SOCKET sock, int port) {
-  char logBuffer[1024];
-  int r;
+static void listenOnSocket(SOCKET sock) {
+  int r = listen(sock, SOMAXCONN);
+  if (r != 0) {
+    LOGF(FATAL, "Failed to listen on socket. Error code: %d", WSAGetLastError());
+  }
+}
 
+void bindSocket(SOCKET sock, int port) {
   struct sockaddr_in addr = {0};
   addr.sin_family = AF_INET;
   addr.sin_port = htons(port);
   addr.sin_addr.s_addr = INADDR_ANY;
 
-  r = bind(sock, (struct sockaddr *)&addr, sizeof(addr));
+  int r = bind(sock, (struct sockaddr *)&addr, sizeof(addr));
   if (r == SOCKET_ERROR) {
-    memset(logBuffer, 0, sizeof(logBuffer));
-    sprintf(logBuffer, "Failed to bind socket. Error code: %d",
-            WSAGetLastError());
-    logMessage(FATAL, logBuffer);
+    LOGF(FATAL, "Failed to bind socket. Error code: %d", WSAGetLastError());
   }
 
-  r = listen(sock, SOMAXCONN);
-  if (r != 0) {
-    memset(logBuffer, 0, sizeof(logBuffer));
-    sprintf(logBuffer, "Failed to listen on socket. Error code: %d",
-            WSAGetLastError());
-    logMessage(FATAL, logBuffer);
+  listenOnSocket(sock);
+  LOGF(INFO, "Listening on 0.0.0.0:%d", port);
+}
+
+void bindUnixSocket(SOCKET sock, const char *path) {
+  struct sockaddr_un addr = {0};
+  addr.sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    LOGF(FATAL, "Unix socket path '%s' is too long.", path);
+  }
+  strcpy(addr.sun_path, path);
+
+  // a socket file left over by a previous run would make bind() fail
+  remove(path);
+  int r = bind(sock, (struct sockaddr *)&addr, sizeof(addr));
+  if (r == SOCKET_ERROR) {
+    LOGF(FATAL, "Failed to bind unix socket. Error code: %d", WSAGetLastError());
   }
-  logMessage(INFO, "Listening on 0.0.0.0:8080");
+
+  listenOnSocket(sock);
+  LOGF(INFO, "Listening on unix socket %s", path);
 }
 
-void handleConnections(SOCKET serverSocket) {
-  char logBuffer[1024];
+// waits until one of the listeners has a client, returns INVALID_SOCKET after the timeout
+static SOCKET acceptNextClient() {
+  fd_set readSet;
+  FD_ZERO(&readSet);
+  SOCKET maxSocket = 0;
+  for (int i = 0; i < LISTENER_COUNT; i++) {
+    if (gl_listeners[i] != INVALID_SOCKET) {
+      FD_SET(gl_listeners[i], &readSet);
+      if (gl_listeners[i] > maxSocket) {
+        maxSocket = gl_listeners[i];
+      }
+    }
+  }
+
+  // the timeout lets the loop notice an interrupt which closed the listeners during select()
+  struct timeval timeout = {0, ACCEPT_TIMEOUT_MS * 1000};
+  int r = select((int)maxSocket + 1, &readSet, NULL, NULL, &timeout);
+  if (r <= 0) {
+    if (r == SOCKET_ERROR && gl_keepRunning) {
+      handleAcceptError();
+    }
+    return INVALID_SOCKET;
+  }
+
+  for (int i = 0; i < LISTENER_COUNT; i++) {
+    SOCKET listener = gl_listeners[i];
+    if (listener != INVALID_SOCKET && FD_ISSET(listener, &readSet)) {
+      return acceptClientConnection(listener);
+    }
+  }
+  return INVALID_SOCKET;
+}
 
+void handleConnections() {
   // we keep running as long as there was no interrupt
   while (gl_keepRunning) {
-    SOCKET clientSocket =
-        acceptClientConnection(serverSocket, logBuffer, sizeof(logBuffer));
+    SOCKET clientSocket = acceptNextClient();
     if (clientSocket == INVALID_SOCKET) {
       continue; // If accept fails, continue to the next iteration
     }
 
-    char* buffer = (char*)calloc(MAX_REQUEST_SIZE, 1);
-    if (receiveData(clientSocket, buffer, MAX_REQUEST_SIZE) == SOCKET_ERROR) {
+    struct kvstr_request *req = create_kvstr_request();
+    if (req == NULL) {
+      logMessage(ERR, "Failed to allocate request.");
+      closesocket(clientSocket);
+      continue;
+    }
+
+    stats_add(STATS_CONNECTIONS, 1);
+    request_timing timing = {0};
+    timing.start = stats_now();
+    stats_set_request(&timing);
+
+    int parseRequestError = receiveRequest(clientSocket, req);
+    if (parseRequestError == SOCKET_ERROR) {
+      stats_set_request(NULL);
+      free_kvstr_request(&req);
       closesocket(clientSocket);
+      stats_add(STATS_CONNECTIONS, -1);
       continue; // Move to the next iteration in case of receiving error
     }
 
-    processClientRequest(clientSocket, buffer, logBuffer, sizeof(logBuffer));
+    if (parseRequestError != 0) {
+      sendParseError(clientSocket, parseRequestError);
+    } else {
+      processClientRequest(clientSocket, req);
+    }
+    stats_set_request(NULL);
+    unsigned long long total = stats_record_request(&timing);
+    if (total > gl_slowlogThreshold) {
+      slowlog_record(clientSocket, req->operation, req->key, req->value_len, &timing, total);
+    }
+
+    free_kvstr_request(&req);
+    if (!clientSocketDetached()) {
+      closesocket(clientSocket);
+    }
+    stats_add(STATS_CONNECTIONS, -1);
+  }
+}
+
+// worker mode: the accepting thread only hands new connections to the I/O threads which read
+// requests and write responses, requests are executed on the executor threads
+void handleConnectionsWithWorkers() {
+  if (gl_ioThreads < 1) {
+    gl_ioThreads = 1;
+  }
+  if (startIoThreads(gl_ioThreads, gl_workerThreads, gl_maxValueSize) != 0) {
+    logMessage(FATAL, "Failed to start I/O and worker threads.");
+    return;
+  }
+
+  LOGF(INFO, "Worker mode with %d I/O threads and %d workers.", gl_ioThreads, gl_workerThreads);
+
+  while (gl_keepRunning) {
+    SOCKET clientSocket = acceptNextClient();
+    if (clientSocket == INVALID_SOCKET) {
+      continue;
+    }
 
-    free(buffer); // release message buffer
-    closesocket(clientSocket);
+    if (dispatchConnection(clientSocket) != 0) {
+      const char *errMsg = "503 Service Unavailable: Too many connections";
+      send(clientSocket, errMsg, strlen(errMsg), 0);
+      closesocket(clientSocket);
+    }
   }
+
+  stopIoThreads();
 }
 
-SOCKET acceptClientConnection(SOCKET serverSocket, char *logBuffer,
-                              size_t logBufferSize) {
-  struct sockaddr_in clientAddr;
-  size_t clientAddrSize = sizeof(clientAddr);
+SOCKET acceptClientConnection(SOCKET serverSocket) {
+  struct sockaddr_storage clientAddr;
+  int clientAddrSize = sizeof(clientAddr);
 
-  SOCKET clientSocket = accept(serverSocket, (struct sockaddr *)&clientAddr,
-                               (int *)&clientAddrSize);
+  SOCKET clientSocket = accept(serverSocket, (struct sockaddr *)&clientAddr, &clientAddrSize);
   if (clientSocket == INVALID_SOCKET) {
-    handleAcceptError(logBuffer, logBufferSize);
+    handleAcceptError();
     return INVALID_SOCKET;
   }
 
   // Log successful connection
-  snprintf(logBuffer, logBufferSize, "Accepted connection from %s:%d",
-           inet_ntoa(clientAddr.sin_addr), ntohs(clientAddr.sin_port));
-  logMessage(DEBUG, logBuffer);
+  if (clientAddr.ss_family == AF_INET) {
+    struct sockaddr_in *inetAddr = (struct sockaddr_in *)&clientAddr;
+    LOGF(DEBUG, "Accepted connection from %s:%d", inet_ntoa(inetAddr->sin_addr),
+         ntohs(inetAddr->sin_port));
+  } else {
+    logMessage(DEBUG, "Accepted connection on unix socket");
+  }
 
   return clientSocket;
 }
 
-void handleAcceptError(char *logBuffer, size_t logBufferSize) {
+void handleAcceptError() {
   int errorCode = WSAGetLastError();
   if (errorCode == WSAEINTR) {
     logMessage(INFO, "Received interrupt signal. Stopping new connections.");
   } else {
-    snprintf(logBuffer, logBufferSize,
-             "Failed to accept connection. Error code: %d", errorCode);
-    logMessage(ERR, logBuffer);
+    LOGF(ERR, "Failed to accept connection. Error code: %d", errorCode);
   }
 }
 
-int receiveData(SOCKET clientSocket, char *buffer, size_t bufferSize) {
-  int receivedBytes = recv(clientSocket, buffer, bufferSize, 0);
-  if (receivedBytes == SOCKET_ERROR) {
-    char logBuffer[1024];
-    snprintf(logBuffer, sizeof(logBuffer), "Failed to receive data. Error code: %d",
-             WSAGetLastError());
-    logMessage(ERR, logBuffer);
-  }
-  return receivedBytes;
-}
-
-int kvstr_parse_request(const char *request_str, struct kvstr_request *result) {
-  if (request_str == NULL || result == NULL) {
-    return -1; // Invalid input
-  }
-
-  result->operation = result->key = result->value = NULL;
-
-  const char *after_op_ptr = parse_operation(request_str, result);
-  if (after_op_ptr == NULL) {
-    return -2; // Failed to parse operation
-  }
-
-
-  const char *after_key_ptr = parse_key(after_op_ptr, result);
-  if (after_key_ptr == NULL) {
-    return -3; // Failed to parse key
-  }
+// reads exactly one request from the socket
+//
+// The header (operation, length prefixes, key) is read in small chunks. Once the decoder knows
+// the size of a value it allocates the final buffer and the remaining value bytes are received
+// directly into it, so a request never needs more memory than its value plus one chunk.
+// Returns 0, a parse error code or SOCKET_ERROR if receiving failed.
+int receiveRequest(SOCKET clientSocket, struct kvstr_request *req) {
+  struct kvstr_decoder dec;
+  kvstr_decoder_init(&dec, req, KVSTR_MAX_KEY_SIZE, gl_maxValueSize);
+
+  char chunk[RECV_CHUNK_SIZE];
+  while (!kvstr_decoder_done(&dec)) {
+    size_t remaining;
+    char *direct = kvstr_decoder_direct_buffer(&dec, &remaining);
+
+    int receivedBytes;
+    if (direct != NULL && remaining >= sizeof(chunk)) {
+      int len = remaining > RECV_DIRECT_SIZE ? RECV_DIRECT_SIZE : (int) remaining;
+      unsigned long long recvStart = stats_now();
+      receivedBytes = recv(clientSocket, direct, len, 0);
+      stats_add_phase(STATS_PHASE_RECV, recvStart);
+      if (receivedBytes > 0) {
+        stats_add(STATS_BYTES_IN, receivedBytes);
+        kvstr_decoder_commit(&dec, receivedBytes);
+        continue;
+      }
+    } else {
+      unsigned long long recvStart = stats_now();
+      receivedBytes = recv(clientSocket, chunk, sizeof(chunk), 0);
+      unsigned long long parseStart = stats_add_phase(STATS_PHASE_RECV, recvStart);
+      if (receivedBytes > 0) {
+        stats_add(STATS_BYTES_IN, receivedBytes);
+        size_t consumed = kvstr_decoder_feed(&dec, chunk, receivedBytes);
+        stats_add_phase(STATS_PHASE_PARSE, parseStart);
+        if (kvstr_decoder_done(&dec) && consumed < (size_t) receivedBytes &&
+            consumed + strspn(chunk + consumed, "\r\n") < (size_t) receivedBytes) {
+          return -5; // Junk data found after the request
+        }
+        if (consumed < (size_t) receivedBytes && !kvstr_decoder_done(&dec)) {
+          break; // decoder stopped on an error
+        }
+        continue;
+      }
+    }
 
-  // If this is a PUT request, parse the value
-  if (strcmp(result->operation, "PUT") == 0) {
-    after_key_ptr = parse_value(after_key_ptr, result);
-    if (after_key_ptr == NULL) {
-      return -4; // Failed to parse value
+    if (receivedBytes == SOCKET_ERROR) {
+      LOGF(ERR, "Failed to receive data. Error code: %d", WSAGetLastError());
+      return SOCKET_ERROR;
     }
+    break; // connection closed before the request was complete
   }
 
-  // Ensure that the request string has been fully parsed
-  if (*after_key_ptr != '\0') {
-    return -5; // Junk data found after parsing
-  }
-  
-  return 0; // Success
+  return kvstr_decoder_finish(&dec);
 }
 
-// Helper function to parse the operation from the request
-const char *parse_operation(const char *request_str,
-                            struct kvstr_request *result) {
-  const char *space_ptr = strchr(request_str, ' ');
-  if (!space_ptr) {
-    return NULL; // Malformed request (no space found)
-  }
-
-  int operation_len = space_ptr - request_str;
-  result->operation = (char *)malloc(operation_len + 1);
-  if (!result->operation) {
-    return NULL;
-  }
-
-  strncpy(result->operation, request_str, operation_len);
-    result->operation[operation_len] = '\0'; // Null-terminate
-
-  if(strcmp(result->operation, "GET") != 0 && strcmp(result->operation, "PUT") != 0 && strcmp(result->operation, "DEL") != 0) {
-    free(result->operation);
-    result->operation = NULL;
-    return NULL; // Invalid operation
-  }
+// responses produced by the current thread are collected here instead of being sent (worker mode)
+static _Thread_local byte_buffer *tl_responseBuffer = NULL;
+static _Thread_local response_value *tl_responseValue = NULL; // ... and a large value they end with, NULL if not taken
 
-  return space_ptr + 1; // Return pointer to next part of the string
+void captureResponses(byte_buffer *buffer, response_value *value) {
+  tl_responseBuffer = buffer;
+  tl_responseValue = value;
 }
 
-const char *parse_key(const char *after_op_ptr, struct kvstr_request *result) {
-  char *colon_ptr = strchr(after_op_ptr, ':');
-  if (!colon_ptr) {
-    return NULL; // Malformed request (no colon found)
-  }
-
-  int key_len = atoi(after_op_ptr);  // Convert key length to integer
-  if (key_len <= 0) {
-    return NULL; // Invalid key length
-  }
-
-  const char *key_ptr = colon_ptr + 1;
-  
-  // Ensure the input string is long enough for the key
-  if (strlen(key_ptr) < key_len) {
-    return NULL; // Key length mismatch
-  }
-
-  result->key = (char *)malloc(key_len + 1); // Allocate memory for the key
-  if (!result->key) {
-    return NULL; // Memory allocation failure
+// appends to the captured responses, a value captured before is copied first so that the order is kept
+static int appendCaptured(const char *buffer, size_t length) {
+  if (tl_responseValue != NULL && tl_responseValue->pin != NULL) {
+    int result = byte_buffer_append(tl_responseBuffer, tl_responseValue->data, tl_responseValue->len);
+    lazyfree_unpin(tl_responseValue->pin);
+    *tl_responseValue = (response_value){0};
+    if (result != 0) {
+      return result;
+    }
   }
+  return byte_buffer_append(tl_responseBuffer, buffer, length);
+}
 
-  // Copy the key and ensure null-termination
-  strncpy(result->key, key_ptr, key_len);
-  result->key[key_len] = '\0'; // Manually null-terminate
-
-  // Additional validation: check if the key matches the expected length
-  if (strlen(result->key) != key_len) {
-    free(result->key);
-    return NULL; // Actual key length does not match the given length
-  }
+static _Thread_local client_state *tl_clientState = NULL;
 
-  return key_ptr + key_len; // Return pointer to next part of the string
+// state of the session the current request belongs to, NULL for connections serving one request
+void setClientState(client_state *state) {
+  tl_clientState = state;
 }
 
-// Helper function to parse the value from the request (for PUT)
-const char* parse_value(const char *after_key_ptr, struct kvstr_request *result) {
-  if (*after_key_ptr != ' ') {
-    return NULL; // Malformed request (no space after key)
-  }
+static _Thread_local bool tl_socketDetached = false;
 
-  after_key_ptr++; // Skip the space
+// the handler of the current request took over the client socket (e.g. a replication link)
+void detachClientSocket() {
+  tl_socketDetached = true;
+}
 
-  char *value_colon_ptr = strchr(after_key_ptr, ':');
-  if (!value_colon_ptr) {
-    return NULL; // Malformed request (no colon found for value length)
-  }
+// whether the last handled request took over the socket, resets the flag
+bool clientSocketDetached() {
+  bool detached = tl_socketDetached;
+  tl_socketDetached = false;
+  return detached;
+}
 
-  int value_len = atoi(after_key_ptr); // Parse value length
-  if (value_len <= 0) {
-    return NULL; // Invalid value length
+// sends a response to the client or appends it to the captured responses of this thread
+int sendResponse(SOCKET clientSocket, const char *buffer, size_t length) {
+  if (tl_responseBuffer != NULL) {
+    return appendCaptured(buffer, length) == 0 ? (int) length : SOCKET_ERROR;
   }
 
-  const char *value_ptr = value_colon_ptr + 1;
-
-  // Ensure the input string is long enough for the value
-  if (strlen(value_ptr) < value_len) {
-    return NULL; // Value length mismatch
+  unsigned long long sendStart = stats_now();
+  int sentBytes = send(clientSocket, buffer, length, 0);
+  stats_add_phase(STATS_PHASE_SEND, sendStart);
+  if (sentBytes > 0) {
+    stats_add(STATS_BYTES_OUT, sentBytes);
   }
+  return sentBytes;
+}
 
-  // Allocate memory for the value and ensure null-termination
-  result->value = (char *)malloc(value_len + 1); // +1 for null terminator
-  if (!result->value) {
-    return NULL; // Memory allocation failure
+int sendAll(SOCKET clientSocket, const char *buffer, size_t length) {
+  if (tl_responseBuffer != NULL) {
+    return appendCaptured(buffer, length) == 0 ? 0 : SOCKET_ERROR;
   }
 
-  strncpy(result->value, value_ptr, value_len); // Copy the value
-  result->value[value_len] = '\0'; // Null-terminate the value
-
-  // Check if the copied value has the expected length
-  if (strlen(result->value) != value_len) {
-    free(result->value);
-    return NULL; // Actual value length does not match the given length
+  unsigned long long sendStart = stats_now();
+  while (length > 0) {
+    int chunk = length > SEND_CHUNK_SIZE ? SEND_CHUNK_SIZE : (int) length;
+    int sentBytes = send(clientSocket, buffer, chunk, 0);
+    if (sentBytes == SOCKET_ERROR) {
+      LOGF(ERR, "Failed to send data. Error code: %d", WSAGetLastError());
+      stats_add_phase(STATS_PHASE_SEND, sendStart);
+      return SOCKET_ERROR;
+    }
+    stats_add(STATS_BYTES_OUT, sentBytes);
+    buffer += sentBytes;
+    length -= sentBytes;
   }
-
-  return value_ptr + value_len;
+  stats_add_phase(STATS_PHASE_SEND, sendStart);
+  return 0;
 }
 
-
 const char *parseError2str(int error) {
   switch (error) {
   case -1:
@@ -426,217 +489,1756 @@ const char *parseError2str(int error) {
     return "malformed key";
   case -4:
     return "malformed value";
+  case -5:
+    return "junk data after request";
+  case -6:
+    return "argument too large";
+  case -7:
+    return "out of memory";
+  case -8:
+    return "malformed argument";
   default:
     return "Unknown error";
   }
 }
 
-void processClientRequest(SOCKET clientSocket, char *buffer, char *logBuffer,
-                          size_t logBufferSize) {
-  struct kvstr_request *req = create_kvstr_request();
+void sendParseError(SOCKET clientSocket, int parseRequestError) {
+  char buffer[1024];
+  snprintf(buffer, sizeof(buffer), "400 Bad Request: %s", parseError2str(parseRequestError));
+  LOGF(ERR, "%s", buffer);
+  stats_add(STATS_ERRORS, 1);
+  sendResponse(clientSocket, buffer, strlen(buffer));
+}
+
+void processClientRequest(SOCKET clientSocket, struct kvstr_request *req) {
+  stats_count_op(stats_op_from_name(req->operation));
+  if (capture_running()) {
+    // a connection without a session serves a single request
+    capture_request(tl_clientState != NULL ? tl_clientState->connectionId : CAPTURE_NO_CONNECTION, req);
+  }
 
-  int parseRequestError = kvstr_parse_request(buffer, req);
-  if (parseRequestError != 0) {
-    char buffer[1024];
-    snprintf(buffer, sizeof(buffer), "400 Bad Request: %s", parseError2str(parseRequestError));
-    logMessage(ERR, buffer);
-    send(clientSocket, buffer, strlen(buffer), 0);
+  if (strcmp(req->operation, "GET") == 0) {
+    handleGetRequest(clientSocket, req->key);
+  } else if (strcmp(req->operation, "GETZ") == 0) {
+    handleGetzRequest(clientSocket, req->key);
+  } else if (strcmp(req->operation, "PUT") == 0) {
+    handleStreamedPutRequest(clientSocket, req);
+  } else if (strcmp(req->operation, "DEL") == 0) {
+    handleDelRequest(clientSocket, req->key);
+  } else if (strcmp(req->operation, "INCRBY") == 0) {
+    handleIncrbyRequest(clientSocket, req->key, req->args[0]);
+  } else if (strcmp(req->operation, "GETV") == 0) {
+    handleGetvRequest(clientSocket, req);
+  } else if (strcmp(req->operation, "PUTV") == 0) {
+    handlePutvRequest(clientSocket, req);
+  } else if (strcmp(req->operation, "GETRANGE") == 0) {
+    handleGetrangeRequest(clientSocket, req);
+  } else if (strcmp(req->operation, "SETRANGE") == 0) {
+    handleSetrangeRequest(clientSocket, req);
+  } else if (strcmp(req->operation, "HSET") == 0) {
+    handleHsetRequest(clientSocket, req);
+  } else if (strcmp(req->operation, "HGET") == 0) {
+    handleHgetRequest(clientSocket, req);
+  } else if (strcmp(req->operation, "HDEL") == 0) {
+    handleHdelRequest(clientSocket, req);
+  } else if (strcmp(req->operation, "HGETALL") == 0) {
+    handleHgetallRequest(clientSocket, req->key);
+  } else if (strcmp(req->operation, "HELLO") == 0) {
+    handleHelloRequest(clientSocket);
+  } else if (strcmp(req->operation, "STATS") == 0) {
+    handleStatsRequest(clientSocket);
+  } else if (strcmp(req->operation, "SLOWLOG") == 0) {
+    handleSlowlogRequest(clientSocket, req->args[0]);
+  } else if (strcmp(req->operation, "HOTKEYS") == 0) {
+    handleHotkeysRequest(clientSocket, req->args[0]);
+  } else if (strcmp(req->operation, "MEMORY") == 0) {
+    handleMemoryRequest(clientSocket, req->args[0]);
+  } else if (strcmp(req->operation, "SYNC") == 0) {
+    handleSyncRequest(clientSocket);
+  } else if (strcmp(req->operation, "REPLPING") == 0 || strcmp(req->operation, "REPLACK") == 0) {
+    const char *errMsg = "400 Bad Request: Only valid on a replication link";
+    sendResponse(clientSocket, errMsg, strlen(errMsg));
+  } else if (strcmp(req->operation, "ASKING") == 0) {
+    handleAskingRequest(clientSocket);
+    return; // applies to the next request
+  } else if (strcmp(req->operation, "SLOTS") == 0) {
+    handleSlotsRequest(clientSocket);
+  } else if (strcmp(req->operation, "KEYSLOT") == 0) {
+    handleKeyslotRequest(clientSocket, req->key);
+  } else if (strcmp(req->operation, "SETSLOT") == 0) {
+    handleSetslotRequest(clientSocket, req->args[0], req->args[1], req->args[2]);
+  } else if (strcmp(req->operation, "MIGRATE") == 0) {
+    handleMigrateRequest(clientSocket, req->args[0], req->args[1]);
+  } else if (strcmp(req->operation, "RESTORE") == 0) {
+    handleRestoreRequest(clientSocket, req);
+  } else if (strcmp(req->operation, "HRESTORE") == 0) {
+    handleHrestoreRequest(clientSocket, req);
+  } else if (strcmp(req->operation, "TRACKING") == 0) {
+    handleTrackingRequest(clientSocket, req->args[0]);
+  } else if (strcmp(req->operation, "WATCH") == 0 || strcmp(req->operation, "UNWATCH") == 0) {
+    handleWatchRequest(clientSocket, req->operation, req->args[0]);
   } else {
-    if (strcmp(req->operation, "GET") == 0) {
-      handleGetRequest(clientSocket, req->key);
-    } else if (strcmp(req->operation, "PUT") == 0) {
-      handlePutRequest(clientSocket, req->key, req->value);
-    } else if (strcmp(req->operation, "DEL") == 0) {
-      handleDelRequest(clientSocket, req->key);
-    } else {
-      logMessage(ERR, "Received unknown request.");
-    }
+    logMessage(ERR, "Received unknown request.");
   }
 
-  free_kvstr_request(&req);
+  if (tl_clientState != NULL) {
+    tl_clientState->asking = false;
+  }
   return;
 }
 
-void logKvStoreStatus() {
-  // return a status of kv store statistics (current stored entries and capcaity)
-  char buffer[1024];
-  snprintf(buffer, 1024, "kvstore status -> size='%d' capacity='%d'", (int) gl_kvStore->size, (int) gl_kvStore->capacity);
-  logMessage(DEBUG, buffer);
-  return;
+// HELLO turns the connection into a session (see PROTOCOL.md), the I/O threads take care of
+// keeping the connection open and framing the responses
+void handleHelloRequest(SOCKET clientSocket) {
+  if (gl_workerThreads == 0) {
+    const char *errMsg = "400 Bad Request: Sessions require worker mode (-w)";
+    sendResponse(clientSocket, errMsg, strlen(errMsg));
+    return;
+  }
+
+  const char *response = "200 HELLO";
+  sendResponse(clientSocket, response, strlen(response));
 }
 
-void handleGetRequest(SOCKET clientSocket, const char *key) {
-  char logBuffer[1024];
-  size_t logBufferSize = sizeof(logBuffer);
+// lets the replication read the store between writes
+static void readKvStore(replication_snapshot_fn read, void *ctx) {
+  AcquireSRWLockShared(&gl_storeLock);
+  read(gl_kvStore, ctx);
+  ReleaseSRWLockShared(&gl_storeLock);
+}
 
-  if(key == NULL) {
-    logMessage(ERR, "Invalid GET request: Key is NULL.");
-    char *errMsg = "400 Bad Request: No key";
-    send(clientSocket, errMsg, strlen(errMsg), 0);
+// SYNC turns the connection into a replication link: the replica receives a snapshot of the
+// store followed by every write (see PROTOCOL.md)
+void handleSyncRequest(SOCKET clientSocket) {
+  // writes are blocked while the keys are listed and the log position is taken, reads go on
+  AcquireSRWLockShared(&gl_storeLock);
+  int result = replication_add_replica(clientSocket, gl_kvStore, readKvStore);
+  ReleaseSRWLockShared(&gl_storeLock);
+
+  if (result != 0) {
+    const char *errMsg = "503 Service Unavailable: Cannot add another replica";
+    sendResponse(clientSocket, errMsg, strlen(errMsg));
     return;
   }
+  detachClientSocket();
+}
+
+// replicas only change their data through the replication stream
+static bool rejectWriteOnReplica(SOCKET clientSocket) {
+  if (!replication_is_replica()) {
+    return false;
+  }
+  const char *errMsg = "403 Forbidden: Replicas are read-only";
+  sendResponse(clientSocket, errMsg, strlen(errMsg));
+  return true;
+}
 
-  if(strlen(key) < 1) {
-    logMessage(ERR, "Invalid GET request: Key is empty.");
-    char *errMsg = "400 Bad Request: No key";
-    send(clientSocket, errMsg, strlen(errMsg), 0);
-    return;
+// applies a write received from the primary and passes it on to replicas of this server
+void applyReplicatedRequest(struct kvstr_request *req) {
+  AcquireSRWLockExclusive(&gl_storeLock);
+  if (strcmp(req->operation, "PUT") == 0) {
+    int result = kv_store_put_owned(gl_kvStore, req->key, req->value, req->value_len);
+    if (result >= 0) {
+      replication_feed("PUT", req->key, req->value, req->value_len);
+      tracking_invalidate(req->key);
+      watch_changed("PUT", req->key);
+    }
+    if (result == 0) {
+      req->value = NULL; // owned by the store now
+    }
+  } else if (strcmp(req->operation, "SETRANGE") == 0) {
+    size_t length;
+    unsigned long long offset = strtoull(req->args[0], NULL, 10);
+    if (kv_store_setrange(gl_kvStore, req->key, offset, req->value, req->value_len, &length) == 0) {
+      replication_feed_field("SETRANGE", req->key, req->args[0], req->arg_lens[0], req->value, req->value_len);
+      tracking_invalidate(req->key);
+      watch_changed("SETRANGE", req->key);
+    }
+  } else if (strcmp(req->operation, "HSET") == 0) {
+    if (kv_store_hset(gl_kvStore, req->key, req->args[0], req->arg_lens[0], req->value, req->value_len) >= 0) {
+      replication_feed_field("HSET", req->key, req->args[0], req->arg_lens[0], req->value, req->value_len);
+      tracking_invalidate(req->key);
+      watch_changed("HSET", req->key);
+    }
+  } else if (strcmp(req->operation, "HDEL") == 0) {
+    if (kv_store_hdel(gl_kvStore, req->key, req->args[0], req->arg_lens[0]) == 0) {
+      replication_feed_field("HDEL", req->key, req->args[0], req->arg_lens[0], NULL, 0);
+      tracking_invalidate(req->key);
+      watch_changed("HDEL", req->key);
+    }
+  } else if (strcmp(req->operation, "DEL") == 0) {
+    if (kv_store_delete(gl_kvStore, req->key) == 0) {
+      replication_feed("DEL", req->key, NULL, 0);
+      tracking_invalidate(req->key);
+      watch_changed("DEL", req->key);
+    }
+  } else {
+    LOGF(WARN, "Skipping unknown replicated operation %s.", req->operation);
   }
+  ReleaseSRWLockExclusive(&gl_storeLock);
+}
 
-  snprintf(logBuffer, logBufferSize, "Received GET request for key: %s", key);
-  logMessage(INFO, logBuffer);
+// every store gets an allocator of its own, so memory of a dropped store is released at once
+static kv_store *createKvStore() {
+  kv_allocator *allocator = kv_allocator_create(gl_allocator);
+  if (allocator == NULL) {
+    return NULL;
+  }
+  kv_store *store = create_kv_store_with_allocator(1024, allocator);
+  if (store != NULL && gl_intKeys && kv_store_use_int_keys(store) != 0) {
+    free_kv_store(store);
+    return NULL;
+  }
+  if (store != NULL) {
+    kv_store_set_compression(store, gl_compressMin);
+    kv_store_set_lazy_free(store, gl_lazyFreeMin, lazyfree_value, NULL); // fails for allocators other than system
+    kv_store_set_pinned(store, lazyfree_pinned, NULL); // ... so does this, large values are then copied to be sent
+  }
+  return store;
+}
 
-  const char *value = kv_store_get(gl_kvStore, key);
-  if(value == NULL) {
-    memset(logBuffer, 0, logBufferSize);
-    sprintf(logBuffer, "Key '%s' not found.", key);
-    logMessage(INFO, logBuffer);
-    char *errMsg = "404 Not Found";
-    send(clientSocket, errMsg, strlen(errMsg), 0);
+// drops all data before the snapshot of the primary is applied
+void resetKvStore() {
+  kv_store *empty = createKvStore();
+  if (empty == NULL) {
+    logMessage(ERR, "Failed to allocate an empty key value store.");
     return;
   }
 
-  char* response = calloc(strlen(value) + 5, 1);
-  sprintf(response, "200 %s", value);
-  
-  send(clientSocket, response, strlen(response), 0);
+  AcquireSRWLockExclusive(&gl_storeLock);
+  kv_store *old = gl_kvStore;
+  gl_kvStore = empty;
+  tracking_invalidate_all();
+  watch_changed_all();
+  ReleaseSRWLockExclusive(&gl_storeLock);
+  free_kv_store(old);
+}
 
-  free((void*) response);
+// the next request of the session may use a slot this node is importing
+void handleAskingRequest(SOCKET clientSocket) {
+  if (tl_clientState == NULL) {
+    const char *errMsg = "400 Bad Request: ASKING requires a session";
+    sendResponse(clientSocket, errMsg, strlen(errMsg));
+    return;
+  }
 
-  return;
+  tl_clientState->asking = true;
+  const char *response = "200 OK";
+  sendResponse(clientSocket, response, strlen(response));
 }
 
-void handlePutRequest(SOCKET clientSocket, const char *key, const char *value) {
-  char logBuffer[1024];
-  if (key == NULL || value == NULL) {
-      const char *errorMsg = "500 Internal Server Error: Key and value must not be NULL.";
-      send(clientSocket, errorMsg, strlen(errorMsg), 0);
-      logMessage(ERR, "Invalid PUT request: Key or value is NULL.");
-      return;
+// TRACKING ON makes the server push invalidations of every key the session reads from then on
+// (see PROTOCOL.md), so the client can cache the values
+void handleTrackingRequest(SOCKET clientSocket, const char *mode) {
+  if (tl_clientState == NULL || tl_clientState->push == NULL) {
+    const char *errMsg = "400 Bad Request: TRACKING requires a session";
+    sendResponse(clientSocket, errMsg, strlen(errMsg));
+    return;
   }
 
-  if (strlen(key) < 1 || strlen(value) < 1) {
-    const char *errorMsg = "400 Bad Request: Key and value must not be empty.";
-      send(clientSocket, errorMsg, strlen(errorMsg), 0);
-      logMessage(ERR, "Invalid PUT request: Key or value is empty.");
+  if (mode != NULL && strcmp(mode, "ON") == 0) {
+    if (tl_clientState->tracking == TRACKING_NO_CLIENT) {
+      tl_clientState->tracking = tracking_register(tl_clientState->push, tl_clientState->pushCtx);
+    }
+    if (tl_clientState->tracking == TRACKING_NO_CLIENT) {
+      const char *errMsg = "500 Internal Server Error: Out of memory";
+      sendResponse(clientSocket, errMsg, strlen(errMsg));
       return;
+    }
+  } else if (mode != NULL && strcmp(mode, "OFF") == 0) {
+    tracking_unregister(tl_clientState->tracking);
+    tl_clientState->tracking = TRACKING_NO_CLIENT;
+  } else {
+    const char *errMsg = "400 Bad Request: TRACKING ON or OFF";
+    sendResponse(clientSocket, errMsg, strlen(errMsg));
+    return;
   }
 
-  int result = kv_store_put(gl_kvStore, key, value);
-  if (result != 0) {
-    memset(logBuffer, 0, 1024);
-    snprintf(logBuffer, 1024, "Failed to store key: %s, reason: %d", key, result);
-    logMessage(ERR, logBuffer);
-    char response[256];
-    snprintf(response, sizeof(response), "500 Internal Server Error: Failed to store key: %s, reason: %d", key, result);
-    send(clientSocket, response, strlen(response), 0);
+  const char *response = "200 OK";
+  sendResponse(clientSocket, response, strlen(response));
+}
+
+// WATCH makes the server push a notification whenever a write touches the key (or any key with
+// the prefix of a pattern ending in '*'), UNWATCH stops that (see PROTOCOL.md)
+void handleWatchRequest(SOCKET clientSocket, const char *operation, const char *pattern) {
+  if (tl_clientState == NULL || tl_clientState->push == NULL) {
+    const char *errMsg = "400 Bad Request: WATCH requires a session";
+    sendResponse(clientSocket, errMsg, strlen(errMsg));
     return;
   }
 
-  memset(logBuffer, 0, 1024);
-  snprintf(logBuffer, 1024, "Key '%s' stored successfully.", key);
-  logMessage(INFO, logBuffer);
-  const char *successMsg = "201 Created: Key stored successfully.";
-  send(clientSocket, successMsg, strlen(successMsg), 0);
-}
+  if (strcmp(operation, "UNWATCH") == 0) {
+    if (watch_remove(tl_clientState->watching, pattern) != 0) {
+      const char *errMsg = "404 Not Found";
+      sendResponse(clientSocket, errMsg, strlen(errMsg));
+      return;
+    }
+  } else {
+    if (tl_clientState->watching == WATCH_NO_CLIENT) {
+      tl_clientState->watching = watch_register(tl_clientState->push, tl_clientState->pushCtx);
+    }
+    if (tl_clientState->watching == WATCH_NO_CLIENT || watch_add(tl_clientState->watching, pattern) != 0) {
+      const char *errMsg = "500 Internal Server Error: Out of memory";
+      sendResponse(clientSocket, errMsg, strlen(errMsg));
+      return;
+    }
+  }
 
+  const char *response = "200 OK";
+  sendResponse(clientSocket, response, strlen(response));
+}
 
-void handleDelRequest(SOCKET clientSocket, const char *key) {
-  char logBuffer[1024];
-  size_t logBufferSize = sizeof(logBuffer);
+static bool rejectWithoutCluster(SOCKET clientSocket) {
+  if (cluster_enabled()) {
+    return false;
+  }
+  const char *errMsg = "400 Bad Request: Cluster mode is disabled (-cluster)";
+  sendResponse(clientSocket, errMsg, strlen(errMsg));
+  return true;
+}
 
-  if(key == NULL) {
-    logMessage(ERR, "Invalid DEL request: Key is NULL.");
-    char *errMsg = "400 Bad Request: No key";
-    send(clientSocket, errMsg, strlen(errMsg), 0);
+void handleSlotsRequest(SOCKET clientSocket) {
+  if (rejectWithoutCluster(clientSocket)) {
     return;
   }
 
-  if(strlen(key) < 1) {
-    logMessage(ERR, "Invalid DEL request: Key is empty.");
-    char *errMsg = "400 Bad Request: No key";
-    send(clientSocket, errMsg, strlen(errMsg), 0);
+  byte_buffer out = {0};
+  if (byte_buffer_append(&out, "200 ", 4) != 0 || cluster_describe(&out) != 0) {
+    byte_buffer_free(&out);
+    const char *errMsg = "500 Internal Server Error: Out of memory";
+    sendResponse(clientSocket, errMsg, strlen(errMsg));
     return;
   }
+  size_t len = out.len > 4 ? out.len - 2 : out.len; // without the last line break
+  sendResponse(clientSocket, out.data, len);
+  byte_buffer_free(&out);
+}
 
-  snprintf(logBuffer, logBufferSize, "Received DEL request for key: %s", key);
-  logMessage(INFO, logBuffer);
+void handleKeyslotRequest(SOCKET clientSocket, const char *key) {
+  char response[32];
+  snprintf(response, sizeof(response), "200 %d", cluster_key_slot(key));
+  sendResponse(clientSocket, response, strlen(response));
+}
 
-  if(kv_store_delete(gl_kvStore, key) != 0) {
-    memset(logBuffer, 0, logBufferSize);
-    sprintf(logBuffer, "Key '%s' not found.", key);
-    logMessage(INFO, logBuffer);
-    char *errMsg = "404 Not Found";
-    send(clientSocket, errMsg, strlen(errMsg), 0);
+void handleSetslotRequest(SOCKET clientSocket, const char *slots, const char *state, const char *node) {
+  if (rejectWithoutCluster(clientSocket)) {
     return;
   }
 
-  // Confirm deletion (dummy implementation for now)
-  char response[1024];
-  snprintf(response, sizeof(response), "200 Key deleted");
-  send(clientSocket, response, strlen(response), 0);
-}
-
-void cleanUp() {
-  if (gl_cleanedUp) {
+  int first, last;
+  if (cluster_parse_slots(slots, &first, &last) != 0) {
+    const char *errMsg = "400 Bad Request: Invalid slot";
+    sendResponse(clientSocket, errMsg, strlen(errMsg));
     return;
   }
-  
-  closesocket(gl_serverSocket);
-  WSACleanup();
 
-  if(gl_kvStore != NULL) {
-    free_kv_store(gl_kvStore);
-    gl_kvStore = NULL;
-    logMessage(DEBUG, "Key value store freed.");
+  int result;
+  if (strcmp(state, "NODE") == 0) {
+    result = cluster_assign(first, last, node);
+  } else if (first != last) {
+    result = -1; // a migration moves a single slot
+  } else if (strcmp(state, "MIGRATING") == 0) {
+    result = cluster_set_migrating(first, node);
+  } else if (strcmp(state, "IMPORTING") == 0) {
+    result = cluster_set_importing(first, node);
+  } else {
+    result = -1;
   }
 
-  gl_cleanedUp = true;
-  logMessage(INFO, "Graceful clean up done.");
-  return;
+  if (result != 0) {
+    const char *errMsg = "400 Bad Request: Cannot set the slot";
+    sendResponse(clientSocket, errMsg, strlen(errMsg));
+    return;
+  }
+  LOGF(INFO, "Slots %d-%d: %s %s", first, last, state, node);
+  const char *response = "200 OK";
+  sendResponse(clientSocket, response, strlen(response));
 }
 
-void handleInterrupt(int signal) {
-  logMessage(INFO, "Received interrupt signal. Shutting down server.");
-  gl_keepRunning = false;
-  cleanUp();
+typedef struct hash_fields {
+  byte_buffer *out;
+  bool first;
+} hash_fields;
+
+static int appendHashField(const char *field, size_t fieldLen, const char *value, size_t valueLen, void *ctx) {
+  hash_fields *fields = ctx;
+  char prefix[48];
+  int len = snprintf(prefix, sizeof(prefix), "%s%zu:", fields->first ? "" : " ", fieldLen);
+  fields->first = false;
+  int r = byte_buffer_append(fields->out, prefix, len) | byte_buffer_append(fields->out, field, fieldLen);
+  len = snprintf(prefix, sizeof(prefix), " %zu:", valueLen);
+  r |= byte_buffer_append(fields->out, prefix, len) | byte_buffer_append(fields->out, value, valueLen);
+  return r != 0 ? -1 : 0;
 }
 
-#ifndef UNIT_TEST // in case of unit tests the server_unit_tests.c will be the entry point
-int main(int argc, char **argv) {
-#ifndef _WIN64
-  printf("This program is only meant to be run on Windows 64-bit. Other OS are "
-         "currently not supported.");
-#else
+// "<len>:<field> <len>:<value>" of all fields of a hash separated by spaces, like the arguments of a request
+static int appendHashFields(byte_buffer *out, const kv_entry *entry) {
+  hash_fields fields = {.out = out, .first = true};
+  return kv_entry_hash_foreach(entry, appendHashField, &fields);
+}
+
+// reads one "<len>:<data>" written by appendHashFields, returns where it ends or NULL if it is malformed
+static const char *parseHashPart(const char *p, const char *end, const char **data, size_t *len) {
+  const char *digits = p;
+  size_t n = 0;
+  while (p < end && *p >= '0' && *p <= '9') {
+    n = n * 10 + (size_t)(*p - '0');
+    p++;
+    if (n > (size_t)(end - p)) {
+      return NULL;
+    }
+  }
+  if (p == digits || p == end || *p != ':' || n > (size_t)(end - p - 1)) {
+    return NULL;
+  }
+  *data = p + 1;
+  *len = n;
+  return p + 1 + n;
+}
+
+// stores the fields of appendHashFields under the key, only checks them if apply is false
+static int restoreHashFields(const char *key, const char *p, const char *end, bool apply) {
+  if (p == end) {
+    return -1; // a hash has at least one field
+  }
+  while (p < end) {
+    const char *field, *value;
+    size_t fieldLen, valueLen;
+    p = parseHashPart(p, end, &field, &fieldLen);
+    if (p == NULL || p == end || *p != ' ') {
+      return -1;
+    }
+    p = parseHashPart(p + 1, end, &value, &valueLen);
+    if (p == NULL || (p < end && (*p != ' ' || ++p == end))) {
+      return -1;
+    }
+    if (apply) {
+      if (kv_store_hset(gl_kvStore, key, field, fieldLen, value, valueLen) < 0) {
+        return -1;
+      }
+      replication_feed_field("HSET", key, field, fieldLen, value, valueLen);
+    }
+  }
+  return 0;
+}
+
+// moves a key to the target of its slot, returns 0 if it was moved, 1 if it is gone and -1 on failure
+static int migrateKey(const char *key, const char *target) {
+  kvclient_conn *conn = kvclient_connect_address(target);
+  if (conn == NULL) {
+    return -1;
+  }
+
+  // writes to the key are refused from here on, so the copy is its final value
+  cluster_set_migrating_key(key);
+  byte_buffer request = {0};
+  int result = 1;
+  AcquireSRWLockShared(&gl_storeLock);
+  const kv_entry *entry = kv_store_lookup(gl_kvStore, key);
+  if (entry != NULL) {
+    char prefix[64];
+    size_t keyLen = strlen(key);
+    char numberText[KV_NUMBER_TEXT_SIZE];
+    size_t valueLen = kv_entry_value_len(entry);
+    const char *value = kv_entry_value(entry, numberText);
+    char *text = NULL;
+    byte_buffer fields = {0};
+    int r = 0;
+    if (kv_entry_is_hash(entry)) {
+      // all fields are restored at once
+      r = appendHashFields(&fields, entry);
+      value = fields.data;
+      valueLen = fields.len;
+    } else if (value == NULL) {
+      // compressed, the target compresses it by its own settings
+      text = malloc(valueLen + 1);
+      r |= text == NULL || kv_entry_read(entry, text) != 0;
+      value = text;
+    }
+    int len = snprintf(prefix, sizeof(prefix), "%s %zu:", kv_entry_is_hash(entry) ? "HRESTORE" : "RESTORE", keyLen);
+    r |= byte_buffer_append(&request, prefix, len) | byte_buffer_append(&request, key, keyLen);
+    len = snprintf(prefix, sizeof(prefix), " %zu:", valueLen);
+    if (r == 0) {
+      r |= byte_buffer_append(&request, prefix, len) | byte_buffer_append(&request, value, valueLen);
+    }
+    free(text);
+    byte_buffer_free(&fields);
+    result = r != 0 ? -1 : 0;
+  }
+  ReleaseSRWLockShared(&gl_storeLock);
+
+  if (result == 0) {
+    char *response = NULL;
+    if (kvclient_send(conn, request.data, request.len) == 0) {
+      response = kvclient_recv_response(conn, NULL);
+    }
+    if (response != NULL && strncmp(response, "201", 3) == 0) {
+      AcquireSRWLockExclusive(&gl_storeLock);
+      if (kv_store_delete(gl_kvStore, key) == 0) {
+        replication_feed("DEL", key, NULL, 0);
+        tracking_invalidate(key);
+        watch_changed("DEL", key);
+      }
+      ReleaseSRWLockExclusive(&gl_storeLock);
+    } else {
+      LOGF(ERR, "Failed to migrate key '%s' to %s: %s", key, target, response != NULL ? response : "no response");
+      result = -1;
+    }
+    free(response);
+  }
+
+  cluster_set_migrating_key(NULL);
+  byte_buffer_free(&request);
+  kvclient_close(&conn);
+  return result;
+}
+
+typedef struct slot_keys {
+  int slot;
+  char **keys;      // copies of the first max keys of the slot
+  size_t max;
+  size_t count;
+  size_t total;     // keys of the slot
+} slot_keys;
+
+static int collectSlotKey(const char *key, const kv_entry *entry, void *ctx) {
+  slot_keys *found = ctx;
+  if (cluster_key_slot(key) == found->slot) {
+    found->total++;
+    if (found->count < found->max) {
+      found->keys[found->count++] = duplicate_string(key);
+    }
+  }
+  return 0;
+}
+
+// moves up to count keys of a migrating slot to its target
+void handleMigrateRequest(SOCKET clientSocket, const char *slotArg, const char *countArg) {
+  if (rejectWithoutCluster(clientSocket)) {
+    return;
+  }
+
+  int slot, last;
+  long count = strtol(countArg, NULL, 10);
+  char target[CLUSTER_ADDRESS_SIZE];
+  if (cluster_parse_slots(slotArg, &slot, &last) != 0 || slot != last || count <= 0) {
+    const char *errMsg = "400 Bad Request: Expected MIGRATE <slot> <count>";
+    sendResponse(clientSocket, errMsg, strlen(errMsg));
+    return;
+  }
+  if (cluster_migration_target(slot, target, sizeof(target)) != 0) {
+    const char *errMsg = "400 Bad Request: Slot is not migrating";
+    sendResponse(clientSocket, errMsg, strlen(errMsg));
+    return;
+  }
+  if (count > MIGRATE_MAX_KEYS) {
+    count = MIGRATE_MAX_KEYS; // the response tells the client how many remain
+  }
+
+  char **keys = malloc((size_t)count * sizeof(char *));
+  if (keys == NULL) {
+    const char *errMsg = "500 Internal Server Error: Out of memory";
+    sendResponse(clientSocket, errMsg, strlen(errMsg));
+    return;
+  }
+
+  // the keys are copied, every key is migrated on its own while the store keeps serving
+  slot_keys found = {.slot = slot, .keys = keys, .max = (size_t)count};
+  AcquireSRWLockShared(&gl_storeLock);
+  kv_store_foreach(gl_kvStore, collectSlotKey, &found);
+  ReleaseSRWLockShared(&gl_storeLock);
+  size_t keyCount = found.count;
+  size_t slotKeys = found.total;
+
+  size_t moved = 0;
+  bool failed = false;
+  for (size_t i = 0; i < keyCount; i++) {
+    if (!failed && keys[i] != NULL) {
+      int result = migrateKey(keys[i], target);
+      failed = result < 0;
+      moved += result == 0;
+    }
+    free(keys[i]);
+  }
+  free(keys);
+
+  char response[128 + CLUSTER_ADDRESS_SIZE];
+  if (failed) {
+    snprintf(response, sizeof(response), "502 Bad Gateway: Migration to %s failed after %zu keys", target, moved);
+  } else {
+    snprintf(response, sizeof(response), "200 moved:%zu remaining:%zu", moved, slotKeys - moved);
+  }
+  sendResponse(clientSocket, response, strlen(response));
+}
+
+// a key sent by the source of a migration, accepted for slots this node imports without ASKING
+void handleRestoreRequest(SOCKET clientSocket, struct kvstr_request *req) {
+  client_state migration = {.asking = true};
+  client_state *previous = tl_clientState;
+  tl_clientState = &migration;
+  handleStreamedPutRequest(clientSocket, req);
+  tl_clientState = previous;
+}
+
+// follows the primary given as "host:port" or "unix:<path>"
+void startReplication(char *primary) {
+  int port = 0;
+  if (strncmp(primary, "unix:", 5) != 0) {
+    char *separator = strrchr(primary, ':');
+    if (separator == NULL || (port = atoi(separator + 1)) <= 0) {
+      LOGF(FATAL, "Invalid primary '%s', expected host:port or unix:<path>.", primary);
+      return;
+    }
+    *separator = '\0';
+  }
+
+  if (replication_start_replica(primary, port, gl_maxValueSize, applyReplicatedRequest, resetKvStore) != 0) {
+    logMessage(FATAL, "Failed to start replication.");
+  }
+}
+
+void logKvStoreStatus() {
+  // return a status of kv store statistics (current stored entries and capcaity)
+  LOGF(DEBUG, "kvstore status -> size='%d' capacity='%d'", (int) gl_kvStore->size, (int) gl_kvStore->capacity);
+  return;
+}
+
+static void appendStat(byte_buffer *out, const char *name, unsigned long long value) {
+  char line[128];
+  int len = snprintf(line, sizeof(line), "%s:%llu\r\n", name, value);
+  byte_buffer_append(out, line, len);
+}
+
+static void appendLatency(byte_buffer *out, const char *phase, const histogram *h) {
+  static const struct {
+    const char *name;
+    double percentile;
+  } percentiles[] = {{"p50", 50.0}, {"p99", 99.0}, {"p999", 99.9}};
+
+  for (size_t i = 0; i < sizeof(percentiles) / sizeof(percentiles[0]); i++) {
+    char name[64];
+    snprintf(name, sizeof(name), "latency_%s_%s_ns", phase, percentiles[i].name);
+    appendStat(out, name, histogram_percentile(h, percentiles[i].percentile));
+  }
+}
+
+// STATS returns counters and latencies as "name:value" lines (see PROTOCOL.md)
+static void appendReplicationStats(byte_buffer *out) {
+  replication_info *info = malloc(sizeof(replication_info));
+  if (info == NULL) {
+    return;
+  }
+  replication_get_info(info);
+
+  const char *role = info->replica ? "role:replica\r\n" : "role:primary\r\n";
+  byte_buffer_append(out, role, strlen(role));
+  appendStat(out, "repl_offset", info->offset);
+  if (info->replica) {
+    appendStat(out, "repl_link_up", info->link_up);
+    appendStat(out, "repl_lag_bytes", info->lag_bytes);
+    appendStat(out, "repl_last_io_ms", info->last_io_ms);
+  }
+  appendStat(out, "connected_replicas", info->replica_count);
+  for (int i = 0; i < info->replica_count; i++) {
+    char name[64];
+    snprintf(name, sizeof(name), "replica%d_offset", i);
+    appendStat(out, name, info->replicas[i].acked_offset);
+    snprintf(name, sizeof(name), "replica%d_lag_bytes", i);
+    appendStat(out, name, info->replicas[i].lag_bytes);
+    snprintf(name, sizeof(name), "replica%d_ack_age_ms", i);
+    appendStat(out, name, info->replicas[i].ack_age_ms);
+  }
+  free(info);
+}
+
+void handleStatsRequest(SOCKET clientSocket) {
+  stats_snapshot *snapshot = malloc(sizeof(stats_snapshot));
+  if (snapshot == NULL) {
+    const char *errMsg = "500 Internal Server Error: Out of memory";
+    sendResponse(clientSocket, errMsg, strlen(errMsg));
+    return;
+  }
+  stats_collect(snapshot);
+
+  AcquireSRWLockShared(&gl_storeLock);
+  size_t keys = kv_store_count(gl_kvStore);
+  size_t storeBytes = gl_kvStore->data_size;
+  size_t indexBytes = sizeof(kv_store) + gl_kvStore->capacity * sizeof(kv_entry) +
+                      gl_kvStore->int_capacity * sizeof(kv_entry);
+  ReleaseSRWLockShared(&gl_storeLock);
+
+  static const char *opNames[STATS_OP_COUNT] = {"get", "put", "del", "other"};
+  static const char *phaseNames[STATS_PHASE_COUNT] = {"recv", "parse", "store", "send"};
+
+  byte_buffer out = {0};
+  byte_buffer_append(&out, "200 ", 4);
+  appendStat(&out, "uptime_seconds", snapshot->uptime_ns / 1000000000ULL);
+  appendStat(&out, "connected_clients", snapshot->counters[STATS_CONNECTIONS]);
+  for (int i = 0; i < STATS_OP_COUNT; i++) {
+    char name[64];
+    snprintf(name, sizeof(name), "%s_calls", opNames[i]);
+    appendStat(&out, name, snapshot->ops[i]);
+    snprintf(name, sizeof(name), "%s_ops_per_sec", opNames[i]);
+    appendStat(&out, name, (unsigned long long) (snapshot->ops_per_sec[i] + 0.5));
+  }
+  appendStat(&out, "errors", snapshot->counters[STATS_ERRORS]);
+  appendStat(&out, "get_hits", snapshot->counters[STATS_HITS]);
+  appendStat(&out, "get_misses", snapshot->counters[STATS_MISSES]);
+  appendStat(&out, "bytes_in", snapshot->counters[STATS_BYTES_IN]);
+  appendStat(&out, "bytes_out", snapshot->counters[STATS_BYTES_OUT]);
+  appendStat(&out, "keys", keys);
+  appendStat(&out, "memory_store_bytes", storeBytes);
+  appendStat(&out, "memory_index_bytes", indexBytes);
+  appendStat(&out, "memory_buffer_bytes", snapshot->counters[STATS_BUFFER_BYTES]);
+  for (int i = 0; i < STATS_PHASE_COUNT; i++) {
+    appendLatency(&out, phaseNames[i], &snapshot->phases[i]);
+  }
+  appendLatency(&out, "total", &snapshot->total);
+  size_t trackingClients, trackingKeys;
+  tracking_get_counts(&trackingClients, &trackingKeys);
+  appendStat(&out, "tracking_clients", trackingClients);
+  appendStat(&out, "tracking_keys", trackingKeys);
+  size_t watchClients, watchPatterns;
+  unsigned long long watchDropped;
+  watch_get_counts(&watchClients, &watchPatterns, &watchDropped);
+  appendStat(&out, "watch_clients", watchClients);
+  appendStat(&out, "watch_patterns", watchPatterns);
+  appendStat(&out, "watch_dropped", watchDropped);
+  unsigned long long captureRecords, captureDropped;
+  capture_get_counts(&captureRecords, &captureDropped);
+  appendStat(&out, "capture_records", captureRecords);
+  appendStat(&out, "capture_dropped", captureDropped);
+  appendStat(&out, "log_dropped_lines", logger_dropped());
+  appendReplicationStats(&out);
+  free(snapshot);
+
+  if (out.data == NULL) {
+    const char *errMsg = "500 Internal Server Error: Out of memory";
+    sendResponse(clientSocket, errMsg, strlen(errMsg));
+    return;
+  }
+  sendResponse(clientSocket, out.data, out.len - 2); // without the last line break
+  byte_buffer_free(&out);
+}
+
+// SLOWLOG GET lists the recorded slow requests (newest first), SLOWLOG RESET clears them
+void handleSlowlogRequest(SOCKET clientSocket, const char *subcommand) {
+  if (subcommand != NULL && strcmp(subcommand, "RESET") == 0) {
+    slowlog_reset();
+    const char *response = "200 Slowlog reset";
+    sendResponse(clientSocket, response, strlen(response));
+    return;
+  }
+
+  if (subcommand == NULL || strcmp(subcommand, "GET") != 0) {
+    const char *errMsg = "400 Bad Request: Unknown SLOWLOG subcommand";
+    sendResponse(clientSocket, errMsg, strlen(errMsg));
+    return;
+  }
+
+  slowlog_entry *entries = malloc(SLOWLOG_LENGTH * sizeof(slowlog_entry));
+  if (entries == NULL) {
+    const char *errMsg = "500 Internal Server Error: Out of memory";
+    sendResponse(clientSocket, errMsg, strlen(errMsg));
+    return;
+  }
+  size_t count = slowlog_get(entries, SLOWLOG_LENGTH);
+
+  byte_buffer out = {0};
+  char line[512];
+  int len = snprintf(line, sizeof(line), "200 count:%zu", count);
+  byte_buffer_append(&out, line, len);
+  for (size_t i = 0; i < count; i++) {
+    const slowlog_entry *e = &entries[i];
+    len = snprintf(line, sizeof(line),
+                   "\r\nid=%llu time=%lld total_ns=%llu op=%s key=%s key_len=%zu value_size=%zu client=%s "
+                   "recv_ns=%llu parse_ns=%llu store_ns=%llu send_ns=%llu",
+                   e->id, (long long) e->time, e->total, e->operation, e->key, e->key_len, e->value_size, e->client,
+                   e->timing.phase[STATS_PHASE_RECV], e->timing.phase[STATS_PHASE_PARSE],
+                   e->timing.phase[STATS_PHASE_STORE], e->timing.phase[STATS_PHASE_SEND]);
+    byte_buffer_append(&out, line, len);
+  }
+  free(entries);
+
+  if (out.data == NULL) {
+    const char *errMsg = "500 Internal Server Error: Out of memory";
+    sendResponse(clientSocket, errMsg, strlen(errMsg));
+    return;
+  }
+  sendResponse(clientSocket, out.data, out.len);
+  byte_buffer_free(&out);
+}
+
+static void appendHotkeys(byte_buffer *out, const char *op, const hotkeys_entry *entries, size_t count) {
+  char line[128];
+  for (size_t i = 0; i < count; i++) {
+    int len = snprintf(line, sizeof(line), "\r\nop=%s count=%llu key=%s key_len=%zu", op, entries[i].count,
+                       entries[i].key, entries[i].key_len);
+    byte_buffer_append(out, line, len);
+  }
+}
+
+void handleHotkeysRequest(SOCKET clientSocket, const char *subcommand) {
+  if (subcommand != NULL && strcmp(subcommand, "RESET") == 0) {
+    hotkeys_reset();
+    const char *response = "200 Hotkeys reset";
+    sendResponse(clientSocket, response, strlen(response));
+    return;
+  }
+
+  if (subcommand == NULL || strcmp(subcommand, "GET") != 0) {
+    const char *errMsg = "400 Bad Request: Unknown HOTKEYS subcommand";
+    sendResponse(clientSocket, errMsg, strlen(errMsg));
+    return;
+  }
+
+  hotkeys_entry *reads = malloc(2 * HOTKEYS_TOP * sizeof(hotkeys_entry));
+  if (reads == NULL) {
+    const char *errMsg = "500 Internal Server Error: Out of memory";
+    sendResponse(clientSocket, errMsg, strlen(errMsg));
+    return;
+  }
+  hotkeys_entry *writes = reads + HOTKEYS_TOP;
+  size_t readCount = hotkeys_top(HOTKEYS_READ, reads, HOTKEYS_TOP);
+  size_t writeCount = hotkeys_top(HOTKEYS_WRITE, writes, HOTKEYS_TOP);
+
+  byte_buffer out = {0};
+  char line[128];
+  int len = snprintf(line, sizeof(line), "200 window_ms:%llu reads:%zu writes:%zu", hotkeys_window(), readCount,
+                     writeCount);
+  byte_buffer_append(&out, line, len);
+  appendHotkeys(&out, "read", reads, readCount);
+  appendHotkeys(&out, "write", writes, writeCount);
+  free(reads);
+
+  if (out.data == NULL) {
+    const char *errMsg = "500 Internal Server Error: Out of memory";
+    sendResponse(clientSocket, errMsg, strlen(errMsg));
+    return;
+  }
+  sendResponse(clientSocket, out.data, out.len);
+  byte_buffer_free(&out);
+}
+
+// MEMORY STATS reports the allocations of the key value store as "name:value" lines
+void handleMemoryRequest(SOCKET clientSocket, const char *subcommand) {
+  if (subcommand == NULL || strcmp(subcommand, "STATS") != 0) {
+    const char *errMsg = "400 Bad Request: Unknown MEMORY subcommand";
+    sendResponse(clientSocket, errMsg, strlen(errMsg));
+    return;
+  }
+
+  kv_memory_stats stats;
+  AcquireSRWLockShared(&gl_storeLock);
+  kv_store_memory_stats(gl_kvStore, &stats);
+  ReleaseSRWLockShared(&gl_storeLock);
+
+  char response[640];
+  int len = snprintf(response, sizeof(response),
+                     "200 allocator:%s\r\nallocated_bytes:%zu\r\nallocations:%zu\r\nreserved_bytes:%zu\r\n"
+                     "fragmentation_ratio:%.2f\r\ncompressed_values:%zu\r\ncompressed_raw_bytes:%zu\r\n"
+                     "compressed_stored_bytes:%zu\r\ncompression_ratio:%.2f\r\ncompress_skipped:%zu\r\n"
+                     "lazyfree_values:%zu\r\nlazyfree_pending_bytes:%zu",
+                     stats.allocator, stats.allocated_bytes, stats.allocations, stats.reserved_bytes,
+                     stats.fragmentation, stats.compressed_values, stats.compressed_raw_bytes,
+                     stats.compressed_stored_bytes, stats.compression_ratio, stats.compress_skipped,
+                     stats.lazy_freed, lazyfree_pending_bytes());
+  sendResponse(clientSocket, response, len);
+}
+
+// whether this node serves the key, call with the store locked
+static cluster_route routeKey(const char *key, bool write, cluster_redirect *redirect) {
+  bool asking = tl_clientState != NULL && tl_clientState->asking;
+  return cluster_route_key(gl_kvStore, key, asking, write, redirect);
+}
+
+static void sendRedirect(SOCKET clientSocket, cluster_route route, const cluster_redirect *redirect) {
+  char response[64 + CLUSTER_ADDRESS_SIZE];
+  switch (route) {
+  case CLUSTER_ROUTE_MOVED:
+    snprintf(response, sizeof(response), "308 MOVED %d %s", redirect->slot, redirect->address);
+    break;
+  case CLUSTER_ROUTE_ASK:
+    snprintf(response, sizeof(response), "307 ASK %d %s", redirect->slot, redirect->address);
+    break;
+  case CLUSTER_ROUTE_TRYAGAIN:
+    snprintf(response, sizeof(response), "503 TRYAGAIN Key is being migrated");
+    break;
+  default:
+    snprintf(response, sizeof(response), "503 CLUSTERDOWN Slot %d is not served", redirect->slot);
+    break;
+  }
+  sendResponse(clientSocket, response, strlen(response));
+}
+
+// sends "<header><value>" and releases the shared store lock the value is read under, the value belongs to
+// the entry (NULL for a field of a hash)
+static void sendValueResponse(SOCKET clientSocket, const char *header, size_t headerLen, const kv_entry *entry,
+                              const char *value, size_t valueLen) {
+  // large values are streamed straight from the store instead of copying them into a response, pinned so
+  // that the lock can be released and a slow reader holds up no writer
+  lazyfree_pin *pin = NULL;
+  if (valueLen > SEND_CHUNK_SIZE && entry != NULL && gl_kvStore->pinned != NULL) {
+    pin = lazyfree_pin_value(entry);
+  }
+  if (pin != NULL) {
+    ReleaseSRWLockShared(&gl_storeLock);
+    if (tl_responseValue != NULL) {
+      // the connection sends it from the store once the response is written
+      if (appendCaptured(header, headerLen) == 0) {
+        *tl_responseValue = (response_value){.pin = pin, .data = value, .len = valueLen};
+        return;
+      }
+    } else if (sendAll(clientSocket, header, headerLen) == 0) {
+      sendAll(clientSocket, value, valueLen);
+    }
+    lazyfree_unpin(pin);
+    return;
+  }
+
+  size_t responseLen = valueLen + headerLen;
+  char* response = calloc(responseLen + 1, 1);
+  if (response == NULL) {
+    ReleaseSRWLockShared(&gl_storeLock);
+    LOGF(ERR, "Failed to allocate a response of %zu bytes.", responseLen);
+    const char *errMsg = "500 Internal Server Error: Out of memory";
+    sendResponse(clientSocket, errMsg, strlen(errMsg));
+    return;
+  }
+  memcpy(response, header, headerLen);
+  memcpy(response + headerLen, value, valueLen);
+  ReleaseSRWLockShared(&gl_storeLock);
+
+  sendResponse(clientSocket, response, responseLen);
+
+  free((void*) response);
+}
+
+// bytes of a value requested by GETRANGE, both inclusive, offsets below 0 count from the end
+typedef struct value_range {
+  long long start;
+  long long end;
+} value_range;
+
+// the part of a value of valueLen bytes the range selects, length is 0 if it selects nothing
+static void resolveRange(const value_range *range, size_t valueLen, size_t *offset, size_t *length) {
+  long long len = (long long)valueLen;
+  long long start = range->start < 0 ? range->start + len : range->start;
+  long long end = range->end < 0 ? range->end + len : range->end;
+  if (start < 0) {
+    start = 0;
+  }
+  if (end >= len) {
+    end = len - 1;
+  }
+  *offset = 0;
+  *length = 0;
+  if (start <= end) {
+    *offset = (size_t)start;
+    *length = (size_t)(end - start + 1);
+  }
+}
+
+// version as the client sees it, the epoch tells versions of another store (or run) apart
+typedef struct version_token {
+  unsigned long long epoch;
+  unsigned long long version;  // 0 for a missing key
+} version_token;
+
+// "<epoch>.<version>" with the epoch of the store in hex, "0" for no version, the caller holds the store lock
+static void formatVersion(char *token, size_t size, unsigned long long version) {
+  if (version == 0) {
+    snprintf(token, size, "0");
+  } else {
+    snprintf(token, size, "%llx.%llu", gl_kvStore->epoch, version);
+  }
+}
+
+// whether the key has the version of the token, tokens of another store never match, the caller holds the store lock
+static bool hasVersion(const kv_entry *entry, const version_token *token) {
+  if (token->version == 0) {
+    return entry == NULL;
+  }
+  return entry != NULL && token->epoch == gl_kvStore->epoch && token->version == entry->version;
+}
+
+// how a value is sent, all zero for GET
+typedef struct value_options {
+  bool asStored;               // compressed values as they are stored (GETZ)
+  const value_range *range;    // only the bytes of the range (GETRANGE)
+  bool versioned;              // "200 <version> <value>", 304 if the client has the version already (GETV)
+  version_token known;
+} value_options;
+
+// responds with the value of the key
+static void sendValue(SOCKET clientSocket, const char *operation, const char *key, const value_options *options) {
+  if(key == NULL) {
+    LOGF(ERR, "Invalid %s request: Key is NULL.", operation);
+    char *errMsg = "400 Bad Request: No key";
+    sendResponse(clientSocket, errMsg, strlen(errMsg));
+    return;
+  }
+
+  if(strlen(key) < 1) {
+    LOGF(ERR, "Invalid %s request: Key is empty.", operation);
+    char *errMsg = "400 Bad Request: No key";
+    sendResponse(clientSocket, errMsg, strlen(errMsg));
+    return;
+  }
+
+  LOGF(INFO, "Received %s request for key: %s", operation, key);
+
+  unsigned long long storeStart = stats_now();
+  AcquireSRWLockShared(&gl_storeLock);
+  cluster_redirect redirect;
+  cluster_route route = routeKey(key, false, &redirect);
+  if (route != CLUSTER_ROUTE_LOCAL) {
+    ReleaseSRWLockShared(&gl_storeLock);
+    sendRedirect(clientSocket, route, &redirect);
+    return;
+  }
+  const kv_entry *entry = kv_store_lookup(gl_kvStore, key);
+  hotkeys_record(HOTKEYS_READ, key);
+  stats_add_phase(STATS_PHASE_STORE, storeStart);
+  stats_add(entry != NULL ? STATS_HITS : STATS_MISSES, 1);
+  if(entry == NULL) {
+    ReleaseSRWLockShared(&gl_storeLock);
+    LOGF(INFO, "Key '%s' not found.", key);
+    char *errMsg = "404 Not Found";
+    sendResponse(clientSocket, errMsg, strlen(errMsg));
+    return;
+  }
+  if (tl_clientState != NULL && tl_clientState->tracking != TRACKING_NO_CLIENT) {
+    // before the lock is released, a write can only come after it and will invalidate the value
+    tracking_remember(tl_clientState->tracking, key);
+  }
+
+  if (kv_entry_is_hash(entry)) {
+    ReleaseSRWLockShared(&gl_storeLock);
+    const char *errMsg = "409 Conflict: Value is a hash";
+    sendResponse(clientSocket, errMsg, strlen(errMsg));
+    return;
+  }
+
+  if (options->versioned && hasVersion(entry, &options->known)) {
+    ReleaseSRWLockShared(&gl_storeLock);
+    const char *response = "304 Not Modified";
+    sendResponse(clientSocket, response, strlen(response));
+    return;
+  }
+
+  size_t valueLen = kv_entry_value_len(entry);
+  size_t offset = 0;
+  size_t length = valueLen;
+  if (options->range != NULL) {
+    resolveRange(options->range, valueLen, &offset, &length);
+  }
+  if (options->asStored && kv_entry_is_compressed(entry)) {
+    // the client decompresses the block itself
+    const kv_compressed_value *compressed = (const kv_compressed_value *)entry->value;
+    char header[64];
+    int headerLen = snprintf(header, sizeof(header), "200 lz %zu ", valueLen);
+    sendValueResponse(clientSocket, header, headerLen, entry, compressed->block, compressed->block_len);
+    return;
+  }
+
+  char header[64];
+  if (options->versioned) {
+    char token[48];
+    formatVersion(token, sizeof(token), entry->version);
+    snprintf(header, sizeof(header), "200 %s ", token);
+  } else {
+    snprintf(header, sizeof(header), "%s", options->asStored ? "200 raw " : "200 ");
+  }
+  if (kv_entry_is_compressed(entry)) {
+    // decompressed straight into the response, a range is moved behind the header
+    size_t headerLen = strlen(header);
+    char *response = malloc(headerLen + valueLen + 1);
+    bool failed = response == NULL || kv_entry_read(entry, response + headerLen) != 0;
+    ReleaseSRWLockShared(&gl_storeLock);
+    if (failed) {
+      LOGF(ERR, "Failed to decompress the value of key '%s'.", key);
+      const char *errMsg = "500 Internal Server Error";
+      sendResponse(clientSocket, errMsg, strlen(errMsg));
+    } else {
+      memmove(response + headerLen, response + headerLen + offset, length);
+      memcpy(response, header, headerLen);
+      sendResponse(clientSocket, response, headerLen + length);
+    }
+    free(response);
+    return;
+  }
+
+  char numberText[KV_NUMBER_TEXT_SIZE];
+  sendValueResponse(clientSocket, header, strlen(header), entry, kv_entry_value(entry, numberText) + offset, length);
+}
+
+void handleGetRequest(SOCKET clientSocket, const char *key) {
+  sendValue(clientSocket, "GET", key, &(value_options){0});
+}
+
+void handleGetzRequest(SOCKET clientSocket, const char *key) {
+  sendValue(clientSocket, "GETZ", key, &(value_options){.asStored = true});
+}
+
+// "0" or "<epoch>.<version>" as formatVersion writes it
+static bool parseVersion(const char *arg, version_token *token) {
+  if (arg != NULL && strcmp(arg, "0") == 0) {
+    *token = (version_token){0};
+    return true;
+  }
+  char *end = NULL;
+  errno = 0;
+  token->epoch = arg != NULL && isxdigit((unsigned char)*arg) ? strtoull(arg, &end, 16) : 0;
+  if (end == NULL || *end != '.' || !isdigit((unsigned char)end[1]) || errno == ERANGE) {
+    return false;
+  }
+  const char *version = end + 1;
+  token->version = strtoull(version, &end, 10);
+  return *end == '\0' && token->version != 0 && errno != ERANGE;
+}
+
+// GETV responds with the version and the value of the key, or only with 304 if the version
+// the client sends is still the current one (0 to always get the value)
+void handleGetvRequest(SOCKET clientSocket, struct kvstr_request *req) {
+  version_token known;
+  if (req->arg_count < 1 || !parseVersion(req->args[0], &known)) {
+    const char *errMsg = "400 Bad Request: Expected GETV <key> <version>";
+    sendResponse(clientSocket, errMsg, strlen(errMsg));
+    return;
+  }
+  sendValue(clientSocket, "GETV", req->key, &(value_options){.versioned = true, .known = known});
+}
+
+static bool parseOffset(const char *arg, long long *offset) {
+  char *end = NULL;
+  errno = 0;
+  *offset = arg != NULL ? strtoll(arg, &end, 10) : 0;
+  return arg != NULL && end != arg && *end == '\0' && errno != ERANGE;
+}
+
+// GETRANGE responds with the bytes from start to end of the value, both inclusive,
+// sent straight from the store like GET
+void handleGetrangeRequest(SOCKET clientSocket, struct kvstr_request *req) {
+  value_range range;
+  if (req->arg_count < 2 || !parseOffset(req->args[0], &range.start) || !parseOffset(req->args[1], &range.end)) {
+    const char *errMsg = "400 Bad Request: Expected GETRANGE <key> <start> <end>";
+    sendResponse(clientSocket, errMsg, strlen(errMsg));
+    return;
+  }
+  sendValue(clientSocket, "GETRANGE", req->key, &(value_options){.range = &range});
+}
+
+// SETRANGE overwrites the value from the offset on, the response is the new length of the value
+void handleSetrangeRequest(SOCKET clientSocket, struct kvstr_request *req) {
+  const char *key = req->key;
+  long long offset;
+  if (key == NULL || req->arg_count < 1 || req->value == NULL || !parseOffset(req->args[0], &offset) || offset < 0) {
+    const char *errMsg = "400 Bad Request: Expected SETRANGE <key> <offset> <value>";
+    sendResponse(clientSocket, errMsg, strlen(errMsg));
+    return;
+  }
+  if ((unsigned long long)offset > gl_maxValueSize || req->value_len > gl_maxValueSize - (size_t)offset) {
+    const char *errMsg = "400 Bad Request: Value would exceed the maximum size";
+    sendResponse(clientSocket, errMsg, strlen(errMsg));
+    return;
+  }
+  if (rejectWriteOnReplica(clientSocket)) {
+    return;
+  }
+
+  unsigned long long storeStart = stats_now();
+  AcquireSRWLockExclusive(&gl_storeLock);
+  cluster_redirect redirect;
+  cluster_route route = routeKey(key, true, &redirect);
+  if (route != CLUSTER_ROUTE_LOCAL) {
+    ReleaseSRWLockExclusive(&gl_storeLock);
+    sendRedirect(clientSocket, route, &redirect);
+    return;
+  }
+  size_t length;
+  int result = kv_store_setrange(gl_kvStore, key, (size_t)offset, req->value, req->value_len, &length);
+  hotkeys_record(HOTKEYS_WRITE, key);
+  if (result == 0 && req->value_len > 0) {
+    // replicas get the range only, not the whole value
+    replication_feed_field("SETRANGE", key, req->args[0], req->arg_lens[0], req->value, req->value_len);
+    tracking_invalidate(key);
+    watch_changed("SETRANGE", key);
+  }
+  ReleaseSRWLockExclusive(&gl_storeLock);
+  stats_add_phase(STATS_PHASE_STORE, storeStart);
+
+  char response[64];
+  if (result == KV_STORE_WRONG_TYPE) {
+    snprintf(response, sizeof(response), "409 Conflict: Value is a hash");
+  } else if (result != 0) {
+    snprintf(response, sizeof(response), "500 Internal Server Error: Failed to store key");
+  } else {
+    snprintf(response, sizeof(response), "200 %zu", length);
+  }
+  sendResponse(clientSocket, response, strlen(response));
+}
+
+// stores the value under the key and responds to the client with the new version of the key,
+// only if the key has the expected version if there is one (0 for a missing key)
+// ownership of the value is transferred to the store if 'owned' is true and it returns 0,
+// KV_STORE_COPIED leaves it with the caller
+static int storeValue(SOCKET clientSocket, const char *key, char *value, size_t valueLen, bool owned,
+                      const version_token *expected) {
+  if (strlen(key) < 1 || valueLen < 1) {
+    const char *errorMsg = "400 Bad Request: Key and value must not be empty.";
+      sendResponse(clientSocket, errorMsg, strlen(errorMsg));
+      logMessage(ERR, "Invalid PUT request: Key or value is empty.");
+      return -1;
+  }
+  if (rejectWriteOnReplica(clientSocket)) {
+    return -1;
+  }
+
+  unsigned long long storeStart = stats_now();
+  AcquireSRWLockExclusive(&gl_storeLock);
+  cluster_redirect redirect;
+  cluster_route route = routeKey(key, true, &redirect);
+  if (route != CLUSTER_ROUTE_LOCAL) {
+    ReleaseSRWLockExclusive(&gl_storeLock);
+    sendRedirect(clientSocket, route, &redirect);
+    return -1;
+  }
+  if (expected != NULL) {
+    const kv_entry *entry = kv_store_lookup(gl_kvStore, key);
+    if (!hasVersion(entry, expected)) {
+      char token[48];
+      formatVersion(token, sizeof(token), entry != NULL ? entry->version : 0);
+      ReleaseSRWLockExclusive(&gl_storeLock);
+      char response[96];
+      snprintf(response, sizeof(response), "412 Precondition Failed: version:%s", token);
+      sendResponse(clientSocket, response, strlen(response));
+      return -1;
+    }
+  }
+  int result = owned ? kv_store_put_owned(gl_kvStore, key, value, valueLen)
+                     : kv_store_put(gl_kvStore, key, value);
+  char version[48];
+  formatVersion(version, sizeof(version), gl_kvStore->version); // the one the put gave to the key
+  hotkeys_record(HOTKEYS_WRITE, key);
+  if (result >= 0) {
+    // in the same order as the writes hit the store
+    replication_feed("PUT", key, value, valueLen);
+    tracking_invalidate(key);
+    watch_changed("PUT", key);
+  }
+  ReleaseSRWLockExclusive(&gl_storeLock);
+  stats_add_phase(STATS_PHASE_STORE, storeStart);
+  if (result < 0) {
+    LOGF(ERR, "Failed to store key: %s, reason: %d", key, result);
+    char response[256];
+    snprintf(response, sizeof(response), "500 Internal Server Error: Failed to store key: %s, reason: %d", key, result);
+    sendResponse(clientSocket, response, strlen(response));
+    return result;
+  }
+
+  LOGF(INFO, "Key '%s' stored successfully.", key);
+  char successMsg[96];
+  snprintf(successMsg, sizeof(successMsg), "201 Created: Key stored successfully. version:%s", version);
+  sendResponse(clientSocket, successMsg, strlen(successMsg));
+  return result;
+}
+
+void handlePutRequest(SOCKET clientSocket, const char *key, const char *value) {
+  if (key == NULL || value == NULL) {
+      const char *errorMsg = "500 Internal Server Error: Key and value must not be NULL.";
+      sendResponse(clientSocket, errorMsg, strlen(errorMsg));
+      logMessage(ERR, "Invalid PUT request: Key or value is NULL.");
+      return;
+  }
+
+  storeValue(clientSocket, key, (char *) value, strlen(value), false, NULL);
+}
+
+// PUT for a value that was received into its own allocation, the value is handed over to
+// the store without copying it again
+void handleStreamedPutRequest(SOCKET clientSocket, struct kvstr_request *req) {
+  if (req->key == NULL || req->value == NULL) {
+      const char *errorMsg = "500 Internal Server Error: Key and value must not be NULL.";
+      sendResponse(clientSocket, errorMsg, strlen(errorMsg));
+      logMessage(ERR, "Invalid PUT request: Key or value is NULL.");
+      return;
+  }
+
+  if (storeValue(clientSocket, req->key, req->value, req->value_len, true, NULL) == 0) {
+    req->value = NULL; // owned by the store now, value_len is kept for the statistics
+  }
+}
+
+
+// PUTV stores the value only if the key still has the version the client sends (0 if it must not exist)
+void handlePutvRequest(SOCKET clientSocket, struct kvstr_request *req) {
+  version_token expected;
+  if (req->key == NULL || req->value == NULL || req->arg_count < 1 || !parseVersion(req->args[0], &expected)) {
+    const char *errMsg = "400 Bad Request: Expected PUTV <key> <version> <value>";
+    sendResponse(clientSocket, errMsg, strlen(errMsg));
+    return;
+  }
+
+  if (storeValue(clientSocket, req->key, req->value, req->value_len, true, &expected) == 0) {
+    req->value = NULL; // owned by the store now
+  }
+}
+
+// INCRBY adds a signed 64-bit delta to a number stored under the key, a missing key counts as 0
+void handleIncrbyRequest(SOCKET clientSocket, const char *key, const char *deltaArg) {
+  char *end = NULL;
+  errno = 0;
+  long long delta = deltaArg != NULL ? strtoll(deltaArg, &end, 10) : 0;
+  if (key == NULL || deltaArg == NULL || end == deltaArg || *end != '\0' || errno == ERANGE) {
+    const char *errMsg = "400 Bad Request: Expected INCRBY <key> <delta>";
+    sendResponse(clientSocket, errMsg, strlen(errMsg));
+    return;
+  }
+  if (rejectWriteOnReplica(clientSocket)) {
+    return;
+  }
+
+  unsigned long long storeStart = stats_now();
+  AcquireSRWLockExclusive(&gl_storeLock);
+  cluster_redirect redirect;
+  cluster_route route = routeKey(key, true, &redirect);
+  if (route != CLUSTER_ROUTE_LOCAL) {
+    ReleaseSRWLockExclusive(&gl_storeLock);
+    sendRedirect(clientSocket, route, &redirect);
+    return;
+  }
+  long long number;
+  int result = kv_store_incrby(gl_kvStore, key, delta, &number);
+  hotkeys_record(HOTKEYS_WRITE, key);
+  char numberText[KV_NUMBER_TEXT_SIZE];
+  if (result == 0) {
+    // replicas and watchers see the new value like a PUT
+    int len = snprintf(numberText, sizeof(numberText), "%lld", number);
+    replication_feed("PUT", key, numberText, len);
+    tracking_invalidate(key);
+    watch_changed("PUT", key);
+  }
+  ReleaseSRWLockExclusive(&gl_storeLock);
+  stats_add_phase(STATS_PHASE_STORE, storeStart);
+
+  char response[64];
+  if (result == KV_STORE_NOT_A_NUMBER) {
+    snprintf(response, sizeof(response), "409 Conflict: Value is not an integer");
+  } else if (result == KV_STORE_OVERFLOW) {
+    snprintf(response, sizeof(response), "409 Conflict: Increment would overflow");
+  } else if (result != 0) {
+    snprintf(response, sizeof(response), "500 Internal Server Error: Failed to store key");
+  } else {
+    snprintf(response, sizeof(response), "200 %s", numberText);
+  }
+  sendResponse(clientSocket, response, strlen(response));
+}
+
+// HSET sets a field of the hash stored under the key, the response is 1 if the field is new and 0 if it was updated
+void handleHsetRequest(SOCKET clientSocket, struct kvstr_request *req) {
+  const char *key = req->key;
+  if (key == NULL || req->arg_count < 1 || req->value == NULL) {
+    const char *errMsg = "400 Bad Request: Expected HSET <key> <field> <value>";
+    sendResponse(clientSocket, errMsg, strlen(errMsg));
+    return;
+  }
+  if (rejectWriteOnReplica(clientSocket)) {
+    return;
+  }
+
+  unsigned long long storeStart = stats_now();
+  AcquireSRWLockExclusive(&gl_storeLock);
+  cluster_redirect redirect;
+  cluster_route route = routeKey(key, true, &redirect);
+  if (route != CLUSTER_ROUTE_LOCAL) {
+    ReleaseSRWLockExclusive(&gl_storeLock);
+    sendRedirect(clientSocket, route, &redirect);
+    return;
+  }
+  int result = kv_store_hset(gl_kvStore, key, req->args[0], req->arg_lens[0], req->value, req->value_len);
+  hotkeys_record(HOTKEYS_WRITE, key);
+  if (result >= 0) {
+    replication_feed_field("HSET", key, req->args[0], req->arg_lens[0], req->value, req->value_len);
+    tracking_invalidate(key);
+    watch_changed("HSET", key);
+  }
+  ReleaseSRWLockExclusive(&gl_storeLock);
+  stats_add_phase(STATS_PHASE_STORE, storeStart);
+
+  char response[64];
+  if (result == KV_STORE_WRONG_TYPE) {
+    snprintf(response, sizeof(response), "409 Conflict: Value is not a hash");
+  } else if (result < 0) {
+    snprintf(response, sizeof(response), "500 Internal Server Error: Failed to store field");
+  } else {
+    snprintf(response, sizeof(response), "200 %d", result);
+  }
+  sendResponse(clientSocket, response, strlen(response));
+}
+
+void handleHgetRequest(SOCKET clientSocket, struct kvstr_request *req) {
+  const char *key = req->key;
+  if (key == NULL || req->arg_count < 1) {
+    const char *errMsg = "400 Bad Request: Expected HGET <key> <field>";
+    sendResponse(clientSocket, errMsg, strlen(errMsg));
+    return;
+  }
+
+  unsigned long long storeStart = stats_now();
+  AcquireSRWLockShared(&gl_storeLock);
+  cluster_redirect redirect;
+  cluster_route route = routeKey(key, false, &redirect);
+  if (route != CLUSTER_ROUTE_LOCAL) {
+    ReleaseSRWLockShared(&gl_storeLock);
+    sendRedirect(clientSocket, route, &redirect);
+    return;
+  }
+  const char *value;
+  size_t valueLen;
+  int result = kv_store_hget(gl_kvStore, key, req->args[0], req->arg_lens[0], &value, &valueLen);
+  hotkeys_record(HOTKEYS_READ, key);
+  stats_add_phase(STATS_PHASE_STORE, storeStart);
+  stats_add(result == 0 ? STATS_HITS : STATS_MISSES, 1);
+  if (result != 0) {
+    ReleaseSRWLockShared(&gl_storeLock);
+    const char *errMsg = result == KV_STORE_WRONG_TYPE ? "409 Conflict: Value is not a hash" : "404 Not Found";
+    sendResponse(clientSocket, errMsg, strlen(errMsg));
+    return;
+  }
+  if (tl_clientState != NULL && tl_clientState->tracking != TRACKING_NO_CLIENT) {
+    tracking_remember(tl_clientState->tracking, key);
+  }
+  sendValueResponse(clientSocket, "200 ", 4, NULL, value, valueLen);
+}
+
+// HDEL deletes a field of the hash stored under the key, the response is 1 if it was there and 0 otherwise
+void handleHdelRequest(SOCKET clientSocket, struct kvstr_request *req) {
+  const char *key = req->key;
+  if (key == NULL || req->arg_count < 1) {
+    const char *errMsg = "400 Bad Request: Expected HDEL <key> <field>";
+    sendResponse(clientSocket, errMsg, strlen(errMsg));
+    return;
+  }
+  if (rejectWriteOnReplica(clientSocket)) {
+    return;
+  }
+
+  unsigned long long storeStart = stats_now();
+  AcquireSRWLockExclusive(&gl_storeLock);
+  cluster_redirect redirect;
+  cluster_route route = routeKey(key, true, &redirect);
+  if (route != CLUSTER_ROUTE_LOCAL) {
+    ReleaseSRWLockExclusive(&gl_storeLock);
+    sendRedirect(clientSocket, route, &redirect);
+    return;
+  }
+  int result = kv_store_hdel(gl_kvStore, key, req->args[0], req->arg_lens[0]);
+  hotkeys_record(HOTKEYS_WRITE, key);
+  if (result == 0) {
+    replication_feed_field("HDEL", key, req->args[0], req->arg_lens[0], NULL, 0);
+    tracking_invalidate(key);
+    watch_changed("HDEL", key);
+  }
+  ReleaseSRWLockExclusive(&gl_storeLock);
+  stats_add_phase(STATS_PHASE_STORE, storeStart);
+
+  const char *response = result == KV_STORE_WRONG_TYPE ? "409 Conflict: Value is not a hash"
+                         : result == 0                 ? "200 1"
+                                                       : "200 0";
+  sendResponse(clientSocket, response, strlen(response));
+}
+
+// HGETALL responds with all fields of the hash stored under the key, encoded like the arguments of a request
+void handleHgetallRequest(SOCKET clientSocket, const char *key) {
+  if (key == NULL) {
+    const char *errMsg = "400 Bad Request: No key";
+    sendResponse(clientSocket, errMsg, strlen(errMsg));
+    return;
+  }
+
+  unsigned long long storeStart = stats_now();
+  AcquireSRWLockShared(&gl_storeLock);
+  cluster_redirect redirect;
+  cluster_route route = routeKey(key, false, &redirect);
+  if (route != CLUSTER_ROUTE_LOCAL) {
+    ReleaseSRWLockShared(&gl_storeLock);
+    sendRedirect(clientSocket, route, &redirect);
+    return;
+  }
+  const kv_entry *entry = kv_store_lookup(gl_kvStore, key);
+  hotkeys_record(HOTKEYS_READ, key);
+  stats_add_phase(STATS_PHASE_STORE, storeStart);
+  stats_add(entry != NULL ? STATS_HITS : STATS_MISSES, 1);
+  if (entry == NULL || !kv_entry_is_hash(entry)) {
+    ReleaseSRWLockShared(&gl_storeLock);
+    const char *errMsg = entry == NULL ? "404 Not Found" : "409 Conflict: Value is not a hash";
+    sendResponse(clientSocket, errMsg, strlen(errMsg));
+    return;
+  }
+  if (tl_clientState != NULL && tl_clientState->tracking != TRACKING_NO_CLIENT) {
+    tracking_remember(tl_clientState->tracking, key);
+  }
+  byte_buffer response = {0};
+  int r = byte_buffer_append(&response, "200 ", 4) | appendHashFields(&response, entry);
+  ReleaseSRWLockShared(&gl_storeLock);
+
+  if (r != 0) {
+    const char *errMsg = "500 Internal Server Error";
+    sendResponse(clientSocket, errMsg, strlen(errMsg));
+  } else {
+    sendResponse(clientSocket, response.data, response.len);
+  }
+  byte_buffer_free(&response);
+}
+
+// HRESTORE replaces the key with a hash of the fields in the value (see appendHashFields),
+// only sent by the source of a slot migration
+void handleHrestoreRequest(SOCKET clientSocket, struct kvstr_request *req) {
+  if (req->key == NULL || req->value == NULL ||
+      restoreHashFields(req->key, req->value, req->value + req->value_len, false) != 0) {
+    const char *errMsg = "400 Bad Request: Expected HRESTORE <key> <fields>";
+    sendResponse(clientSocket, errMsg, strlen(errMsg));
+    return;
+  }
+
+  client_state migration = {.asking = true};
+  client_state *previous = tl_clientState;
+  tl_clientState = &migration;
+  AcquireSRWLockExclusive(&gl_storeLock);
+  cluster_redirect redirect;
+  cluster_route route = routeKey(req->key, true, &redirect);
+  tl_clientState = previous;
+  if (route != CLUSTER_ROUTE_LOCAL) {
+    ReleaseSRWLockExclusive(&gl_storeLock);
+    sendRedirect(clientSocket, route, &redirect);
+    return;
+  }
+  if (kv_store_delete(gl_kvStore, req->key) == 0) {
+    replication_feed("DEL", req->key, NULL, 0);
+  }
+  int result = restoreHashFields(req->key, req->value, req->value + req->value_len, true);
+  tracking_invalidate(req->key);
+  watch_changed("HSET", req->key);
+  ReleaseSRWLockExclusive(&gl_storeLock);
+
+  const char *response = result == 0 ? "201 Created: Key stored successfully."
+                                     : "500 Internal Server Error: Failed to store key";
+  sendResponse(clientSocket, response, strlen(response));
+}
+
+void handleDelRequest(SOCKET clientSocket, const char *key) {
+  if(key == NULL) {
+    logMessage(ERR, "Invalid DEL request: Key is NULL.");
+    char *errMsg = "400 Bad Request: No key";
+    sendResponse(clientSocket, errMsg, strlen(errMsg));
+    return;
+  }
+
+  if(strlen(key) < 1) {
+    logMessage(ERR, "Invalid DEL request: Key is empty.");
+    char *errMsg = "400 Bad Request: No key";
+    sendResponse(clientSocket, errMsg, strlen(errMsg));
+    return;
+  }
+
+  LOGF(INFO, "Received DEL request for key: %s", key);
+  if (rejectWriteOnReplica(clientSocket)) {
+    return;
+  }
+
+  unsigned long long storeStart = stats_now();
+  AcquireSRWLockExclusive(&gl_storeLock);
+  cluster_redirect redirect;
+  cluster_route route = routeKey(key, true, &redirect);
+  if (route != CLUSTER_ROUTE_LOCAL) {
+    ReleaseSRWLockExclusive(&gl_storeLock);
+    sendRedirect(clientSocket, route, &redirect);
+    return;
+  }
+  int result = kv_store_delete(gl_kvStore, key);
+  hotkeys_record(HOTKEYS_WRITE, key);
+  if (result == 0) {
+    replication_feed("DEL", key, NULL, 0);
+    tracking_invalidate(key);
+    watch_changed("DEL", key);
+  }
+  ReleaseSRWLockExclusive(&gl_storeLock);
+  stats_add_phase(STATS_PHASE_STORE, storeStart);
+
+  if(result != 0) {
+    LOGF(INFO, "Key '%s' not found.", key);
+    char *errMsg = "404 Not Found";
+    sendResponse(clientSocket, errMsg, strlen(errMsg));
+    return;
+  }
+
+  // Confirm deletion (dummy implementation for now)
+  char response[1024];
+  snprintf(response, sizeof(response), "200 Key deleted");
+  sendResponse(clientSocket, response, strlen(response));
+}
+
+void cleanUp() {
+  if (gl_cleanedUp) {
+    return;
+  }
+  
+  for (int i = 0; i < LISTENER_COUNT; i++) {
+    if (gl_listeners[i] != INVALID_SOCKET) {
+      closesocket(gl_listeners[i]);
+      gl_listeners[i] = INVALID_SOCKET;
+    }
+  }
+  if (gl_unixSocketPath != NULL) {
+    remove(gl_unixSocketPath);
+  }
+  WSACleanup();
+
+  if(gl_kvStore != NULL) {
+    free_kv_store(gl_kvStore);
+    gl_kvStore = NULL;
+    logMessage(DEBUG, "Key value store freed.");
+  }
+
+  gl_cleanedUp = true;
+  logMessage(INFO, "Graceful clean up done.");
+  return;
+}
+
+void handleInterrupt(int signal) {
+  logMessage(INFO, "Received interrupt signal. Shutting down server.");
+  gl_keepRunning = false;
+
+  // unblocks accept(), main() cleans up once requests in flight are finished
+  for (int i = 0; i < LISTENER_COUNT; i++) {
+    SOCKET listener = gl_listeners[i];
+    gl_listeners[i] = INVALID_SOCKET;
+    if (listener != INVALID_SOCKET) {
+      closesocket(listener);
+    }
+  }
+}
+
+#ifndef UNIT_TEST // in case of unit tests the server_unit_tests.c will be the entry point
+int main(int argc, char **argv) {
+#ifndef _WIN64
+  printf("This program is only meant to be run on Windows 64-bit. Other OS are "
+         "currently not supported.");
+#else
 
   signal(SIGINT, handleInterrupt);
+  logger_start(stdout, LOG_RING_SLOTS, LOG_FLUSH_INTERVAL);
+  stats_init();
 
-  if (argc > 1) {
-    if (argc < 3) {
+  // every option takes exactly one value
+  for (int i = 1; i < argc; i += 2) {
+    if (i + 1 >= argc) {
       logMessage(WARN,
-                 "Invalid number of arguments. Usage: server [-l loglevel]");
+                 "Invalid number of arguments. Usage: server [-l loglevel] [-p port] [-u unix socket path] [-m max value size in MB] [-w workers] [-io io threads] [-slow slowlog threshold in us] [-replicaof host:port | unix:path] [-cluster own address] [-capture file] [-hotwindow hot key window in ms] [-allocator system|arena|slab] [-intkeys on|off] [-compress min value size in bytes] [-lazyfree min value size in bytes]");
       return 1;
     }
 
-    // check if -l is given and set global log level
-    if (strcmp(argv[1], "-l") == 0) {
-      setLoglevel(argv[2]);
+    if (strcmp(argv[i], "-l") == 0) {
+      setLoglevel(argv[i + 1]);
+    } else if (strcmp(argv[i], "-p") == 0) {
+      gl_port = atoi(argv[i + 1]);
+    } else if (strcmp(argv[i], "-u") == 0) {
+      gl_unixSocketPath = argv[i + 1];
+    } else if (strcmp(argv[i], "-m") == 0) {
+      setMaxValueSize(argv[i + 1]);
+    } else if (strcmp(argv[i], "-w") == 0) {
+      gl_workerThreads = atoi(argv[i + 1]);
+    } else if (strcmp(argv[i], "-io") == 0) {
+      gl_ioThreads = atoi(argv[i + 1]);
+    } else if (strcmp(argv[i], "-slow") == 0) {
+      gl_slowlogThreshold = strtoull(argv[i + 1], NULL, 10) * 1000;
+    } else if (strcmp(argv[i], "-replicaof") == 0) {
+      gl_primary = argv[i + 1];
+    } else if (strcmp(argv[i], "-cluster") == 0) {
+      if (cluster_enable(argv[i + 1]) != 0) {
+        LOGF(FATAL, "Invalid cluster address '%s'.", argv[i + 1]);
+      }
+    } else if (strcmp(argv[i], "-hotwindow") == 0) {
+      hotkeys_set_window(strtoull(argv[i + 1], NULL, 10));
+    } else if (strcmp(argv[i], "-allocator") == 0) {
+      kv_allocator *allocator = kv_allocator_create(argv[i + 1]);
+      if (allocator == NULL) {
+        LOGF(FATAL, "Unknown allocator '%s'.", argv[i + 1]);
+      }
+      kv_allocator_destroy(allocator);
+      gl_allocator = argv[i + 1];
+    } else if (strcmp(argv[i], "-intkeys") == 0) {
+      gl_intKeys = strcmp(argv[i + 1], "on") == 0;
+    } else if (strcmp(argv[i], "-compress") == 0) {
+      gl_compressMin = strtoull(argv[i + 1], NULL, 10);
+    } else if (strcmp(argv[i], "-lazyfree") == 0) {
+      gl_lazyFreeMin = strtoull(argv[i + 1], NULL, 10);
+    } else if (strcmp(argv[i], "-capture") == 0) {
+      if (capture_start(argv[i + 1], CAPTURE_RING_SIZE, CAPTURE_FLUSH_INTERVAL) != 0) {
+        LOGF(FATAL, "Failed to start capturing requests to '%s'.", argv[i + 1]);
+      }
+      LOGF(INFO, "Capturing requests to '%s'.", argv[i + 1]);
+    } else {
+      LOGF(WARN, "Unknown option '%s' ignored.", argv[i]);
     }
   }
 
   logMessage(INFO, "Starting server.");
 
   // Initialize the key value store
-  logMessage(INFO, "Initializing key value store with initial capacity of 1024");
-  gl_kvStore = create_kv_store(1024);
+  LOGF(INFO, "Initializing key value store with initial capacity of 1024 and the %s allocator%s", gl_allocator,
+       gl_intKeys ? ", integer keys are stored unboxed" : "");
+  if (gl_compressMin > 0) {
+    LOGF(INFO, "Values of %zu bytes or more are stored compressed.", gl_compressMin);
+  }
+  gl_kvStore = createKvStore();
+  if (gl_kvStore == NULL) {
+    logMessage(FATAL, "Failed to allocate the key value store.");
+  }
+  if (gl_lazyFreeMin > 0 && gl_kvStore->lazy_free != NULL) {
+    if (lazyfree_start() != 0) {
+      logMessage(FATAL, "Failed to start the lazy free thread.");
+    }
+    LOGF(INFO, "Deleted values of %zu bytes or more are freed in the background.", gl_lazyFreeMin);
+  }
 
-  // Bind and listen on the server socket
-  createSocket();
-  bindSocket(gl_serverSocket, 8080);
-  handleConnections(gl_serverSocket);
+  if (gl_port <= 0 && gl_unixSocketPath == NULL) {
+    logMessage(FATAL, "Neither a TCP port nor a unix socket to listen on.");
+  }
+
+  // Bind and listen on the server sockets
+  startWinsock();
+  if (gl_port > 0) {
+    gl_listeners[LISTENER_TCP] = createSocket(AF_INET);
+    bindSocket(gl_listeners[LISTENER_TCP], gl_port);
+  }
+  if (gl_unixSocketPath != NULL) {
+    gl_listeners[LISTENER_UNIX] = createSocket(AF_UNIX);
+    bindUnixSocket(gl_listeners[LISTENER_UNIX], gl_unixSocketPath);
+  }
+  if (gl_primary != NULL) {
+    startReplication(gl_primary);
+  }
+  if (gl_workerThreads > 0) {
+    // only sessions watch keys
+    if (watch_start() != 0) {
+      logMessage(FATAL, "Failed to start the watch notifier.");
+    }
+    handleConnectionsWithWorkers();
+  } else {
+    handleConnections();
+  }
 
+  replication_stop();
+  watch_stop();
+  if (capture_stop() != 0) {
+    logMessage(ERR, "Failed to write the capture file.");
+  }
+  lazyfree_stop();
   cleanUp();
   logMessage(INFO, "Server shutdown complete.");
+  logger_stop();
 
 #endif
   return 0;
@@ -3,40 +3,90 @@
 
 #ifdef _WIN64
 #include <WinSock2.h>
+#include <afunix.h>
 #endif
 
-/* Data Types */
-enum LogLevel {
-  FATAL = 0,
-  WARN = 1,
-  ERR = 2,
-  INFO = 3,
-  DEBUG = 4,
-};
+#include <stdbool.h>
 
-// represents a request from the client
-struct kvstr_request {
-    char* key;
-    char* value;
-    char* operation;
-};
+#include "capture.h"
+#include "hotkeys.h"
+#include "kvstrdecoder.h"
+#include "lazyfree.h"
+#include "logger.h"
+#include "tracking.h"
+#include "watch.h"
 
 
+#include "utilfuns.h"
+
+// state of a session that outlives a single request
+typedef struct client_state {
+  unsigned long long connectionId;  // identifies the requests of the connection in a capture
+  bool asking;                  // the next request may use a slot this node is importing (ASKING)
+  unsigned long long tracking;  // registered for invalidations of the keys it reads (TRACKING ON)
+  unsigned long long watching;  // registered for notifications of the keys it watches (WATCH)
+  tracking_push_fn push;        // sends invalidations and notifications to the connection of the session
+  void *pushCtx;
+} client_state;
+
+// a large value a captured response ends with, sent from the store instead of a copy (worker mode)
+typedef struct response_value {
+  lazyfree_pin *pin;  // keeps the value until it was sent, NULL if the response has none
+  const char *data;
+  size_t len;
+} response_value;
+
 /* Prototypes */
-void handleConnections(SOCKET serverSocket);
-SOCKET acceptClientConnection(SOCKET serverSocket, char *logBuffer, size_t logBufferSize);
-void handleAcceptError(char *logBuffer, size_t logBufferSize);
-int receiveData(SOCKET clientSocket, char *buffer, size_t bufferSize);
-void processClientRequest(SOCKET clientSocket, char *buffer, char *logBuffer, size_t logBufferSize);
+void logMessage(enum LogLevel lvl, const char *message);
+void startWinsock();
+SOCKET createSocket(int family);
+void bindSocket(SOCKET sock, int port);
+void bindUnixSocket(SOCKET sock, const char *path);
+void handleConnections();
+void handleConnectionsWithWorkers();
+SOCKET acceptClientConnection(SOCKET serverSocket);
+void handleAcceptError();
+int receiveRequest(SOCKET clientSocket, struct kvstr_request *req);
+int sendAll(SOCKET clientSocket, const char *buffer, size_t length);
+int sendResponse(SOCKET clientSocket, const char *buffer, size_t length);
+void captureResponses(byte_buffer *buffer, response_value *value);
+void setClientState(client_state *state);
+void detachClientSocket();
+bool clientSocketDetached();
+void sendParseError(SOCKET clientSocket, int parseRequestError);
+void processClientRequest(SOCKET clientSocket, struct kvstr_request *req);
 void handleGetRequest(SOCKET clientSocket, const char *key);
+void handleGetzRequest(SOCKET clientSocket, const char *key);
 void handlePutRequest(SOCKET clientSocket, const char *key, const char *value);
+void handleStreamedPutRequest(SOCKET clientSocket, struct kvstr_request *req);
 void handleDelRequest(SOCKET clientSocket, const char *key);
-const char* parse_value(const char *after_key_ptr, struct kvstr_request *result);
-int kvstr_parse_request(const char *request_str, struct kvstr_request *result);
-const char *parse_operation(const char *request_str, struct kvstr_request *result);
-const char *parse_key(const char *after_op_ptr, struct kvstr_request *result);
-struct kvstr_request* create_kvstr_request();
-void free_kvstr_request(struct kvstr_request** req_ptr);
+void handleIncrbyRequest(SOCKET clientSocket, const char *key, const char *deltaArg);
+void handleGetvRequest(SOCKET clientSocket, struct kvstr_request *req);
+void handlePutvRequest(SOCKET clientSocket, struct kvstr_request *req);
+void handleGetrangeRequest(SOCKET clientSocket, struct kvstr_request *req);
+void handleSetrangeRequest(SOCKET clientSocket, struct kvstr_request *req);
+void handleHsetRequest(SOCKET clientSocket, struct kvstr_request *req);
+void handleHgetRequest(SOCKET clientSocket, struct kvstr_request *req);
+void handleHdelRequest(SOCKET clientSocket, struct kvstr_request *req);
+void handleHgetallRequest(SOCKET clientSocket, const char *key);
+void handleHelloRequest(SOCKET clientSocket);
+void handleStatsRequest(SOCKET clientSocket);
+void handleSlowlogRequest(SOCKET clientSocket, const char *subcommand);
+void handleHotkeysRequest(SOCKET clientSocket, const char *subcommand);
+void handleMemoryRequest(SOCKET clientSocket, const char *subcommand);
+void handleSyncRequest(SOCKET clientSocket);
+void applyReplicatedRequest(struct kvstr_request *req);
+void resetKvStore();
+void startReplication(char *primary);
+void handleAskingRequest(SOCKET clientSocket);
+void handleSlotsRequest(SOCKET clientSocket);
+void handleKeyslotRequest(SOCKET clientSocket, const char *key);
+void handleSetslotRequest(SOCKET clientSocket, const char *slots, const char *state, const char *node);
+void handleMigrateRequest(SOCKET clientSocket, const char *slotArg, const char *countArg);
+void handleRestoreRequest(SOCKET clientSocket, struct kvstr_request *req);
+void handleHrestoreRequest(SOCKET clientSocket, struct kvstr_request *req);
+void handleTrackingRequest(SOCKET clientSocket, const char *mode);
+void handleWatchRequest(SOCKET clientSocket, const char *operation, const char *pattern);
 void setGlobalKVStore(void *kvstore);
 
 #endif
\ No newline at end of file
@@ -10,10 +10,36 @@
 
 #include "kvstore.h"
 #include "server.h"
+#include "executor.h"
+#include "logger.h"
+#include "histogram.h"
+#include "stats.h"
+#include "slowlog.h"
+#include "replication.h"
+#include "cluster.h"
+#include "tracking.h"
+#include "watch.h"
+#include "capture.h"
+#include "hotkeys.h"
+#include "kvcompress.h"
+#include "lazyfree.h"
 
 // defined in server.c
 extern kv_store* gl_kvStore;
 extern const char* _mock_lastMessage;
+extern size_t _mock_sentBytes;
+extern const char* _mock_recvData;
+extern size_t _mock_recvLength;
+extern size_t _mock_recvPos;
+extern size_t _mock_recvChunk;
+
+// lets the mocked recv hand out the given bytes in chunks of at most chunkSize bytes
+void mock_recv_data(const char* data, size_t length, size_t chunkSize) {
+    _mock_recvData = data;
+    _mock_recvLength = length;
+    _mock_recvPos = 0;
+    _mock_recvChunk = chunkSize;
+}
 
 char* test_create_and_free_kvstr_request() {
     struct kvstr_request* req = create_kvstr_request();
@@ -635,6 +661,1654 @@ char* test_kv_store_delete_nonexistent_key() {
     return NULL;
 }
 
+char* test_kvstr_decoder_handles_fragmented_input() {
+    struct kvstr_request* req = create_kvstr_request();
+    cmunit_assert("allocating kvstr request failed", req != NULL);
+
+    struct kvstr_decoder dec;
+    kvstr_decoder_init(&dec, req, KVSTR_MAX_KEY_SIZE, KVSTR_MAX_VALUE_SIZE);
+
+    // feed the request byte by byte as if it arrived in tiny packets
+    const char* request_str = "PUT 3:key 5:value";
+    for (size_t i = 0; i < strlen(request_str); i++) {
+        cmunit_assert("decoder finished too early", !kvstr_decoder_done(&dec));
+        size_t consumed = kvstr_decoder_feed(&dec, request_str + i, 1);
+        cmunit_assert("decoder did not consume byte", consumed == 1);
+    }
+
+    cmunit_assert("decoder not done", kvstr_decoder_finish(&dec) == 0);
+    cmunit_assert("operation not parsed", strcmp(req->operation, "PUT") == 0);
+    cmunit_assert("key not parsed", strcmp(req->key, "key") == 0);
+    cmunit_assert("value not parsed", strcmp(req->value, "value") == 0);
+    cmunit_assert("value length not set", req->value_len == 5);
+
+    free_kvstr_request(&req);
+    return NULL;
+}
+
+char* test_kvstr_decoder_direct_buffer_receives_value() {
+    struct kvstr_request* req = create_kvstr_request();
+    cmunit_assert("allocating kvstr request failed", req != NULL);
+
+    struct kvstr_decoder dec;
+    kvstr_decoder_init(&dec, req, KVSTR_MAX_KEY_SIZE, KVSTR_MAX_VALUE_SIZE);
+
+    const char* header = "PUT 3:key 10:";
+    cmunit_assert("header not consumed", kvstr_decoder_feed(&dec, header, strlen(header)) == strlen(header));
+
+    size_t remaining;
+    char* direct = kvstr_decoder_direct_buffer(&dec, &remaining);
+    cmunit_assert("no direct buffer for value", direct != NULL);
+    cmunit_assert("direct buffer is not the value allocation", direct == req->value);
+    cmunit_assert("wrong remaining length", remaining == 10);
+
+    memcpy(direct, "0123456789", 10);
+    kvstr_decoder_commit(&dec, 10);
+    cmunit_assert("decoder not done", kvstr_decoder_done(&dec));
+    cmunit_assert("value not received", strcmp(req->value, "0123456789") == 0);
+
+    free_kvstr_request(&req);
+    return NULL;
+}
+
+char* test_kvstr_decoder_rejects_too_large_value() {
+    struct kvstr_request* req = create_kvstr_request();
+    cmunit_assert("allocating kvstr request failed", req != NULL);
+
+    struct kvstr_decoder dec;
+    kvstr_decoder_init(&dec, req, KVSTR_MAX_KEY_SIZE, 1024);
+
+    const char* header = "PUT 3:key 1025:";
+    kvstr_decoder_feed(&dec, header, strlen(header));
+    cmunit_assert("too large value not rejected", kvstr_decoder_finish(&dec) == -6);
+    cmunit_assert("value was allocated", req->value == NULL);
+
+    free_kvstr_request(&req);
+    return NULL;
+}
+
+char* test_receiveRequest_streams_large_value() {
+    const size_t value_len = 3 * 1024 * 1024;
+    const char* header = "PUT 8:bigvalue 3145728:";
+    size_t header_len = strlen(header);
+
+    char* data = malloc(header_len + value_len);
+    memcpy(data, header, header_len);
+    for (size_t i = 0; i < value_len; i++) {
+        data[header_len + i] = 'a' + (i % 26);
+    }
+    mock_recv_data(data, header_len + value_len, 100 * 1000);
+
+    struct kvstr_request* req = create_kvstr_request();
+    int result = receiveRequest(1, req);
+    cmunit_assert("receiving request failed", result == 0);
+    cmunit_assert("key not received", strcmp(req->key, "bigvalue") == 0);
+    cmunit_assert("value length not received", req->value_len == value_len);
+    cmunit_assert("value not received", memcmp(req->value, data + header_len, value_len) == 0);
+
+    free_kvstr_request(&req);
+    free(data);
+    return NULL;
+}
+
+char* test_receiveRequest_incomplete_request() {
+    const char* data = "PUT 3:key 10:val";
+    mock_recv_data(data, strlen(data), 0);
+
+    struct kvstr_request* req = create_kvstr_request();
+    int result = receiveRequest(1, req);
+    cmunit_assert("incomplete value should result in value error", result == -4);
+
+    free_kvstr_request(&req);
+    return NULL;
+}
+
+char* test_handleStreamedPutRequest_takes_ownership() {
+    gl_kvStore = create_kv_store(1);
+    gl_kvStore->epoch = 0x2a;
+
+    struct kvstr_request* req = create_kvstr_request();
+    int result = kvstr_parse_request("PUT 3:key 5:value", req);
+    cmunit_assert("parsing request failed", result == 0);
+
+    char* value = req->value;
+    handleStreamedPutRequest(1, req);
+    cmunit_assert("value was not handed over", req->value == NULL);
+    cmunit_assert("value was copied", kv_store_get(gl_kvStore, "key") == value);
+    cmunit_assert("wrong response message sent.", strcmp(_mock_lastMessage, "201 Created: Key stored successfully. version:2a.1") == 0);
+
+    free_kvstr_request(&req);
+    free_kv_store(gl_kvStore);
+    return NULL;
+}
+
+char* test_handleGetRequest_streams_large_value() {
+    gl_kvStore = create_kv_store(1);
+    kv_store_set_pinned(gl_kvStore, lazyfree_pinned, NULL);
+
+    const size_t value_len = 1024 * 1024;
+    char* value = malloc(value_len + 1);
+    memset(value, 'x', value_len);
+    value[value_len] = '\0';
+    kv_store_put_owned(gl_kvStore, "big", value, value_len);
+
+    _mock_sentBytes = 0;
+    handleGetRequest(1, "big");
+    cmunit_assert("not all bytes sent", _mock_sentBytes == value_len + 4);
+    cmunit_assert("value not sent in chunks", strlen(_mock_lastMessage) < value_len);
+
+    // without pins the value is copied before the lock is released
+    kv_store_set_pinned(gl_kvStore, NULL, NULL);
+    _mock_sentBytes = 0;
+    handleGetRequest(1, "big");
+    cmunit_assert("copied value not sent", _mock_sentBytes == value_len + 4);
+
+    free_kv_store(gl_kvStore);
+    return NULL;
+}
+
+char* test_kv_store_reuses_free_slot_without_duplicating_keys() {
+    kv_store* store = create_kv_store(2);
+    cmunit_assert("allocating kv_store failed", store != NULL);
+
+    kv_store_put(store, "key1", "value1");
+    kv_store_put(store, "key2", "value2");
+    kv_store_delete(store, "key1");
+
+    // key2 already exists behind the free slot and must be overwritten, not inserted again
+    kv_store_put(store, "key2", "new_value");
+    cmunit_assert("deleting key2 failed", kv_store_delete(store, "key2") == 0);
+    cmunit_assert("key2 stored twice", kv_store_get(store, "key2") == NULL);
+
+    free_kv_store(store);
+    return NULL;
+}
+
+static atomic_int _executor_counter;
+
+void executor_count_task(void* arg) {
+    atomic_fetch_add(&_executor_counter, 1);
+}
+
+// keeps its worker busy until released, the other workers have to steal the queued tasks
+static atomic_bool _executor_release;
+
+void executor_blocking_task(void* arg) {
+    while (!atomic_load(&_executor_release)) {
+        Sleep(1);
+    }
+}
+
+char* test_executor_runs_all_tasks() {
+    atomic_store(&_executor_counter, 0);
+    executor* pool = executor_create(4);
+    cmunit_assert("creating executor failed", pool != NULL);
+
+    for (int i = 0; i < 10000; i++) {
+        cmunit_assert("submitting task failed", executor_submit(pool, executor_count_task, NULL) == 0);
+    }
+
+    executor_destroy(pool); // waits for queued tasks
+    cmunit_assert("not all tasks were executed", atomic_load(&_executor_counter) == 10000);
+    return NULL;
+}
+
+char* test_executor_steals_from_blocked_worker() {
+    atomic_store(&_executor_counter, 0);
+    atomic_store(&_executor_release, false);
+    executor* pool = executor_create(2);
+    cmunit_assert("creating executor failed", pool != NULL);
+
+    // round robin puts every second task behind the blocking one
+    executor_submit(pool, executor_blocking_task, NULL);
+    for (int i = 0; i < 100; i++) {
+        executor_submit(pool, executor_count_task, NULL);
+    }
+
+    for (int i = 0; i < 5000 && atomic_load(&_executor_counter) < 100; i++) {
+        Sleep(1);
+    }
+    int counted = atomic_load(&_executor_counter);
+    atomic_store(&_executor_release, true);
+    executor_destroy(pool);
+
+    cmunit_assert("tasks behind a blocked worker were not stolen", counted == 100);
+    return NULL;
+}
+
+char* test_kvstr_parse_operation_without_arguments() {
+    struct kvstr_request* req = create_kvstr_request();
+    cmunit_assert("allocating kvstr request failed", req != NULL);
+
+    int result = kvstr_parse_request("HELLO\r\n", req);
+    cmunit_assert("parsing request failed", result == 0);
+    cmunit_assert("operation not parsed", strcmp(req->operation, "HELLO") == 0);
+    cmunit_assert("key not NULL", req->key == NULL);
+
+    free_kvstr_request(&req);
+    return NULL;
+}
+
+char* test_handleHelloRequest_without_worker_mode() {
+    handleHelloRequest(1);
+    cmunit_assert("wrong response message sent.", strcmp(_mock_lastMessage, "400 Bad Request: Sessions require worker mode (-w)") == 0);
+    return NULL;
+}
+
+char* test_captured_responses_are_not_sent() {
+    gl_kvStore = create_kv_store(1);
+    kv_store_put(gl_kvStore, "key", "value");
+
+    byte_buffer response = {0};
+    _mock_sentBytes = 0;
+    captureResponses(&response, NULL);
+    handleGetRequest(1, "key");
+    captureResponses(NULL, NULL);
+
+    cmunit_assert("captured response was sent", _mock_sentBytes == 0);
+    cmunit_assert("response not captured", response.len == 9 && memcmp(response.data, "200 value", 9) == 0);
+
+    byte_buffer_free(&response);
+    free_kv_store(gl_kvStore);
+    return NULL;
+}
+
+char* test_captured_large_value_is_not_copied() {
+    gl_kvStore = create_kv_store(1);
+    kv_store_set_pinned(gl_kvStore, lazyfree_pinned, NULL);
+    const size_t value_len = 1024 * 1024;
+    char* value = malloc(value_len + 1);
+    memset(value, 'x', value_len);
+    value[value_len] = '\0';
+    kv_store_put_owned(gl_kvStore, "big", value, value_len);
+
+    byte_buffer response = {0};
+    response_value captured = {0};
+    captureResponses(&response, &captured);
+    handleGetRequest(1, "big");
+    cmunit_assert("value copied", response.len == 4 && memcmp(response.data, "200 ", 4) == 0);
+    cmunit_assert("value not captured", captured.pin != NULL && captured.data == value && captured.len == value_len);
+
+    // the value is deleted meanwhile, the pin keeps it
+    captureResponses(NULL, NULL);
+    handleDelRequest(1, "big");
+    cmunit_assert("value gone", captured.data[value_len - 1] == 'x');
+
+    // anything behind the value keeps its place
+    captureResponses(&response, &captured);
+    sendResponse(1, "!", 1);
+    captureResponses(NULL, NULL);
+    cmunit_assert("value not copied before the next response", captured.pin == NULL && response.len == value_len + 5);
+    cmunit_assert("wrong order", response.data[4] == 'x' && response.data[value_len + 4] == '!');
+
+    byte_buffer_free(&response);
+    free_kv_store(gl_kvStore);
+    return NULL;
+}
+
+char* test_logger_skips_disabled_levels_before_formatting() {
+    enum LogLevel level = gl_logLevel;
+    gl_logLevel = INFO;
+    int evaluated = 0;
+
+    LOGF(DEBUG, "%d", ++evaluated);
+    cmunit_assert("arguments of a disabled level were evaluated", evaluated == 0);
+
+    gl_logLevel = level;
+    return NULL;
+}
+
+char* test_logger_counts_dropped_lines() {
+    FILE* out = tmpfile();
+    cmunit_assert("creating temp file failed", out != NULL);
+
+    // the flusher does not run on its own during the test, so the ring overflows
+    cmunit_assert("starting logger failed", logger_start(out, 4, 60000) == 0);
+    for (int i = 0; i < 10; i++) {
+        logger_write(INFO, "line %d", i);
+    }
+    cmunit_assert("wrong number of dropped lines", logger_dropped() == 6);
+    logger_stop();
+
+    char line[LOG_LINE_SIZE + 64];
+    int lines = 0;
+    bool reported = false;
+    rewind(out);
+    while (fgets(line, sizeof(line), out) != NULL) {
+        lines++;
+        if (lines == 1) {
+            cmunit_assert("first line not written", strstr(line, "INFO - line 0") != NULL);
+        }
+        reported = reported || strstr(line, "6 log lines dropped.") != NULL;
+    }
+    fclose(out);
+
+    cmunit_assert("wrong number of lines written", lines == 5);
+    cmunit_assert("dropped lines not reported", reported);
+    return NULL;
+}
+
+static DWORD WINAPI logOneLine(LPVOID arg) {
+    logger_write(INFO, "line of thread %d", *(int*)arg);
+    return 0;
+}
+
+char* test_logger_reuses_rings_of_ended_threads() {
+    FILE* out = tmpfile();
+    cmunit_assert("creating temp file failed", out != NULL);
+    cmunit_assert("starting logger failed", logger_start(out, 4, 60000) == 0);
+
+    // one thread after the other, each takes over the ring of the one before
+    int ids[3] = {1, 2, 3};
+    for (int i = 0; i < 3; i++) {
+        HANDLE thread = CreateThread(NULL, 0, logOneLine, &ids[i], 0, NULL);
+        WaitForSingleObject(thread, INFINITE);
+        CloseHandle(thread);
+    }
+    size_t rings = logger_rings();
+    logger_stop();
+
+    char line[LOG_LINE_SIZE + 64];
+    int lines = 0;
+    rewind(out);
+    while (fgets(line, sizeof(line), out) != NULL) {
+        lines += strstr(line, "line of thread") != NULL;
+    }
+    fclose(out);
+
+    cmunit_assert("ring of an ended thread not reused", rings == 1);
+    cmunit_assert("lines of ended threads lost", lines == 3);
+    return NULL;
+}
+
+char* test_histogram_percentiles() {
+    histogram* h = calloc(1, sizeof(histogram));
+    cmunit_assert("allocating histogram failed", h != NULL);
+
+    for (unsigned long long i = 1; i <= 1000; i++) {
+        histogram_record(h, i * 1000);
+    }
+
+    unsigned long long p50 = histogram_percentile(h, 50.0);
+    unsigned long long p99 = histogram_percentile(h, 99.0);
+    cmunit_assert("wrong number of values", histogram_count(h) == 1000);
+    cmunit_assert("p50 not within 1/16", p50 >= 500000 && p50 <= 500000 + 500000 / 16);
+    cmunit_assert("p99 not within 1/16", p99 >= 990000 && p99 <= 990000 + 990000 / 16);
+    cmunit_assert("p999 below p99", histogram_percentile(h, 99.9) >= p99);
+
+    free(h);
+    return NULL;
+}
+
+char* test_kv_store_tracks_data_size() {
+    kv_store* store = create_kv_store(2);
+    kv_store_put(store, "key", "value");
+    cmunit_assert("data size wrong after put", store->data_size == 8);
+    kv_store_put(store, "key", "other value");
+    cmunit_assert("data size wrong after overwrite", store->data_size == 14);
+    kv_store_delete(store, "key");
+    cmunit_assert("data size wrong after delete", store->data_size == 0);
+    free_kv_store(store);
+    return NULL;
+}
+
+char* test_handleStatsRequest_reports_counters() {
+    gl_kvStore = create_kv_store(1);
+    kv_store_put(gl_kvStore, "key", "value");
+
+    stats_snapshot* before = malloc(sizeof(stats_snapshot));
+    stats_collect(before);
+
+    struct kvstr_request* req = create_kvstr_request();
+    kvstr_parse_request("GET 3:key", req);
+    processClientRequest(1, req);
+    free_kvstr_request(&req);
+
+    stats_snapshot* after = malloc(sizeof(stats_snapshot));
+    stats_collect(after);
+    cmunit_assert("GET not counted", after->ops[STATS_OP_GET] == before->ops[STATS_OP_GET] + 1);
+    cmunit_assert("hit not counted", after->counters[STATS_HITS] == before->counters[STATS_HITS] + 1);
+    free(before);
+    free(after);
+
+    handleStatsRequest(1);
+    cmunit_assert("wrong response code", strncmp(_mock_lastMessage, "200 ", 4) == 0);
+    cmunit_assert("keys missing", strstr(_mock_lastMessage, "\r\nkeys:1\r\n") != NULL);
+    cmunit_assert("memory missing", strstr(_mock_lastMessage, "\r\nmemory_store_bytes:8\r\n") != NULL);
+    cmunit_assert("latency missing", strstr(_mock_lastMessage, "\r\nlatency_store_p99_ns:") != NULL);
+
+    free_kv_store(gl_kvStore);
+    return NULL;
+}
+
+char* test_kvstr_parse_operation_with_argument() {
+    struct kvstr_request* req = create_kvstr_request();
+    cmunit_assert("allocating kvstr request failed", req != NULL);
+
+    int result = kvstr_parse_request("SLOWLOG 5:RESET", req);
+    cmunit_assert("parsing request failed", result == 0);
+    cmunit_assert("argument not parsed", req->arg_count == 1 && strcmp(req->args[0], "RESET") == 0);
+    cmunit_assert("argument length not set", req->arg_lens[0] == 5);
+    cmunit_assert("key not NULL", req->key == NULL);
+
+    free_kvstr_request(&req);
+    return NULL;
+}
+
+char* test_handleSlowlogRequest_lists_slow_requests() {
+    slowlog_reset();
+
+    request_timing timing = {0};
+    timing.phase[STATS_PHASE_STORE] = 42;
+    slowlog_record(1, "PUT", "a key that is much longer than what the slowlog keeps", 100, &timing, 20000000);
+    slowlog_record(1, "GET", "key", 0, &timing, 30000000);
+
+    handleSlowlogRequest(1, "GET");
+    cmunit_assert("wrong entry count", strncmp(_mock_lastMessage, "200 count:2\r\n", 13) == 0);
+    const char* newest = strstr(_mock_lastMessage, "op=GET key=key ");
+    const char* oldest = strstr(_mock_lastMessage, "op=PUT key=a.key.that.is.much.longer.than.w key_len=53 value_size=100 ");
+    cmunit_assert("entries missing", newest != NULL && oldest != NULL);
+    cmunit_assert("newest entry not first", newest < oldest);
+    cmunit_assert("phases missing", strstr(_mock_lastMessage, "store_ns=42") != NULL);
+
+    handleSlowlogRequest(1, "RESET");
+    handleSlowlogRequest(1, "GET");
+    cmunit_assert("slowlog not reset", strcmp(_mock_lastMessage, "200 count:0") == 0);
+
+    handleSlowlogRequest(1, "FOO");
+    cmunit_assert("unknown subcommand accepted", strncmp(_mock_lastMessage, "400 ", 4) == 0);
+    return NULL;
+}
+
+char* test_unix_socket_listener_accepts_clients() {
+    const char* path = "simplekv_test.sock";
+    startWinsock();
+    SOCKET listener = createSocket(AF_UNIX);
+    bindUnixSocket(listener, path);
+
+    struct sockaddr_un addr = {0};
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    SOCKET client = socket(AF_UNIX, SOCK_STREAM, 0);
+    int r = connect(client, (struct sockaddr*)&addr, sizeof(addr));
+    SOCKET accepted = acceptClientConnection(listener);
+
+    closesocket(client);
+    closesocket(accepted);
+    closesocket(listener);
+    remove(path);
+    WSACleanup();
+
+    cmunit_assert("could not connect to the unix socket", r == 0);
+    cmunit_assert("connection not accepted", accepted != INVALID_SOCKET);
+    return NULL;
+}
+
+// replication
+
+char* test_replication_feed_moves_offset() {
+    replication_info info;
+    replication_get_info(&info);
+    unsigned long long before = info.offset;
+
+    replication_feed("PUT", "key", "value", 5);
+    replication_feed("DEL", "key", NULL, 0);
+    replication_get_info(&info);
+
+    // "PUT 3:key 5:value" and "DEL 3:key"
+    cmunit_assert("offset not moved by the written bytes", info.offset == before + 17 + 9);
+    cmunit_assert("not a primary", !info.replica && info.replica_count == 0);
+    return NULL;
+}
+
+char* test_replication_commands_rejected_from_clients() {
+    struct kvstr_request* req = create_kvstr_request();
+    int result = kvstr_parse_request("REPLACK 2:10", req);
+    cmunit_assert("parsing REPLACK failed", result == 0);
+
+    processClientRequest(1, req);
+    cmunit_assert("REPLACK accepted from a client", strncmp(_mock_lastMessage, "400 ", 4) == 0);
+    free_kvstr_request(&req);
+    return NULL;
+}
+
+char* test_replication_skips_unknown_operations() {
+    gl_kvStore = create_kv_store(16);
+    kv_store_put(gl_kvStore, "a", "1");
+
+    struct kvstr_request* req = create_kvstr_request();
+    kvstr_parse_request("GET 1:a", req);
+    applyReplicatedRequest(req);
+    const char* kept = kv_store_get(gl_kvStore, "a");
+    free_kvstr_request(&req);
+
+    req = create_kvstr_request();
+    kvstr_parse_request("DEL 1:a", req);
+    applyReplicatedRequest(req);
+    const char* deleted = kv_store_get(gl_kvStore, "a");
+    free_kvstr_request(&req);
+    free_kv_store(gl_kvStore);
+
+    cmunit_assert("unknown operation applied as a delete", kept != NULL);
+    cmunit_assert("delete not applied", deleted == NULL);
+    return NULL;
+}
+
+static kv_store* replicatedStore;
+
+static void readReplicatedStore(replication_snapshot_fn read, void* ctx) {
+    read(replicatedStore, ctx);
+}
+
+char* test_replication_streams_snapshot_and_writes() {
+    const char* path = "simplekv_repl_test.sock";
+    startWinsock();
+    SOCKET listener = createSocket(AF_UNIX);
+    bindUnixSocket(listener, path);
+
+    struct sockaddr_un addr = {0};
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    SOCKET client = socket(AF_UNIX, SOCK_STREAM, 0);
+    connect(client, (struct sockaddr*)&addr, sizeof(addr));
+    SOCKET accepted = acceptClientConnection(listener);
+
+    kv_store* store = create_kv_store(16);
+    kv_store_use_int_keys(store);
+    kv_store_put(store, "a", "1");
+    kv_store_put(store, "7", "2");
+    replicatedStore = store;
+    int added = replication_add_replica(accepted, store, readReplicatedStore);
+    replication_feed("DEL", "a", NULL, 0);
+
+    // the snapshot, the position it corresponds to, then the delete
+    char stream[256] = {0};
+    size_t len = 0;
+    while (strstr(stream, "DEL 1:a") == NULL && len < sizeof(stream) - 1) {
+        int n = recv(client, stream + len, (int)(sizeof(stream) - 1 - len), 0);
+        if (n <= 0) {
+            break;
+        }
+        len += n;
+    }
+
+    replication_info info;
+    replication_get_info(&info);
+    replication_stop();
+    closesocket(client);
+    closesocket(listener);
+    remove(path);
+    free_kv_store(store);
+    WSACleanup();
+
+    cmunit_assert("replica not added", added == 0);
+    cmunit_assert("replica not listed", info.replica_count == 1);
+    cmunit_assert("snapshot missing", strncmp(stream, "PUT 1:a 1:1PUT 1:7 1:2REPLPING ", 31) == 0);
+    cmunit_assert("write not streamed", strstr(stream, "DEL 1:a") != NULL);
+    return NULL;
+}
+
+// cluster
+
+char* test_cluster_key_slot() {
+    cmunit_assert("wrong slot", cluster_key_slot("foo") == 12182);
+    cmunit_assert("hash tag ignored", cluster_key_slot("{user1}.name") == cluster_key_slot("user1"));
+    cmunit_assert("empty hash tag used", cluster_key_slot("{}.name") == cluster_key_slot("{}.name") &&
+                                          cluster_key_slot("{}.name") != cluster_key_slot(""));
+
+    int first, last;
+    cmunit_assert("range not parsed", cluster_parse_slots("10-20", &first, &last) == 0 && first == 10 && last == 20);
+    cmunit_assert("single slot not parsed", cluster_parse_slots("7", &first, &last) == 0 && first == 7 && last == 7);
+    cmunit_assert("slot out of range accepted", cluster_parse_slots("0-16384", &first, &last) != 0);
+    cmunit_assert("reversed range accepted", cluster_parse_slots("5-4", &first, &last) != 0);
+    return NULL;
+}
+
+char* test_cluster_routes_keys() {
+    kv_store* store = create_kv_store(16);
+    kv_store_put(store, "bar", "1");
+
+    cluster_enable("127.0.0.1:7000");
+    cluster_assign(0, 8191, "127.0.0.1:7000");
+    cluster_assign(8192, 16383, "127.0.0.1:7001");
+
+    cluster_redirect redirect;
+    cmunit_assert("own slot not served", cluster_route_key(store, "bar", false, true, &redirect) == CLUSTER_ROUTE_LOCAL);
+    cluster_route route = cluster_route_key(store, "foo", false, false, &redirect);
+    cmunit_assert("foreign slot served", route == CLUSTER_ROUTE_MOVED);
+    cmunit_assert("wrong redirect", redirect.slot == 12182 && strcmp(redirect.address, "127.0.0.1:7001") == 0);
+
+    // "bar" (slot 5061) migrates to the other node
+    cmunit_assert("migration not started", cluster_set_migrating(5061, "127.0.0.1:7001") == 0);
+    cmunit_assert("stored key not served", cluster_route_key(store, "bar", false, false, &redirect) == CLUSTER_ROUTE_LOCAL);
+    cmunit_assert("missing key not sent to the target", cluster_route_key(store, "{bar}x", false, false, &redirect) == CLUSTER_ROUTE_ASK);
+    cluster_set_migrating_key("bar");
+    cmunit_assert("write to a migrating key accepted", cluster_route_key(store, "bar", false, true, &redirect) == CLUSTER_ROUTE_TRYAGAIN);
+    cmunit_assert("read of a migrating key refused", cluster_route_key(store, "bar", false, false, &redirect) == CLUSTER_ROUTE_LOCAL);
+    cluster_set_migrating_key(NULL);
+
+    // "foo" (slot 12182) is imported from the other node
+    cmunit_assert("import not started", cluster_set_importing(12182, "127.0.0.1:7001") == 0);
+    cmunit_assert("imported slot served without ASKING", cluster_route_key(store, "foo", false, false, &redirect) == CLUSTER_ROUTE_MOVED);
+    cmunit_assert("imported slot not served after ASKING", cluster_route_key(store, "foo", true, false, &redirect) == CLUSTER_ROUTE_LOCAL);
+
+    cluster_enable(NULL);
+    free_kv_store(store);
+    cmunit_assert("cluster mode not turned off", cluster_route_key(store, "foo", false, false, &redirect) == CLUSTER_ROUTE_LOCAL);
+    return NULL;
+}
+
+char* test_asking_requires_a_session() {
+    handleAskingRequest(1);
+    cmunit_assert("ASKING accepted without a session", strncmp(_mock_lastMessage, "400 ", 4) == 0);
+
+    client_state state = {0};
+    setClientState(&state);
+    handleAskingRequest(1);
+    setClientState(NULL);
+    cmunit_assert("ASKING not accepted", strcmp(_mock_lastMessage, "200 OK") == 0 && state.asking);
+    return NULL;
+}
+
+// client side caching
+
+static void capturePush(void* ctx, const char* message, size_t length) {
+    byte_buffer* pushes = ctx;
+    byte_buffer_append(pushes, message, length);
+    byte_buffer_append(pushes, "|", 1);
+}
+
+static int pushedEquals(byte_buffer* pushes, const char* expected) {
+    return pushes->len == strlen(expected) && memcmp(pushes->data, expected, pushes->len) == 0;
+}
+
+char* test_tracking_invalidates_readers_once() {
+    byte_buffer first = {0};
+    byte_buffer second = {0};
+    unsigned long long a = tracking_register(capturePush, &first);
+    unsigned long long b = tracking_register(capturePush, &second);
+    cmunit_assert("client not registered", a != TRACKING_NO_CLIENT && b != TRACKING_NO_CLIENT && a != b);
+
+    tracking_remember(a, "akey");
+    tracking_remember(a, "akey");
+    tracking_remember(b, "akey");
+    tracking_invalidate("other");
+    tracking_invalidate("akey");
+    tracking_invalidate("akey"); // not read again since the last change
+    cmunit_assert("wrong invalidation", pushedEquals(&first, "INVALIDATE 4:akey|"));
+    cmunit_assert("second reader not invalidated", pushedEquals(&second, "INVALIDATE 4:akey|"));
+
+    // a client that is gone is not pushed to anymore, even for keys it read before
+    tracking_remember(b, "bkey");
+    tracking_unregister(b);
+    tracking_remember(b, "ckey");
+    tracking_invalidate("bkey");
+    cmunit_assert("unregistered client invalidated", pushedEquals(&second, "INVALIDATE 4:akey|"));
+
+    tracking_remember(a, "dkey");
+    tracking_invalidate_all();
+    size_t clients, keys;
+    tracking_get_counts(&clients, &keys);
+    cmunit_assert("flush not pushed", pushedEquals(&first, "INVALIDATE 4:akey|INVALIDATE|"));
+    cmunit_assert("keys still tracked", clients == 1 && keys == 0);
+
+    tracking_unregister(a);
+    byte_buffer_free(&first);
+    byte_buffer_free(&second);
+    return NULL;
+}
+
+char* test_tracking_session_invalidated_on_write() {
+    gl_kvStore = create_kv_store(16);
+    kv_store_put(gl_kvStore, "akey", "old");
+
+    handleTrackingRequest(1, "ON");
+    cmunit_assert("TRACKING accepted without a session", strncmp(_mock_lastMessage, "400 ", 4) == 0);
+
+    byte_buffer pushes = {0};
+    client_state state = {.push = capturePush, .pushCtx = &pushes};
+    setClientState(&state);
+    handleTrackingRequest(1, "ON");
+    cmunit_assert("TRACKING not accepted", strcmp(_mock_lastMessage, "200 OK") == 0 && state.tracking != TRACKING_NO_CLIENT);
+    handleGetRequest(1, "akey");
+    handleGetRequest(1, "missing");
+    setClientState(NULL);
+
+    handlePutRequest(1, "missing", "new");
+    cmunit_assert("invalidation for a key that was not cached", pushes.len == 0);
+    handlePutRequest(1, "akey", "new");
+    cmunit_assert("write not invalidated", pushedEquals(&pushes, "INVALIDATE 4:akey|"));
+
+    setClientState(&state);
+    handleTrackingRequest(1, "OFF");
+    handleGetRequest(1, "akey");
+    setClientState(NULL);
+    handleDelRequest(1, "akey");
+    cmunit_assert("invalidated after TRACKING OFF", pushedEquals(&pushes, "INVALIDATE 4:akey|"));
+
+    byte_buffer_free(&pushes);
+    free_kv_store(gl_kvStore);
+    return NULL;
+}
+
+// passes a request to the handler of its operation
+static void handleParsed(const char* request) {
+    struct kvstr_request* req = create_kvstr_request();
+    kvstr_parse_request(request, req);
+    if (strcmp(req->operation, "HSET") == 0) {
+        handleHsetRequest(1, req);
+    } else if (strcmp(req->operation, "HGET") == 0) {
+        handleHgetRequest(1, req);
+    } else if (strcmp(req->operation, "HDEL") == 0) {
+        handleHdelRequest(1, req);
+    } else if (strcmp(req->operation, "HRESTORE") == 0) {
+        handleHrestoreRequest(1, req);
+    } else if (strcmp(req->operation, "SETRANGE") == 0) {
+        handleSetrangeRequest(1, req);
+    }
+    free_kvstr_request(&req);
+}
+
+// key change notifications
+
+char* test_watch_notifies_keys_and_prefixes() {
+    byte_buffer first = {0};
+    byte_buffer second = {0};
+    cmunit_assert("notifier not started", watch_start() == 0);
+    unsigned long long a = watch_register(capturePush, &first);
+    unsigned long long b = watch_register(capturePush, &second);
+    cmunit_assert("client not registered", a != WATCH_NO_CLIENT && b != WATCH_NO_CLIENT && a != b);
+
+    cmunit_assert("key not watched", watch_add(a, "user:1") == 0 && watch_add(a, "user:*") == 0);
+    cmunit_assert("prefix not watched", watch_add(b, "user:*") == 0 && watch_add(b, "u*") == 0);
+    watch_changed("PUT", "user:1");   // once per client, whichever patterns match
+    watch_changed("DEL", "user:22");
+    watch_changed("PUT", "other");
+    watch_changed("PUT", "u");
+
+    // stopping notifies everything that was queued
+    watch_stop();
+    size_t clients, patterns;
+    unsigned long long dropped;
+    watch_get_counts(&clients, &patterns, &dropped);
+    cmunit_assert("wrong counts", clients == 2 && patterns == 3 && dropped == 0);
+    cmunit_assert("wrong notifications", pushedEquals(&first, "NOTIFY PUT 6:user:1|NOTIFY DEL 7:user:22|"));
+    cmunit_assert("wrong prefix notifications",
+                  pushedEquals(&second, "NOTIFY PUT 6:user:1|NOTIFY DEL 7:user:22|NOTIFY PUT 1:u|"));
+
+    cmunit_assert("notifier not started", watch_start() == 0);
+    cmunit_assert("pattern not removed", watch_remove(b, "u*") == 0 && watch_remove(b, "u*") != 0);
+    watch_unregister(a);
+    watch_changed("PUT", "user:3");
+    watch_changed("PUT", "u");
+    watch_changed_all();
+    watch_stop();
+    watch_get_counts(&clients, &patterns, &dropped);
+    cmunit_assert("client not forgotten", clients == 1 && patterns == 1);
+    cmunit_assert("unregistered client notified", pushedEquals(&first, "NOTIFY PUT 6:user:1|NOTIFY DEL 7:user:22|"));
+    cmunit_assert("wrong notifications after changes",
+                  pushedEquals(&second, "NOTIFY PUT 6:user:1|NOTIFY DEL 7:user:22|NOTIFY PUT 1:u|NOTIFY PUT 6:user:3|NOTIFY|"));
+
+    watch_unregister(b);
+    byte_buffer_free(&first);
+    byte_buffer_free(&second);
+    return NULL;
+}
+
+char* test_watch_session_notified_on_write() {
+    gl_kvStore = create_kv_store(16);
+    handleWatchRequest(1, "WATCH", "akey");
+    cmunit_assert("WATCH accepted without a session", strncmp(_mock_lastMessage, "400 ", 4) == 0);
+
+    byte_buffer pushes = {0};
+    client_state state = {.push = capturePush, .pushCtx = &pushes};
+    cmunit_assert("notifier not started", watch_start() == 0);
+    setClientState(&state);
+    handleWatchRequest(1, "WATCH", "akey");
+    cmunit_assert("WATCH not accepted", strcmp(_mock_lastMessage, "200 OK") == 0 && state.watching != WATCH_NO_CLIENT);
+    handleWatchRequest(1, "UNWATCH", "bkey");
+    cmunit_assert("UNWATCH of a key not watched accepted", strncmp(_mock_lastMessage, "404 ", 4) == 0);
+    setClientState(NULL);
+
+    handlePutRequest(1, "akey", "new");
+    handlePutRequest(1, "bkey", "new");
+    handleDelRequest(1, "akey");
+    handleDelRequest(1, "akey"); // nothing changed
+    watch_stop();
+    cmunit_assert("writes not notified", pushedEquals(&pushes, "NOTIFY PUT 4:akey|NOTIFY DEL 4:akey|"));
+
+    // field and range writes are notified with their own operation
+    cmunit_assert("notifier not started", watch_start() == 0);
+    setClientState(&state);
+    handleWatchRequest(1, "WATCH", "hkey");
+    setClientState(NULL);
+    handleParsed("HSET 4:hkey 1:f 1:1");
+    handleParsed("HDEL 4:hkey 1:f");
+    handleParsed("SETRANGE 4:hkey 1:0 1:x");
+    watch_stop();
+    cmunit_assert("field writes not notified", pushedEquals(&pushes, "NOTIFY PUT 4:akey|NOTIFY DEL 4:akey|NOTIFY HSET 4:hkey|"
+                                                                     "NOTIFY HDEL 4:hkey|NOTIFY SETRANGE 4:hkey|"));
+
+    watch_unregister(state.watching);
+    byte_buffer_free(&pushes);
+    free_kv_store(gl_kvStore);
+    return NULL;
+}
+
+static void captureParsed(unsigned long long connection, const char *request) {
+    struct kvstr_request *req = create_kvstr_request();
+    kvstr_parse_request(request, req);
+    capture_request(connection, req);
+    free_kvstr_request(&req);
+}
+
+char* test_capture_records_requests_as_sent() {
+    const char *path = "capture_test.bin";
+    cmunit_assert("capture not started", capture_start(path, 4096, 1) == 0);
+    captureParsed(7, "HELLO\r\n");
+    captureParsed(7, "PUT 4:akey 3:a b");
+    captureParsed(7, "WATCH 2:a*");
+    captureParsed(7, "SYNC\r\n"); // internal to replication links
+
+    // processed requests are captured, without a session each of them on a connection of its own
+    gl_kvStore = create_kv_store(16);
+    struct kvstr_request *req = create_kvstr_request();
+    kvstr_parse_request("GET 4:akey", req);
+    processClientRequest(1, req);
+    processClientRequest(1, req);
+    free_kvstr_request(&req);
+
+    char *large = malloc(5001);
+    memset(large, 'v', 5000);
+    large[5000] = '\0';
+    struct kvstr_request put = {.operation = "PUT", .key = "big", .value = large, .value_len = 5000};
+    capture_request(7, &put); // does not fit into the ring
+    free(large);
+
+    unsigned long long records, dropped;
+    capture_get_counts(&records, &dropped);
+    cmunit_assert("wrong counts while capturing", records == 5 && dropped == 1);
+    cmunit_assert("capture not written", capture_stop() == 0);
+    capture_get_counts(&records, &dropped);
+    cmunit_assert("wrong counts after the capture", records == 5 && dropped == 1);
+
+    FILE *in = fopen(path, "rb");
+    cmunit_assert("capture file missing", in != NULL && capture_read_header(in) == 0);
+    const char *expected[] = {"HELLO\r\n", "PUT 4:akey 3:a b", "WATCH 2:a*", "GET 4:akey", "GET 4:akey"};
+    unsigned long long connections[5];
+    unsigned long long lastTime = 0;
+    capture_record record;
+    for (int i = 0; i < 5; i++) {
+        cmunit_assert("record missing", capture_read_record(in, &record) == 1);
+        bool same = record.length == strlen(expected[i]) && memcmp(record.data, expected[i], record.length) == 0;
+        connections[i] = record.connection;
+        bool ordered = record.time >= lastTime;
+        lastTime = record.time;
+        free(record.data);
+        cmunit_assert("request not recorded as sent", same);
+        cmunit_assert("records out of order", ordered);
+    }
+    cmunit_assert("unexpected record", capture_read_record(in, &record) == 0);
+    fclose(in);
+    remove(path);
+    free_kv_store(gl_kvStore);
+
+    cmunit_assert("session requests on different connections",
+                  connections[0] == 7 && connections[1] == 7 && connections[2] == 7);
+    cmunit_assert("one-shot requests share a connection",
+                  connections[3] != 7 && connections[4] != 7 && connections[3] != connections[4]);
+    return NULL;
+}
+
+static DWORD WINAPI readHotKey(LPVOID arg) {
+    for (int i = 0; i < 50; i++) {
+        hotkeys_record(HOTKEYS_READ, (const char*)arg);
+    }
+    return 0;
+}
+
+char* test_hotkeys_reports_most_accessed_keys() {
+    hotkeys_reset();
+    char key[32];
+    for (int i = 0; i < 200; i++) {
+        snprintf(key, sizeof(key), "cold:%d", i);
+        hotkeys_record(HOTKEYS_READ, key);
+        hotkeys_record(i % 20 == 0 ? HOTKEYS_WRITE : HOTKEYS_READ, i % 10 == 0 ? "warm" : "hot");
+    }
+    // accesses of other threads are added up
+    HANDLE thread = CreateThread(NULL, 0, readHotKey, "hot", 0, NULL);
+    WaitForSingleObject(thread, INFINITE);
+    CloseHandle(thread);
+
+    hotkeys_entry entries[HOTKEYS_TOP];
+    size_t count = hotkeys_top(HOTKEYS_READ, entries, HOTKEYS_TOP);
+    cmunit_assert("keys missing", count == HOTKEYS_TOP);
+    cmunit_assert("hottest key not first", strcmp(entries[0].key, "hot") == 0 && entries[0].key_len == 3);
+    cmunit_assert("wrong count of the hottest key", entries[0].count >= 230 && entries[0].count < 240);
+    cmunit_assert("second hottest key not second", strcmp(entries[1].key, "warm") == 0 && entries[1].count >= 10);
+    cmunit_assert("cold keys above the hot ones", entries[2].count < 10);
+
+    count = hotkeys_top(HOTKEYS_WRITE, entries, HOTKEYS_TOP);
+    cmunit_assert("wrong writes", count == 1 && strcmp(entries[0].key, "warm") == 0 && entries[0].count >= 10);
+
+    hotkeys_reset();
+    cmunit_assert("keys not reset", hotkeys_top(HOTKEYS_READ, entries, HOTKEYS_TOP) == 0);
+
+    // accesses older than the window are not reported anymore
+    hotkeys_set_window(20);
+    hotkeys_record(HOTKEYS_READ, "hot");
+    cmunit_assert("key missing", hotkeys_top(HOTKEYS_READ, entries, HOTKEYS_TOP) == 1);
+    Sleep(50);
+    cmunit_assert("old accesses reported", hotkeys_top(HOTKEYS_READ, entries, HOTKEYS_TOP) == 0);
+    hotkeys_set_window(HOTKEYS_DEFAULT_WINDOW);
+    hotkeys_reset();
+    return NULL;
+}
+
+char* test_handleHotkeysRequest_lists_hot_keys() {
+    gl_kvStore = create_kv_store(16);
+    handleHotkeysRequest(1, "RESET");
+    cmunit_assert("hotkeys not reset", strcmp(_mock_lastMessage, "200 Hotkeys reset") == 0);
+
+    handlePutRequest(1, "a key", "value");
+    handleGetRequest(1, "a key");
+    handleGetRequest(1, "a key");
+    handleGetRequest(1, "missing");
+    handleHotkeysRequest(1, "GET");
+    cmunit_assert("wrong header", strncmp(_mock_lastMessage, "200 window_ms:10000 reads:2 writes:1\r\n", 38) == 0);
+    const char* first = strstr(_mock_lastMessage, "op=read count=2 key=a.key key_len=5");
+    const char* second = strstr(_mock_lastMessage, "op=read count=1 key=missing key_len=7");
+    cmunit_assert("reads missing", first != NULL && second != NULL && first < second);
+    cmunit_assert("write missing", strstr(_mock_lastMessage, "op=write count=1 key=a.key key_len=5") != NULL);
+
+    handleHotkeysRequest(1, "FOO");
+    cmunit_assert("unknown subcommand accepted", strncmp(_mock_lastMessage, "400 ", 4) == 0);
+    hotkeys_reset();
+    free_kv_store(gl_kvStore);
+    return NULL;
+}
+
+char* test_kv_store_allocators_track_memory() {
+    const char* names[] = {"system", "arena", "slab"};
+    for (size_t n = 0; n < sizeof(names) / sizeof(names[0]); n++) {
+        kv_store* store = create_kv_store_with_allocator(2, kv_allocator_create(names[n]));
+        cmunit_assert("allocating kv_store failed", store != NULL);
+        size_t emptyBytes = store->allocated_bytes;
+        cmunit_assert("entries not counted", store->allocations == 1 && emptyBytes == 2 * sizeof(kv_entry));
+
+        char key[16];
+        for (int i = 0; i < 100; i++) {
+            snprintf(key, sizeof(key), "key%d", i);
+            cmunit_assert("put failed", kv_store_put(store, key, "value") == 0);
+        }
+        cmunit_assert("value not stored", strcmp(kv_store_get(store, "key42"), "value") == 0);
+
+        // an owned value is copied into the allocator of the store unless it is the system allocator
+        char* big = malloc(5000);
+        memset(big, 'x', 4999);
+        big[4999] = '\0';
+        int stored = kv_store_put_owned(store, "key7", big, 4999);
+        cmunit_assert("put_owned failed", stored == (strcmp(names[n], "system") == 0 ? 0 : KV_STORE_COPIED));
+        if (stored == KV_STORE_COPIED) free(big);
+        cmunit_assert("owned value lost", strlen(kv_store_get(store, "key7")) == 4999);
+
+        kv_memory_stats stats;
+        kv_store_memory_stats(store, &stats);
+        cmunit_assert("wrong allocator", strcmp(stats.allocator, names[n]) == 0);
+        cmunit_assert("wrong allocation count", stats.allocations == 201);
+        cmunit_assert("too little reserved", stats.reserved_bytes >= stats.allocated_bytes && stats.fragmentation >= 1.0);
+
+        for (int i = 0; i < 100; i++) {
+            snprintf(key, sizeof(key), "key%d", i);
+            cmunit_assert("delete failed", kv_store_delete(store, key) == 0);
+        }
+        cmunit_assert("allocations left", store->allocations == 1 && store->allocated_bytes == 128 * sizeof(kv_entry));
+        free_kv_store(store);
+    }
+    return NULL;
+}
+
+char* test_handleMemoryRequest_reports_allocator() {
+    gl_kvStore = create_kv_store_with_allocator(16, kv_allocator_slab());
+    handlePutRequest(1, "akey", "value");
+    handleMemoryRequest(1, "STATS");
+    cmunit_assert("wrong header", strncmp(_mock_lastMessage, "200 allocator:slab\r\n", 20) == 0);
+    char expected[64];
+    snprintf(expected, sizeof(expected), "allocated_bytes:%zu\r\nallocations:3\r\n", 16 * sizeof(kv_entry) + 5 + 6);
+    cmunit_assert("wrong allocations", strstr(_mock_lastMessage, expected) != NULL);
+    cmunit_assert("reserved missing", strstr(_mock_lastMessage, "reserved_bytes:131072\r\nfragmentation_ratio:") != NULL);
+
+    handleMemoryRequest(1, "DOCTOR");
+    cmunit_assert("unknown subcommand accepted", strncmp(_mock_lastMessage, "400 ", 4) == 0);
+    free_kv_store(gl_kvStore);
+    return NULL;
+}
+
+static int countVisitedKeys(const char* key, const kv_entry* entry, void* ctx) {
+    size_t* sum = ctx;
+    sum[0]++;
+    sum[1] += strtoull(key, NULL, 10);
+    return 0;
+}
+
+char* test_kv_store_int_keys() {
+    kv_store* store = create_kv_store(4);
+    cmunit_assert("enabling int keys failed", kv_store_use_int_keys(store) == 0);
+
+    unsigned long long id;
+    cmunit_assert("not an int key", kv_parse_int_key("18446744073709551615", &id) && id == 18446744073709551615ULL);
+    cmunit_assert("overflow accepted", !kv_parse_int_key("18446744073709551616", &id));
+    cmunit_assert("leading zero accepted", !kv_parse_int_key("007", &id) && kv_parse_int_key("0", &id));
+    cmunit_assert("sign accepted", !kv_parse_int_key("-1", &id) && !kv_parse_int_key("", &id));
+
+    // the non-canonical keys stay strings, so "007" and "7" are different keys
+    kv_store_put(store, "7", "seven");
+    kv_store_put(store, "007", "bond");
+    cmunit_assert("int key lost", strcmp(kv_store_get(store, "7"), "seven") == 0);
+    cmunit_assert("string key lost", strcmp(kv_store_get(store, "007"), "bond") == 0);
+    cmunit_assert("int key stored as string", store->size == 1 && store->int_size == 1);
+    kv_store_put(store, "7", "sieben");
+    cmunit_assert("int key not overwritten", strcmp(kv_store_get(store, "7"), "sieben") == 0 && store->int_size == 1);
+
+    // growing and deleting, keys behind a deleted one in its probe sequence have to stay reachable
+    char key[24];
+    for (int i = 1000; i < 21000; i++) {
+        snprintf(key, sizeof(key), "%d", i);
+        cmunit_assert("put failed", kv_store_put(store, key, key) == 0);
+    }
+    for (int i = 1000; i < 21000; i += 2) {
+        snprintf(key, sizeof(key), "%d", i);
+        cmunit_assert("delete failed", kv_store_delete(store, key) == 0);
+    }
+    for (int i = 1000; i < 21000; i++) {
+        snprintf(key, sizeof(key), "%d", i);
+        const char* value = kv_store_get(store, key);
+        cmunit_assert("wrong key after delete", i % 2 == 0 ? value == NULL : value != NULL && strcmp(value, key) == 0);
+    }
+    cmunit_assert("deleted twice", kv_store_delete(store, "1000") == -1);
+    cmunit_assert("wrong count", kv_store_count(store) == 10002);
+
+    size_t visited[2] = {0, 0};
+    kv_store_foreach(store, countVisitedKeys, visited);
+    cmunit_assert("wrong keys visited", visited[0] == 10002 && visited[1] == 7 + 7 + 10000 * 11000ULL);
+
+    free_kv_store(store);
+    return NULL;
+}
+
+static int countScannedKeys(const char* key, const kv_entry* entry, void* ctx) {
+    size_t* counts = ctx;
+    counts[key[0] - 'a']++;
+    return 0;
+}
+
+char* test_kv_store_scan_in_batches() {
+    kv_store* store = create_kv_store(2);
+    kv_store_use_int_keys(store);
+    const char* keys[] = {"a", "b", "c", "d", "e", "42"};
+    for (size_t i = 0; i < sizeof(keys) / sizeof(keys[0]); i++) {
+        kv_store_put(store, keys[i], "v");
+    }
+
+    // keys that stay are visited once, while the store changes between the batches
+    size_t counts[8] = {0};
+    size_t cursor = 0;
+    kv_store_scan(store, &cursor, 2, countScannedKeys, counts);
+    kv_store_delete(store, "a");
+    kv_store_delete(store, "d");
+    kv_store_put(store, "f", "v");
+    kv_store_put(store, "g", "v");
+    int batches = 1;
+    while (cursor < store->size) {
+        kv_store_scan(store, &cursor, 2, countScannedKeys, counts);
+        batches++;
+    }
+    cmunit_assert("kept keys not visited once", counts[0] == 1 && counts[1] == 1 && counts[2] == 1 && counts[4] == 1);
+    cmunit_assert("deleted key visited", counts[3] == 0);
+    cmunit_assert("not scanned in batches", batches > 2);
+
+    unsigned long long* ids;
+    size_t count;
+    cmunit_assert("int keys not listed", kv_store_int_keys(store, &ids, &count) == 0 && count == 1 && ids[0] == 42);
+    free(ids);
+
+    free_kv_store(store);
+    return NULL;
+}
+
+char* test_kv_store_keeps_numbers_inline() {
+    kv_store* store = create_kv_store(4);
+    kv_store_put(store, "n", "-42");
+    const kv_entry* entry = kv_store_lookup(store, "n");
+    cmunit_assert("number not inline", kv_entry_is_number(entry) && entry->number == -42 && kv_entry_value_len(entry) == 3);
+    cmunit_assert("number not rendered", strcmp(kv_store_get(store, "n"), "-42") == 0);
+    cmunit_assert("number allocated", store->allocations == 2); // entries and key
+
+    // anything that would not be rendered back the same stays text
+    const char* texts[] = {"007", "-0", "+1", "1.0", "9223372036854775808", "-9223372036854775809", ""};
+    for (size_t i = 0; i < sizeof(texts) / sizeof(texts[0]); i++) {
+        kv_store_put(store, "t", texts[i]);
+        entry = kv_store_lookup(store, "t");
+        cmunit_assert("text kept as number", !kv_entry_is_number(entry) && strcmp(entry->value, texts[i]) == 0);
+    }
+    kv_store_put(store, "t", "-9223372036854775808");
+    cmunit_assert("minimum not inline", kv_entry_is_number(kv_store_lookup(store, "t")));
+
+    long long result;
+    cmunit_assert("incrby failed", kv_store_incrby(store, "n", 50, &result) == 0 && result == 8);
+    cmunit_assert("incrby not stored", strcmp(kv_store_get(store, "n"), "8") == 0 && store->data_size == 2 + 1 + 20);
+    cmunit_assert("missing key not 0", kv_store_incrby(store, "new", -3, &result) == 0 && result == -3);
+    cmunit_assert("underflow not detected", kv_store_incrby(store, "t", -1, &result) == KV_STORE_OVERFLOW);
+    kv_store_put(store, "s", "text");
+    cmunit_assert("text incremented", kv_store_incrby(store, "s", 1, &result) == KV_STORE_NOT_A_NUMBER);
+
+    // an owned number stays with the caller, number 0 in the table of integer keys is not a free slot
+    kv_store_use_int_keys(store);
+    char zero[] = "0";
+    cmunit_assert("put_owned failed", kv_store_put_owned(store, "17", zero, 1) == KV_STORE_COPIED);
+    cmunit_assert("zero lost", strcmp(kv_store_get(store, "17"), "0") == 0 && kv_store_count(store) == 5);
+    cmunit_assert("zero not deleted", kv_store_delete(store, "17") == 0 && kv_store_get(store, "17") == NULL);
+
+    free_kv_store(store);
+    return NULL;
+}
+
+char* test_handleIncrbyRequest() {
+    gl_kvStore = create_kv_store(16);
+    handleIncrbyRequest(1, "counter", "5");
+    cmunit_assert("wrong first value", strcmp(_mock_lastMessage, "200 5") == 0);
+    handleIncrbyRequest(1, "counter", "-7");
+    cmunit_assert("wrong second value", strcmp(_mock_lastMessage, "200 -2") == 0);
+    handleGetRequest(1, "counter");
+    cmunit_assert("GET of number wrong", strcmp(_mock_lastMessage, "200 -2") == 0);
+
+    handleIncrbyRequest(1, "counter", "1x");
+    cmunit_assert("bad delta accepted", strncmp(_mock_lastMessage, "400 ", 4) == 0);
+    handlePutRequest(1, "text", "value");
+    handleIncrbyRequest(1, "text", "1");
+    cmunit_assert("text incremented", strcmp(_mock_lastMessage, "409 Conflict: Value is not an integer") == 0);
+    free_kv_store(gl_kvStore);
+    return NULL;
+}
+
+char* test_kvcompress_round_trip() {
+    // repetitive text, an overlapping match (a run of one byte) and lengths needing continuation bytes
+    char text[4000];
+    for (size_t i = 0; i < sizeof(text); i++) {
+        text[i] = i < 1000 ? "abcdefgh"[i % 8] : i < 2000 ? 'x' : (char)(i * 7919 % 251);
+    }
+    char block[4000];
+    size_t block_len = kvcompress_encode(text, sizeof(text), block, sizeof(block));
+    cmunit_assert("not compressed", block_len > 0 && block_len < 2100);
+    char decoded[4000];
+    cmunit_assert("decode failed", kvcompress_decode(block, block_len, decoded, sizeof(decoded)) == 0);
+    cmunit_assert("wrong text", memcmp(decoded, text, sizeof(text)) == 0);
+
+    cmunit_assert("too small output accepted", kvcompress_encode(text, sizeof(text), block, 100) == 0);
+    cmunit_assert("wrong length accepted", kvcompress_decode(block, block_len, decoded, sizeof(decoded) - 1) != 0);
+    cmunit_assert("truncated block accepted", kvcompress_decode(block, block_len / 2, decoded, sizeof(decoded)) != 0);
+    return NULL;
+}
+
+char* test_kv_store_compresses_large_values() {
+    kv_store* store = create_kv_store(4);
+    kv_store_set_compression(store, 1024);
+    char text[5000];
+    for (size_t i = 0; i < sizeof(text) - 1; i++) {
+        text[i] = "value "[i % 6];
+    }
+    text[sizeof(text) - 1] = '\0';
+
+    kv_store_put(store, "big", text);
+    kv_store_put(store, "small", "value value value value");
+    const kv_entry* entry = kv_store_lookup(store, "big");
+    cmunit_assert("large value not compressed", kv_entry_is_compressed(entry) && kv_entry_value_len(entry) == 4999);
+    cmunit_assert("small value compressed", !kv_entry_is_compressed(kv_store_lookup(store, "small")));
+    cmunit_assert("wrong value", strcmp(kv_store_get(store, "big"), text) == 0);
+    cmunit_assert("text not counted", store->compressed_values == 1 && store->compressed_raw_bytes == 4999);
+    cmunit_assert("not smaller", store->compressed_stored_bytes < 500 && store->allocated_bytes < 4 * sizeof(kv_entry) + 600);
+
+    // random bytes do not compress and stay text
+    char noise[2000];
+    unsigned int seed = 42;
+    for (size_t i = 0; i < sizeof(noise) - 1; i++) {
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+        noise[i] = (char)('!' + seed % 90);
+    }
+    noise[sizeof(noise) - 1] = '\0';
+    char* owned = malloc(sizeof(noise));
+    strcpy(owned, noise);
+    cmunit_assert("noise not adopted", kv_store_put_owned(store, "noise", owned, strlen(owned)) == 0);
+    cmunit_assert("noise compressed", !kv_entry_is_compressed(kv_store_lookup(store, "noise")) && store->compress_skipped == 1);
+    cmunit_assert("wrong noise", strcmp(kv_store_get(store, "noise"), noise) == 0);
+
+    char* large = malloc(sizeof(text));
+    strcpy(large, text);
+    cmunit_assert("compressed value adopted", kv_store_put_owned(store, "big2", large, strlen(large)) == KV_STORE_COPIED);
+    free(large);
+    cmunit_assert("owned value not compressed", kv_entry_is_compressed(kv_store_lookup(store, "big2")));
+    kv_store_delete(store, "big2");
+
+    kv_store_put(store, "big", "short");
+    cmunit_assert("old value not released", store->compressed_values == 0 && store->compressed_stored_bytes == 0);
+    long long result;
+    kv_store_put(store, "big", text);
+    cmunit_assert("compressed value incremented", kv_store_incrby(store, "big", 1, &result) == KV_STORE_NOT_A_NUMBER);
+    free_kv_store(store);
+    return NULL;
+}
+
+char* test_handleGetzRequest_sends_stored_block() {
+    gl_kvStore = create_kv_store(16);
+    kv_store_set_compression(gl_kvStore, 64);
+    char text[201];
+    memset(text, 'a', 200);
+    text[200] = '\0';
+    handlePutRequest(1, "akey", text);
+
+    handleGetRequest(1, "akey");
+    cmunit_assert("GET not decompressed", strncmp(_mock_lastMessage, "200 aaaa", 8) == 0 && strlen(_mock_lastMessage) == 204);
+    handleGetzRequest(1, "akey");
+    cmunit_assert("GETZ not compressed", strncmp(_mock_lastMessage, "200 lz 200 ", 11) == 0);
+    handlePutRequest(1, "akey", "plain");
+    handleGetzRequest(1, "akey");
+    cmunit_assert("GETZ of text wrong", strcmp(_mock_lastMessage, "200 raw plain") == 0);
+
+    handleMemoryRequest(1, "STATS");
+    cmunit_assert("compression stats missing", strstr(_mock_lastMessage, "\r\ncompressed_values:0\r\n") != NULL &&
+                  strstr(_mock_lastMessage, "\r\ncompress_skipped:0") != NULL);
+    free_kv_store(gl_kvStore);
+    return NULL;
+}
+
+static int countHashField(const char* field, size_t field_len, const char* value, size_t value_len, void* ctx) {
+    (void)field;
+    (void)value;
+    *(size_t*)ctx += field_len + value_len;
+    return 0;
+}
+
+char* test_kv_store_hash_fields() {
+    kv_store* store = create_kv_store(4);
+    size_t baseline = store->allocated_bytes;
+    cmunit_assert("field not new", kv_store_hset(store, "h", "name", 4, "alice", 5) == 1);
+    cmunit_assert("field not updated", kv_store_hset(store, "h", "name", 4, "bob", 3) == 0);
+    kv_store_hset(store, "h", "age", 3, "42", 2);
+    const char* value;
+    size_t value_len;
+    cmunit_assert("field missing", kv_store_hget(store, "h", "name", 4, &value, &value_len) == 0);
+    cmunit_assert("wrong field", value_len == 3 && memcmp(value, "bob", 3) == 0);
+    cmunit_assert("unknown field found", kv_store_hget(store, "h", "nope", 4, &value, &value_len) == -1);
+    cmunit_assert("hash has a value", kv_store_get(store, "h") == NULL);
+
+    // more fields than the packed encoding holds, all of them stay reachable after the conversion
+    char field[16];
+    for (int i = 0; i < KV_HASH_PACKED_MAX_FIELDS + 50; i++) {
+        int len = snprintf(field, sizeof(field), "f%d", i);
+        kv_store_hset(store, "h", field, len, field, len);
+    }
+    const kv_entry* entry = kv_store_lookup(store, "h");
+    cmunit_assert("wrong field count", kv_entry_hash_len(entry) == KV_HASH_PACKED_MAX_FIELDS + 52);
+    size_t bytes = 0;
+    kv_entry_hash_foreach(entry, countHashField, &bytes);
+    cmunit_assert("wrong hash length", bytes == kv_entry_value_len(entry) && bytes == store->data_size - 1);
+    cmunit_assert("converted field missing", kv_store_hget(store, "h", "f100", 4, &value, &value_len) == 0 &&
+                  value_len == 4 && memcmp(value, "f100", 4) == 0);
+    cmunit_assert("old field missing", kv_store_hget(store, "h", "age", 3, &value, &value_len) == 0);
+
+    char large[KV_HASH_PACKED_MAX_LEN + 10];
+    memset(large, 'x', sizeof(large));
+    kv_store_hset(store, "small", "a", 1, "1", 1);
+    cmunit_assert("long value not stored", kv_store_hset(store, "small", "b", 1, large, sizeof(large)) == 1);
+    cmunit_assert("long value wrong", kv_store_hget(store, "small", "b", 1, &value, &value_len) == 0 &&
+                  value_len == sizeof(large));
+    cmunit_assert("short value lost", kv_store_hget(store, "small", "a", 1, &value, &value_len) == 0 && *value == '1');
+
+    cmunit_assert("field not deleted", kv_store_hdel(store, "small", "a", 1) == 0);
+    cmunit_assert("field deleted twice", kv_store_hdel(store, "small", "a", 1) == -1);
+    kv_store_hdel(store, "small", "b", 1);
+    cmunit_assert("empty hash kept", kv_store_lookup(store, "small") == NULL);
+
+    kv_store_put(store, "text", "value");
+    cmunit_assert("field set on text", kv_store_hset(store, "text", "a", 1, "1", 1) == KV_STORE_WRONG_TYPE);
+    cmunit_assert("field read from text", kv_store_hget(store, "text", "a", 1, &value, &value_len) == KV_STORE_WRONG_TYPE);
+    kv_store_put(store, "h", "value");
+    kv_store_delete(store, "h");
+    kv_store_delete(store, "text");
+    cmunit_assert("hash memory not released", store->allocated_bytes == baseline && store->data_size == 0);
+    free_kv_store(store);
+    return NULL;
+}
+
+char* test_handleHashRequests() {
+    gl_kvStore = create_kv_store(16);
+    handleParsed("HSET 4:user 4:name 5:alice");
+    cmunit_assert("HSET of new field wrong", strcmp(_mock_lastMessage, "200 1") == 0);
+    handleParsed("HSET 4:user 3:age 2:42");
+    handleParsed("HGET 4:user 4:name");
+    cmunit_assert("HGET wrong", strcmp(_mock_lastMessage, "200 alice") == 0);
+    handleParsed("HGET 4:user 4:none");
+    cmunit_assert("HGET of missing field wrong", strcmp(_mock_lastMessage, "404 Not Found") == 0);
+    handleHgetallRequest(1, "user");
+    cmunit_assert("HGETALL wrong", strcmp(_mock_lastMessage, "200 4:name 5:alice 3:age 2:42") == 0);
+    handleGetRequest(1, "user");
+    cmunit_assert("GET of hash wrong", strcmp(_mock_lastMessage, "409 Conflict: Value is a hash") == 0);
+
+    handleParsed("HDEL 4:user 3:age");
+    cmunit_assert("HDEL wrong", strcmp(_mock_lastMessage, "200 1") == 0);
+    handleParsed("HDEL 4:user 3:age");
+    cmunit_assert("HDEL of missing field wrong", strcmp(_mock_lastMessage, "200 0") == 0);
+    handleParsed("HSET 4:user 4:name");
+    cmunit_assert("HSET without value accepted", strncmp(_mock_lastMessage, "400 ", 4) == 0);
+    handlePutRequest(1, "text", "value");
+    handleParsed("HSET 4:text 1:a 1:1");
+    cmunit_assert("HSET on text wrong", strcmp(_mock_lastMessage, "409 Conflict: Value is not a hash") == 0);
+
+    // what a migration sends, the key is replaced as a whole
+    handleParsed("HRESTORE 4:user 18:1:a 1:1 3:b c 2:xy");
+    cmunit_assert("HRESTORE failed", strncmp(_mock_lastMessage, "201 ", 4) == 0);
+    handleHgetallRequest(1, "user");
+    cmunit_assert("HRESTORE wrong", strcmp(_mock_lastMessage, "200 1:a 1:1 3:b c 2:xy") == 0);
+    handleParsed("HRESTORE 4:user 7:1:a 2:1");
+    cmunit_assert("malformed HRESTORE accepted", strncmp(_mock_lastMessage, "400 ", 4) == 0);
+    free_kv_store(gl_kvStore);
+    return NULL;
+}
+
+char* test_kv_store_setrange() {
+    kv_store* store = create_kv_store(4);
+    size_t length;
+    char text[64];
+    memset(text, 'a', sizeof(text) - 1);
+    text[sizeof(text) - 1] = '\0';
+    kv_store_put(store, "text", text);
+    const char* before = kv_store_lookup(store, "text")->value;
+    cmunit_assert("range not written", kv_store_setrange(store, "text", 10, "bcd", 3, &length) == 0 && length == 63);
+    cmunit_assert("text not changed in place", kv_store_lookup(store, "text")->value == before);
+    cmunit_assert("wrong text", strncmp(kv_store_get(store, "text") + 9, "abcda", 5) == 0);
+
+    // writing behind the end fills the gap with zero bytes
+    kv_store_setrange(store, "text", 70, "end", 3, &length);
+    const kv_entry* entry = kv_store_lookup(store, "text");
+    cmunit_assert("text not grown", length == 73 && kv_entry_value_len(entry) == 73 && store->data_size == 73 + 4);
+    cmunit_assert("gap not zeroed", entry->value[63] == '\0' && entry->value[69] == '\0' && strcmp(entry->value + 70, "end") == 0);
+
+    cmunit_assert("missing key not created", kv_store_setrange(store, "new", 2, "xy", 2, &length) == 0 && length == 4);
+    cmunit_assert("wrong new value", memcmp(kv_store_lookup(store, "new")->value, "\0\0xy", 5) == 0);
+    kv_store_put(store, "number", "1234");
+    kv_store_setrange(store, "number", 1, "9", 1, &length);
+    cmunit_assert("number not changed", kv_entry_is_number(kv_store_lookup(store, "number")) &&
+                  strcmp(kv_store_get(store, "number"), "1934") == 0);
+    kv_store_setrange(store, "number", 4, "x", 1, &length);
+    cmunit_assert("number not turned into text", strcmp(kv_store_get(store, "number"), "1934x") == 0);
+    cmunit_assert("empty range wrote", kv_store_setrange(store, "none", 10, "", 0, &length) == 0 &&
+                  length == 0 && kv_store_lookup(store, "none") == NULL);
+
+    kv_store_hset(store, "hash", "a", 1, "1", 1);
+    cmunit_assert("range written into hash", kv_store_setrange(store, "hash", 0, "x", 1, &length) == KV_STORE_WRONG_TYPE);
+    free_kv_store(store);
+    return NULL;
+}
+
+static void handleRangeRequest(const char* request) {
+    struct kvstr_request* req = create_kvstr_request();
+    kvstr_parse_request(request, req);
+    if (strcmp(req->operation, "GETRANGE") == 0) {
+        handleGetrangeRequest(1, req);
+    } else {
+        handleSetrangeRequest(1, req);
+    }
+    free_kvstr_request(&req);
+}
+
+char* test_handleRangeRequests() {
+    gl_kvStore = create_kv_store(16);
+    kv_store_set_compression(gl_kvStore, 64);
+    handlePutRequest(1, "akey", "0123456789");
+    handleRangeRequest("GETRANGE 4:akey 1:2 1:5");
+    cmunit_assert("GETRANGE wrong", strcmp(_mock_lastMessage, "200 2345") == 0);
+    handleRangeRequest("GETRANGE 4:akey 2:-3 2:-1");
+    cmunit_assert("GETRANGE from the end wrong", strcmp(_mock_lastMessage, "200 789") == 0);
+    handleRangeRequest("GETRANGE 4:akey 1:8 3:100");
+    cmunit_assert("GETRANGE not clamped", strcmp(_mock_lastMessage, "200 89") == 0);
+    handleRangeRequest("GETRANGE 4:akey 1:5 1:2");
+    cmunit_assert("empty GETRANGE wrong", strcmp(_mock_lastMessage, "200 ") == 0);
+    handleRangeRequest("GETRANGE 4:akey 1:x 1:2");
+    cmunit_assert("bad offset accepted", strncmp(_mock_lastMessage, "400 ", 4) == 0);
+    handleRangeRequest("GETRANGE 4:nope 1:0 1:2");
+    cmunit_assert("GETRANGE of missing key wrong", strcmp(_mock_lastMessage, "404 Not Found") == 0);
+
+    handleRangeRequest("SETRANGE 4:akey 1:8 4:abcd");
+    cmunit_assert("SETRANGE wrong", strcmp(_mock_lastMessage, "200 12") == 0);
+    handleGetRequest(1, "akey");
+    cmunit_assert("SETRANGE not stored", strcmp(_mock_lastMessage, "200 01234567abcd") == 0);
+    handleRangeRequest("SETRANGE 4:akey 2:-1 1:x");
+    cmunit_assert("negative offset accepted", strncmp(_mock_lastMessage, "400 ", 4) == 0);
+
+    // compressed values are decompressed and the range is sent
+    char text[201];
+    memset(text, 'a', 200);
+    memcpy(text + 150, "marker", 6);
+    text[200] = '\0';
+    handlePutRequest(1, "big", text);
+    cmunit_assert("not compressed", kv_entry_is_compressed(kv_store_lookup(gl_kvStore, "big")));
+    handleRangeRequest("GETRANGE 3:big 3:150 3:155");
+    cmunit_assert("GETRANGE of compressed value wrong", strcmp(_mock_lastMessage, "200 marker") == 0);
+    free_kv_store(gl_kvStore);
+    return NULL;
+}
+
+char* test_kv_store_versions() {
+    kv_store* store = create_kv_store(4);
+    kv_store_put(store, "a", "value");
+    kv_store_put(store, "b", "value");
+    unsigned long long first = kv_store_lookup(store, "a")->version;
+    cmunit_assert("versions not increasing", first > 0 && kv_store_lookup(store, "b")->version > first);
+    kv_store_put(store, "a", "value");
+    cmunit_assert("same value kept the version", kv_store_lookup(store, "a")->version > first);
+
+    // every kind of write gives a new version, also after the key was deleted and stored again
+    unsigned long long last = kv_store_lookup(store, "a")->version;
+    long long number;
+    size_t length;
+    kv_store_setrange(store, "a", 0, "V", 1, &length);
+    cmunit_assert("SETRANGE kept the version", kv_store_lookup(store, "a")->version > last);
+    kv_store_incrby(store, "n", 1, &number);
+    last = kv_store_lookup(store, "n")->version;
+    kv_store_incrby(store, "n", 1, &number);
+    cmunit_assert("INCRBY kept the version", kv_store_lookup(store, "n")->version > last);
+    kv_store_hset(store, "h", "f", 1, "1", 1);
+    last = kv_store_lookup(store, "h")->version;
+    kv_store_hset(store, "h", "f", 1, "2", 1);
+    cmunit_assert("HSET kept the version", kv_store_lookup(store, "h")->version > last);
+    kv_store_delete(store, "b");
+    kv_store_put(store, "b", "value");
+    cmunit_assert("version reused", kv_store_lookup(store, "b")->version == store->version);
+    free_kv_store(store);
+    return NULL;
+}
+
+static void handleVersionRequest(const char* request) {
+    struct kvstr_request* req = create_kvstr_request();
+    kvstr_parse_request(request, req);
+    if (strcmp(req->operation, "GETV") == 0) {
+        handleGetvRequest(1, req);
+    } else {
+        handlePutvRequest(1, req);
+    }
+    free_kvstr_request(&req);
+}
+
+char* test_handleVersionRequests() {
+    gl_kvStore = create_kv_store(16);
+    gl_kvStore->epoch = 0x2a;
+    handleVersionRequest("PUTV 4:akey 1:0 5:first");
+    cmunit_assert("PUTV of new key failed", strcmp(_mock_lastMessage, "201 Created: Key stored successfully. version:2a.1") == 0);
+    handleVersionRequest("PUTV 4:akey 1:0 5:again");
+    cmunit_assert("PUTV of existing key accepted", strcmp(_mock_lastMessage, "412 Precondition Failed: version:2a.1") == 0);
+    handleVersionRequest("GETV 4:akey 1:0");
+    cmunit_assert("GETV wrong", strcmp(_mock_lastMessage, "200 2a.1 first") == 0);
+    handleVersionRequest("GETV 4:akey 4:2a.1");
+    cmunit_assert("GETV of known version wrong", strcmp(_mock_lastMessage, "304 Not Modified") == 0);
+
+    handleVersionRequest("PUTV 4:akey 4:2a.1 6:second");
+    cmunit_assert("PUTV of current version failed", strcmp(_mock_lastMessage, "201 Created: Key stored successfully. version:2a.2") == 0);
+    handleVersionRequest("PUTV 4:akey 4:2a.1 5:stale");
+    cmunit_assert("PUTV of old version accepted", strcmp(_mock_lastMessage, "412 Precondition Failed: version:2a.2") == 0);
+    handleVersionRequest("GETV 4:akey 4:2a.1");
+    cmunit_assert("GETV of changed value wrong", strcmp(_mock_lastMessage, "200 2a.2 second") == 0);
+    handlePutRequest(1, "akey", "third");
+    cmunit_assert("PUT without version", strcmp(_mock_lastMessage, "201 Created: Key stored successfully. version:2a.3") == 0);
+
+    // the same number from another store (a restarted or resynced one) is a different version
+    handleVersionRequest("GETV 4:akey 4:2b.3");
+    cmunit_assert("GETV of version of another epoch wrong", strcmp(_mock_lastMessage, "200 2a.3 third") == 0);
+    handleVersionRequest("PUTV 4:akey 4:2b.3 5:stale");
+    cmunit_assert("PUTV of version of another epoch accepted", strcmp(_mock_lastMessage, "412 Precondition Failed: version:2a.3") == 0);
+
+    handleVersionRequest("GETV 4:akey 2:-1");
+    cmunit_assert("negative version accepted", strncmp(_mock_lastMessage, "400 ", 4) == 0);
+    handleVersionRequest("GETV 4:akey 1:3");
+    cmunit_assert("version without epoch accepted", strncmp(_mock_lastMessage, "400 ", 4) == 0);
+    handleVersionRequest("GETV 4:akey 3:2a.");
+    cmunit_assert("epoch without version accepted", strncmp(_mock_lastMessage, "400 ", 4) == 0);
+    handleVersionRequest("GETV 4:nope 1:0");
+    cmunit_assert("GETV of missing key wrong", strcmp(_mock_lastMessage, "404 Not Found") == 0);
+    free_kv_store(gl_kvStore);
+    return NULL;
+}
+
+typedef struct lazy_values {
+    kv_entry values[4];
+    size_t bytes;
+    int count;
+} lazy_values;
+
+static void collectLazyValue(kv_entry value, size_t bytes, void* ctx) {
+    lazy_values* lazy = ctx;
+    lazy->values[lazy->count++] = value;
+    lazy->bytes += bytes;
+}
+
+char* test_kv_store_lazy_free() {
+    kv_store* store = create_kv_store(4);
+    lazy_values lazy = {0};
+    cmunit_assert("lazy free not set", kv_store_set_lazy_free(store, 1000, collectLazyValue, &lazy) == 0);
+    size_t baseline = store->allocated_bytes;
+    size_t allocations = store->allocations;
+
+    char text[2000];
+    memset(text, 'a', sizeof(text) - 1);
+    text[sizeof(text) - 1] = '\0';
+    kv_store_put(store, "big", text);
+    kv_store_put(store, "small", "value");
+    kv_store_put(store, "big", "short"); // overwritten
+    cmunit_assert("large value freed inline", lazy.count == 1 && lazy.bytes == sizeof(text));
+    kv_store_delete(store, "small");
+    kv_store_delete(store, "big");
+    cmunit_assert("small value handed over", lazy.count == 1);
+
+    // a hash goes with all of its fields
+    char field[16];
+    for (int i = 0; i < 200; i++) {
+        int len = snprintf(field, sizeof(field), "f%d", i);
+        kv_store_hset(store, "hash", field, len, field, len);
+    }
+    kv_store_delete(store, "hash");
+    cmunit_assert("hash freed inline", lazy.count == 2 && store->lazy_freed == 2);
+    cmunit_assert("unlinked values still counted", store->allocated_bytes == baseline && store->allocations == allocations);
+    for (int i = 0; i < lazy.count; i++) {
+        kv_entry_free_detached(lazy.values[i]);
+    }
+
+    kv_store_put(store, "big", text);
+    free_kv_store(store); // frees inline
+    cmunit_assert("freed store handed over values", lazy.count == 2);
+
+    store = create_kv_store_with_allocator(4, kv_allocator_slab());
+    cmunit_assert("lazy free with slab allocator", kv_store_set_lazy_free(store, 1000, collectLazyValue, &lazy) == -1);
+    free_kv_store(store);
+    return NULL;
+}
+
+char* test_lazyfree_keeps_pinned_values() {
+    kv_store* store = create_kv_store(4);
+    cmunit_assert("pins not set", kv_store_set_pinned(store, lazyfree_pinned, NULL) == 0);
+    size_t baseline = store->allocated_bytes;
+    char text[2000];
+    memset(text, 'a', sizeof(text) - 1);
+    text[sizeof(text) - 1] = '\0';
+    kv_store_put(store, "big", text);
+    size_t stored = store->allocated_bytes;
+
+    lazyfree_pin* pin = lazyfree_pin_value(kv_store_lookup(store, "big"));
+    lazyfree_pin* again = lazyfree_pin_value(kv_store_lookup(store, "big"));
+    cmunit_assert("readers of a value do not share the pin", pin != NULL && again == pin);
+    const char* value = kv_store_lookup(store, "big")->value;
+
+    // a pinned value is replaced by a copy instead of being changed in place
+    size_t length;
+    kv_store_setrange(store, "big", 0, "bb", 2, &length);
+    cmunit_assert("pinned value changed", value[0] == 'a' && kv_store_get(store, "big")[0] == 'b');
+    cmunit_assert("replaced value still counted", store->allocated_bytes == stored);
+    lazyfree_unpin(pin);
+    cmunit_assert("value gone before the last reader", value[0] == 'a');
+    lazyfree_unpin(again); // freed inline without the thread
+
+    // so is one that is deleted, it stays until it was sent
+    pin = lazyfree_pin_value(kv_store_lookup(store, "big"));
+    value = kv_store_lookup(store, "big")->value;
+    kv_store_delete(store, "big");
+    cmunit_assert("deleted value still counted", store->allocated_bytes == baseline);
+    cmunit_assert("deleted value gone before the reader", value[0] == 'b' && value[sizeof(text) - 2] == 'a');
+    lazyfree_unpin(pin);
+
+    // values nobody reads are changed in place
+    kv_store_put(store, "big", text);
+    value = kv_store_lookup(store, "big")->value;
+    kv_store_setrange(store, "big", 0, "cc", 2, &length);
+    cmunit_assert("unpinned value copied", kv_store_lookup(store, "big")->value == value && value[0] == 'c');
+    free_kv_store(store);
+
+    store = create_kv_store_with_allocator(4, kv_allocator_slab());
+    cmunit_assert("pins with slab allocator", kv_store_set_pinned(store, lazyfree_pinned, NULL) == -1);
+    free_kv_store(store);
+    return NULL;
+}
+
+char* test_lazyfree_frees_in_background() {
+    gl_kvStore = create_kv_store(16);
+    kv_store_set_lazy_free(gl_kvStore, 1000, lazyfree_value, NULL);
+    cmunit_assert("thread not started", lazyfree_start() == 0);
+    unsigned long long freed = lazyfree_freed_values();
+    char text[5000];
+    memset(text, 'a', sizeof(text) - 1);
+    text[sizeof(text) - 1] = '\0';
+    handlePutRequest(1, "big", text);
+    handleDelRequest(1, "big");
+    handlePutRequest(1, "big", text);
+    handlePutRequest(1, "big", "short");
+
+    // the thread is woken up for every value
+    for (int i = 0; i < 1000 && lazyfree_freed_values() < freed + 2; i++) {
+        Sleep(1);
+    }
+    cmunit_assert("values not freed", lazyfree_freed_values() == freed + 2 && lazyfree_pending_bytes() == 0);
+    handleMemoryRequest(1, "STATS");
+    cmunit_assert("lazy free stats missing", strstr(_mock_lastMessage, "\r\nlazyfree_values:2\r\nlazyfree_pending_bytes:0") != NULL);
+    lazyfree_stop();
+    cmunit_assert("still running", !lazyfree_running());
+
+    // without the thread values are freed inline
+    handlePutRequest(1, "big", text);
+    handleDelRequest(1, "big");
+    cmunit_assert("value queued without thread", lazyfree_freed_values() == freed + 2 && lazyfree_pending_bytes() == 0);
+    free_kv_store(gl_kvStore);
+    return NULL;
+}
+
 int main(void) {
     cmunit_init();
 
@@ -657,6 +2331,10 @@ int main(void) {
     cmunit_run_test(test_kvstr_parse_request_with_junk_data);
     cmunit_run_test(test_kvstr_parse_del_request_with_junk_data);
     cmunit_run_test(test_kvstr_parse_request_with_short_key);
+    cmunit_run_test(test_kvstr_decoder_handles_fragmented_input);
+    cmunit_run_test(test_kvstr_decoder_direct_buffer_receives_value);
+    cmunit_run_test(test_kvstr_decoder_rejects_too_large_value);
+    cmunit_run_test(test_kvstr_parse_operation_without_arguments);
 
     // tests for the key value store basic operations
     cmunit_run_test(test_kv_store_put_and_retrieve_a_value);
@@ -668,6 +2346,7 @@ int main(void) {
     cmunit_run_test(test_kv_store_case_sensitivity);
     cmunit_run_test(test_kv_store_delete_existing_key);
     cmunit_run_test(test_kv_store_delete_nonexistent_key);
+    cmunit_run_test(test_kv_store_reuses_free_slot_without_duplicating_keys);
 
     // testing server side request handling
     cmunit_run_test(test_handlePutRequest_validInput);
@@ -683,6 +2362,88 @@ int main(void) {
     cmunit_run_test(test_handleDelRequest_nonexistentKey);
     cmunit_run_test(test_handleDelRequest_nullKey);
     cmunit_run_test(test_handleDelRequest_emptyKey);
+    cmunit_run_test(test_receiveRequest_streams_large_value);
+    cmunit_run_test(test_receiveRequest_incomplete_request);
+    cmunit_run_test(test_handleStreamedPutRequest_takes_ownership);
+    cmunit_run_test(test_handleGetRequest_streams_large_value);
+    cmunit_run_test(test_handleHelloRequest_without_worker_mode);
+    cmunit_run_test(test_captured_responses_are_not_sent);
+    cmunit_run_test(test_captured_large_value_is_not_copied);
+
+    // logging
+    cmunit_run_test(test_logger_skips_disabled_levels_before_formatting);
+    cmunit_run_test(test_logger_counts_dropped_lines);
+    cmunit_run_test(test_logger_reuses_rings_of_ended_threads);
+
+    // statistics
+    cmunit_run_test(test_histogram_percentiles);
+    cmunit_run_test(test_kv_store_tracks_data_size);
+    cmunit_run_test(test_handleStatsRequest_reports_counters);
+    cmunit_run_test(test_kvstr_parse_operation_with_argument);
+    cmunit_run_test(test_handleSlowlogRequest_lists_slow_requests);
+
+    // worker mode
+    cmunit_run_test(test_executor_runs_all_tasks);
+    cmunit_run_test(test_executor_steals_from_blocked_worker);
+
+    // transports
+    cmunit_run_test(test_unix_socket_listener_accepts_clients);
+
+    // replication
+    cmunit_run_test(test_replication_feed_moves_offset);
+    cmunit_run_test(test_replication_commands_rejected_from_clients);
+    cmunit_run_test(test_replication_skips_unknown_operations);
+    cmunit_run_test(test_replication_streams_snapshot_and_writes);
+
+    // cluster
+    cmunit_run_test(test_cluster_key_slot);
+    cmunit_run_test(test_cluster_routes_keys);
+    cmunit_run_test(test_asking_requires_a_session);
+
+    // client side caching
+    cmunit_run_test(test_tracking_invalidates_readers_once);
+    cmunit_run_test(test_tracking_session_invalidated_on_write);
+
+    // key change notifications
+    cmunit_run_test(test_watch_notifies_keys_and_prefixes);
+    cmunit_run_test(test_watch_session_notified_on_write);
+
+    // tests for capturing requests
+    cmunit_run_test(test_capture_records_requests_as_sent);
+
+    // tests for hot key detection
+    cmunit_run_test(test_hotkeys_reports_most_accessed_keys);
+    cmunit_run_test(test_handleHotkeysRequest_lists_hot_keys);
+
+    // tests for the allocators of the key value store
+    cmunit_run_test(test_kv_store_allocators_track_memory);
+    cmunit_run_test(test_handleMemoryRequest_reports_allocator);
+    cmunit_run_test(test_kv_store_int_keys);
+    cmunit_run_test(test_kv_store_scan_in_batches);
+    cmunit_run_test(test_kv_store_keeps_numbers_inline);
+    cmunit_run_test(test_handleIncrbyRequest);
+
+    // tests for compression of large values
+    cmunit_run_test(test_kvcompress_round_trip);
+    cmunit_run_test(test_kv_store_compresses_large_values);
+    cmunit_run_test(test_handleGetzRequest_sends_stored_block);
+
+    // tests for hash values
+    cmunit_run_test(test_kv_store_hash_fields);
+    cmunit_run_test(test_handleHashRequests);
+
+    // tests for partial value access
+    cmunit_run_test(test_kv_store_setrange);
+    cmunit_run_test(test_handleRangeRequests);
+
+    // tests for versions of keys
+    cmunit_run_test(test_kv_store_versions);
+    cmunit_run_test(test_handleVersionRequests);
+
+    // tests for freeing large values in the background
+    cmunit_run_test(test_kv_store_lazy_free);
+    cmunit_run_test(test_lazyfree_frees_in_background);
+    cmunit_run_test(test_lazyfree_keeps_pinned_values);
 
     cmunit_summary();
 
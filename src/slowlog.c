@@ -0,0 +1,76 @@
+#include <stdio.h>
+#include <string.h>
+#include "slowlog.h"
+
+unsigned long long gl_slowlogThreshold = SLOWLOG_DEFAULT_THRESHOLD;
+
+// ring of the latest slow requests, only touched for requests above the threshold
+static SRWLOCK gl_slowlogLock = SRWLOCK_INIT;
+static slowlog_entry gl_slowlog[SLOWLOG_LENGTH];
+static size_t gl_slowlogCount = 0;
+static size_t gl_slowlogNext = 0;
+static unsigned long long gl_slowlogNextId = 0;
+
+static void describeClient(SOCKET clientSocket, char *buffer, size_t size) {
+  struct sockaddr_storage addr = {0};
+  int addrLen = sizeof(addr);
+  if (getpeername(clientSocket, (struct sockaddr *)&addr, &addrLen) != 0) {
+    snprintf(buffer, size, "unknown");
+    return;
+  }
+  if (addr.ss_family == AF_UNIX) {
+    snprintf(buffer, size, "unix");
+    return;
+  }
+  if (addr.ss_family != AF_INET) {
+    snprintf(buffer, size, "unknown");
+    return;
+  }
+  struct sockaddr_in *inetAddr = (struct sockaddr_in *)&addr;
+  snprintf(buffer, size, "%s:%d", inet_ntoa(inetAddr->sin_addr), ntohs(inetAddr->sin_port));
+}
+
+void slowlog_record(SOCKET clientSocket, const char *operation, const char *key, size_t valueSize,
+                    const request_timing *timing, unsigned long long total) {
+  slowlog_entry entry = {0};
+  entry.time = time(NULL);
+  snprintf(entry.operation, sizeof(entry.operation), "%s", operation != NULL ? operation : "-");
+  if (key != NULL) {
+    entry.key_len = strlen(key);
+    size_t len = entry.key_len < SLOWLOG_MAX_KEY_LEN ? entry.key_len : SLOWLOG_MAX_KEY_LEN;
+    for (size_t i = 0; i < len; i++) {
+      // keep the entry on one line and separated by spaces
+      entry.key[i] = key[i] > ' ' && key[i] < 127 ? key[i] : '.';
+    }
+  }
+  entry.value_size = valueSize;
+  describeClient(clientSocket, entry.client, sizeof(entry.client));
+  entry.total = total;
+  entry.timing = *timing;
+
+  AcquireSRWLockExclusive(&gl_slowlogLock);
+  entry.id = gl_slowlogNextId++;
+  gl_slowlog[gl_slowlogNext] = entry;
+  gl_slowlogNext = (gl_slowlogNext + 1) % SLOWLOG_LENGTH;
+  if (gl_slowlogCount < SLOWLOG_LENGTH) {
+    gl_slowlogCount++;
+  }
+  ReleaseSRWLockExclusive(&gl_slowlogLock);
+}
+
+size_t slowlog_get(slowlog_entry *entries, size_t max) {
+  AcquireSRWLockShared(&gl_slowlogLock);
+  size_t count = gl_slowlogCount < max ? gl_slowlogCount : max;
+  for (size_t i = 0; i < count; i++) {
+    entries[i] = gl_slowlog[(gl_slowlogNext + SLOWLOG_LENGTH - 1 - i) % SLOWLOG_LENGTH];
+  }
+  ReleaseSRWLockShared(&gl_slowlogLock);
+  return count;
+}
+
+void slowlog_reset() {
+  AcquireSRWLockExclusive(&gl_slowlogLock);
+  gl_slowlogCount = 0;
+  gl_slowlogNext = 0;
+  ReleaseSRWLockExclusive(&gl_slowlogLock);
+}
@@ -0,0 +1,38 @@
+#ifndef _KVSTR_SLOWLOG_H
+#define _KVSTR_SLOWLOG_H
+
+#include <stddef.h>
+#include <time.h>
+
+#ifdef _WIN64
+#include <WinSock2.h>
+#endif
+
+#include "stats.h"
+
+#define SLOWLOG_LENGTH 128                   // entries kept, the oldest are overwritten
+#define SLOWLOG_MAX_KEY_LEN 32               // keys are truncated to this length
+#define SLOWLOG_DEFAULT_THRESHOLD 10000000   // ns (10ms)
+
+typedef struct slowlog_entry {
+  unsigned long long id;
+  time_t time;
+  char operation[16];
+  char key[SLOWLOG_MAX_KEY_LEN + 1];   // truncated, non-printable characters replaced
+  size_t key_len;                      // length of the complete key
+  size_t value_size;
+  char client[64];                     // address and port of the client, "unix" for unix sockets
+  unsigned long long total;            // ns
+  request_timing timing;
+} slowlog_entry;
+
+// requests taking longer than this (in ns) are recorded, compare before calling slowlog_record
+extern unsigned long long gl_slowlogThreshold;
+
+/* Prototypes */
+void slowlog_record(SOCKET clientSocket, const char *operation, const char *key, size_t valueSize,
+                    const request_timing *timing, unsigned long long total); // add a slow request
+size_t slowlog_get(slowlog_entry *entries, size_t max); // copy the newest entries first, returns the count
+void slowlog_reset(); // remove all entries
+
+#endif
@@ -0,0 +1,166 @@
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "stats.h"
+
+#ifdef _WIN64
+#include <windows.h>
+#endif
+
+/*
+ * Every thread counts into its own block, so recording a statistic is a plain add without any
+ * locked instruction or shared cache line. The blocks are only summed up when they are read.
+ */
+
+typedef struct thread_stats {
+  atomic_ullong ops[STATS_OP_COUNT];
+  atomic_ullong counters[STATS_COUNTER_COUNT];  // may wrap below zero per thread, the sum does not
+  histogram phases[STATS_PHASE_COUNT];
+  histogram total;
+  struct thread_stats *next;
+} thread_stats;
+
+static _Thread_local thread_stats *tl_stats = NULL;
+static _Thread_local request_timing *tl_request = NULL;
+
+static _Atomic(thread_stats *) gl_threadStats = NULL;  // blocks live as long as the process
+static thread_stats gl_discardedStats;                 // used if a block cannot be allocated
+
+static unsigned long long gl_startTime = 0;
+static SRWLOCK gl_snapshotLock = SRWLOCK_INIT;
+static unsigned long long gl_lastSnapshotTime = 0;
+static unsigned long long gl_lastSnapshotOps[STATS_OP_COUNT];
+
+static thread_stats *threadStats() {
+  if (tl_stats != NULL) {
+    return tl_stats;
+  }
+
+  thread_stats *stats = calloc(1, sizeof(thread_stats));
+  if (stats == NULL) {
+    tl_stats = &gl_discardedStats;
+    return tl_stats;
+  }
+
+  thread_stats *first = atomic_load(&gl_threadStats);
+  do {
+    stats->next = first;
+  } while (!atomic_compare_exchange_weak(&gl_threadStats, &first, stats));
+
+  tl_stats = stats;
+  return stats;
+}
+
+// only the owning thread writes to its block
+static void increment(atomic_ullong *counter, unsigned long long n) {
+  atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + n, memory_order_relaxed);
+}
+
+void stats_init() {
+  gl_startTime = stats_now();
+  gl_lastSnapshotTime = gl_startTime;
+}
+
+unsigned long long stats_now() {
+  static long long frequency = 0;
+  if (frequency == 0) {
+    LARGE_INTEGER f;
+    QueryPerformanceFrequency(&f);
+    frequency = f.QuadPart;
+  }
+
+  LARGE_INTEGER counter;
+  QueryPerformanceCounter(&counter);
+  // split up to avoid overflowing the multiplication
+  unsigned long long ticks = (unsigned long long) counter.QuadPart;
+  unsigned long long freq = (unsigned long long) frequency;
+  return ticks / freq * 1000000000ULL + ticks % freq * 1000000000ULL / freq;
+}
+
+enum stats_op stats_op_from_name(const char *operation) {
+  if (operation == NULL) {
+    return STATS_OP_OTHER;
+  }
+  if (strcmp(operation, "GET") == 0) {
+    return STATS_OP_GET;
+  }
+  if (strcmp(operation, "PUT") == 0) {
+    return STATS_OP_PUT;
+  }
+  if (strcmp(operation, "DEL") == 0) {
+    return STATS_OP_DEL;
+  }
+  return STATS_OP_OTHER;
+}
+
+void stats_count_op(enum stats_op op) {
+  increment(&threadStats()->ops[op], 1);
+}
+
+void stats_add(enum stats_counter counter, long long n) {
+  increment(&threadStats()->counters[counter], (unsigned long long) n);
+}
+
+void stats_set_request(request_timing *timing) {
+  tl_request = timing;
+}
+
+unsigned long long stats_timing_add(request_timing *timing, enum stats_phase phase, unsigned long long since) {
+  unsigned long long now = stats_now();
+  if (timing != NULL) {
+    timing->phase[phase] += now - since;
+    timing->measured |= 1u << phase;
+  }
+  return now;
+}
+
+unsigned long long stats_add_phase(enum stats_phase phase, unsigned long long since) {
+  return stats_timing_add(tl_request, phase, since);
+}
+
+unsigned long long stats_record_request(const request_timing *timing) {
+  thread_stats *stats = threadStats();
+  for (int i = 0; i < STATS_PHASE_COUNT; i++) {
+    if (timing->measured & (1u << i)) {
+      histogram_record(&stats->phases[i], timing->phase[i]);
+    }
+  }
+  unsigned long long total = stats_now() - timing->start;
+  histogram_record(&stats->total, total);
+  return total;
+}
+
+void stats_collect(stats_snapshot *snapshot) {
+  memset(snapshot, 0, sizeof(*snapshot));
+
+  unsigned long long sums[STATS_COUNTER_COUNT] = {0};
+  for (thread_stats *stats = atomic_load(&gl_threadStats); stats != NULL; stats = stats->next) {
+    for (int i = 0; i < STATS_OP_COUNT; i++) {
+      snapshot->ops[i] += atomic_load_explicit(&stats->ops[i], memory_order_relaxed);
+    }
+    for (int i = 0; i < STATS_COUNTER_COUNT; i++) {
+      sums[i] += atomic_load_explicit(&stats->counters[i], memory_order_relaxed);
+    }
+    for (int i = 0; i < STATS_PHASE_COUNT; i++) {
+      histogram_merge(&snapshot->phases[i], &stats->phases[i]);
+    }
+    histogram_merge(&snapshot->total, &stats->total);
+  }
+  for (int i = 0; i < STATS_COUNTER_COUNT; i++) {
+    snapshot->counters[i] = (long long) sums[i];
+  }
+
+  // rates are calculated over the time since the previous snapshot
+  unsigned long long now = stats_now();
+  AcquireSRWLockExclusive(&gl_snapshotLock);
+  snapshot->uptime_ns = now - gl_startTime;
+  unsigned long long interval = now - gl_lastSnapshotTime;
+  for (int i = 0; i < STATS_OP_COUNT; i++) {
+    if (interval > 0) {
+      snapshot->ops_per_sec[i] = (double) (snapshot->ops[i] - gl_lastSnapshotOps[i]) * 1e9 / (double) interval;
+    }
+    gl_lastSnapshotOps[i] = snapshot->ops[i];
+  }
+  gl_lastSnapshotTime = now;
+  ReleaseSRWLockExclusive(&gl_snapshotLock);
+}
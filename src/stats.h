@@ -0,0 +1,64 @@
+#ifndef _KVSTR_STATS_H
+#define _KVSTR_STATS_H
+
+#include <stdatomic.h>
+#include "histogram.h"
+
+/* Data Types */
+enum stats_op {
+  STATS_OP_GET,
+  STATS_OP_PUT,
+  STATS_OP_DEL,
+  STATS_OP_OTHER,
+  STATS_OP_COUNT,
+};
+
+enum stats_phase {
+  STATS_PHASE_RECV,   // waiting for the request to arrive
+  STATS_PHASE_PARSE,  // decoding the request
+  STATS_PHASE_STORE,  // kv_store_* calls incl. waiting for the store lock
+  STATS_PHASE_SEND,   // from the response being ready until it was handed to the socket
+  STATS_PHASE_COUNT,
+};
+
+enum stats_counter {
+  STATS_HITS,
+  STATS_MISSES,
+  STATS_ERRORS,         // requests answered with a parse error
+  STATS_BYTES_IN,
+  STATS_BYTES_OUT,
+  STATS_CONNECTIONS,    // currently connected clients
+  STATS_BUFFER_BYTES,   // memory held by connection buffers
+  STATS_COUNTER_COUNT,
+};
+
+// timing of a single request, handed along with the request if it moves between threads
+typedef struct request_timing {
+  unsigned long long start;                       // stats_now() when the request started to arrive
+  unsigned long long phase[STATS_PHASE_COUNT];    // ns spent in each phase
+  unsigned int measured;                          // bit per phase the request went through
+} request_timing;
+
+// sum of the statistics of all threads
+typedef struct stats_snapshot {
+  unsigned long long uptime_ns;
+  unsigned long long ops[STATS_OP_COUNT];
+  double ops_per_sec[STATS_OP_COUNT];             // since the previous snapshot
+  long long counters[STATS_COUNTER_COUNT];
+  histogram phases[STATS_PHASE_COUNT];
+  histogram total;                                // complete request incl. all phases
+} stats_snapshot;
+
+/* Prototypes */
+void stats_init(); // remember the start time of the server
+unsigned long long stats_now(); // monotonic time in ns
+enum stats_op stats_op_from_name(const char *operation);
+void stats_count_op(enum stats_op op);
+void stats_add(enum stats_counter counter, long long n);
+void stats_set_request(request_timing *timing); // request currently handled by this thread (NULL when done)
+unsigned long long stats_timing_add(request_timing *timing, enum stats_phase phase, unsigned long long since); // add the time since 'since' to a phase, returns now
+unsigned long long stats_add_phase(enum stats_phase phase, unsigned long long since); // same for the current request of this thread
+unsigned long long stats_record_request(const request_timing *timing); // record the phases of an answered request, returns its total time
+void stats_collect(stats_snapshot *snapshot); // aggregate all threads
+
+#endif
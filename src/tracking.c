@@ -0,0 +1,263 @@
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "tracking.h"
+#include "utilfuns.h"
+
+#ifdef _WIN64
+#include <windows.h>
+#endif
+
+/*
+ * Clients that cache values (TRACKING ON) are remembered for every key they read. When the key
+ * changes, each of them is sent an invalidation once and forgotten for that key until it reads
+ * it again. Readers register while holding the store lock and writers invalidate while holding
+ * it exclusively, so a client never misses the invalidation of a value it was sent.
+ *
+ * Clients are referred to by id (generation and slot), so keys still naming a client that went
+ * away are harmless: its slot has a new generation or is free.
+ */
+
+#define TRACKING_INITIAL_BUCKETS 1024
+
+typedef struct tracking_client {
+  tracking_push_fn push;
+  void *ctx;
+  unsigned int generation;
+  bool active;
+} tracking_client;
+
+typedef struct tracked_key {
+  char *key;
+  unsigned long long *clients;
+  int count;
+  int capacity;
+  struct tracked_key *next;     // in the bucket
+  struct tracked_key *older;    // in the order the keys were first read
+  struct tracked_key *newer;
+} tracked_key;
+
+static SRWLOCK gl_trackingLock = SRWLOCK_INIT;
+static tracking_client *gl_clients = NULL;
+static size_t gl_clientSlots = 0;
+static size_t gl_activeClients = 0;
+static tracked_key **gl_buckets = NULL;
+static size_t gl_bucketCount = 0;
+static atomic_size_t gl_keyCount;
+static tracked_key *gl_oldest = NULL;
+static tracked_key *gl_newest = NULL;
+
+static unsigned long long hashKey(const char *key) {
+  unsigned long long h = 14695981039346656037ULL;
+  for (; *key != '\0'; key++) {
+    h ^= (unsigned char)*key;
+    h *= 1099511628211ULL;
+  }
+  return h;
+}
+
+// the client of an id if it is still registered, call with the lock held
+static tracking_client *findClient(unsigned long long id) {
+  size_t slot = (size_t)(id & 0xffffffffULL);
+  if (slot == 0 || slot > gl_clientSlots) {
+    return NULL;
+  }
+  tracking_client *c = &gl_clients[slot - 1];
+  return c->active && c->generation == (unsigned int)(id >> 32) ? c : NULL;
+}
+
+unsigned long long tracking_register(tracking_push_fn push, void *ctx) {
+  unsigned long long id = TRACKING_NO_CLIENT;
+  AcquireSRWLockExclusive(&gl_trackingLock);
+  size_t slot = 0;
+  while (slot < gl_clientSlots && gl_clients[slot].active) {
+    slot++;
+  }
+  if (slot == gl_clientSlots) {
+    size_t slots = gl_clientSlots > 0 ? gl_clientSlots * 2 : 16;
+    tracking_client *clients = realloc(gl_clients, slots * sizeof(tracking_client));
+    if (clients != NULL) {
+      memset(clients + gl_clientSlots, 0, (slots - gl_clientSlots) * sizeof(tracking_client));
+      gl_clients = clients;
+      gl_clientSlots = slots;
+    }
+  }
+  if (slot < gl_clientSlots) {
+    tracking_client *c = &gl_clients[slot];
+    c->push = push;
+    c->ctx = ctx;
+    c->active = true;
+    gl_activeClients++;
+    id = ((unsigned long long)c->generation << 32) | (unsigned long long)(slot + 1);
+  }
+  ReleaseSRWLockExclusive(&gl_trackingLock);
+  return id;
+}
+
+void tracking_unregister(unsigned long long client) {
+  AcquireSRWLockExclusive(&gl_trackingLock);
+  tracking_client *c = findClient(client);
+  if (c != NULL) {
+    c->active = false;
+    c->generation++; // ids left in tracked keys do not match anymore
+    gl_activeClients--;
+  }
+  ReleaseSRWLockExclusive(&gl_trackingLock);
+}
+
+static tracked_key **findKey(const char *key) {
+  tracked_key **link = &gl_buckets[hashKey(key) & (gl_bucketCount - 1)];
+  while (*link != NULL && strcmp((*link)->key, key) != 0) {
+    link = &(*link)->next;
+  }
+  return link;
+}
+
+static int growBuckets() {
+  size_t count = gl_bucketCount > 0 ? gl_bucketCount * 2 : TRACKING_INITIAL_BUCKETS;
+  tracked_key **buckets = calloc(count, sizeof(tracked_key *));
+  if (buckets == NULL) {
+    return -1;
+  }
+  for (tracked_key *k = gl_oldest; k != NULL; k = k->newer) {
+    size_t b = hashKey(k->key) & (count - 1);
+    k->next = buckets[b];
+    buckets[b] = k;
+  }
+  free(gl_buckets);
+  gl_buckets = buckets;
+  gl_bucketCount = count;
+  return 0;
+}
+
+// removes the key from the table and pushes its invalidation, call with the lock held exclusively
+static void invalidateKey(tracked_key **link) {
+  tracked_key *k = *link;
+  *link = k->next;
+  if (k->older != NULL) {
+    k->older->newer = k->newer;
+  } else {
+    gl_oldest = k->newer;
+  }
+  if (k->newer != NULL) {
+    k->newer->older = k->older;
+  } else {
+    gl_newest = k->older;
+  }
+  atomic_fetch_sub(&gl_keyCount, 1);
+
+  byte_buffer message = {0};
+  char header[64];
+  int headerLen = snprintf(header, sizeof(header), TRACKING_INVALIDATE " %zu:", strlen(k->key));
+  if (byte_buffer_append(&message, header, headerLen) == 0 &&
+      byte_buffer_append(&message, k->key, strlen(k->key)) == 0) {
+    for (int i = 0; i < k->count; i++) {
+      tracking_client *c = findClient(k->clients[i]);
+      if (c != NULL) {
+        c->push(c->ctx, message.data, message.len);
+      }
+    }
+  }
+  byte_buffer_free(&message);
+  free(k->clients);
+  free(k->key);
+  free(k);
+}
+
+void tracking_remember(unsigned long long client, const char *key) {
+  AcquireSRWLockExclusive(&gl_trackingLock);
+  if (atomic_load(&gl_keyCount) >= gl_bucketCount) {
+    growBuckets(); // if this fails the chains only get longer
+  }
+  if (findClient(client) == NULL || gl_bucketCount == 0) {
+    ReleaseSRWLockExclusive(&gl_trackingLock);
+    return;
+  }
+
+  tracked_key **link = findKey(key);
+  tracked_key *k = *link;
+  if (k == NULL) {
+    // a full table makes room by invalidating the key read first, the clients read it again if needed
+    if (atomic_load(&gl_keyCount) >= TRACKING_MAX_KEYS) {
+      invalidateKey(findKey(gl_oldest->key));
+      link = findKey(key);
+    }
+    k = calloc(1, sizeof(tracked_key));
+    if (k == NULL || (k->key = duplicate_string(key)) == NULL) {
+      free(k);
+      ReleaseSRWLockExclusive(&gl_trackingLock);
+      return;
+    }
+    *link = k;
+    k->older = gl_newest;
+    if (gl_newest != NULL) {
+      gl_newest->newer = k;
+    } else {
+      gl_oldest = k;
+    }
+    gl_newest = k;
+    atomic_fetch_add(&gl_keyCount, 1);
+  }
+
+  bool known = false;
+  for (int i = 0; i < k->count && !known; i++) {
+    known = k->clients[i] == client;
+  }
+  if (!known && k->count == k->capacity) {
+    int capacity = k->capacity > 0 ? k->capacity * 2 : 2;
+    unsigned long long *clients = realloc(k->clients, (size_t)capacity * sizeof(unsigned long long));
+    if (clients != NULL) {
+      k->clients = clients;
+      k->capacity = capacity;
+    }
+  }
+  if (!known && k->count < k->capacity) {
+    k->clients[k->count++] = client;
+  }
+  ReleaseSRWLockExclusive(&gl_trackingLock);
+}
+
+void tracking_invalidate(const char *key) {
+  // writers skip the lock as long as nobody caches anything
+  if (atomic_load(&gl_keyCount) == 0) {
+    return;
+  }
+  AcquireSRWLockExclusive(&gl_trackingLock);
+  tracked_key **link = gl_bucketCount > 0 ? findKey(key) : NULL;
+  if (link != NULL && *link != NULL) {
+    invalidateKey(link);
+  }
+  ReleaseSRWLockExclusive(&gl_trackingLock);
+}
+
+void tracking_invalidate_all() {
+  AcquireSRWLockExclusive(&gl_trackingLock);
+  while (gl_oldest != NULL) {
+    tracked_key *k = gl_oldest;
+    gl_oldest = k->newer;
+    free(k->clients);
+    free(k->key);
+    free(k);
+  }
+  gl_newest = NULL;
+  if (gl_bucketCount > 0) {
+    memset(gl_buckets, 0, gl_bucketCount * sizeof(tracked_key *));
+  }
+  atomic_store(&gl_keyCount, 0);
+
+  for (size_t i = 0; i < gl_clientSlots; i++) {
+    if (gl_clients[i].active) {
+      gl_clients[i].push(gl_clients[i].ctx, TRACKING_INVALIDATE, strlen(TRACKING_INVALIDATE));
+    }
+  }
+  ReleaseSRWLockExclusive(&gl_trackingLock);
+}
+
+void tracking_get_counts(size_t *clients, size_t *keys) {
+  AcquireSRWLockShared(&gl_trackingLock);
+  *clients = gl_activeClients;
+  *keys = atomic_load(&gl_keyCount);
+  ReleaseSRWLockShared(&gl_trackingLock);
+}
@@ -0,0 +1,21 @@
+#ifndef _KVSTR_TRACKING_H
+#define _KVSTR_TRACKING_H
+
+#include <stddef.h>
+
+#define TRACKING_NO_CLIENT 0ULL
+#define TRACKING_MAX_KEYS 1024 * 1024   // tracked keys, the oldest are invalidated early beyond that
+#define TRACKING_INVALIDATE "INVALIDATE" // pushed to a client: "INVALIDATE <len>:<key>", without a key for all keys
+
+// sends a message to a tracking client without waiting, must not call back into tracking
+typedef void (*tracking_push_fn)(void *ctx, const char *message, size_t length);
+
+/* Prototypes */
+unsigned long long tracking_register(tracking_push_fn push, void *ctx); // a client that caches values, TRACKING_NO_CLIENT on failure
+void tracking_unregister(unsigned long long client); // after this returns the push function is not called for the client anymore
+void tracking_remember(unsigned long long client, const char *key); // the client read the key, call with the store locked
+void tracking_invalidate(const char *key); // the key changed, call with the store locked exclusively
+void tracking_invalidate_all(); // every key changed (the store was replaced)
+void tracking_get_counts(size_t *clients, size_t *keys);
+
+#endif
@@ -0,0 +1,167 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "histogram.h"
+#include "kvclient.h"
+#include "kvstrprotocol.h"
+#include "stats.h"
+
+/*
+ * Compares the round trip latency of TCP loopback and unix socket connections to a running
+ * server. Every transport is measured twice: with a new connection per request (the way the
+ * protocol is used without sessions) and with all requests sent on one HELLO session, which
+ * only measures the transport itself. Sessions require the server to run in worker mode.
+ */
+
+#define BENCH_DEFAULT_REQUESTS 10000
+#define BENCH_WARMUP_REQUESTS 100
+#define BENCH_KEY "transport_bench"
+#define BENCH_VALUE "0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcdef"
+
+static void printResult(const char *transport, const char *mode, const histogram *h, unsigned long long elapsed) {
+  unsigned long long count = histogram_count(h);
+  printf("%-6s %-10s %8llu requests %10.0f req/s  p50 %8llu ns  p99 %8llu ns  p999 %8llu ns\n", transport, mode,
+         count, elapsed > 0 ? (double) count * 1e9 / (double) elapsed : 0.0, histogram_percentile(h, 50),
+         histogram_percentile(h, 99), histogram_percentile(h, 99.9));
+}
+
+// one connection per request, includes connecting and the server closing the connection
+static int benchConnections(const char *server, int port, const char *request, int requests, histogram *h) {
+  for (int i = -BENCH_WARMUP_REQUESTS; i < requests; i++) {
+    unsigned long long start = stats_now();
+    kvclient_conn *conn = kvclient_connect(server, port);
+    if (conn == NULL) {
+      return -1;
+    }
+    char *response = kvclient_request(conn, request, NULL);
+    kvclient_close(&conn);
+    if (response == NULL) {
+      return -1;
+    }
+    free(response);
+    if (i >= 0) {
+      histogram_record(h, stats_now() - start);
+    }
+  }
+  return 0;
+}
+
+// all requests on one session, one request in flight at a time
+static int benchSession(const char *server, int port, const char *request, int requests, histogram *h) {
+  kvclient_conn *conn = kvclient_connect(server, port);
+  if (conn == NULL) {
+    return -1;
+  }
+  if (kvclient_hello(conn) != 0) {
+    kvclient_close(&conn);
+    return -1;
+  }
+
+  for (int i = -BENCH_WARMUP_REQUESTS; i < requests; i++) {
+    unsigned long long start = stats_now();
+    char *response = kvclient_request(conn, request, NULL);
+    if (response == NULL) {
+      kvclient_close(&conn);
+      return -1;
+    }
+    free(response);
+    if (i >= 0) {
+      histogram_record(h, stats_now() - start);
+    }
+  }
+
+  kvclient_close(&conn);
+  return 0;
+}
+
+static void benchTransport(const char *transport, const char *server, int port, int requests) {
+  char *put = kvstr_build_put_request(BENCH_KEY, BENCH_VALUE);
+  kvclient_conn *conn = kvclient_connect(server, port);
+  if (put == NULL || conn == NULL) {
+    printf("%-6s failed to connect to %s\n", transport, server);
+    free(put);
+    return;
+  }
+  free(kvclient_request(conn, put, NULL));
+  kvclient_close(&conn);
+  free(put);
+
+  char *get = kvstr_build_get_request(BENCH_KEY);
+  if (get == NULL) {
+    return;
+  }
+
+  // the histograms are too large for the stack
+  histogram *h = calloc(1, sizeof(histogram));
+  if (h == NULL) {
+    free(get);
+    return;
+  }
+
+  unsigned long long start = stats_now();
+  if (benchConnections(server, port, get, requests, h) == 0) {
+    printResult(transport, "connection", h, stats_now() - start);
+  } else {
+    printf("%-6s connection failed\n", transport);
+  }
+
+  memset(h, 0, sizeof(histogram));
+  start = stats_now();
+  if (benchSession(server, port, get, requests, h) == 0) {
+    printResult(transport, "session", h, stats_now() - start);
+  } else {
+    printf("%-6s session    not available (the server needs to run in worker mode)\n", transport);
+  }
+
+  free(h);
+  free(get);
+}
+
+int main(int argc, char **argv) {
+  const char *host = "127.0.0.1";
+  int port = 8080;
+  const char *unixPath = NULL;
+  int requests = BENCH_DEFAULT_REQUESTS;
+
+  // every option takes exactly one value
+  for (int i = 1; i < argc; i += 2) {
+    if (i + 1 >= argc) {
+      printf("Usage: %s [-h host] [-p port] [-u unix socket path] [-n requests]\n", argv[0]);
+      return 1;
+    }
+
+    if (strcmp(argv[i], "-h") == 0) {
+      host = argv[i + 1];
+    } else if (strcmp(argv[i], "-p") == 0) {
+      port = atoi(argv[i + 1]);
+    } else if (strcmp(argv[i], "-u") == 0) {
+      unixPath = argv[i + 1];
+    } else if (strcmp(argv[i], "-n") == 0) {
+      requests = atoi(argv[i + 1]);
+    } else {
+      printf("Unknown option '%s' ignored.\n", argv[i]);
+    }
+  }
+
+  if (requests <= 0) {
+    requests = BENCH_DEFAULT_REQUESTS;
+  }
+
+  int r = kvclient_init();
+  if (r != 0) {
+    printf("WSAStartup failed. Error code: %d\n", r);
+    return 1;
+  }
+
+  if (port > 0) {
+    benchTransport("tcp", host, port, requests);
+  }
+  if (unixPath != NULL) {
+    char server[256];
+    snprintf(server, sizeof(server), "%s%s", KVCLIENT_UNIX_PREFIX, unixPath);
+    benchTransport("unix", server, 0, requests);
+  }
+
+  kvclient_cleanup();
+  return 0;
+}
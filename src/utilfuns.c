@@ -22,3 +22,37 @@ char* duplicate_string(const char* str) {
 
     return dup;
 }
+
+int byte_buffer_reserve(byte_buffer* buf, size_t len) {
+    if (buf->len + len > buf->capacity) {
+        size_t capacity = buf->capacity == 0 ? 256 : buf->capacity;
+        while (capacity < buf->len + len) {
+            capacity *= 2;
+        }
+
+        char* grown = realloc(buf->data, capacity);
+        if (grown == NULL) {
+            return -1;
+        }
+        buf->data = grown;
+        buf->capacity = capacity;
+    }
+    return 0;
+}
+
+int byte_buffer_append(byte_buffer* buf, const void* data, size_t len) {
+    if (byte_buffer_reserve(buf, len) != 0) {
+        return -1;
+    }
+
+    memcpy(buf->data + buf->len, data, len);
+    buf->len += len;
+    return 0;
+}
+
+void byte_buffer_free(byte_buffer* buf) {
+    free(buf->data);
+    buf->data = NULL;
+    buf->len = 0;
+    buf->capacity = 0;
+}
@@ -1,4 +1,16 @@
 #ifndef _KVSTR_UTILFUNS_H
 #define _KVSTR_UTILFUNS_H
+#include <stddef.h>
+
+// growable byte buffer, e.g. to collect a response before it is written to a socket
+typedef struct byte_buffer {
+    char* data;
+    size_t len;
+    size_t capacity;
+} byte_buffer;
+
 char* duplicate_string(const char* str);
-#endif
\ No newline at end of file
+int byte_buffer_reserve(byte_buffer* buf, size_t len); // room for len more bytes, so appending them cannot fail
+int byte_buffer_append(byte_buffer* buf, const void* data, size_t len);
+void byte_buffer_free(byte_buffer* buf);
+#endif
@@ -0,0 +1,516 @@
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "watch.h"
+#include "utilfuns.h"
+
+#ifdef _WIN64
+#include <windows.h>
+#endif
+
+/*
+ * Clients watch keys or key prefixes and are pushed "NOTIFY PUT <len>:<key>" or "NOTIFY DEL
+ * <len>:<key>" whenever a write touches one of them. Writers only queue the change, a single
+ * notifier thread looks up the watchers and pushes to them, so a key watched by thousands of
+ * clients costs the write no more than any other key and the changes arrive in write order.
+ *
+ * Patterns are found by hash: the key itself and each of its prefixes as long as a watched
+ * prefix. A change costs one lookup per distinct prefix length, however many patterns exist.
+ *
+ * Clients are referred to by id (generation and slot) like the tracking clients.
+ */
+
+#define WATCH_INITIAL_BUCKETS 1024
+
+typedef struct watched_pattern {
+  char *pattern;                // without the '*' of a prefix
+  size_t len;
+  bool prefix;
+  unsigned long long *clients;
+  int count;
+  int capacity;
+  struct watched_pattern *next; // in the bucket
+} watched_pattern;
+
+typedef struct watch_client {
+  tracking_push_fn push;
+  void *ctx;
+  unsigned int generation;
+  bool active;
+  watched_pattern **patterns;   // watched by the client, to forget them when it goes away
+  int count;
+  int capacity;
+  unsigned long long notified;  // last change the client was pushed, to push a change only once
+} watch_client;
+
+typedef struct prefix_length {
+  size_t len;
+  size_t patterns;              // prefixes of that length
+} prefix_length;
+
+typedef struct watch_change {
+  char operation[WATCH_MAX_OPERATION_LEN + 1];
+  char *key;                    // NULL if anything may have changed
+  struct watch_change *next;
+} watch_change;
+
+// clients and patterns
+static SRWLOCK gl_watchLock = SRWLOCK_INIT;
+static watch_client *gl_clients = NULL;
+static size_t gl_clientSlots = 0;
+static size_t gl_activeClients = 0;
+static watched_pattern **gl_buckets = NULL;
+static size_t gl_bucketCount = 0;
+static atomic_size_t gl_patternCount;
+static prefix_length *gl_prefixLengths = NULL; // ascending
+static size_t gl_prefixLengthCount = 0;
+static unsigned long long gl_changeCount = 0;
+
+// changes waiting for the notifier
+static SRWLOCK gl_queueLock = SRWLOCK_INIT;
+static CONDITION_VARIABLE gl_queueCond = CONDITION_VARIABLE_INIT;
+static watch_change *gl_queueHead = NULL;
+static watch_change *gl_queueTail = NULL;
+static size_t gl_queued = 0;
+static bool gl_overflow = false;      // changes were dropped since the notifier ran last
+static unsigned long long gl_dropped = 0;
+static bool gl_stopping = false;
+static HANDLE gl_notifierThread = NULL;
+
+static unsigned long long hashPattern(const char *pattern, size_t len, bool prefix) {
+  unsigned long long h = prefix ? 1099511628211ULL : 14695981039346656037ULL;
+  for (size_t i = 0; i < len; i++) {
+    h ^= (unsigned char)pattern[i];
+    h *= 1099511628211ULL;
+  }
+  return h;
+}
+
+// the client of an id if it is still registered, call with the lock held
+static watch_client *findClient(unsigned long long id) {
+  size_t slot = (size_t)(id & 0xffffffffULL);
+  if (slot == 0 || slot > gl_clientSlots) {
+    return NULL;
+  }
+  watch_client *c = &gl_clients[slot - 1];
+  return c->active && c->generation == (unsigned int)(id >> 32) ? c : NULL;
+}
+
+static watched_pattern **findPattern(const char *pattern, size_t len, bool prefix) {
+  watched_pattern **link = &gl_buckets[hashPattern(pattern, len, prefix) & (gl_bucketCount - 1)];
+  while (*link != NULL && ((*link)->prefix != prefix || (*link)->len != len || memcmp((*link)->pattern, pattern, len) != 0)) {
+    link = &(*link)->next;
+  }
+  return link;
+}
+
+static int growBuckets() {
+  size_t count = gl_bucketCount > 0 ? gl_bucketCount * 2 : WATCH_INITIAL_BUCKETS;
+  watched_pattern **buckets = calloc(count, sizeof(watched_pattern *));
+  if (buckets == NULL) {
+    return -1;
+  }
+  for (size_t i = 0; i < gl_bucketCount; i++) {
+    watched_pattern *p = gl_buckets[i];
+    while (p != NULL) {
+      watched_pattern *next = p->next;
+      size_t b = hashPattern(p->pattern, p->len, p->prefix) & (count - 1);
+      p->next = buckets[b];
+      buckets[b] = p;
+      p = next;
+    }
+  }
+  free(gl_buckets);
+  gl_buckets = buckets;
+  gl_bucketCount = count;
+  return 0;
+}
+
+static int countPrefixLength(size_t len) {
+  size_t i = 0;
+  while (i < gl_prefixLengthCount && gl_prefixLengths[i].len < len) {
+    i++;
+  }
+  if (i == gl_prefixLengthCount || gl_prefixLengths[i].len != len) {
+    prefix_length *lengths = realloc(gl_prefixLengths, (gl_prefixLengthCount + 1) * sizeof(prefix_length));
+    if (lengths == NULL) {
+      return -1;
+    }
+    gl_prefixLengths = lengths;
+    memmove(&lengths[i + 1], &lengths[i], (gl_prefixLengthCount - i) * sizeof(prefix_length));
+    lengths[i].len = len;
+    lengths[i].patterns = 0;
+    gl_prefixLengthCount++;
+  }
+  gl_prefixLengths[i].patterns++;
+  return 0;
+}
+
+static void uncountPrefixLength(size_t len) {
+  for (size_t i = 0; i < gl_prefixLengthCount; i++) {
+    if (gl_prefixLengths[i].len == len) {
+      if (--gl_prefixLengths[i].patterns == 0) {
+        memmove(&gl_prefixLengths[i], &gl_prefixLengths[i + 1], (gl_prefixLengthCount - i - 1) * sizeof(prefix_length));
+        gl_prefixLengthCount--;
+      }
+      return;
+    }
+  }
+}
+
+// removes the client from the pattern and the pattern once nobody watches it, call with the lock held exclusively
+static void unwatchPattern(watched_pattern *p, unsigned long long client) {
+  for (int i = 0; i < p->count; i++) {
+    if (p->clients[i] == client) {
+      p->clients[i] = p->clients[--p->count];
+      break;
+    }
+  }
+  if (p->count > 0) {
+    return;
+  }
+
+  watched_pattern **link = findPattern(p->pattern, p->len, p->prefix);
+  *link = p->next;
+  if (p->prefix) {
+    uncountPrefixLength(p->len);
+  }
+  atomic_fetch_sub(&gl_patternCount, 1);
+  free(p->clients);
+  free(p->pattern);
+  free(p);
+}
+
+unsigned long long watch_register(tracking_push_fn push, void *ctx) {
+  unsigned long long id = WATCH_NO_CLIENT;
+  AcquireSRWLockExclusive(&gl_watchLock);
+  size_t slot = 0;
+  while (slot < gl_clientSlots && gl_clients[slot].active) {
+    slot++;
+  }
+  if (slot == gl_clientSlots) {
+    size_t slots = gl_clientSlots > 0 ? gl_clientSlots * 2 : 16;
+    watch_client *clients = realloc(gl_clients, slots * sizeof(watch_client));
+    if (clients != NULL) {
+      memset(clients + gl_clientSlots, 0, (slots - gl_clientSlots) * sizeof(watch_client));
+      gl_clients = clients;
+      gl_clientSlots = slots;
+    }
+  }
+  if (slot < gl_clientSlots) {
+    watch_client *c = &gl_clients[slot];
+    c->push = push;
+    c->ctx = ctx;
+    c->active = true;
+    c->count = 0;
+    gl_activeClients++;
+    id = ((unsigned long long)c->generation << 32) | (unsigned long long)(slot + 1);
+  }
+  ReleaseSRWLockExclusive(&gl_watchLock);
+  return id;
+}
+
+void watch_unregister(unsigned long long client) {
+  AcquireSRWLockExclusive(&gl_watchLock);
+  watch_client *c = findClient(client);
+  if (c != NULL) {
+    for (int i = 0; i < c->count; i++) {
+      unwatchPattern(c->patterns[i], client);
+    }
+    free(c->patterns);
+    c->patterns = NULL;
+    c->count = 0;
+    c->capacity = 0;
+    c->active = false;
+    c->generation++;
+    gl_activeClients--;
+  }
+  ReleaseSRWLockExclusive(&gl_watchLock);
+}
+
+int watch_add(unsigned long long client, const char *pattern) {
+  size_t len = strlen(pattern);
+  bool prefix = len > 0 && pattern[len - 1] == '*';
+  if (prefix) {
+    len--;
+  }
+
+  AcquireSRWLockExclusive(&gl_watchLock);
+  if (atomic_load(&gl_patternCount) >= gl_bucketCount) {
+    growBuckets(); // if this fails the chains only get longer
+  }
+  watch_client *c = findClient(client);
+  if (c == NULL || gl_bucketCount == 0) {
+    ReleaseSRWLockExclusive(&gl_watchLock);
+    return -1;
+  }
+
+  watched_pattern **link = findPattern(pattern, len, prefix);
+  watched_pattern *p = *link;
+  for (int i = 0; p != NULL && i < p->count; i++) {
+    if (p->clients[i] == client) {
+      ReleaseSRWLockExclusive(&gl_watchLock);
+      return 0; // watched already
+    }
+  }
+
+  if (c->count == c->capacity) {
+    int capacity = c->capacity > 0 ? c->capacity * 2 : 4;
+    watched_pattern **patterns = realloc(c->patterns, (size_t)capacity * sizeof(watched_pattern *));
+    if (patterns == NULL) {
+      ReleaseSRWLockExclusive(&gl_watchLock);
+      return -1;
+    }
+    c->patterns = patterns;
+    c->capacity = capacity;
+  }
+
+  if (p != NULL && p->count == p->capacity) {
+    int capacity = p->capacity * 2;
+    unsigned long long *clients = realloc(p->clients, (size_t)capacity * sizeof(unsigned long long));
+    if (clients == NULL) {
+      ReleaseSRWLockExclusive(&gl_watchLock);
+      return -1;
+    }
+    p->clients = clients;
+    p->capacity = capacity;
+  }
+
+  if (p == NULL) {
+    p = calloc(1, sizeof(watched_pattern));
+    char *copy = malloc(len + 1);
+    unsigned long long *clients = malloc(2 * sizeof(unsigned long long));
+    if (p == NULL || copy == NULL || clients == NULL || (prefix && countPrefixLength(len) != 0)) {
+      free(p);
+      free(copy);
+      free(clients);
+      ReleaseSRWLockExclusive(&gl_watchLock);
+      return -1;
+    }
+    memcpy(copy, pattern, len);
+    copy[len] = '\0';
+    p->pattern = copy;
+    p->len = len;
+    p->prefix = prefix;
+    p->clients = clients;
+    p->capacity = 2;
+    *link = p;
+    atomic_fetch_add(&gl_patternCount, 1);
+  }
+  p->clients[p->count++] = client;
+  c->patterns[c->count++] = p;
+  ReleaseSRWLockExclusive(&gl_watchLock);
+  return 0;
+}
+
+int watch_remove(unsigned long long client, const char *pattern) {
+  size_t len = strlen(pattern);
+  bool prefix = len > 0 && pattern[len - 1] == '*';
+  if (prefix) {
+    len--;
+  }
+
+  int result = -1;
+  AcquireSRWLockExclusive(&gl_watchLock);
+  watch_client *c = findClient(client);
+  watched_pattern *p = c != NULL && gl_bucketCount > 0 ? *findPattern(pattern, len, prefix) : NULL;
+  for (int i = 0; p != NULL && i < c->count; i++) {
+    if (c->patterns[i] == p) {
+      c->patterns[i] = c->patterns[--c->count];
+      unwatchPattern(p, client);
+      result = 0;
+      break;
+    }
+  }
+  ReleaseSRWLockExclusive(&gl_watchLock);
+  return result;
+}
+
+static void notifyPattern(watched_pattern *p, const char *message, size_t length) {
+  for (int i = 0; i < p->count; i++) {
+    watch_client *c = findClient(p->clients[i]);
+    if (c != NULL && c->notified != gl_changeCount) {
+      c->notified = gl_changeCount;
+      c->push(c->ctx, message, length);
+    }
+  }
+}
+
+// pushes a change to everyone watching the key, call with the lock held (only the notifier does)
+static void notifyChange(watch_change *change) {
+  gl_changeCount++;
+  if (change->key == NULL) {
+    for (size_t i = 0; i < gl_clientSlots; i++) {
+      if (gl_clients[i].active) {
+        gl_clients[i].push(gl_clients[i].ctx, WATCH_NOTIFY, strlen(WATCH_NOTIFY));
+      }
+    }
+    return;
+  }
+  if (gl_bucketCount == 0) {
+    return;
+  }
+
+  size_t keyLen = strlen(change->key);
+  byte_buffer message = {0};
+  char header[64];
+  int headerLen = snprintf(header, sizeof(header), WATCH_NOTIFY " %s %zu:", change->operation, keyLen);
+  if (byte_buffer_append(&message, header, headerLen) != 0 ||
+      byte_buffer_append(&message, change->key, keyLen) != 0) {
+    byte_buffer_free(&message);
+    return;
+  }
+
+  watched_pattern *p = *findPattern(change->key, keyLen, false);
+  if (p != NULL) {
+    notifyPattern(p, message.data, message.len);
+  }
+  for (size_t i = 0; i < gl_prefixLengthCount && gl_prefixLengths[i].len <= keyLen; i++) {
+    p = *findPattern(change->key, gl_prefixLengths[i].len, true);
+    if (p != NULL) {
+      notifyPattern(p, message.data, message.len);
+    }
+  }
+  byte_buffer_free(&message);
+}
+
+static void freeChanges(watch_change *change) {
+  while (change != NULL) {
+    watch_change *next = change->next;
+    free(change->key);
+    free(change);
+    change = next;
+  }
+}
+
+static DWORD WINAPI notifierMain(LPVOID arg) {
+  (void)arg;
+  AcquireSRWLockExclusive(&gl_queueLock);
+  while (true) {
+    while (gl_queueHead == NULL && !gl_overflow && !gl_stopping) {
+      SleepConditionVariableSRW(&gl_queueCond, &gl_queueLock, INFINITE, 0);
+    }
+    if (gl_queueHead == NULL && !gl_overflow) {
+      break; // stopping with nothing left to notify
+    }
+
+    // the writers queue on while the changes taken are pushed
+    watch_change *changes = gl_queueHead;
+    bool overflow = gl_overflow;
+    gl_queueHead = NULL;
+    gl_queueTail = NULL;
+    gl_queued = 0;
+    gl_overflow = false;
+    ReleaseSRWLockExclusive(&gl_queueLock);
+
+    AcquireSRWLockShared(&gl_watchLock);
+    for (watch_change *change = changes; change != NULL; change = change->next) {
+      notifyChange(change);
+    }
+    if (overflow) {
+      // changes after the ones above were dropped, the watchers have to read everything again
+      watch_change all = {0};
+      notifyChange(&all);
+    }
+    ReleaseSRWLockShared(&gl_watchLock);
+    freeChanges(changes);
+
+    AcquireSRWLockExclusive(&gl_queueLock);
+  }
+  ReleaseSRWLockExclusive(&gl_queueLock);
+  return 0;
+}
+
+int watch_start() {
+  AcquireSRWLockExclusive(&gl_queueLock);
+  gl_stopping = false;
+  ReleaseSRWLockExclusive(&gl_queueLock);
+  gl_notifierThread = CreateThread(NULL, 0, notifierMain, NULL, 0, NULL);
+  return gl_notifierThread != NULL ? 0 : -1;
+}
+
+void watch_stop() {
+  if (gl_notifierThread == NULL) {
+    return;
+  }
+  AcquireSRWLockExclusive(&gl_queueLock);
+  gl_stopping = true;
+  WakeConditionVariable(&gl_queueCond);
+  ReleaseSRWLockExclusive(&gl_queueLock);
+  WaitForSingleObject(gl_notifierThread, INFINITE);
+  CloseHandle(gl_notifierThread);
+  gl_notifierThread = NULL;
+
+  // writes after the notifier stopped are not notified anymore
+  AcquireSRWLockExclusive(&gl_queueLock);
+  freeChanges(gl_queueHead);
+  gl_queueHead = NULL;
+  gl_queueTail = NULL;
+  gl_queued = 0;
+  ReleaseSRWLockExclusive(&gl_queueLock);
+}
+
+static void queueChange(watch_change *change) {
+  AcquireSRWLockExclusive(&gl_queueLock);
+  if (gl_queued >= WATCH_MAX_QUEUE) {
+    gl_overflow = true;
+    gl_dropped++;
+    freeChanges(change);
+  } else {
+    if (gl_queueTail != NULL) {
+      gl_queueTail->next = change;
+    } else {
+      gl_queueHead = change;
+    }
+    gl_queueTail = change;
+    gl_queued++;
+  }
+  WakeConditionVariable(&gl_queueCond);
+  ReleaseSRWLockExclusive(&gl_queueLock);
+}
+
+void watch_changed(const char *operation, const char *key) {
+  // writers skip the queue as long as nobody watches anything
+  if (atomic_load(&gl_patternCount) == 0) {
+    return;
+  }
+  watch_change *change = calloc(1, sizeof(watch_change));
+  if (change == NULL || (change->key = duplicate_string(key)) == NULL) {
+    free(change);
+    AcquireSRWLockExclusive(&gl_queueLock);
+    gl_overflow = true; // the watchers learn that they missed something
+    gl_dropped++;
+    WakeConditionVariable(&gl_queueCond);
+    ReleaseSRWLockExclusive(&gl_queueLock);
+    return;
+  }
+  strncpy_s(change->operation, sizeof(change->operation), operation, sizeof(change->operation) - 1);
+  queueChange(change);
+}
+
+void watch_changed_all() {
+  if (atomic_load(&gl_patternCount) == 0) {
+    return;
+  }
+  watch_change *change = calloc(1, sizeof(watch_change));
+  if (change == NULL) {
+    AcquireSRWLockExclusive(&gl_queueLock);
+    gl_overflow = true;
+    WakeConditionVariable(&gl_queueCond);
+    ReleaseSRWLockExclusive(&gl_queueLock);
+    return;
+  }
+  queueChange(change);
+}
+
+void watch_get_counts(size_t *clients, size_t *patterns, unsigned long long *dropped) {
+  AcquireSRWLockShared(&gl_watchLock);
+  *clients = gl_activeClients;
+  *patterns = atomic_load(&gl_patternCount);
+  ReleaseSRWLockShared(&gl_watchLock);
+  AcquireSRWLockShared(&gl_queueLock);
+  *dropped = gl_dropped;
+  ReleaseSRWLockShared(&gl_queueLock);
+}
@@ -0,0 +1,25 @@
+#ifndef _KVSTR_WATCH_H
+#define _KVSTR_WATCH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "tracking.h"
+
+#define WATCH_NO_CLIENT 0ULL
+#define WATCH_MAX_QUEUE 64 * 1024   // changes waiting for the notifier, beyond that watchers are told to re-read everything
+#define WATCH_NOTIFY "NOTIFY"       // pushed to a watcher: "NOTIFY <PUT|DEL|HSET|HDEL|SETRANGE> <len>:<key>", without a change when anything may have changed
+#define WATCH_MAX_OPERATION_LEN 15  // longest name of the write operation of a change, like the decoder accepts
+
+/* Prototypes */
+int watch_start(); // starts the thread that notifies the watchers
+void watch_stop(); // notifies what is queued and stops the thread
+unsigned long long watch_register(tracking_push_fn push, void *ctx); // a client that watches keys, WATCH_NO_CLIENT on failure
+void watch_unregister(unsigned long long client); // forgets all of its patterns, after this returns the push function is not called for the client anymore
+int watch_add(unsigned long long client, const char *pattern); // a key, or a prefix when it ends with '*'
+int watch_remove(unsigned long long client, const char *pattern); // -1 if the client did not watch the pattern
+void watch_changed(const char *operation, const char *key); // queues the change for the watchers without waiting for them, call with the store locked exclusively
+void watch_changed_all(); // every key may have changed (the store was replaced)
+void watch_get_counts(size_t *clients, size_t *patterns, unsigned long long *dropped);
+
+#endif